@@ -0,0 +1,15 @@
+// crc16.h - UKHAS telemetry checksum
+//
+//	$$CALLSIGN,count,hh:mm:ss,lat,lon,alt,...*CRC16
+//
+// the CRC covers everything between the $$ and the * and is written as 4 upper case hex digits
+
+#ifndef CRC16_H
+#define CRC16_H
+
+#include <stddef.h>
+
+unsigned int crc16(const char *p);			// from p up to a '*' or the end of the string
+unsigned int crc16_update(unsigned int crc, const char *p, size_t len);	// start with 0xFFFF
+
+#endif
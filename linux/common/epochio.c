@@ -0,0 +1,371 @@
+// epochio.c - epoch at a time output for the generators
+//
+// see epochio.h for the usage
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/uio.h>
+#include "epochio.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#endif
+
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void reset(epochio_buf *b)
+{
+	b->used = 0;
+	b->niov = 0;
+	b->bytes = 0;
+	b->epochs = 0;
+	b->busy = 0;
+}
+
+// write a buffer's iovecs (less the first skip bytes, already written) - retrying short writes
+static void write_all(epochio *e, epochio_buf *b, size_t skip)
+{
+	struct iovec *iov = b->iov;
+	int n = b->niov;
+	ssize_t done;
+	struct pollfd pfd;
+
+	while ((n > 0) && !e->error)
+	{
+		while ((n > 0) && (skip >= iov->iov_len))
+		{ // step over what has gone
+			skip -= iov->iov_len;
+			iov++;
+			n--;
+		}
+		if (n == 0)
+			break;
+		iov->iov_base = (char *)iov->iov_base + skip;
+		iov->iov_len -= skip;
+		skip = 0;
+
+		e->syscalls++;
+		if ((done = writev(e->fd, iov, n)) >= 0)
+			skip = done;
+		else if (errno == EAGAIN)
+		{ // non-blocking and full - wait for room
+			pfd.fd = e->fd;
+			pfd.events = POLLOUT;
+			poll(&pfd, 1, -1);
+		}
+		else if (errno != EINTR)
+			e->error = errno;
+	}
+}
+
+#ifdef HAVE_IO_URING
+
+typedef struct ring
+{
+	int fd;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr, *cq_ptr;
+	size_t sq_len, cq_len, sqes_len;
+	int inflight;					// buffer being written, -1 if none
+} ring;
+
+static void ring_close(ring *r)
+{
+	if (r->sqes)
+		munmap(r->sqes, r->sqes_len);
+	if (r->cq_ptr && (r->cq_ptr != r->sq_ptr))
+		munmap(r->cq_ptr, r->cq_len);
+	if (r->sq_ptr)
+		munmap(r->sq_ptr, r->sq_len);
+	close(r->fd);
+	free(r);
+}
+
+static ring *ring_open(void)
+{
+	struct io_uring_params p;
+	ring *r;
+
+	if ((r = calloc(1, sizeof(*r))) == NULL)
+		return NULL;
+	memset(&p, 0, sizeof(p));
+	if ((r->fd = syscall(__NR_io_uring_setup, 2, &p)) < 0)
+	{
+		free(r);
+		return NULL;
+	}
+	r->inflight = -1;
+	r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		r->sq_len = r->cq_len = r->sq_len > r->cq_len ? r->sq_len : r->cq_len;
+	r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	r->sq_ptr = mmap(0, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ptr == MAP_FAILED)
+		r->sq_ptr = NULL;
+	else if (p.features & IORING_FEAT_SINGLE_MMAP)
+		r->cq_ptr = r->sq_ptr;
+	else if ((r->cq_ptr = mmap(0, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING)) == MAP_FAILED)
+		r->cq_ptr = NULL;
+	if (r->cq_ptr && ((r->sqes = mmap(0, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES)) == MAP_FAILED))
+		r->sqes = NULL;
+
+	// writing at the file position (offset -1) needs 5.6 or later
+	if ((r->sqes == NULL) || !(p.features & IORING_FEAT_RW_CUR_POS))
+	{
+		ring_close(r);
+		return NULL;
+	}
+
+	r->sq_head = (unsigned *)((char *)r->sq_ptr + p.sq_off.head);
+	r->sq_tail = (unsigned *)((char *)r->sq_ptr + p.sq_off.tail);
+	r->sq_mask = (unsigned *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *)((char *)r->sq_ptr + p.sq_off.array);
+	r->cq_head = (unsigned *)((char *)r->cq_ptr + p.cq_off.head);
+	r->cq_tail = (unsigned *)((char *)r->cq_ptr + p.cq_off.tail);
+	r->cq_mask = (unsigned *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+	return r;
+}
+
+// queue a writev of buffer i
+static void ring_submit(epochio *e, int i)
+{
+	ring *r = (ring *)e->ring;
+	unsigned tail = *r->sq_tail, idx = tail & *r->sq_mask;
+	struct io_uring_sqe *sqe = &r->sqes[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_WRITEV;
+	sqe->fd = e->fd;
+	sqe->addr = (unsigned long)e->b[i]->iov;
+	sqe->len = e->b[i]->niov;
+	sqe->off = (__u64)-1;			// at the file position, as write() - and pipes have none
+	sqe->user_data = i;
+	r->sq_array[idx] = idx;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	e->b[i]->busy = 1;
+	r->inflight = i;
+	while (1)
+	{
+		e->syscalls++;
+		if (syscall(__NR_io_uring_enter, r->fd, 1, 0, 0, NULL, 0) >= 0)
+			break;
+		if (errno != EINTR)
+		{ // fall back to writing it here
+			__atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+			r->inflight = -1;
+			write_all(e, e->b[i], 0);
+			reset(e->b[i]);
+			return;
+		}
+	}
+}
+
+// wait for the write in flight (if any) to finish
+static void ring_wait(epochio *e)
+{
+	ring *r = (ring *)e->ring;
+	unsigned head;
+	struct io_uring_cqe *cqe;
+	epochio_buf *b;
+
+	if (r->inflight < 0)
+		return;
+	b = e->b[r->inflight];
+
+	head = *r->cq_head;
+	while (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+	{ // not done yet - only now is a system call needed
+		e->syscalls++;
+		if ((syscall(__NR_io_uring_enter, r->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0) && (errno != EINTR))
+		{
+			e->error = errno;
+			return;
+		}
+	}
+	cqe = &r->cqes[head & *r->cq_mask];
+	if (cqe->res < 0)
+	{
+		if (cqe->res == -EAGAIN)
+			write_all(e, b, 0);
+		else
+			e->error = -cqe->res;
+	}
+	else if ((size_t)cqe->res < b->bytes)
+		write_all(e, b, cqe->res); // short - finish it here
+	__atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+
+	reset(b);
+	r->inflight = -1;
+}
+
+#endif
+
+int epochio_init(epochio *e, int fd, int batch, int uring)
+{
+	memset(e, 0, sizeof(*e));
+	e->fd = fd;
+	e->batch = batch > 0 ? batch : 1;
+	e->start_ns = e->end_ns = now_ns();
+	if ((e->b[0] = malloc(sizeof(epochio_buf))) == NULL)
+		return 0;
+	reset(e->b[0]);
+#ifdef HAVE_IO_URING
+	if (uring && ((e->b[1] = malloc(sizeof(epochio_buf))) != NULL))
+	{
+		reset(e->b[1]);
+		if ((e->ring = ring_open()) != NULL)
+			e->uring = 1;
+		else
+		{
+			fprintf(stderr,"epochio: no io_uring here - using writev\n");
+			free(e->b[1]);
+			e->b[1] = NULL;
+		}
+	}
+#endif
+	return 1;
+}
+
+void epochio_flush(epochio *e)
+{
+	epochio_buf *b = e->b[e->cur];
+
+	if (b->niov == 0)
+		return;
+	if (e->error)
+	{ // output has gone - drop it
+		reset(b);
+		return;
+	}
+#ifdef HAVE_IO_URING
+	if (e->ring)
+	{
+		ring_wait(e);			// the other buffer
+		ring_submit(e, e->cur);
+		e->cur ^= 1;
+		return;
+	}
+#endif
+	write_all(e, b, 0);
+	reset(b);
+}
+
+// room for len more bytes (copied) and an iovec - writing what there is if not
+static epochio_buf *room(epochio *e, size_t len)
+{
+	epochio_buf *b = e->b[e->cur];
+
+	if ((b->niov == EPOCHIO_IOV) || (b->used + len > EPOCHIO_BUF))
+	{
+		epochio_flush(e);
+		b = e->b[e->cur];
+	}
+	return b;
+}
+
+void epochio_ref(epochio *e, const void *p, size_t len)
+{
+	epochio_buf *b = room(e, 0);
+
+	if (e->bytes == 0)
+		e->start_ns = now_ns(); // throughput is from the first output
+
+	b->iov[b->niov].iov_base = (void *)p;
+	b->iov[b->niov++].iov_len = len;
+	b->bytes += len;
+	e->bytes += len;
+}
+
+void epochio_add(epochio *e, const void *p, size_t len)
+{
+	epochio_buf *b;
+	struct iovec *last;
+
+	if (len > EPOCHIO_BUF)
+	{ // too big to copy - send it as it is
+		epochio_ref(e, p, len);
+		epochio_flush(e);
+#ifdef HAVE_IO_URING
+		if (e->ring)
+			ring_wait(e);
+#endif
+		return;
+	}
+
+	if (e->bytes == 0)
+		e->start_ns = now_ns();
+	b = room(e, len);
+	memcpy(b->data + b->used, p, len);
+	last = b->niov ? &b->iov[b->niov - 1] : NULL;
+	if (last && ((char *)last->iov_base + last->iov_len == b->data + b->used))
+		last->iov_len += len; // follows on from the last one
+	else
+	{
+		b->iov[b->niov].iov_base = b->data + b->used;
+		b->iov[b->niov++].iov_len = len;
+	}
+	b->used += len;
+	b->bytes += len;
+	e->bytes += len;
+}
+
+void epochio_end(epochio *e)
+{
+	epochio_buf *b = e->b[e->cur];
+
+	e->epochs++;
+	// written when the batch is complete - or the next epoch might not fit
+	if ((++b->epochs >= e->batch) || (b->used > EPOCHIO_BUF - 4096) || (b->niov > EPOCHIO_IOV - 16))
+		epochio_flush(e);
+}
+
+int epochio_close(epochio *e)
+{
+	epochio_flush(e);
+#ifdef HAVE_IO_URING
+	if (e->ring)
+	{
+		ring_wait(e);
+		ring_close((ring *)e->ring);
+		e->ring = NULL;
+	}
+#endif
+	free(e->b[0]);
+	free(e->b[1]);
+	e->b[0] = e->b[1] = NULL;
+	e->end_ns = now_ns();
+	return e->error ? -1 : 0;
+}
+
+void epochio_report(const epochio *e, FILE *fp)
+{
+	double secs = (e->end_ns - e->start_ns) / 1e9;
+
+	fprintf(fp,"epochio: %llu epochs, %llu bytes in %llu system calls (%.3f an epoch) with %s, %.1f MB/s\n",
+		e->epochs, e->bytes, e->syscalls, e->epochs ? (double)e->syscalls / e->epochs : 0.0,
+		e->uring ? "io_uring" : "writev", secs > 0 ? e->bytes / secs / 1e6 : 0.0);
+}
@@ -0,0 +1,70 @@
+// epochio.h - epoch at a time output for the generators
+//
+// the sentences (or UBX frames) of an epoch are gathered as a list of iovecs and written with one writev()
+// when the epoch is over, so an epoch costs one system call however many sentences it has. Nothing is ever
+// written part way through an epoch, and a pipe write of up to PIPE_BUF (4096) bytes is atomic, so a reader
+// at the other end of a pipe never sees half an epoch - even with other writers on the same pipe.
+//
+// when the output isn't paced (offline - writing a log as fast as possible) up to batch epochs are gathered
+// for each writev(), which takes the system calls well below one an epoch.
+//
+// sentences that never change (e.g. $GPGSA) can be added by reference rather than copied - they must then
+// stay where they are until written. Copied ones that follow each other share an iovec.
+//
+// with io_uring (where the kernel has it - checked at run time) each write is queued to the kernel and the
+// generator gets on with the next batch in a second buffer while it is written. Only one write is in
+// flight at a time so the output stays in order; waiting for it costs a system call only if it hasn't
+// already finished.
+//
+// epochio_report() prints the epochs, bytes, system calls per epoch and throughput.
+//
+// typical use
+//	epochio_init(&eo, 1, 64, 0);
+//	for each epoch
+//		epochio_add(&eo, sentence, strlen(sentence));	// any number
+//		epochio_end(&eo);
+//		(epochio_flush(&eo) before waiting for the next epoch, if paced)
+//	epochio_close(&eo);
+//	epochio_report(&eo, stderr);
+
+#ifndef EPOCHIO_H
+#define EPOCHIO_H
+
+#include <stdio.h>
+#include <sys/uio.h>
+
+#define EPOCHIO_BUF		262144		// bytes copied per write
+#define EPOCHIO_IOV		1024		// iovecs per write (IOV_MAX)
+
+typedef struct epochio_buf
+{
+	char data[EPOCHIO_BUF];			// copied sentences
+	size_t used;
+	struct iovec iov[EPOCHIO_IOV];
+	int niov;
+	size_t bytes;					// in iov
+	int epochs;						// complete epochs gathered
+	int busy;						// being written (io_uring)
+} epochio_buf;
+
+typedef struct epochio
+{
+	int fd;
+	int batch;						// epochs per write when not flushed sooner
+	epochio_buf *b[2];
+	int cur;						// being filled
+	void *ring;						// io_uring state, NULL if writev
+	int uring;						// writing with io_uring
+	int error;						// errno of the first write that failed (output is then dropped)
+	unsigned long long epochs, bytes, syscalls, start_ns, end_ns;
+} epochio;
+
+int epochio_init(epochio *e, int fd, int batch, int uring);	// uring 1 to try io_uring - 0 if out of memory
+void epochio_add(epochio *e, const void *p, size_t len);	// copied
+void epochio_ref(epochio *e, const void *p, size_t len);	// by reference - must stay put until written
+void epochio_end(epochio *e);								// end of an epoch - written when batch are gathered
+void epochio_flush(epochio *e);								// write what is gathered now
+int epochio_close(epochio *e);								// flush and wait - 0, or -1 if a write failed
+void epochio_report(const epochio *e, FILE *fp);
+
+#endif
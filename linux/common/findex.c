@@ -0,0 +1,620 @@
+// findex.c - space / time index over flight logs
+//
+// see findex.h for the layout and usage
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "sentence.h"
+#include "findex.h"
+
+#define SEG_MAGIC	"FIDXSEG1"
+#define SEG_HEADER	16			// magic and record count
+#define CELLS		(1 << FINDEX_CELL_BITS)
+
+// spread the low 16 bits of v out to the even bits
+static unsigned long long spread(unsigned long long v)
+{
+	v &= 0xFFFF;
+	v = (v | (v << 8)) & 0x00FF00FF;
+	v = (v | (v << 4)) & 0x0F0F0F0F;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+static int lat_cell(double lat)
+{
+	int c = (int)((lat + 90.0) / 180.0 * CELLS);
+
+	return c < 0 ? 0 : c >= CELLS ? CELLS - 1 : c;
+}
+
+static int lon_cell(double lon)
+{
+	int c = (int)((lon + 180.0) / 360.0 * CELLS);
+
+	return c < 0 ? 0 : c >= CELLS ? CELLS - 1 : c;
+}
+
+static unsigned long long cell_key(int lat_c, int lon_c)
+{
+	return (spread(lat_c) << 1 | spread(lon_c)) << 32;
+}
+
+static long days_from_civil(int y, int m, int d)
+{
+	struct tm tm;
+
+	memset(&tm, 0, sizeof(tm));
+	tm.tm_year = y - 1900;
+	tm.tm_mon = m - 1;
+	tm.tm_mday = d;
+	return (long)(timegm(&tm) / 86400);
+}
+
+static double haversine_km(double lat1, double lon1, double lat2, double lon2)
+{
+	double dlat = (lat2 - lat1) * M_PI / 180.0, dlon = (lon2 - lon1) * M_PI / 180.0;
+	double a = sin(dlat / 2) * sin(dlat / 2) + cos(lat1 * M_PI / 180.0) * cos(lat2 * M_PI / 180.0) * sin(dlon / 2) * sin(dlon / 2);
+
+	return 6371.0 * 2 * atan2(sqrt(a), sqrt(1 - a));
+}
+
+static int rec_cmp(const void *a, const void *b)
+{
+	const findex_rec *x = a, *y = b;
+
+	if (x->key != y->key)
+		return x->key < y->key ? -1 : 1;
+	return x->t < y->t ? -1 : x->t > y->t;
+}
+
+static void add_rec(findex *ix, const findex_rec *r)
+{
+	if (ix->npending == ix->pending_size)
+	{
+		ix->pending_size = ix->pending_size ? ix->pending_size * 2 : 65536;
+		ix->pending = realloc(ix->pending, ix->pending_size * sizeof(findex_rec));
+	}
+	ix->pending[ix->npending++] = *r;
+}
+
+static int map_segment(findex *ix, findex_seg *s)
+{
+	char path[1024];
+	struct stat st;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/seg_%04u.dat", ix->dir, s->num);
+	if ((fd = open(path, O_RDONLY)) < 0)
+	{
+		fprintf(stderr,"Can't open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	fstat(fd, &st);
+	s->map_size = st.st_size;
+	s->map = st.st_size >= SEG_HEADER ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+	if ((s->map == MAP_FAILED) || (memcmp(s->map, SEG_MAGIC, 8) != 0))
+	{
+		fprintf(stderr,"%s is not an index segment\n", path);
+		if (s->map != MAP_FAILED)
+			munmap(s->map, s->map_size);
+		s->map = NULL;
+		return -1;
+	}
+	memcpy(&s->count, (char *)s->map + 8, 8);
+	if (SEG_HEADER + s->count * sizeof(findex_rec) > s->map_size)
+	{
+		fprintf(stderr,"%s is truncated\n", path);
+		munmap(s->map, s->map_size);
+		s->map = NULL;
+		return -1;
+	}
+	s->recs = (const findex_rec *)((char *)s->map + SEG_HEADER);
+	return 0;
+}
+
+static void unmap_segments(findex *ix)
+{
+	int i;
+
+	for (i = 0; i < ix->nsegs; i++)
+		if (ix->segs[i].map)
+			munmap(ix->segs[i].map, ix->segs[i].map_size);
+	free(ix->segs);
+	ix->segs = NULL;
+	ix->nsegs = 0;
+}
+
+// write recs as segment num (sorting them first)
+static int write_segment(findex *ix, unsigned int num, findex_rec *recs, unsigned long long count)
+{
+	char path[1024], tmp[1100];
+	FILE *fp;
+
+	qsort(recs, count, sizeof(findex_rec), rec_cmp);
+
+	snprintf(path, sizeof(path), "%s/seg_%04u.dat", ix->dir, num);
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	if ((fp = fopen(tmp, "wb")) == NULL)
+	{
+		fprintf(stderr,"Can't create %s: %s\n", tmp, strerror(errno));
+		return -1;
+	}
+	fwrite(SEG_MAGIC, 8, 1, fp);
+	fwrite(&count, 8, 1, fp);
+	if (((count > 0) && (fwrite(recs, sizeof(findex_rec), count, fp) != count)) | fclose(fp))
+	{
+		fprintf(stderr,"Can't write %s: %s\n", tmp, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+	return rename(tmp, path);
+}
+
+static int write_catalogue(findex *ix)
+{
+	char path[1024], tmp[1100];
+	FILE *fp;
+	int i;
+
+	snprintf(path, sizeof(path), "%s/index.txt", ix->dir);
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	if ((fp = fopen(tmp, "w")) == NULL)
+	{
+		fprintf(stderr,"Can't create %s: %s\n", tmp, strerror(errno));
+		return -1;
+	}
+	fprintf(fp,"next %u %u\n", ix->next_id, ix->next_seg);
+	for (i = 0; i < ix->nsegs; i++)
+		fprintf(fp,"segment %u %llu\n", ix->segs[i].num, ix->segs[i].count);
+	for (i = 0; i < ix->nfiles; i++)
+		fprintf(fp,"file %u %lld %lld %d %ld %.3f %s\n", ix->files[i].id, ix->files[i].size, ix->files[i].mtime,
+			ix->files[i].dead, ix->files[i].day, ix->files[i].last_tod, ix->files[i].path);
+	if (fclose(fp))
+	{
+		fprintf(stderr,"Can't write %s: %s\n", tmp, strerror(errno));
+		unlink(tmp);
+		return -1;
+	}
+	return rename(tmp, path);
+}
+
+static findex_file *new_file(findex *ix, const char *path)
+{
+	findex_file *f;
+
+	ix->files = realloc(ix->files, (ix->nfiles + 1) * sizeof(findex_file));
+	f = &ix->files[ix->nfiles++];
+	memset(f, 0, sizeof(*f));
+	f->id = ix->next_id++;
+	f->path = strdup(path);
+	f->last_tod = -1;
+	return f;
+}
+
+int findex_open(findex *ix, const char *dir)
+{
+	char path[1024], line[2048], name[1500];
+	FILE *fp;
+	findex_file *f;
+	findex_seg *s;
+	unsigned int a, b;
+	unsigned long long count;
+	int i;
+
+	memset(ix, 0, sizeof(*ix));
+	snprintf(ix->dir, sizeof(ix->dir), "%s", dir);
+	if ((mkdir(dir, 0777) < 0) && (errno != EEXIST))
+	{
+		fprintf(stderr,"Can't create %s: %s\n", dir, strerror(errno));
+		return -1;
+	}
+
+	snprintf(path, sizeof(path), "%s/index.txt", dir);
+	if ((fp = fopen(path, "r")) == NULL)
+		return 0;		// new index
+
+	while (fgets(line, sizeof(line), fp))
+	{
+		if (sscanf(line,"next %u %u", &a, &b) == 2)
+		{
+			ix->next_id = a;
+			ix->next_seg = b;
+		}
+		else if (sscanf(line,"segment %u %llu", &a, &count) == 2)
+		{
+			ix->segs = realloc(ix->segs, (ix->nsegs + 1) * sizeof(findex_seg));
+			s = &ix->segs[ix->nsegs++];
+			memset(s, 0, sizeof(*s));
+			s->num = a;
+		}
+		else if (strncmp(line, "file ", 5) == 0)
+		{
+			ix->files = realloc(ix->files, (ix->nfiles + 1) * sizeof(findex_file));
+			f = &ix->files[ix->nfiles];
+			if (sscanf(line,"file %u %lld %lld %d %ld %lf %1499[^\n]", &f->id, &f->size, &f->mtime,
+				&f->dead, &f->day, &f->last_tod, name) == 7)
+			{
+				f->path = strdup(name);
+				ix->nfiles++;
+			}
+		}
+	}
+	fclose(fp);
+
+	for (i = 0; i < ix->nsegs; i++)
+		if (map_segment(ix, &ix->segs[i]) < 0)
+		{
+			findex_close(ix);
+			return -1;
+		}
+	return 0;
+}
+
+long findex_add(findex *ix, const char *path)
+{
+	char *full, *line = NULL;
+	size_t line_size = 0;
+	ssize_t n;
+	struct stat st;
+	findex_file *f = NULL, *t = NULL;
+	FILE *fp;
+	sentence_fix fix;
+	findex_rec r, *last = NULL;
+	long long offset, end;
+	long added = 0, day = 0;
+	double last_fix_tod = -1, last_tod = -1;
+	unsigned int id;
+	int i, type, last_type = SENTENCE_NONE, tail = 0;
+
+	if (((full = realpath(path, NULL)) == NULL) || (stat(full, &st) < 0))
+	{
+		fprintf(stderr,"Can't index %s: %s\n", path, strerror(errno));
+		free(full);
+		return -1;
+	}
+
+	for (i = 0; i < ix->nfiles; i++)
+		if (strcmp(ix->files[i].path, full) == 0)
+		{
+			if (!ix->files[i].dead)
+				f = &ix->files[i];
+			else if (ix->files[i].dead == FINDEX_TAIL)
+				t = &ix->files[i];
+		}
+
+	if (f && (st.st_size == (t ? t->size : f->size)) && (st.st_mtime == (t ? t->mtime : f->mtime)))
+	{ // unchanged
+		free(full);
+		return 0;
+	}
+	if (t) // its last line has been added to (or the file rewritten) - read again below
+		t->dead = FINDEX_DEAD;
+	if (f && (st.st_size <= f->size))
+	{ // rewritten - start again
+		f->dead = FINDEX_DEAD;
+		f = NULL;
+	}
+	if (f == NULL)
+	{
+		f = new_file(ix, full);
+		f->day = (long)(st.st_mtime / 86400);
+	}
+	id = f->id;
+	free(full);
+
+	if ((fp = fopen(f->path, "r")) == NULL)
+	{
+		fprintf(stderr,"Can't open %s: %s\n", f->path, strerror(errno));
+		return -1;
+	}
+	offset = end = f->size;
+	fseeko(fp, offset, SEEK_SET);
+
+	while ((n = getline(&line, &line_size, fp)) > 0)
+	{
+		if (line[n - 1] != '\n')
+		{ // still being written, or no newline at the end - under an entry of its own that the next pass replaces
+			i = f - ix->files;
+			t = new_file(ix, ix->files[i].path);
+			f = &ix->files[i];
+			t->dead = FINDEX_TAIL;
+			t->size = st.st_size;
+			t->mtime = st.st_mtime;
+			id = t->id;
+			tail = 1;
+			day = f->day;		// and the next pass reads it again from the same dates
+			last_tod = f->last_tod;
+		}
+		else
+		{
+			offset += n;
+			end = offset;
+		}
+
+		if ((type = parse_sentence(line, &fix)) == SENTENCE_NONE)
+			continue;
+
+		if (fix.have_date)
+			f->day = days_from_civil(fix.year, fix.month, fix.day);
+		else if (f->last_tod < 0)
+		{ // first time seen - the file was last written at the end of the flight
+			if (fix.tod > st.st_mtime % 86400)
+				f->day--;
+		}
+		else if (fix.tod < f->last_tod - 43200)
+			f->day++;	// past midnight
+		f->last_tod = fix.tod;
+
+		if (!fix.have_pos)
+			continue;
+
+		// $GPGGA and $GPRMC for the same second are the same fix - keep one, with the altitude
+		if (last && (fix.tod == last_fix_tod) && (type != SENTENCE_UKHAS) && (last_type != SENTENCE_UKHAS))
+		{
+			if (fix.have_alt)
+				last->alt = fix.alt;
+			last->t = f->day * 86400000LL + (long long)llround(fix.tod * 1000);
+			last->key = cell_key(lat_cell(fix.lat), lon_cell(fix.lon)) | (unsigned int)f->day;
+			continue;
+		}
+
+		r.key = cell_key(lat_cell(fix.lat), lon_cell(fix.lon)) | (unsigned int)f->day;
+		r.t = f->day * 86400000LL + (long long)llround(fix.tod * 1000);
+		r.lat = fix.lat;
+		r.lon = fix.lon;
+		r.alt = fix.have_alt ? fix.alt : NAN;
+		r.file = id;
+		add_rec(ix, &r);
+		last = &ix->pending[ix->npending - 1];
+		last_fix_tod = fix.tod;
+		last_type = type;
+		added++;
+	}
+	free(line);
+	fclose(fp);
+
+	if (tail)
+	{
+		f->day = day;
+		f->last_tod = last_tod;
+	}
+	f->size = end;
+	f->mtime = st.st_mtime;
+	return added;
+}
+
+int findex_commit(findex *ix)
+{
+	findex_seg *s;
+
+	if (ix->npending > 0)
+	{
+		if (write_segment(ix, ix->next_seg, ix->pending, ix->npending) < 0)
+			return -1;
+		ix->segs = realloc(ix->segs, (ix->nsegs + 1) * sizeof(findex_seg));
+		s = &ix->segs[ix->nsegs++];
+		memset(s, 0, sizeof(*s));
+		s->num = ix->next_seg++;
+		if (map_segment(ix, s) < 0)
+			return -1;
+		free(ix->pending);
+		ix->pending = NULL;
+		ix->npending = ix->pending_size = 0;
+	}
+	if (write_catalogue(ix) < 0)
+		return -1;
+	if (ix->nsegs > FINDEX_MAX_SEGMENTS)
+		return findex_compact(ix);
+	return 0;
+}
+
+int findex_compact(findex *ix)
+{
+	findex_rec *all;
+	unsigned long long total = 0, count = 0, j;
+	unsigned char *dead;
+	unsigned int *old;
+	char path[1024];
+	int i, k, nold;
+
+	dead = calloc(ix->next_id + 1, 1);
+	for (i = 0; i < ix->nfiles; i++)
+		dead[ix->files[i].id] = ix->files[i].dead == FINDEX_DEAD;
+	for (i = 0; i < ix->nsegs; i++)
+		total += ix->segs[i].count;
+	all = malloc((total ? total : 1) * sizeof(findex_rec));
+	for (i = 0; i < ix->nsegs; i++)
+		for (j = 0; j < ix->segs[i].count; j++)
+			if (!dead[ix->segs[i].recs[j].file])
+				all[count++] = ix->segs[i].recs[j];
+
+	if (write_segment(ix, ix->next_seg, all, count) < 0)
+	{
+		free(all);
+		free(dead);
+		return -1;
+	}
+	free(all);
+
+	// the old segments go once the catalogue no longer mentions them
+	nold = ix->nsegs;
+	old = malloc((nold + 1) * sizeof(unsigned int));
+	for (i = 0; i < nold; i++)
+		old[i] = ix->segs[i].num;
+	unmap_segments(ix);
+	ix->segs = calloc(1, sizeof(findex_seg));
+	ix->segs[0].num = ix->next_seg++;
+	ix->nsegs = 1;
+	if (map_segment(ix, &ix->segs[0]) < 0)
+	{
+		free(old);
+		free(dead);
+		return -1;
+	}
+
+	// so do the dead files
+	for (i = k = 0; i < ix->nfiles; i++)
+		if (ix->files[i].dead == FINDEX_DEAD)
+			free(ix->files[i].path);
+		else
+			ix->files[k++] = ix->files[i];
+	ix->nfiles = k;
+
+	if (write_catalogue(ix) < 0)
+	{
+		free(old);
+		free(dead);
+		return -1;
+	}
+	for (i = 0; i < nold; i++)
+	{
+		snprintf(path, sizeof(path), "%s/seg_%04u.dat", ix->dir, old[i]);
+		unlink(path);
+	}
+	free(old);
+	free(dead);
+	return 0;
+}
+
+void findex_close(findex *ix)
+{
+	int i;
+
+	unmap_segments(ix);
+	for (i = 0; i < ix->nfiles; i++)
+		free(ix->files[i].path);
+	free(ix->files);
+	free(ix->pending);
+	memset(ix, 0, sizeof(*ix));
+}
+
+void findex_query_init(findex_query *q)
+{
+	memset(q, 0, sizeof(*q));
+	q->lat_min = -90;
+	q->lat_max = 90;
+	q->lon_min = -180;
+	q->lon_max = 180;
+	q->alt_min = -HUGE_VAL;
+	q->alt_max = HUGE_VAL;
+	q->t_from = -(1LL << 40);
+	q->t_to = 1LL << 40;
+}
+
+// the records of one segment with keys from lo to hi
+static long query_range(findex *ix, const findex_query *q, const findex_seg *s, unsigned long long lo, unsigned long long hi,
+						const char **paths, findex_fn fn, void *user, int *stop)
+{
+	unsigned long long a = 0, b = s->count, m;
+	const findex_rec *r;
+	long found = 0;
+
+	while (a < b)
+	{ // first key >= lo
+		m = (a + b) / 2;
+		if (s->recs[m].key < lo)
+			a = m + 1;
+		else
+			b = m;
+	}
+
+	for (; (a < s->count) && (s->recs[a].key <= hi); a++)
+	{
+		r = &s->recs[a];
+		if ((r->t < q->t_from * 1000) || (r->t > q->t_to * 1000) || (paths[r->file] == NULL))
+			continue;
+		if ((q->alt_min > -HUGE_VAL) || (q->alt_max < HUGE_VAL))
+			if (isnan(r->alt) || (r->alt < q->alt_min) || (r->alt > q->alt_max))
+				continue;
+		if (q->radius > 0)
+		{
+			if (haversine_km(q->lat, q->lon, r->lat, r->lon) > q->radius)
+				continue;
+		}
+		else if ((r->lat < q->lat_min) || (r->lat > q->lat_max) || (r->lon < q->lon_min) || (r->lon > q->lon_max))
+			continue;
+
+		found++;
+		if (fn && fn(r, paths[r->file], user))
+		{
+			*stop = 1;
+			break;
+		}
+	}
+	return found;
+}
+
+long findex_search(findex *ix, const findex_query *q, findex_fn fn, void *user)
+{
+	double lat0 = q->lat_min, lat1 = q->lat_max, lon0 = q->lon_min, lon1 = q->lon_max, d;
+	long long day0, day1;
+	const char **paths;
+	unsigned long long key;
+	long found = 0;
+	int i, la, lo, la0, la1, lo0, lo1, stop = 0;
+
+	if (q->radius > 0)
+	{ // box around the circle
+		d = q->radius / 111.19;
+		lat0 = q->lat - d;
+		lat1 = q->lat + d;
+		if ((lat0 <= -89) || (lat1 >= 89))
+		{
+			lon0 = -180;
+			lon1 = 180;
+		}
+		else
+		{
+			d /= cos(q->lat * M_PI / 180.0);
+			lon0 = q->lon - d;
+			lon1 = q->lon + d;
+		}
+	}
+	la0 = lat_cell(lat0);
+	la1 = lat_cell(lat1);
+	lo0 = lon_cell(lon0);
+	lo1 = lon_cell(lon1);
+
+	day0 = q->t_from < 0 ? 0 : q->t_from / 86400;
+	day1 = q->t_to / 86400;
+	if (day1 > 0xFFFFFFFFLL)
+		day1 = 0xFFFFFFFFLL;
+	if (day1 < day0)
+		return 0;
+
+	// path of each file by id - NULL for dead ones
+	paths = calloc(ix->next_id + 1, sizeof(char *));
+	for (i = 0; i < ix->nfiles; i++)
+		if (ix->files[i].dead != FINDEX_DEAD)
+			paths[ix->files[i].id] = ix->files[i].path;
+
+	if ((long)(la1 - la0 + 1) * (lo1 - lo0 + 1) > FINDEX_MAX_CELLS)
+	{ // big area - quicker to look at everything
+		for (i = 0; (i < ix->nsegs) && !stop; i++)
+			found += query_range(ix, q, &ix->segs[i], 0, ~0ULL, paths, fn, user, &stop);
+	}
+	else
+	{
+		for (la = la0; (la <= la1) && !stop; la++)
+			for (lo = lo0; (lo <= lo1) && !stop; lo++)
+			{
+				key = cell_key(la, lo);
+				for (i = 0; (i < ix->nsegs) && !stop; i++)
+					found += query_range(ix, q, &ix->segs[i], key | day0, key | day1, paths, fn, user, &stop);
+			}
+	}
+	free(paths);
+	return found;
+}
@@ -0,0 +1,105 @@
+// findex.h - persistent space / time index over an archive of flight logs
+//
+// every fix in the logs ($GPGGA / $GPRMC, or $$CALLSIGN telemetry - see sentence.h) becomes a 32 byte record
+// keyed on where and when it was: the upper 32 bits of the key are a 12+12 bit lat/lon grid cell (about
+// 5km x 10km at the equator) interleaved into a Morton code, the lower 32 bits the day number. A query
+// walks the grid cells its box covers and binary searches each cell's run of days, so only the records
+// that can match are ever touched.
+//
+// the index lives in a directory
+//	index.txt		catalogue - the segments in use and every file indexed (size, mtime, where its dates had got to)
+//	seg_NNNN.dat	"FIDXSEG1", record count, records sorted by key
+//
+// each findex_commit() writes the records added since the last one as a new segment, so adding a night's
+// flights is cheap. A file that has only grown is indexed from where it got to last time; one that has
+// shrunk or been rewritten is marked dead (its old records are skipped) and indexed again from the start.
+// A last line with no newline (still being written, or the file just doesn't end with one) is indexed
+// under a catalogue entry of its own, which the next pass over the grown file marks dead and replaces.
+// findex_compact() merges the segments into one and drops dead records - findex_commit() does it for you
+// once there are FINDEX_MAX_SEGMENTS.
+//
+// dates come from $GPRMC when the log has it. Otherwise (telemetry) the file's mtime is taken as the end of
+// the flight and the day is stepped on whenever the time of day goes backwards past midnight.
+//
+// typical use
+//	findex_open(&ix, "flights.idx");
+//	findex_add(&ix, "flight.log");			// any number
+//	findex_commit(&ix);
+//	findex_query_init(&q); q.lat = ..; q.lon = ..; q.radius = 20; q.alt_min = 5000; q.alt_max = 15000;
+//	findex_search(&ix, &q, got_fix, NULL);
+//	findex_close(&ix);
+
+#ifndef FINDEX_H
+#define FINDEX_H
+
+#define FINDEX_CELL_BITS		12			// per axis
+#define FINDEX_MAX_SEGMENTS		32
+#define FINDEX_MAX_CELLS		4096		// a query covering more cells than this just scans
+
+#define FINDEX_DEAD				1			// findex_file.dead - its records are skipped
+#define FINDEX_TAIL				2			// live, but only the unterminated last line of the file of the same path
+
+typedef struct findex_rec
+{
+	unsigned long long key;		// Morton cell << 32 | day
+	long long t;				// ms since 1970 UTC
+	float lat, lon;				// degrees
+	float alt;					// metres (NAN if the sentence had none)
+	unsigned int file;			// id in the catalogue
+} findex_rec;
+
+typedef struct findex_file
+{
+	unsigned int id;
+	long long size;				// bytes indexed (up to the last complete line)
+	long long mtime;
+	int dead;					// FINDEX_DEAD or FINDEX_TAIL (0 - a live file)
+	long day;					// where the dates had got to, so a grown file carries on from there
+	double last_tod;
+	char *path;
+} findex_file;
+
+typedef struct findex_seg
+{
+	unsigned int num;
+	unsigned long long count;
+	void *map;
+	size_t map_size;
+	const findex_rec *recs;
+} findex_seg;
+
+typedef struct findex
+{
+	char dir[900];
+	findex_file *files;
+	int nfiles;
+	unsigned int next_id;
+	findex_seg *segs;
+	int nsegs;
+	unsigned int next_seg;
+	findex_rec *pending;		// added but not committed
+	size_t npending, pending_size;
+} findex;
+
+typedef struct findex_query
+{
+	double lat_min, lat_max;	// box, degrees
+	double lon_min, lon_max;
+	double lat, lon, radius;	// or a circle - used instead of the box when radius (km) > 0
+	double alt_min, alt_max;	// metres
+	long long t_from, t_to;		// seconds since 1970 UTC
+} findex_query;
+
+// return non-zero to stop the query
+typedef int (*findex_fn)(const findex_rec *r, const char *path, void *user);
+
+int findex_open(findex *ix, const char *dir);			// creates the directory if need be - returns 0 on success
+long findex_add(findex *ix, const char *path);			// fixes added, 0 if the file hasn't changed, -1 on error
+int findex_commit(findex *ix);							// write what has been added - returns 0 on success
+int findex_compact(findex *ix);
+void findex_close(findex *ix);
+
+void findex_query_init(findex_query *q);				// matches everything
+long findex_search(findex *ix, const findex_query *q, findex_fn fn, void *user);		// returns the number of matches
+
+#endif
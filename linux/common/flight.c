@@ -0,0 +1,187 @@
+// flight.c - a flight profile that can be asked where the payload is at any time
+//
+// see flight.h for the usage
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "zio.h"
+#include "flight.h"
+
+// radians to degrees
+#define DEGREES(x) ((x) * 57.295779513082320877)
+// degrees to radians
+#define RADIANS(x) ((x) / 57.295779513082320877)
+
+#define LOG_BASE 1.4142135623730950488
+#define LOG_POWER 5300.0
+
+
+void flight_init(flight *f)
+{
+	memset(f, 0, sizeof(*f));
+}
+
+void flight_free(flight *f)
+{
+	free(f->p);
+	flight_init(f);
+}
+
+int flight_add(flight *f, double lat, double lon, double alt)
+{
+	flight_point *p, *from;
+	double Rate, Elapsed, DeltaLat, DeltaLon, DeltaAlt, AdjLon;
+	int Duration;
+
+	if (f->n == f->size)
+	{
+		if ((p = realloc(f->p, (f->size ? f->size * 2 : 1024) * sizeof(*p))) == NULL)
+			return 0;
+		f->p = p;
+		f->size = f->size ? f->size * 2 : 1024;
+	}
+	p = &f->p[f->n];
+	memset(p, 0, sizeof(*p));
+	p->lat = lat;
+	p->lon = lon;
+	p->alt = alt;
+	if (f->n++ == 0)
+		return 1; // launch site
+
+	from = p - 1;
+	DeltaAlt = alt - from->alt;
+	DeltaLat = lat - from->lat;
+	DeltaLon = lon - from->lon;
+
+	if (DeltaAlt >= 0)
+		Rate = 5.0; // ascending
+	else // descending - the geometric mean of the expected velocities at To and From altitude
+		Rate = -5.0 * sqrt(pow(LOG_BASE,(from->alt / LOG_POWER)) * pow(LOG_BASE,(alt / LOG_POWER)));
+
+	// time (secs) between the coordinates, to the nearest second but at least 1
+	Elapsed = DeltaAlt / Rate; // always positive
+	Duration = (int)Elapsed;
+	if ((Duration == 0) || f->short_segments)
+		Duration = 1;
+	if ((Elapsed - (float)Duration) >= 0.5)
+		Duration++;
+	p->t = from->t + Duration;
+
+	// course (0 - 360 clockwise from north) and speed for the entire segment
+	p->course = DEGREES(atan2(DeltaLat,DeltaLon)); // +180 (cw) to -180 (ccw) from the longitude axis
+	if (p->course <= 90.0)
+		p->course = 90.0 - p->course;
+	else
+		p->course = 450.0 - p->course;
+	AdjLon = cos(RADIANS((from->lat + lat) / 2.0)) * DeltaLon;
+	p->speed = sqrt((DeltaLat * DeltaLat) + (AdjLon * AdjLon)) * 111194.9266 / Duration;
+	p->climb = DeltaAlt / Duration;
+	return 1;
+}
+
+int flight_load(flight *f, const char *path)
+{
+	char buf[129];
+	double lon, lat, alt;
+	FILE *fp;
+	int found = 0;
+
+	if ((fp = zio_fopen(path, "r")) == NULL)
+		return 0;
+	while (!found && (fscanf(fp, "%128s", buf) == 1))
+		found = (strcmp(buf, "<LineString>") == 0);
+	while (found && (fscanf(fp, "%128s", buf) == 1) && (strcmp(buf, "<coordinates>") != 0))
+		;
+	while (fscanf(fp, "%lf , %lf , %lf", &lon, &lat, &alt) == 3)
+		if (!flight_add(f, lat, lon, alt))
+			break;
+	zio_fclose(fp);
+	return f->n > 0;
+}
+
+double flight_duration(const flight *f)
+{
+	return f->n ? f->p[f->n - 1].t : 0.0;
+}
+
+// the state at t along the segment ending at p[i]
+static void interpolate(const flight *f, long i, double t, flight_fix *fix)
+{
+	const flight_point *from = &f->p[i - 1], *to = &f->p[i];
+	double frac = (t - from->t) / (to->t - from->t);
+
+	fix->t = t;
+	fix->lat = from->lat + (to->lat - from->lat) * frac;
+	fix->lon = from->lon + (to->lon - from->lon) * frac;
+	fix->alt = from->alt + (to->alt - from->alt) * frac;
+	fix->course = to->course;
+	fix->speed = to->speed;
+	fix->climb = to->climb;
+}
+
+// at a coordinate, not moving (before launch or after landing)
+static void stationary(const flight_point *p, double t, flight_fix *fix)
+{
+	fix->t = t;
+	fix->lat = p->lat;
+	fix->lon = p->lon;
+	fix->alt = p->alt;
+	fix->course = fix->speed = fix->climb = 0.0;
+}
+
+// the segment flying at t - the first i with p[i].t > t (1 <= i < n)
+static long find_segment(const flight *f, double t)
+{
+	long lo = 1, hi = f->n - 1, mid;
+
+	while (lo < hi)
+	{
+		mid = (lo + hi) / 2;
+		if (f->p[mid].t > t)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return lo;
+}
+
+int flight_at(const flight *f, double t, flight_fix *fix)
+{
+	if ((f->n == 0) || (t < 0.0))
+	{
+		if (f->n)
+			stationary(&f->p[0], t, fix);
+		else
+			memset(fix, 0, sizeof(*fix));
+		return 0;
+	}
+	if (t >= f->p[f->n - 1].t)
+	{ // landed
+		stationary(&f->p[f->n - 1], t, fix);
+		return t == f->p[f->n - 1].t;
+	}
+	interpolate(f, find_segment(f, t), t, fix);
+	return 1;
+}
+
+void flight_sample(const flight *f, const double *t, long n, flight_fix *fix)
+{
+	long i, seg = 1;
+
+	for (i = 0; i < n; i++)
+	{
+		if ((f->n < 2) || (t[i] < 0.0) || (t[i] >= f->p[f->n - 1].t))
+		{
+			flight_at(f, t[i], &fix[i]);
+			continue;
+		}
+		if ((f->p[seg - 1].t > t[i]) || ((seg + 16 < f->n) && (f->p[seg + 16].t <= t[i])))
+			seg = find_segment(f, t[i]); // went back, or a long way on - search again
+		else
+			while (f->p[seg].t <= t[i])
+				seg++; // in order - walk on from the last one
+		interpolate(f, seg, t[i], &fix[i]);
+	}
+}
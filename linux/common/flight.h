@@ -0,0 +1,55 @@
+// flight.h - a flight profile that can be asked where the payload is at any time
+//
+// the KML coordinates are added once; the time to fly each segment is worked out as gpsGen and ubxGen
+// always have (ascent 5 m/s, descent 5 m/s at the ground getting faster with height - the geometric mean
+// of the rates at either end - rounded to the nearest second, at least 1) and summed into a table of the
+// time each coordinate is reached. The state at time t is then found by binary search of that table and
+// linear interpolation along the segment, so second 5400 costs the same as second 1 and nothing before it
+// has to be generated. Course, speed and climb are those of the segment (as the generators give them);
+// at the end of the flight the payload is stationary.
+//
+// times are seconds from launch and needn't be whole. flight_sample() answers many at once - walking the
+// table when the times are in order, so sampling a whole flight is O(n) rather than O(n log n).
+//
+// typical use
+//	flight_init(&f);
+//	flight_add(&f, lat, lon, alt);			// every coordinate, launch site first
+//	flight_at(&f, 90 * 60, &fix);			// where it is at minute 90
+//	flight_free(&f);
+
+#ifndef FLIGHT_H
+#define FLIGHT_H
+
+typedef struct flight_point
+{
+	double t;						// seconds from launch to reach it
+	double lat, lon, alt;
+	double course, speed, climb;	// of the segment ending here (degrees, m/s, m/s)
+} flight_point;
+
+typedef struct flight
+{
+	flight_point *p;
+	long n, size;
+	int short_segments;				// every segment takes 1 or 2 seconds (gpsGen's timing before the profile)
+} flight;
+
+typedef struct flight_fix
+{
+	double t;
+	double lat, lon, alt;
+	double course;					// degrees clockwise from north
+	double speed;					// over the ground, m/s
+	double climb;					// m/s, -ve descending
+} flight_fix;
+
+void flight_init(flight *f);
+int flight_add(flight *f, double lat, double lon, double alt);	// next coordinate - 0 if out of memory
+int flight_load(flight *f, const char *path);		// the first <LineString> of a KML file (see zio.h) - 0 if none
+double flight_duration(const flight *f);			// seconds from launch to the last coordinate
+int flight_at(const flight *f, double t, flight_fix *fix);	// 0 if t is outside the flight (fix is then the launch
+															// site or the landing site)
+void flight_sample(const flight *f, const double *t, long n, flight_fix *fix);	// fix[i] for each t[i]
+void flight_free(flight *f);
+
+#endif
@@ -0,0 +1,176 @@
+// pool.c - work stealing thread pool
+//
+// see pool.h for the usage
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "pool.h"
+
+static __thread pool *self_pool = NULL;		// the pool the calling thread works for, if any
+static __thread int self = -1;
+
+static void push(pool_deque *d, pool_fn fn, void *arg)
+{
+	unsigned long i;
+	pool_task *t;
+
+	pthread_mutex_lock(&d->lock);
+	if (d->tail - d->head == d->size)
+	{ // full - double it, unwrapping as we go
+		t = malloc(d->size * 2 * sizeof(pool_task));
+		for (i = d->head; i != d->tail; i++)
+			t[i - d->head] = d->tasks[i & (d->size - 1)];
+		free(d->tasks);
+		d->tasks = t;
+		d->tail -= d->head;
+		d->head = 0;
+		d->size *= 2;
+	}
+	d->tasks[d->tail & (d->size - 1)].fn = fn;
+	d->tasks[d->tail & (d->size - 1)].arg = arg;
+	d->tail++;
+	pthread_mutex_unlock(&d->lock);
+}
+
+// own = 1 takes the newest task (the owner), 0 the oldest (a thief)
+static int take(pool_deque *d, int own, pool_task *t)
+{
+	int got = 0;
+
+	pthread_mutex_lock(&d->lock);
+	if (d->tail != d->head)
+	{
+		*t = own ? d->tasks[--d->tail & (d->size - 1)] : d->tasks[d->head++ & (d->size - 1)];
+		got = 1;
+	}
+	pthread_mutex_unlock(&d->lock);
+	return got;
+}
+
+static void *worker(void *arg)
+{
+	pool *p = arg;
+	pool_task t;
+	int me, i, got;
+
+	pthread_mutex_lock(&p->lock);
+	me = p->next++ % p->threads;
+	pthread_mutex_unlock(&p->lock);
+	self_pool = p;
+	self = me;
+
+	for (;;)
+	{
+		got = take(&p->q[me], 1, &t);
+		for (i = 1; !got && (i < p->threads); i++)
+			if ((got = take(&p->q[(me + i) % p->threads], 0, &t)))
+				__atomic_add_fetch(&p->steals, 1, __ATOMIC_RELAXED);
+
+		if (!got)
+		{
+			pthread_mutex_lock(&p->lock);
+			while ((__atomic_load_n(&p->queued, __ATOMIC_ACQUIRE) == 0) && !p->stop)
+				pthread_cond_wait(&p->work, &p->lock);
+			if (p->stop && (p->queued == 0))
+			{
+				pthread_mutex_unlock(&p->lock);
+				return NULL;
+			}
+			pthread_mutex_unlock(&p->lock);
+			continue;
+		}
+
+		__atomic_sub_fetch(&p->queued, 1, __ATOMIC_ACQ_REL);
+		t.fn(t.arg);
+
+		if (__atomic_sub_fetch(&p->pending, 1, __ATOMIC_ACQ_REL) == 0)
+		{
+			pthread_mutex_lock(&p->lock);
+			pthread_cond_broadcast(&p->idle);
+			pthread_mutex_unlock(&p->lock);
+		}
+	}
+}
+
+pool *pool_create(int threads)
+{
+	pool *p = calloc(1, sizeof(pool));
+	int i;
+
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads <= 0)
+		threads = 1;
+	p->threads = threads;
+	p->q = calloc(threads, sizeof(pool_deque));
+	for (i = 0; i < threads; i++)
+	{
+		pthread_mutex_init(&p->q[i].lock, NULL);
+		p->q[i].size = 64;
+		p->q[i].tasks = malloc(p->q[i].size * sizeof(pool_task));
+	}
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->work, NULL);
+	pthread_cond_init(&p->idle, NULL);
+
+	p->tid = malloc(threads * sizeof(pthread_t));
+	for (i = 0; i < threads; i++)
+		pthread_create(&p->tid[i], NULL, worker, p);
+	return p;
+}
+
+void pool_submit(pool *p, pool_fn fn, void *arg)
+{
+	int q;
+
+	if (self_pool == p)
+		q = self;
+	else
+	{
+		pthread_mutex_lock(&p->lock);
+		q = p->next++ % p->threads;
+		pthread_mutex_unlock(&p->lock);
+	}
+
+	__atomic_add_fetch(&p->pending, 1, __ATOMIC_ACQ_REL);
+	__atomic_add_fetch(&p->queued, 1, __ATOMIC_ACQ_REL);
+	push(&p->q[q], fn, arg);
+
+	pthread_mutex_lock(&p->lock);		// so a worker about to wait can't miss it
+	pthread_cond_signal(&p->work);
+	pthread_mutex_unlock(&p->lock);
+}
+
+void pool_wait(pool *p)
+{
+	pthread_mutex_lock(&p->lock);
+	while (__atomic_load_n(&p->pending, __ATOMIC_ACQUIRE) > 0)
+		pthread_cond_wait(&p->idle, &p->lock);
+	pthread_mutex_unlock(&p->lock);
+}
+
+void pool_destroy(pool *p)
+{
+	int i;
+
+	pool_wait(p);
+	pthread_mutex_lock(&p->lock);
+	p->stop = 1;
+	pthread_cond_broadcast(&p->work);
+	pthread_mutex_unlock(&p->lock);
+	for (i = 0; i < p->threads; i++)
+		pthread_join(p->tid[i], NULL);
+
+	for (i = 0; i < p->threads; i++)
+	{
+		pthread_mutex_destroy(&p->q[i].lock);
+		free(p->q[i].tasks);
+	}
+	pthread_mutex_destroy(&p->lock);
+	pthread_cond_destroy(&p->work);
+	pthread_cond_destroy(&p->idle);
+	free(p->q);
+	free(p->tid);
+	free(p);
+}
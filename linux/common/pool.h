@@ -0,0 +1,55 @@
+// pool.h - work stealing thread pool
+//
+// each worker has its own deque of tasks. A worker pushes the tasks it submits on to the back of its own
+// deque and takes work from there too (newest first, while its data is still in cache); when that runs dry
+// it steals the oldest task from the front of another worker's deque. Tasks submitted from outside the pool
+// are dealt out round robin. So one big job that splits itself into pieces spreads over every worker
+// without a central queue everyone fights over.
+//
+// typical use
+//	p = pool_create(0);					// one worker per CPU
+//	pool_submit(p, convert_file, job);	// tasks may submit more tasks
+//	pool_wait(p);						// until every task (and any they submitted) has run
+//	pool_destroy(p);
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+
+typedef void (*pool_fn)(void *arg);
+
+typedef struct pool_task
+{
+	pool_fn fn;
+	void *arg;
+} pool_task;
+
+typedef struct pool_deque
+{
+	pthread_mutex_t lock;
+	pool_task *tasks;				// circular buffer
+	unsigned long head, tail;		// take from tail (owner) or head (thief)
+	unsigned long size;				// power of 2
+} pool_deque;
+
+typedef struct pool
+{
+	int threads;
+	pthread_t *tid;
+	pool_deque *q;
+	pthread_mutex_t lock;
+	pthread_cond_t work, idle;
+	long queued;					// tasks sitting in deques
+	long pending;					// tasks submitted but not finished
+	int stop;
+	unsigned int next;				// round robin for outside submissions
+	unsigned long long steals;
+} pool;
+
+pool *pool_create(int threads);				// 0 = one per CPU
+void pool_submit(pool *p, pool_fn fn, void *arg);
+void pool_wait(pool *p);
+void pool_destroy(pool *p);					// waits for the work to finish first
+
+#endif
@@ -0,0 +1,294 @@
+// profile.c - built in profiling (--profile): where each tool's time goes, stage by stage
+//
+// see profile.h for the usage
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "profile.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/perf_event.h>)
+#define HAVE_PERF
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#endif
+
+typedef struct stage
+{
+	const char *name;
+	unsigned long long calls;
+	unsigned long long self;			// ticks, less the scopes inside
+	unsigned long long total;			// ticks, including them
+	long long pmc[PROFILE_EVENTS];		// self counts
+} stage;
+
+int profiling = 0;
+
+static stage stages[PROFILE_STAGES];
+static int nstages;
+static unsigned long long start_ticks, start_ns;
+static __thread profile_scope *current;	// innermost open scope of this thread
+
+static const char *event_names[PROFILE_EVENTS] = {"cycles", "instructions", "cache-misses", "branch-misses"};
+static int event_fd[PROFILE_EVENTS] = {-1, -1, -1, -1};
+static long long event_start[PROFILE_EVENTS];
+static int pmc_ok = 0;					// every counter can be read from user space
+static __thread int pmc_thread = 0;		// the counters are this thread's
+
+#if defined(__x86_64__) || defined(__i386__)
+static const char *timer_name = "rdtsc";
+#elif defined(__aarch64__)
+static const char *timer_name = "cntvct_el0";
+#else
+static const char *timer_name = "clock_gettime";
+#endif
+
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline unsigned long long ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned lo, hi;
+
+	__asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((unsigned long long)hi << 32) | lo;
+#elif defined(__aarch64__)
+	unsigned long long v;
+
+	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(v));
+	return v;
+#else
+	return now_ns();
+#endif
+}
+
+#ifdef HAVE_PERF
+
+static struct perf_event_mmap_page *event_page[PROFILE_EVENTS];
+
+static long perf_open(struct perf_event_attr *attr, int group)
+{
+	return syscall(__NR_perf_event_open, attr, 0, -1, group, 0); // this thread, any CPU
+}
+
+static void perf_init(void)
+{
+	static const unsigned long long config[PROFILE_EVENTS] =
+		{PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+	struct perf_event_attr attr;
+	long long v;
+	void *p;
+	int i;
+
+	pmc_ok = 1;
+	for (i = 0; i < PROFILE_EVENTS; i++)
+	{
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = config[i];
+		attr.exclude_kernel = 1;		// allowed at perf_event_paranoid 2
+		attr.exclude_hv = 1;
+		// grouped under cycles so they are all on the PMU together
+		if ((event_fd[i] = perf_open(&attr, i ? event_fd[0] : -1)) < 0)
+		{
+			if (i == 0)
+			{
+				fprintf(stderr,"profile: no hardware counters here (perf_event_paranoid or no PMU) - times only\n");
+				pmc_ok = 0;
+				return;
+			}
+			continue;
+		}
+		if (read(event_fd[i], &v, sizeof(v)) == sizeof(v))
+			event_start[i] = v;
+		p = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, event_fd[i], 0);
+		event_page[i] = p == MAP_FAILED ? NULL : p;
+		if ((event_page[i] == NULL) || !event_page[i]->cap_user_rdpmc)
+			pmc_ok = 0;
+	}
+#if !defined(__x86_64__) && !defined(__i386__)
+	pmc_ok = 0; // rdpmc is x86 only - the rest get the totals
+#endif
+	pmc_thread = 1;
+}
+
+// the counter's value now, from user space (see perf_event_mmap_page in linux/perf_event.h)
+static long long pmc_read(int i)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	struct perf_event_mmap_page *pc = event_page[i];
+	unsigned seq, idx, lo, hi;
+	long long count;
+	unsigned long long pmc;
+
+	if (pc == NULL)
+		return 0;
+	do
+	{
+		seq = pc->lock;
+		__asm__ __volatile__("" ::: "memory");
+		idx = pc->index;
+		count = pc->offset;
+		if (idx)
+		{
+			__asm__ __volatile__("rdpmc" : "=a"(lo), "=d"(hi) : "c"(idx - 1));
+			pmc = ((unsigned long long)hi << 32) | lo;
+			pmc <<= 64 - pc->pmc_width; // sign extend from the counter's width
+			count += (long long)pmc >> (64 - pc->pmc_width);
+		}
+		__asm__ __volatile__("" ::: "memory");
+	} while (pc->lock != seq);
+	return count;
+#else
+	return 0;
+#endif
+}
+
+#endif
+
+int profile_stage(const char *name)
+{
+	int i;
+
+	for (i = 0; i < nstages; i++)
+		if (strcmp(stages[i].name, name) == 0)
+			return i;
+	if (nstages == PROFILE_STAGES)
+		return PROFILE_STAGES - 1; // lumped in with the last
+	stages[nstages].name = name;
+	return nstages++;
+}
+
+void profile_init(void)
+{
+#ifdef HAVE_PERF
+	perf_init();
+#else
+	fprintf(stderr,"profile: no hardware counters here - times only\n");
+#endif
+	start_ns = now_ns();
+	start_ticks = ticks();
+	profiling = 1;
+}
+
+void profile_enter(profile_scope *s, int stage)
+{
+	s->stage = stage;
+	s->child = 0;
+	s->parent = current;
+	current = s;
+	s->counting = pmc_ok && pmc_thread;
+#ifdef HAVE_PERF
+	if (s->counting)
+	{
+		int i;
+
+		for (i = 0; i < PROFILE_EVENTS; i++)
+		{
+			s->pmc[i] = pmc_read(i);
+			s->pmc_child[i] = 0;
+		}
+	}
+#endif
+	s->t = ticks(); // last, so the counters aren't read in the time
+}
+
+void profile_leave(profile_scope *s)
+{
+	unsigned long long took = ticks() - s->t;
+	stage *st = &stages[s->stage];
+
+	__atomic_fetch_add(&st->calls, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&st->total, took, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&st->self, took - s->child, __ATOMIC_RELAXED);
+	if (s->parent)
+		s->parent->child += took;
+#ifdef HAVE_PERF
+	if (s->counting)
+	{
+		long long n;
+		int i;
+
+		for (i = 0; i < PROFILE_EVENTS; i++)
+		{
+			n = pmc_read(i) - s->pmc[i];
+			__atomic_fetch_add(&st->pmc[i], n - s->pmc_child[i], __ATOMIC_RELAXED);
+			if (s->parent && s->parent->counting)
+				s->parent->pmc_child[i] += n;
+		}
+	}
+#endif
+	current = s->parent;
+}
+
+void profile_report(FILE *fp)
+{
+	unsigned long long run_ticks, run_ns, staged = 0;
+	double ns_tick, ms;
+	long long total[PROFILE_EVENTS];
+	int i, j, counters = 0;
+
+	if (!profiling)
+		return;
+	run_ticks = ticks() - start_ticks;
+	run_ns = now_ns() - start_ns;
+	ns_tick = run_ticks ? (double)run_ns / run_ticks : 1.0;
+
+	memset(total, 0, sizeof(total));
+#ifdef HAVE_PERF
+	for (i = 0; i < PROFILE_EVENTS; i++)
+		if ((event_fd[i] >= 0) && (read(event_fd[i], &total[i], sizeof(total[i])) == sizeof(total[i])))
+		{
+			total[i] -= event_start[i];
+			counters = 1;
+		}
+#endif
+
+	fprintf(fp,"profile: %.3f s with %s (%.3f ns a tick)%s\n", run_ns / 1e9, timer_name, ns_tick,
+		counters ? (pmc_ok ? "" : " - counters for the whole run only") : "");
+	fprintf(fp,"%-14s %12s %12s %12s %6s %10s", "stage", "calls", "total ms", "self ms", "%", "ns/call");
+	if (counters && pmc_ok)
+		fprintf(fp," %12s %6s %12s %12s", "cycles/call", "IPC", "cmiss/call", "bmiss/call");
+	fprintf(fp,"\n");
+	for (i = 0; i < nstages; i++)
+	{
+		if (stages[i].calls == 0)
+			continue;
+		staged += stages[i].self;
+		ms = stages[i].self * ns_tick / 1e6;
+		fprintf(fp,"%-14s %12llu %12.3f %12.3f %6.2f %10.1f", stages[i].name, stages[i].calls, stages[i].total * ns_tick / 1e6, ms,
+			run_ticks ? 100.0 * stages[i].self / run_ticks : 0.0, ms * 1e6 / stages[i].calls);
+		if (counters && pmc_ok)
+			fprintf(fp," %12.1f %6.2f %12.2f %12.2f", (double)stages[i].pmc[0] / stages[i].calls,
+				stages[i].pmc[0] ? (double)stages[i].pmc[1] / stages[i].pmc[0] : 0.0,
+				(double)stages[i].pmc[2] / stages[i].calls, (double)stages[i].pmc[3] / stages[i].calls);
+		fprintf(fp,"\n");
+	}
+	if (run_ticks > staged)
+		fprintf(fp,"%-14s %12s %12s %12.3f %6.2f\n", "(other)", "", "", (run_ticks - staged) * ns_tick / 1e6,
+			100.0 * (run_ticks - staged) / run_ticks);
+
+	if (counters)
+	{
+		fprintf(fp,"counters (user space, whole run):");
+		for (j = 0; j < PROFILE_EVENTS; j++)
+			if (event_fd[j] >= 0)
+				fprintf(fp," %lld %s", total[j], event_names[j]);
+		if (total[0])
+			fprintf(fp," - IPC %.2f", (double)total[1] / total[0]);
+		fprintf(fp,"\n");
+	}
+}
@@ -0,0 +1,68 @@
+// profile.h - built in profiling (--profile): where each tool's time goes, stage by stage
+//
+// the major stages of a tool (reading, parsing, interpolation, formatting, checksum, encoding, I/O ...)
+// are wrapped in scoped timers. The timer is the CPU's own counter - rdtsc on x86, cntvct_el0 on ARM64
+// (clock_gettime() elsewhere) - so a scope costs a few tens of cycles when profiling and one test of
+// a global when not. Ticks are turned into time at the end from how far the counter moved over the run.
+//
+// scopes may nest - each stage is charged its own (self) time, less the stages inside it, so the
+// breakdown adds up to the run. Any thread may use them.
+//
+// where perf_event_open() is allowed (perf_event_paranoid, a PMU in the VM) cycles, instructions,
+// cache misses and branch misses are counted too - for the whole run, and per stage where the counters
+// can be read from user space (rdpmc on x86). They count the thread that called profile_init().
+//
+// profile_report() prints the breakdown: calls, total and self time, share of the run, time a call
+// and - with the counters - cycles, instructions per cycle and misses a call.
+//
+// typical use
+//	static int s_parse;
+//	s_parse = profile_stage("parse");	// at start up
+//	if (--profile) profile_init();
+//	...
+//	profile_scope ps;
+//	profile_begin(&ps, s_parse);
+//	parse(line);
+//	profile_end(&ps);
+//	...
+//	profile_report(stderr);				// at exit - does nothing unless profiling
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+
+#define PROFILE_STAGES	32
+#define PROFILE_EVENTS	4			// cycles, instructions, cache misses, branch misses
+
+typedef struct profile_scope
+{
+	int stage;
+	unsigned long long t;						// ticks at the start
+	unsigned long long child;					// ticks in scopes inside this one
+	long long pmc[PROFILE_EVENTS], pmc_child[PROFILE_EVENTS];
+	int counting;								// pmc read at the start
+	struct profile_scope *parent;
+} profile_scope;
+
+extern int profiling;				// set by profile_init()
+
+int profile_stage(const char *name);	// the stage's number (the same one for the same name)
+void profile_init(void);				// start profiling - the run is timed from here
+void profile_enter(profile_scope *s, int stage);
+void profile_leave(profile_scope *s);
+void profile_report(FILE *fp);
+
+static inline void profile_begin(profile_scope *s, int stage)
+{
+	if (profiling)
+		profile_enter(s, stage);
+}
+
+static inline void profile_end(profile_scope *s)
+{
+	if (profiling)
+		profile_leave(s);
+}
+
+#endif
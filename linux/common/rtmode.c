@@ -0,0 +1,96 @@
+// rtmode.c - low jitter real-time mode for the emulators
+//
+// see rtmode.h
+
+#define _GNU_SOURCE		// sched_setaffinity()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include "rtmode.h"
+
+// touch the stack now, so the pages it grows into are there (and locked) before they are needed
+static void prefault_stack(void)
+{
+	volatile char stack[RTMODE_STACK];
+
+	memset((char *)stack, 0, sizeof(stack));
+}
+
+int rtmode_init(int cpu, int priority)
+{
+	struct sched_param sp;
+	cpu_set_t set;
+	void *heap;
+	int got = 0, flags = MCL_CURRENT | MCL_FUTURE;
+
+#ifdef MCL_ONFAULT
+	flags |= MCL_ONFAULT; // lock pages as they are used - don't read in every mapping now
+#endif
+	if (mlockall(flags) == 0)
+		got |= RTMODE_LOCKED;
+	else
+		fprintf(stderr,"rtmode: can't lock memory (%s) - raise ulimit -l or run with CAP_IPC_LOCK\n", strerror(errno));
+
+	// freed memory stays in the heap (already faulted and locked) rather than going back to the kernel
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+	if ((heap = malloc(RTMODE_HEAP)) != NULL)
+	{
+		rtmode_prefault(heap, RTMODE_HEAP);
+		free(heap);
+	}
+	prefault_stack();
+
+	prctl(PR_SET_TIMERSLACK, 1UL);
+
+	if (cpu >= 0)
+	{
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set) == 0)
+			got |= RTMODE_PINNED;
+		else
+			fprintf(stderr,"rtmode: can't run on CPU %d (%s)\n", cpu, strerror(errno));
+	}
+
+	memset(&sp, 0, sizeof(sp));
+	sp.sched_priority = priority;
+	if (sched_setscheduler(0, SCHED_FIFO, &sp) == 0)
+		got |= RTMODE_FIFO;
+	else
+		fprintf(stderr,"rtmode: can't have SCHED_FIFO priority %d (%s) - run with CAP_SYS_NICE or raise ulimit -r\n",
+			priority, strerror(errno));
+
+	fprintf(stderr,"rtmode:%s%s%s%s\n", got & RTMODE_FIFO ? " SCHED_FIFO" : "", got & RTMODE_LOCKED ? " memory locked" : "",
+		got & RTMODE_PINNED ? " pinned" : "", got ? "" : " none of it - epochs are still pre-rendered");
+	return got;
+}
+
+void rtmode_prefault(void *p, size_t len)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	size_t i;
+
+	for (i = 0; i < len; i += page)
+		((volatile char *)p)[i] = 0;
+	if (len)
+		((volatile char *)p)[len - 1] = 0;
+}
+
+void rtmode_spin_until(unsigned long long deadline, unsigned long long (*now)(void))
+{
+	while (now() < deadline)
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		__asm__ __volatile__("pause");
+#elif defined(__aarch64__)
+		__asm__ __volatile__("yield");
+#endif
+	}
+}
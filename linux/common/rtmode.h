@@ -0,0 +1,47 @@
+// rtmode.h - low jitter real-time mode for the emulators
+//
+// on a busy test host an epoch can go out late because something else had the CPU, because a page
+// of the program had to be faulted back in, or because the sleep overslept. rtmode_init() asks for
+//	SCHED_FIFO			the calling thread runs before anything that isn't real-time
+//	mlockall()			nothing is paged out - with MCL_ONFAULT where the kernel has it, so a multi-gigabyte
+//						log mapped before the call isn't read in (and locked) all at once
+//	prefaulted memory	the stack and the heap's top are touched now, and glibc is told not to hand freed
+//						memory back, so the hot path doesn't take page faults
+//	CPU pinning			the thread stays on one CPU (isolcpus= or a cpuset keeps other work off it)
+//	1ns timer slack		sleeps end when asked, not up to 50us later
+//
+// each of these needs privileges (CAP_SYS_NICE, CAP_IPC_LOCK or a large enough RLIMIT_MEMLOCK) - what
+// can't be had is reported and the rest carry on, so the same command line works everywhere.
+//
+// the scheduling and pinning are for the calling thread only - threads started before (metrics, the
+// KML server) keep the normal scheduler and can run on any CPU.
+//
+// the last few microseconds before a deadline are best spent spinning - rtmode_spin_until() - as
+// waking from a sleep takes tens of microseconds even for a real-time thread.
+//
+// typical use
+//	rtmode_init(3, 50);						// CPU 3, priority 50 - after the threads have been started
+//	rtmode_prefault(buffer, sizeof(buffer));
+//	...
+//	sleep_until(deadline - RTMODE_SPIN_NS);
+//	rtmode_spin_until(deadline, now);
+//	write(...);
+
+#ifndef RTMODE_H
+#define RTMODE_H
+
+#include <stddef.h>
+
+#define RTMODE_SPIN_NS		200000ull		// spin for the last 200us before a deadline
+#define RTMODE_STACK		(256 * 1024)	// stack prefaulted
+#define RTMODE_HEAP			(1024 * 1024)	// heap prefaulted
+
+#define RTMODE_FIFO			0x01			// what rtmode_init() got
+#define RTMODE_LOCKED		0x02
+#define RTMODE_PINNED		0x04
+
+int rtmode_init(int cpu, int priority);		// cpu < 0 - not pinned; priority 1 - 99. Returns RTMODE_ flags
+void rtmode_prefault(void *p, size_t len);	// touch every page of p (writes zeros - call before it is used)
+void rtmode_spin_until(unsigned long long deadline, unsigned long long (*now)(void));
+
+#endif
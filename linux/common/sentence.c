@@ -0,0 +1,92 @@
+// sentence.c - $GPGGA, $GPRMC and UKHAS telemetry parsing
+//
+// see sentence.h for the usage
+
+#include <stdio.h>
+#include <string.h>
+#include "sentence.h"
+
+// degrees, minutes and direction into signed decimal degrees
+static double DegMin_to_Deg(double Deg, double Min, char Dir)
+{
+	Deg += Min / 60.0;
+	return ((Dir == 'N') || (Dir == 'E')) ? Deg : -Deg;
+}
+
+int parse_sentence(const char *line, sentence_fix *f)
+{
+	int Hour, Minute, Second, i;
+	double Sec, LatDeg, LatMin, LonDeg, LonMin, Alt;
+	char LatDir, LonDir, Val, FixQual;
+	int Day, Month, Year;
+	double Lat, Lon;
+
+	f->have_pos = f->have_alt = f->have_date = 0;
+
+	if (strncmp(line, "$GPGGA,", 7) == 0)
+	{
+		i = sscanf(line,"$GPGGA,%2d%2d%lf,%2lf%lf,%c,%3lf%lf,%c,%c,%*d,%*f,%lf,M,",
+			&Hour,&Minute,&Sec,&LatDeg,&LatMin,&LatDir,&LonDeg,&LonMin,&LonDir,&FixQual,&Alt);
+		if (i < 3)
+			return SENTENCE_NONE;
+		f->tod = Hour * 3600.0 + Minute * 60.0 + Sec;
+		if ((i >= 10) && (FixQual != '0'))
+		{
+			f->lat = DegMin_to_Deg(LatDeg, LatMin, LatDir);
+			f->lon = DegMin_to_Deg(LonDeg, LonMin, LonDir);
+			f->have_pos = 1;
+			if (i >= 11)
+			{
+				f->alt = Alt;
+				f->have_alt = 1;
+			}
+		}
+		return SENTENCE_GGA;
+	}
+
+	if (strncmp(line, "$GPRMC,", 7) == 0)
+	{
+		i = sscanf(line,"$GPRMC,%2d%2d%lf,%c,%2lf%lf,%c,%3lf%lf,%c,%*f,%*f,%2d%2d%2d,",
+			&Hour,&Minute,&Sec,&Val,&LatDeg,&LatMin,&LatDir,&LonDeg,&LonMin,&LonDir,&Day,&Month,&Year);
+		if (i < 3)
+			return SENTENCE_NONE;
+		f->tod = Hour * 3600.0 + Minute * 60.0 + Sec;
+		if ((i >= 10) && (Val == 'A'))
+		{
+			f->lat = DegMin_to_Deg(LatDeg, LatMin, LatDir);
+			f->lon = DegMin_to_Deg(LonDeg, LonMin, LonDir);
+			f->have_pos = 1;
+		}
+		if (i >= 13)
+		{
+			f->day = Day;
+			f->month = Month;
+			f->year = 2000 + Year;
+			f->have_date = 1;
+		}
+		return SENTENCE_RMC;
+	}
+
+	if (strncmp(line, "$$", 2) == 0)
+	{ // $$CALLSIGN,count,hh:mm:ss,lat,lon,alt,...
+		i = sscanf(line,"$$%31[^,],%ld,%d:%d:%d,%lf,%lf,%lf",
+			f->callsign,&f->count,&Hour,&Minute,&Second,&Lat,&Lon,&Alt);
+		if (i < 5)
+			return SENTENCE_NONE;
+		f->tod = Hour * 3600.0 + Minute * 60.0 + Second;
+		if ((i >= 7) && ((Lat != 0.0) || (Lon != 0.0)))
+		{ // 0,0 is what trackers send before they have a fix
+			f->lat = Lat;
+			f->lon = Lon;
+			f->have_pos = 1;
+			if (i >= 8)
+			{
+				f->alt = Alt;
+				f->have_alt = 1;
+			}
+		}
+		return SENTENCE_UKHAS;
+	}
+
+	return SENTENCE_NONE;
+}
@@ -0,0 +1,33 @@
+// sentence.h - parse the position sentences found in our logs into one record
+//
+//	$GPGGA		time, position, altitude
+//	$GPRMC		time, position, date
+//	$$CALLSIGN	UKHAS telemetry - $$CALLSIGN,count,hh:mm:ss,lat,lon,alt,...*CRC16
+//
+// only the fields a sentence carries are filled in (see the have_ flags) so a caller can
+// carry the date from $GPRMC on to the $GPGGA lines that follow it
+
+#ifndef SENTENCE_H
+#define SENTENCE_H
+
+#define SENTENCE_NONE	0
+#define SENTENCE_GGA	1
+#define SENTENCE_RMC	2
+#define SENTENCE_UKHAS	3
+
+typedef struct sentence_fix
+{
+	int have_pos;			// lat, lon (and alt for GGA and UKHAS) are valid
+	int have_alt;
+	int have_date;
+	double tod;				// time of day (seconds since midnight UTC)
+	int day, month, year;
+	double lat, lon;		// degrees
+	double alt;				// metres
+	char callsign[32];		// UKHAS
+	long count;				// UKHAS sentence count
+} sentence_fix;
+
+int parse_sentence(const char *line, sentence_fix *f);		// returns SENTENCE_... (NONE if not a sentence we know)
+
+#endif
@@ -0,0 +1,72 @@
+// shaper.c - baud rate token bucket and epoch overrun accounting
+//
+// see shaper.h for the usage
+
+#include <stdio.h>
+#include <string.h>
+#include "vclock.h"
+#include "shaper.h"
+
+// the link runs to the vclock, so a virtual clock models the wire without waiting for it
+unsigned long long shaper_now(void)
+{
+	return vclock_now();
+}
+
+void shaper_sleep_until(unsigned long long ns)
+{
+	vclock_sleep_until(ns);
+}
+
+void shaper_init(shaper *s, double baud, int bits, int fifo)
+{
+	memset(s, 0, sizeof(*s));
+	s->baud = baud;
+	s->char_ns = 1e9 * bits / baud;
+	s->fifo_ns = fifo * s->char_ns;
+}
+
+unsigned long long shaper_send(shaper *s, size_t len)
+{
+	unsigned long long now = shaper_now(), release, wire;
+
+	if (s->start == 0)
+		s->start = now;
+
+	// may be written once the wire has caught up to within a FIFO's worth
+	release = (s->tat > now + (unsigned long long)s->fifo_ns) ? s->tat - (unsigned long long)s->fifo_ns : now;
+	wire = s->tat > release ? s->tat : release; // when the first of these characters goes out
+	s->tat = wire + (unsigned long long)(len * s->char_ns);
+
+	s->bytes += len;
+	s->total += len;
+	return release;
+}
+
+int shaper_epoch(shaper *s, double epoch_ns)
+{
+	double busy = s->bytes * s->char_ns;
+
+	s->bytes = 0;
+	s->epochs++;
+	s->last_use = epoch_ns > 0 ? busy / epoch_ns : 0.0;
+	if (s->last_use > s->peak_use)
+		s->peak_use = s->last_use;
+	if (busy > epoch_ns)
+	{
+		s->overruns++;
+		return 1;
+	}
+	return 0;
+}
+
+void shaper_report(shaper *s, FILE *fp)
+{
+	double secs = s->start ? (shaper_now() - s->start) / 1e9 : 0.0;
+
+	fprintf(fp,"\n%.0f baud: %llu bytes in %llu epochs over %.1f s (%.2f epochs/s, %.0f%% of the link), "
+		"%llu epochs overran, busiest epoch used %.0f%% of the link\n",
+		s->baud, s->total, s->epochs, secs, secs > 0 ? s->epochs / secs : 0.0,
+		secs > 0 ? 100.0 * s->total * s->char_ns / 1e9 / secs : 0.0,
+		s->overruns, 100.0 * s->peak_use);
+}
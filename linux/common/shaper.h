@@ -0,0 +1,47 @@
+// shaper.h - model of a serial link: paces output to what a UART at a given baud rate can carry
+//
+// each character takes bits / baud seconds on the wire (10 bits for 8N1). A token bucket lets the
+// writer get up to fifo characters ahead of the wire (the UART's FIFO / driver buffer) and then holds
+// each write back until the wire has room for it.
+//
+// the bytes sent in each epoch are added up - if they need longer on the wire than the epoch lasts the
+// epoch has overrun, i.e. the receiver is configured to send more than the link can carry.
+//
+// typical use
+//	shaper_init(&link, 9600, 10, 16);
+//	for each epoch
+//		shaper_epoch(&link, 1e9);						// account for the last one
+//		for each message
+//			shaper_sleep_until(shaper_send(&link, len));	// or wait some other way
+//			write(...);
+//	shaper_report(&link, stderr);
+
+#ifndef SHAPER_H
+#define SHAPER_H
+
+#include <stdio.h>
+
+typedef struct shaper
+{
+	double baud;
+	double char_ns;					// time one character takes on the wire
+	double fifo_ns;					// how far ahead of the wire a write may be
+	unsigned long long tat;			// when the wire will have sent everything written so far
+	unsigned long long bytes;		// in the current epoch
+	unsigned long long total;		// bytes sent
+	unsigned long long epochs;		// epochs accounted for
+	unsigned long long overruns;	// epochs that needed more time on the wire than they had
+	double last_use;				// fraction of the last epoch the wire was busy
+	double peak_use;
+	unsigned long long start;		// first send
+} shaper;
+
+unsigned long long shaper_now(void);								// ns on the vclock (see vclock.h)
+void shaper_sleep_until(unsigned long long ns);
+
+void shaper_init(shaper *s, double baud, int bits, int fifo);		// bits per character (10 for 8N1), fifo in characters
+unsigned long long shaper_send(shaper *s, size_t len);				// book len bytes on the wire - returns when they may be written
+int shaper_epoch(shaper *s, double epoch_ns);						// an epoch of epoch_ns has ended - returns 1 if it overran
+void shaper_report(shaper *s, FILE *fp);							// summary - epochs per second, overruns, peak link use
+
+#endif
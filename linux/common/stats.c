@@ -0,0 +1,330 @@
+// stats.c - counters, gauges and HDR style latency histograms exported as Prometheus text
+//
+// see stats.h for the usage
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "stats.h"
+
+#define SUB_COUNT (1 << STAT_SUB_BITS)
+
+static stat_counter *counters = NULL;		// all registered counters and gauges (oldest first)
+static stat_counter **counters_end = &counters;
+static stat_hist *hists = NULL;				// all registered histograms (oldest first)
+static stat_hist **hists_end = &hists;
+
+static char *stats_path = NULL;				// where to write - NULL if not wanted
+static unsigned long long interval_ns;		// how often stats_tick() flushes
+static unsigned long long last_flush;		// when it last did
+
+static stat_hist *flush_hist;				// time taken to write the stats file
+static stat_counter *overhead_gauge;		// measured cost of timing one operation
+
+
+unsigned long long stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+static stat_counter *new_counter(const char *name, const char *help, const char *labels, int gauge, int ns)
+{
+	stat_counter *c;
+
+	if ((c = calloc(1, sizeof(*c))) == NULL)
+	{
+		fprintf(stderr,"stats: out of memory\n");
+		exit(1);
+	}
+	c->name = name;
+	c->help = help;
+	c->gauge = gauge;
+	c->ns = ns;
+	if (labels)
+		snprintf(c->labels, sizeof(c->labels), "%s", labels);
+
+	*counters_end = c; // kept in order so a family's labels come out in the order they were made
+	counters_end = &c->next;
+	return c;
+}
+
+stat_counter *stats_counter(const char *name, const char *help, const char *labels)
+{
+	return new_counter(name, help, labels, 0, 0);
+}
+
+stat_counter *stats_gauge(const char *name, const char *help, const char *labels)
+{
+	return new_counter(name, help, labels, 1, 0);
+}
+
+stat_counter *stats_gauge_ns(const char *name, const char *help, const char *labels)
+{
+	return new_counter(name, help, labels, 1, 1);
+}
+
+stat_hist *stats_hist(const char *name, const char *help, const char *labels)
+{
+	stat_hist *h;
+
+	if ((h = calloc(1, sizeof(*h))) == NULL)
+	{
+		fprintf(stderr,"stats: out of memory\n");
+		exit(1);
+	}
+	h->name = name;
+	h->help = help;
+	if (labels)
+		snprintf(h->labels, sizeof(h->labels), "%s", labels);
+
+	*hists_end = h;
+	hists_end = &h->next;
+	return h;
+}
+
+
+// log-linear bucket for a value
+// values below SUB_COUNT get a bucket each, above that each power of 2 is split into SUB_COUNT buckets
+static inline int bucket_of(unsigned long long v)
+{
+	int msb, shift;
+
+	if (v < SUB_COUNT)
+		return (int)v;
+
+	msb = 63 - __builtin_clzll(v);
+	shift = msb - STAT_SUB_BITS;
+	return ((shift + 1) << STAT_SUB_BITS) + (int)((v >> shift) & (SUB_COUNT - 1));
+}
+
+// lowest value that lands in a bucket
+static unsigned long long bucket_low(int idx)
+{
+	int shift;
+
+	if (idx < SUB_COUNT)
+		return idx;
+
+	shift = (idx >> STAT_SUB_BITS) - 1;
+	return (unsigned long long)(SUB_COUNT + (idx & (SUB_COUNT - 1))) << shift;
+}
+
+void stats_record(stat_hist *h, unsigned long long ns)
+{
+	unsigned long long max;
+
+	__atomic_fetch_add(&h->bucket[bucket_of(ns)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum, ns, __ATOMIC_RELAXED);
+
+	max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+	while (ns > max)
+	{ // lost a race with another thread - max now holds their value
+		if (__atomic_compare_exchange_n(&h->max, &max, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			break;
+	}
+}
+
+unsigned long long stats_quantile(stat_hist *h, double q)
+{
+	unsigned long long count, rank, seen;
+	unsigned long long lo, hi;
+	int i;
+
+	count = __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+	if (count == 0)
+		return 0;
+
+	rank = (unsigned long long)(q * (double)count);
+	if (rank >= count)
+		rank = count - 1;
+
+	seen = 0;
+	for (i = 0; i < STAT_BUCKETS; i++)
+	{
+		seen += __atomic_load_n(&h->bucket[i], __ATOMIC_RELAXED);
+		if (seen > rank)
+		{ // report the middle of the bucket - but never more than the largest value seen
+			lo = bucket_low(i);
+			hi = (i + 1 < STAT_BUCKETS) ? bucket_low(i + 1) : lo;
+			lo += (hi - lo) / 2;
+			return (lo < h->max) ? lo : h->max;
+		}
+	}
+	return h->max;
+}
+
+
+// time a batch of stats_now() + stats_record() pairs, so the stats file shows what the instrumentation costs
+static void calibrate(void)
+{
+	stat_hist scratch;
+	unsigned long long start, t;
+	int i;
+
+	memset(&scratch, 0, sizeof(scratch));
+
+	start = stats_now();
+	for (i = 0; i < 10000; i++)
+	{
+		t = stats_now();
+		stats_record(&scratch, stats_now() - t);
+	}
+	stats_set(overhead_gauge, (long long)((stats_now() - start) / 10000));
+}
+
+void stats_open(const char *path, double interval)
+{
+	if (flush_hist == NULL)
+	{
+		flush_hist = stats_hist("stats_flush_seconds","Time taken to write the stats file",NULL);
+		overhead_gauge = stats_gauge_ns("stats_timing_overhead_seconds","Measured cost of timing one operation",NULL);
+		calibrate();
+	}
+
+	free(stats_path);
+	stats_path = path ? strdup(path) : NULL;
+	interval_ns = (unsigned long long)(interval * 1e9);
+	last_flush = stats_now();
+}
+
+void stats_tick(void)
+{
+	unsigned long long now;
+
+	if (stats_path == NULL)
+		return;
+
+	now = stats_now();
+	if (now - last_flush >= interval_ns)
+	{
+		last_flush = now;
+		stats_flush();
+	}
+}
+
+
+// has a metric of this name already been written by this flush (a family is written all together, the
+// first time its name comes up)
+static int seen_counter(stat_counter *upto, const char *name)
+{
+	stat_counter *c;
+
+	for (c = counters; c != upto; c = c->next)
+		if (strcmp(c->name, name) == 0)
+			return 1;
+	return 0;
+}
+
+static int seen_hist(stat_hist *upto, const char *name)
+{
+	stat_hist *h;
+
+	for (h = hists; h != upto; h = h->next)
+		if (strcmp(h->name, name) == 0)
+			return 1;
+	return 0;
+}
+
+// the value part of a Prometheus sample, with or without labels (and an optional quantile)
+static void write_series(FILE *fp, const char *name, const char *suffix, const char *labels, const char *quantile)
+{
+	fprintf(fp, "%s%s", name, suffix);
+
+	if (labels[0] || quantile)
+	{
+		fputc('{', fp);
+		fputs(labels, fp);
+		if (quantile)
+			fprintf(fp, "%squantile=\"%s\"", labels[0] ? "," : "", quantile);
+		fputc('}', fp);
+	}
+	fputc(' ', fp);
+}
+
+// a histogram's samples - the quantiles, max, sum and count
+static void write_hist(FILE *fp, stat_hist *h)
+{
+	static const double q[] = {0.5, 0.9, 0.99, 0.999};
+	static const char *qname[] = {"0.5", "0.9", "0.99", "0.999"};
+	int i;
+
+	for (i = 0; i < 4; i++)
+	{
+		write_series(fp, h->name, "", h->labels, qname[i]);
+		fprintf(fp, "%.9f\n", (double)stats_quantile(h, q[i]) / 1e9);
+	}
+	write_series(fp, h->name, "", h->labels, "1");
+	fprintf(fp, "%.9f\n", (double)__atomic_load_n(&h->max, __ATOMIC_RELAXED) / 1e9);
+	write_series(fp, h->name, "_sum", h->labels, NULL);
+	fprintf(fp, "%.9f\n", (double)__atomic_load_n(&h->sum, __ATOMIC_RELAXED) / 1e9);
+	write_series(fp, h->name, "_count", h->labels, NULL);
+	fprintf(fp, "%llu\n", __atomic_load_n(&h->count, __ATOMIC_RELAXED));
+}
+
+void stats_flush(void)
+{
+	char tmp[1024];
+	FILE *fp;
+	stat_counter *family, *c;
+	stat_hist *hfamily, *h;
+	unsigned long long start;
+
+	if (stats_path == NULL)
+		return;
+
+	start = stats_now();
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", stats_path);
+	if ((fp = fopen(tmp, "w")) == NULL)
+		return;	// cant write it now - maybe next time
+
+	for (family = counters; family != NULL; family = family->next)
+	{
+		if (seen_counter(family, family->name))
+			continue;
+		fprintf(fp, "# HELP %s %s\n", family->name, family->help);
+		fprintf(fp, "# TYPE %s %s\n", family->name, family->gauge ? "gauge" : "counter");
+		for (c = family; c != NULL; c = c->next)
+		{
+			if (strcmp(c->name, family->name) != 0)
+				continue;
+			write_series(fp, c->name, "", c->labels, NULL);
+			if (c->ns)
+				fprintf(fp, "%.9f\n", (double)__atomic_load_n(&c->value, __ATOMIC_RELAXED) / 1e9);
+			else
+				fprintf(fp, "%lld\n", __atomic_load_n(&c->value, __ATOMIC_RELAXED));
+		}
+	}
+
+	for (hfamily = hists; hfamily != NULL; hfamily = hfamily->next)
+	{
+		if (seen_hist(hfamily, hfamily->name))
+			continue;
+		fprintf(fp, "# HELP %s %s\n", hfamily->name, hfamily->help);
+		fprintf(fp, "# TYPE %s summary\n", hfamily->name);
+		for (h = hfamily; h != NULL; h = h->next)
+		{
+			if (strcmp(h->name, hfamily->name) != 0)
+				continue;
+			write_hist(fp, h);
+		}
+	}
+
+	fclose(fp);
+	rename(tmp, stats_path); // atomic replace
+
+	stats_record(flush_hist, stats_now() - start);
+}
+
+void stats_close(void)
+{
+	stats_flush();
+	free(stats_path);
+	stats_path = NULL;
+}
@@ -0,0 +1,81 @@
+// stats.h - low overhead run-time metrics shared by the testing tools
+//
+// counters and gauges are plain 64 bit values updated with relaxed atomic operations
+// so any thread can bump them without a lock.
+// latencies are recorded in nanoseconds into log-linear (HDR style) histograms,
+// 8 linear sub-buckets per power of two - about 12% resolution from 1ns to centuries.
+//
+// stats_flush() writes every metric to a file in Prometheus text format, histograms
+// as summaries (p50, p90, p99, p99.9 and max). Metrics of the same name with different labels
+// are written together under one # HELP and # TYPE, in the order they were created. The file is written to a temporary
+// and renamed so a reader (cat, node_exporter textfile collector etc.) never sees half a file.
+//
+// typical use
+//	h = stats_hist("tool_thing_seconds","Time taken to do the thing",NULL);
+//	t = stats_now();
+//	do_thing();
+//	stats_record(h,stats_now() - t);
+//	stats_tick(); // flushes to the stats file at most once per interval
+
+#ifndef STATS_H
+#define STATS_H
+
+#define STAT_SUB_BITS	3						// linear sub-buckets per power of 2 (as a power of 2)
+#define STAT_BUCKETS	(64 << STAT_SUB_BITS)	// enough for any 64 bit value
+#define STAT_LABELS		64						// size of the label text e.g. payload="NAILBRUSH"
+
+typedef struct stat_counter
+{
+	const char *name;			// metric name e.g. gpsemulate_lines_total
+	const char *help;			// one line description
+	char labels[STAT_LABELS];	// optional label set (without the braces)
+	int gauge;					// 1 if set with stats_set(), 0 if only ever added to
+	int ns;						// value is in nanoseconds - written out as seconds
+	long long value;
+	struct stat_counter *next;
+} stat_counter;
+
+typedef struct stat_hist
+{
+	const char *name;
+	const char *help;
+	char labels[STAT_LABELS];
+	unsigned long long count;	// number of samples
+	unsigned long long sum;		// sum of samples (ns)
+	unsigned long long max;		// largest sample (ns)
+	unsigned long long bucket[STAT_BUCKETS];
+	struct stat_hist *next;
+} stat_hist;
+
+// create a metric - call at start up, not in the hot path (labels may be NULL)
+stat_counter *stats_counter(const char *name, const char *help, const char *labels);
+stat_counter *stats_gauge(const char *name, const char *help, const char *labels);
+stat_counter *stats_gauge_ns(const char *name, const char *help, const char *labels);	// set in ns, shown in seconds
+stat_hist *stats_hist(const char *name, const char *help, const char *labels);
+
+// monotonic time in nanoseconds
+unsigned long long stats_now(void);
+
+// the hot path
+static inline void stats_add(stat_counter *c, long long n)
+{
+	__atomic_fetch_add(&c->value, n, __ATOMIC_RELAXED);
+}
+
+static inline void stats_set(stat_counter *c, long long v)
+{
+	__atomic_store_n(&c->value, v, __ATOMIC_RELAXED);
+}
+
+void stats_record(stat_hist *h, unsigned long long ns);
+
+// value at quantile q (0.0 - 1.0) of a histogram, in nanoseconds
+unsigned long long stats_quantile(stat_hist *h, double q);
+
+// stats file handling - path may be NULL in which case metrics are kept but never written
+void stats_open(const char *path, double interval);
+void stats_tick(void);	// flush if the interval has passed since the last flush
+void stats_flush(void);
+void stats_close(void);	// final flush
+
+#endif
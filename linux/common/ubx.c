@@ -0,0 +1,123 @@
+// ubx.c - UBX frame packing (NAV-PVT) and checksums
+//
+// see ubx.h for the usage
+
+#include <math.h>
+#include "ubx.h"
+
+static unsigned char *put_u8(unsigned char *p, unsigned long v)
+{
+	*p++ = v & 0xFF;
+	return p;
+}
+
+static unsigned char *put_u16(unsigned char *p, unsigned long v)
+{
+	*p++ = v & 0xFF;
+	*p++ = (v >> 8) & 0xFF;
+	return p;
+}
+
+static unsigned char *put_u32(unsigned char *p, unsigned long v)
+{
+	*p++ = v & 0xFF;
+	*p++ = (v >> 8) & 0xFF;
+	*p++ = (v >> 16) & 0xFF;
+	*p++ = (v >> 24) & 0xFF;
+	return p;
+}
+
+// signed values go out as 2's complement
+static unsigned char *put_i32(unsigned char *p, double v)
+{
+	return put_u32(p, (unsigned long)(long)lround(v));
+}
+
+// Fletcher checksum over class, id, length and payload
+void ubx_checksum(unsigned char *frame, int size)
+{
+	unsigned char CK_A = 0;
+	unsigned char CK_B = 0;
+	int i;
+
+	for (i = 2; i < size - 2; i++)
+	{
+		CK_A = CK_A + frame[i];
+		CK_B = CK_B + CK_A;
+	}
+	frame[i++] = CK_A;
+	frame[i++] = CK_B;
+}
+
+// days since 1 Jan 1970 of a Gregorian date
+static long days_from_civil(int y, int m, int d)
+{
+	long era;
+	unsigned yoe, doy, doe;
+
+	y -= m <= 2;
+	era = (y >= 0 ? y : y - 399) / 400;
+	yoe = (unsigned)(y - era * 400);
+	doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+	return era * 146097 + (long)doe - 719468;
+}
+
+unsigned long ubx_itow(int year, int month, int day, double tod)
+{
+	// 1 Jan 1970 was a Thursday - GPS weeks start on Sunday
+	long dow = (days_from_civil(year, month, day) + 4) % 7;
+	double ms = (dow * 86400.0 + tod + GPS_LEAP_SECONDS) * 1000.0;
+
+	return (unsigned long)llround(ms) % (7ul * 86400000ul);
+}
+
+int ubx_nav_pvt(unsigned char *frame, const ubx_pvt *p)
+{
+	unsigned char *q = frame;
+	double whole = floor(p->sec);
+	unsigned long flags = p->fixOK ? 0x01 : 0x00;
+
+	q = put_u8(q, UBX_SYNC1);
+	q = put_u8(q, UBX_SYNC2);
+	q = put_u8(q, UBX_CLASS_NAV);
+	q = put_u8(q, UBX_ID_NAV_PVT);
+	q = put_u16(q, UBX_NAV_PVT_PAYLOAD);
+
+	q = put_u32(q, ubx_itow(p->year, p->month, p->day, p->hour * 3600.0 + p->min * 60.0 + p->sec));
+	q = put_u16(q, p->year);
+	q = put_u8(q, p->month);
+	q = put_u8(q, p->day);
+	q = put_u8(q, p->hour);
+	q = put_u8(q, p->min);
+	q = put_u8(q, (unsigned long)whole);
+	q = put_u8(q, p->valid);
+	q = put_u32(q, 50);								// tAcc ns
+	q = put_i32(q, (p->sec - whole) * 1e9);			// nano
+	q = put_u8(q, p->fixType);
+	q = put_u8(q, flags);
+	q = put_u8(q, (p->valid & 0x03) == 0x03 ? 0xE0 : 0x20);	// flags2 - confirmed date and time
+	q = put_u8(q, p->numSV);
+	q = put_i32(q, p->lon * 1e7);					// 1e-7 degrees
+	q = put_i32(q, p->lat * 1e7);
+	q = put_i32(q, p->height * 1000.0);				// mm
+	q = put_i32(q, p->hMSL * 1000.0);
+	q = put_u32(q, (unsigned long)lround(p->hAcc * 1000.0));
+	q = put_u32(q, (unsigned long)lround(p->vAcc * 1000.0));
+	q = put_i32(q, p->velN * 1000.0);				// mm/s
+	q = put_i32(q, p->velE * 1000.0);
+	q = put_i32(q, p->velD * 1000.0);
+	q = put_i32(q, p->gSpeed * 1000.0);
+	q = put_i32(q, p->headMot * 1e5);				// 1e-5 degrees
+	q = put_u32(q, (unsigned long)lround(p->sAcc * 1000.0));
+	q = put_u32(q, (unsigned long)lround(p->headAcc * 1e5));
+	q = put_u16(q, (unsigned long)lround(p->pDOP * 100.0));
+	q = put_u16(q, 0);								// flags3
+	q = put_u32(q, 0);								// reserved
+	q = put_i32(q, p->headMot * 1e5);				// headVeh (not valid - flags bit 5 clear)
+	q = put_i32(q, 0);								// magDec, magAcc
+	q += 2;
+
+	ubx_checksum(frame, q - frame);
+	return q - frame;
+}
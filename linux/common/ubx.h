@@ -0,0 +1,46 @@
+// ubx.h - u-blox UBX protocol frames shared by the testing tools
+//
+// frames are packed field by field, little endian, into a byte buffer - never by copying a C struct,
+// whose padding and sizes (long is 8 bytes on 64 bit Linux) don't match the wire format.
+// Nothing is allocated - the caller owns the buffer.
+
+#ifndef UBX_H
+#define UBX_H
+
+#define UBX_SYNC1		0xB5
+#define UBX_SYNC2		0x62
+#define UBX_CLASS_NAV	0x01
+#define UBX_ID_NAV_PVT	0x07
+
+#define UBX_NAV_PVT_PAYLOAD	92
+#define UBX_NAV_PVT_LEN		(6 + UBX_NAV_PVT_PAYLOAD + 2)	// header, payload, checksum
+
+#define GPS_LEAP_SECONDS 18		// GPS - UTC since 1 Jan 2017
+
+// one navigation solution in everyday units - ubx_nav_pvt() does the scaling
+typedef struct ubx_pvt
+{
+	int year, month, day;		// UTC
+	int hour, min;
+	double sec;					// including the fraction
+	int valid;					// UBX valid flags - bit 0 date, bit 1 time, bit 2 fully resolved
+	int fixType;				// 0 no fix, 2 2D, 3 3D
+	int fixOK;					// within DOP and accuracy masks
+	int numSV;
+	double lat, lon;			// degrees
+	double height;				// metres above the ellipsoid
+	double hMSL;				// metres above mean sea level
+	double hAcc, vAcc;			// metres
+	double velN, velE, velD;	// metres/sec
+	double gSpeed;				// ground speed metres/sec
+	double headMot;				// heading of motion, degrees
+	double sAcc;				// metres/sec
+	double headAcc;				// degrees
+	double pDOP;
+} ubx_pvt;
+
+void ubx_checksum(unsigned char *frame, int size);					// fill in the last 2 bytes of a frame size bytes long
+int ubx_nav_pvt(unsigned char *frame, const ubx_pvt *p);			// build a NAV-PVT frame (UBX_NAV_PVT_LEN bytes) - returns its length
+unsigned long ubx_itow(int year, int month, int day, double tod);	// GPS time of week (ms) for a UTC date and time of day (seconds)
+
+#endif
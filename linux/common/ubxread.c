@@ -0,0 +1,278 @@
+// ubxread.c - UBX stream reader: vectorised sync word search, checksum check, resync and typed decoding
+//
+// see ubxread.h for the usage
+
+#include <stdlib.h>
+#include <string.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include "ubxread.h"
+
+
+void ubx_reader_init(ubx_reader *r, ubx_msg_fn fn, void *user)
+{
+	memset(r, 0, sizeof(*r));
+	r->fn = fn;
+	r->user = user;
+	r->max_payload = UBX_MAX_PAYLOAD;
+}
+
+// first 0xB5 0x62 in p .. end - NULL if there isn't one
+static const unsigned char *find_sync(const unsigned char *p, const unsigned char *end)
+{
+#if defined(__AVX2__)
+	const __m256i s1 = _mm256_set1_epi8((char)UBX_SYNC1), s2 = _mm256_set1_epi8(UBX_SYNC2);
+
+	for (; p + 33 <= end; p += 32)
+	{ // compare each byte with 0xB5 and the byte after it with 0x62 at once
+		unsigned m = _mm256_movemask_epi8(_mm256_and_si256(
+			_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), s1),
+			_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 1)), s2)));
+		if (m)
+			return p + __builtin_ctz(m);
+	}
+#elif defined(__SSE2__)
+	const __m128i s1 = _mm_set1_epi8((char)UBX_SYNC1), s2 = _mm_set1_epi8(UBX_SYNC2);
+
+	for (; p + 17 <= end; p += 16)
+	{
+		unsigned m = _mm_movemask_epi8(_mm_and_si128(
+			_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p), s1),
+			_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 1)), s2)));
+		if (m)
+			return p + __builtin_ctz(m);
+	}
+#elif defined(__ARM_NEON)
+	const uint8x16_t s1 = vdupq_n_u8(UBX_SYNC1), s2 = vdupq_n_u8(UBX_SYNC2);
+
+	for (; p + 17 <= end; p += 16)
+	{ // no movemask on NEON - test for any match then find it byte by byte
+		uint8x16_t m = vandq_u8(vceqq_u8(vld1q_u8(p), s1), vceqq_u8(vld1q_u8(p + 1), s2));
+		if (vmaxvq_u8(m))
+			break;
+	}
+#endif
+	for (; p + 1 < end; p++)
+		if ((p[0] == UBX_SYNC1) && (p[1] == UBX_SYNC2))
+			return p;
+	return NULL;
+}
+
+static int checksum_ok(const unsigned char *frame, int size)
+{
+	unsigned char CK_A = 0, CK_B = 0;
+	int i;
+
+	for (i = 2; i < size - 2; i++)
+	{
+		CK_A += frame[i];
+		CK_B += CK_A;
+	}
+	return (frame[size - 2] == CK_A) && (frame[size - 1] == CK_B);
+}
+
+// hand on every good frame in data - returns how many bytes were used up (the rest is the start of a
+// frame that needs more data, unless final)
+static size_t scan(ubx_reader *r, const unsigned char *data, size_t len, unsigned long long offset, int final)
+{
+	const unsigned char *p;
+	size_t pos = 0, plen;
+	ubx_msg m;
+
+	while (pos < len)
+	{
+		if ((p = find_sync(data + pos, data + len)) == NULL)
+		{ // keep a last 0xB5 - it may be the start of a sync word
+			size_t keep = (!final && (data[len - 1] == UBX_SYNC1)) ? 1 : 0;
+
+			r->skipped += len - keep - pos;
+			return len - keep;
+		}
+		r->skipped += p - (data + pos);
+		pos = p - data;
+
+		if (len - pos < 6)
+			break; // need the length
+		plen = data[pos + 4] | (data[pos + 5] << 8);
+		if ((int)plen > r->max_payload)
+		{ // can't be right - look again from the next byte
+			r->bad++;
+			r->skipped++;
+			pos++;
+			continue;
+		}
+		if (len - pos < plen + 8)
+			break; // whole frame not here yet
+
+		if (!checksum_ok(data + pos, plen + 8))
+		{
+			r->bad++;
+			r->skipped++;
+			pos++;
+			continue;
+		}
+
+		m.cls = data[pos + 2];
+		m.id = data[pos + 3];
+		m.len = plen;
+		m.payload = data + pos + 6;
+		m.offset = offset + pos;
+		r->frames++;
+		r->fn(&m, r->user);
+		pos += plen + 8;
+	}
+
+	if (final && (pos < len))
+	{
+		r->skipped += len - pos;
+		pos = len;
+	}
+	return pos;
+}
+
+void ubx_reader_feed(ubx_reader *r, const unsigned char *data, size_t len)
+{
+	size_t cap = 2 * ((size_t)r->max_payload + 8), used, take, old;
+
+	if (r->carry == NULL)
+		r->carry = malloc(cap);
+
+	while (r->carry_len && len)
+	{ // finish the frame left over from last time - only copying as much as it can need
+		old = r->carry_len;
+		take = len < cap - old ? len : cap - old;
+		memcpy(r->carry + old, data, take);
+		r->carry_len += take;
+
+		used = scan(r, r->carry, r->carry_len, r->offset - old, 0);
+		if (used >= old)
+		{ // done with what was carried over - the rest is read straight from data
+			r->carry_len = 0;
+			data += used - old;
+			len -= used - old;
+			r->offset += used - old;
+			break;
+		}
+		// a frame that started in the carried over bytes is still not complete
+		memmove(r->carry, r->carry + used, r->carry_len - used);
+		r->carry_len -= used;
+		data += take;
+		len -= take;
+		r->offset += take;
+	}
+	if (len == 0)
+		return;
+
+	used = scan(r, data, len, r->offset, 0);
+	memcpy(r->carry, data + used, len - used); // part frame (at most max_payload + 7 bytes)
+	r->carry_len = len - used;
+	r->offset += len;
+}
+
+void ubx_reader_end(ubx_reader *r)
+{
+	if (r->carry_len)
+		scan(r, r->carry, r->carry_len, r->offset - r->carry_len, 1);
+	r->carry_len = 0;
+	free(r->carry);
+	r->carry = NULL;
+}
+
+
+// ************************************* typed records *************************************
+
+static unsigned long get_u16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static unsigned long get_u32(const unsigned char *p)
+{
+	return (unsigned long)p[0] | ((unsigned long)p[1] << 8) | ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+static long get_i32(const unsigned char *p)
+{
+	return (long)(int)get_u32(p);
+}
+
+int ubx_get_nav_pvt(const ubx_msg *m, unsigned long *iTOW, ubx_pvt *p)
+{
+	const unsigned char *d = m->payload;
+
+	if ((m->cls != UBX_CLASS_NAV) || (m->id != UBX_ID_NAV_PVT) || (m->len != UBX_NAV_PVT_PAYLOAD))
+		return 0;
+
+	*iTOW = get_u32(d);
+	p->year = get_u16(d + 4);
+	p->month = d[6];
+	p->day = d[7];
+	p->hour = d[8];
+	p->min = d[9];
+	p->sec = d[10] + get_i32(d + 16) / 1e9;
+	p->valid = d[11];
+	p->fixType = d[20];
+	p->fixOK = d[21] & 0x01;
+	p->numSV = d[23];
+	p->lon = get_i32(d + 24) / 1e7;
+	p->lat = get_i32(d + 28) / 1e7;
+	p->height = get_i32(d + 32) / 1000.0;
+	p->hMSL = get_i32(d + 36) / 1000.0;
+	p->hAcc = get_u32(d + 40) / 1000.0;
+	p->vAcc = get_u32(d + 44) / 1000.0;
+	p->velN = get_i32(d + 48) / 1000.0;
+	p->velE = get_i32(d + 52) / 1000.0;
+	p->velD = get_i32(d + 56) / 1000.0;
+	p->gSpeed = get_i32(d + 60) / 1000.0;
+	p->headMot = get_i32(d + 64) / 1e5;
+	p->sAcc = get_u32(d + 68) / 1000.0;
+	p->headAcc = get_u32(d + 72) / 1e5;
+	p->pDOP = get_u16(d + 76) / 100.0;
+	return 1;
+}
+
+int ubx_get_nav_posllh(const ubx_msg *m, ubx_posllh *p)
+{
+	const unsigned char *d = m->payload;
+
+	if ((m->cls != UBX_CLASS_NAV) || (m->id != 0x02) || (m->len != 28))
+		return 0;
+
+	p->iTOW = get_u32(d);
+	p->lon = get_i32(d + 4) / 1e7;
+	p->lat = get_i32(d + 8) / 1e7;
+	p->height = get_i32(d + 12) / 1000.0;
+	p->hMSL = get_i32(d + 16) / 1000.0;
+	p->hAcc = get_u32(d + 20) / 1000.0;
+	p->vAcc = get_u32(d + 24) / 1000.0;
+	return 1;
+}
+
+static const struct
+{
+	int cls, id;
+	const char *name;
+} names[] =
+{
+	{0x01, 0x01, "NAV-POSECEF"}, {0x01, 0x02, "NAV-POSLLH"}, {0x01, 0x03, "NAV-STATUS"},
+	{0x01, 0x04, "NAV-DOP"}, {0x01, 0x07, "NAV-PVT"}, {0x01, 0x12, "NAV-VELNED"},
+	{0x01, 0x20, "NAV-TIMEGPS"}, {0x01, 0x21, "NAV-TIMEUTC"}, {0x01, 0x35, "NAV-SAT"},
+	{0x02, 0x15, "RXM-RAWX"}, {0x02, 0x13, "RXM-SFRBX"},
+	{0x05, 0x00, "ACK-NAK"}, {0x05, 0x01, "ACK-ACK"},
+	{0x06, 0x00, "CFG-PRT"}, {0x06, 0x01, "CFG-MSG"}, {0x06, 0x08, "CFG-RATE"}, {0x06, 0x24, "CFG-NAV5"},
+	{0x0A, 0x04, "MON-VER"}, {0x0A, 0x09, "MON-HW"},
+	{0x0D, 0x01, "TIM-TP"},
+};
+
+const char *ubx_name(int cls, int id)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+		if ((names[i].cls == cls) && (names[i].id == id))
+			return names[i].name;
+	return NULL;
+}
@@ -0,0 +1,60 @@
+// ubxread.h - streaming UBX frame reader
+//
+// feed it bytes in whatever sized pieces they arrive (or a whole memory mapped capture at once) and
+// it calls back with every frame whose checksum is good. Anything else in the stream - NMEA mixed in
+// with the UBX, corrupted or cut off frames - is skipped: after a bad frame it carries on looking for
+// the next sync word from the byte after the bad one, so it resynchronises straight away.
+//
+// sync words are found 16 (SSE2, NEON) or 32 (AVX2) bytes at a time. Frames are handed over where they
+// lie in the caller's buffer - only a frame split between two feeds is copied.
+
+#ifndef UBXREAD_H
+#define UBXREAD_H
+
+#include "ubx.h"
+
+#define UBX_MAX_PAYLOAD 8192	// default longest payload believed - a longer length is taken as corruption
+
+typedef struct ubx_msg
+{
+	int cls, id;
+	int len;						// payload length
+	const unsigned char *payload;
+	unsigned long long offset;		// of the sync word, from the start of the stream
+} ubx_msg;
+
+typedef void (*ubx_msg_fn)(const ubx_msg *m, void *user);
+
+typedef struct ubx_reader
+{
+	ubx_msg_fn fn;
+	void *user;
+	int max_payload;
+	unsigned char *carry;			// the start of a frame cut off at the end of the last feed
+	size_t carry_len;
+	unsigned long long offset;		// stream offset of the next byte fed
+	unsigned long long frames;		// good frames
+	unsigned long long bad;			// sync word found but bad checksum or length
+	unsigned long long skipped;		// bytes not in a good frame
+} ubx_reader;
+
+void ubx_reader_init(ubx_reader *r, ubx_msg_fn fn, void *user);
+void ubx_reader_feed(ubx_reader *r, const unsigned char *data, size_t len);
+void ubx_reader_end(ubx_reader *r);			// end of the stream - a part frame left over is counted as skipped
+
+// typed records - return 0 if the message is not that type (or the wrong length)
+int ubx_get_nav_pvt(const ubx_msg *m, unsigned long *iTOW, ubx_pvt *p);
+
+typedef struct ubx_posllh
+{
+	unsigned long iTOW;				// ms
+	double lon, lat;				// degrees
+	double height, hMSL;			// metres
+	double hAcc, vAcc;				// metres
+} ubx_posllh;
+
+int ubx_get_nav_posllh(const ubx_msg *m, ubx_posllh *p);
+
+const char *ubx_name(int cls, int id);		// e.g. "NAV-PVT" (NULL if not known)
+
+#endif
@@ -0,0 +1,139 @@
+// vclock.c - real, scaled and virtual clocks
+//
+// see vclock.h for the usage
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include "vclock.h"
+
+static int mode = VCLOCK_REAL;
+static double scale = 1.0;
+static int started = 0;
+static unsigned long long t0;			// real monotonic time of the first call
+static unsigned long long virtual_now;
+static time_t epoch0 = 0;				// vclock_time() at t0
+static int epoch_set = 0;
+
+static unsigned long long real_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void start(void)
+{
+	if (started)
+		return;
+	started = 1;
+	t0 = virtual_now = real_now();
+	if (!epoch_set)
+		epoch0 = time(NULL);
+}
+
+int vclock_set(const char *spec)
+{
+	double f;
+	char *end;
+
+	if (strcmp(spec, "real") == 0)
+		mode = VCLOCK_REAL;
+	else if (strcmp(spec, "virtual") == 0)
+		mode = VCLOCK_VIRTUAL;
+	else
+	{
+		f = strtod(spec, &end);
+		if ((end == spec) || *end || (f <= 0))
+			return 0;
+		mode = f == 1.0 ? VCLOCK_REAL : VCLOCK_SCALED;
+		scale = f;
+	}
+	return 1;
+}
+
+int vclock_start(const char *when)
+{
+	struct tm tm;
+	long long secs;
+	char *end;
+
+	memset(&tm, 0, sizeof(tm));
+	if (sscanf(when, "%d-%d-%d%*1[T ]%d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) >= 3)
+	{
+		tm.tm_year -= 1900;
+		tm.tm_mon -= 1;
+		epoch0 = timegm(&tm);
+	}
+	else
+	{
+		secs = strtoll(when, &end, 10);
+		if ((end == when) || *end)
+			return 0;
+		epoch0 = (time_t)secs;
+	}
+	epoch_set = 1;
+	return 1;
+}
+
+int vclock_mode(void)
+{
+	return mode;
+}
+
+unsigned long long vclock_now(void)
+{
+	start();
+	switch (mode)
+	{
+	case VCLOCK_SCALED:
+		return t0 + (unsigned long long)((real_now() - t0) * scale);
+	case VCLOCK_VIRTUAL:
+		return virtual_now;
+	default:
+		return real_now();
+	}
+}
+
+unsigned long long vclock_real_ns(unsigned long long ns)
+{
+	switch (mode)
+	{
+	case VCLOCK_SCALED:
+		return (unsigned long long)(ns / scale);
+	case VCLOCK_VIRTUAL:
+		return 0;
+	default:
+		return ns;
+	}
+}
+
+void vclock_sleep_until(unsigned long long ns)
+{
+	struct timespec ts;
+
+	start();
+	if (mode == VCLOCK_VIRTUAL)
+	{
+		if (ns > virtual_now)
+			virtual_now = ns;
+		return;
+	}
+	if (mode == VCLOCK_SCALED)
+		ns = ns > t0 ? t0 + (unsigned long long)((ns - t0) / scale) : t0;	// when the real clock gets there
+
+	ts.tv_sec = ns / 1000000000ull;
+	ts.tv_nsec = ns % 1000000000ull;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+time_t vclock_time(void)
+{
+	unsigned long long now = vclock_now();
+
+	return epoch0 + (time_t)((now - t0) / 1000000000ull);
+}
@@ -0,0 +1,38 @@
+// vclock.h - the clock the generators and emulators run to
+//
+//	real		CLOCK_MONOTONIC - the default
+//	scaled		real time sped up (or slowed down) by a factor - "60" runs an hour's flight in a minute
+//	virtual		no waiting at all - sleeping just moves the clock on to when the sleep would have ended
+//
+// with a virtual clock and a fixed start (vclock_start) a run does exactly the same thing every time,
+// however loaded the machine is, so its output can be compared byte for byte - and a 3 hour flight
+// takes as long as the CPU needs.
+//
+// typical use
+//	vclock_set("virtual");
+//	vclock_start("2016-08-17T10:00:00");
+//	Now = vclock_time();
+//	next = vclock_now();
+//	for each epoch
+//		next += 1000000000ull;
+//		vclock_sleep_until(next);
+
+#ifndef VCLOCK_H
+#define VCLOCK_H
+
+#include <time.h>
+
+#define VCLOCK_REAL		0
+#define VCLOCK_SCALED	1
+#define VCLOCK_VIRTUAL	2
+
+int vclock_set(const char *spec);				// "real", "virtual" or a speed factor - 0 if not understood
+int vclock_start(const char *when);				// yyyy-mm-ddThh:mm:ss UTC or seconds since 1970 - 0 if not understood
+int vclock_mode(void);
+
+unsigned long long vclock_now(void);			// ns on this clock (same origin as CLOCK_MONOTONIC at the first call)
+void vclock_sleep_until(unsigned long long ns);
+unsigned long long vclock_real_ns(unsigned long long ns);	// real time that ns on this clock take (0 when virtual)
+time_t vclock_time(void);						// seconds since 1970 on this clock - from vclock_start() or the time at the first call
+
+#endif
@@ -0,0 +1,756 @@
+// zio.c - gzip / zstd / tar / KMZ behind plain file descriptors
+//
+// see zio.h for the usage
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "zio.h"
+
+#define ZIO_PIPE	(1 << 20)	// pipe between the caller and the thread
+#define ZIO_BLOCK	65536
+#define ZIO_MAX		16			// files being compressed at once
+
+#define Z_PLAIN		0
+#define Z_GZIP		1
+#define Z_ZSTD		2
+#define Z_KMZ		3
+#define Z_ZIP		4			// reading a .kmz (or any zip) - always Z_KMZ when writing
+
+#define KMZ_NAME	"doc.kml"
+
+typedef struct zjob
+{
+	int used;
+	int user_fd;				// the caller's end of the pipe
+	int src, dst;				// the thread reads src and writes dst
+	int kind;
+	int result;					// 0 or -1 once the thread has finished
+	pthread_t tid;
+	// reading - tar is picked apart as it goes by
+	int tar;					// -1 not known yet, 0 no, 1 yes
+	int regular;				// src is a file, not a pipe or terminal
+	unsigned char hdr[512];
+	int hdr_len;
+	unsigned long long remaining, skip;
+	int pass;
+	unsigned char *zip;			// a zip is read whole - the sizes are at the end
+	size_t zip_len, zip_size;
+} zjob;
+
+static zjob writers[ZIO_MAX];
+static pthread_mutex_t writers_lock = PTHREAD_MUTEX_INITIALIZER;
+static int finish_registered = 0;
+
+
+static int write_all(int fd, const void *data, size_t len)
+{
+	const char *p = data;
+	ssize_t n;
+
+	while (len > 0)
+	{
+		if ((n = write(fd, p, len)) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int kind_of(const unsigned char *b, size_t len)
+{
+	if ((len >= 2) && (b[0] == 0x1F) && (b[1] == 0x8B))
+		return Z_GZIP;
+	if ((len >= 4) && (b[0] == 0x28) && (b[1] == 0xB5) && (b[2] == 0x2F) && (b[3] == 0xFD))
+		return Z_ZSTD;
+	if ((len >= 4) && (b[0] == 'P') && (b[1] == 'K') && (b[2] == 3) && (b[3] == 4))
+		return Z_ZIP;
+	return Z_PLAIN;
+}
+
+static int is_tar(const unsigned char *b, size_t len)
+{
+	return (len >= 262) && (memcmp(b + 257, "ustar", 5) == 0);
+}
+
+static void block_sigpipe(void)
+{
+	sigset_t set;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);		// a reader that goes away gives EPIPE, not death
+}
+
+static void big_pipe(int fd)
+{
+	fcntl(fd, F_SETPIPE_SZ, ZIO_PIPE);
+}
+
+// ************************************* reading *************************************
+
+// the members of a tar archive, one after another
+static int tar_out(zjob *j, const unsigned char *data, size_t len)
+{
+	size_t n;
+
+	while (len > 0)
+	{
+		if (j->remaining)
+		{
+			n = len < j->remaining ? len : j->remaining;
+			if (j->pass && (write_all(j->dst, data, n) < 0))
+				return -1;
+			j->remaining -= n;
+		}
+		else if (j->skip)
+		{ // padding to the next 512 byte block
+			n = len < j->skip ? len : j->skip;
+			j->skip -= n;
+		}
+		else
+		{
+			n = len < (size_t)(512 - j->hdr_len) ? len : (size_t)(512 - j->hdr_len);
+			memcpy(j->hdr + j->hdr_len, data, n);
+			if ((j->hdr_len += n) == 512)
+			{
+				j->hdr_len = 0;
+				if (j->hdr[0])
+				{ // a header (an empty block is the end)
+					j->remaining = strtoull((char *)j->hdr + 124, NULL, 8);
+					j->skip = (512 - j->remaining % 512) % 512;
+					j->pass = (j->hdr[156] == '0') || (j->hdr[156] == 0);	// only regular files
+				}
+			}
+		}
+		data += n;
+		len -= n;
+	}
+	return 0;
+}
+
+// decompressed bytes - straight to the caller, or through tar_out() if they turn out to be a tar
+static int out(zjob *j, const unsigned char *data, size_t len)
+{
+	unsigned char first[512];
+	size_t n;
+
+	if (j->tar < 0)
+	{ // hold back the first block to see
+		n = len < (size_t)(512 - j->hdr_len) ? len : (size_t)(512 - j->hdr_len);
+		memcpy(j->hdr + j->hdr_len, data, n);
+		j->hdr_len += n;
+		data += n;
+		len -= n;
+		if (j->hdr_len < 512)
+			return 0;
+		j->hdr_len = 0;
+		memcpy(first, j->hdr, 512);
+		if ((j->tar = is_tar(first, 512)))
+		{
+			if (tar_out(j, first, 512) < 0)
+				return -1;
+		}
+		else if (write_all(j->dst, first, 512) < 0)
+			return -1;
+	}
+	if (len == 0)
+		return 0;
+	return j->tar ? tar_out(j, data, len) : write_all(j->dst, data, len);
+}
+
+static unsigned int get16(const unsigned char *b)
+{
+	return b[0] | (b[1] << 8);
+}
+
+static unsigned long get32(const unsigned char *b)
+{
+	return get16(b) | ((unsigned long)get16(b + 2) << 16);
+}
+
+// every file in a zip, one after another - a KMZ's doc.kml, or a zipped log
+static int unzip(zjob *j, const unsigned char *z, size_t len)
+{
+	unsigned char buf[ZIO_BLOCK];
+	size_t at = 0, csize, name_len;
+	int flags, method, zr, r = 0, dir;
+	z_stream zs;
+
+	while ((r == 0) && (at + 30 <= len) && (get32(z + at) == 0x04034B50))
+	{
+		flags = get16(z + at + 6);
+		method = get16(z + at + 8);
+		csize = get32(z + at + 18);
+		name_len = get16(z + at + 26);
+		dir = (name_len > 0) && (at + 30 + name_len <= len) && (z[at + 30 + name_len - 1] == '/');
+		at += 30 + name_len + get16(z + at + 28);
+		if (at > len)
+			break;
+
+		if ((method == 0) && !(flags & 8))
+		{ // stored
+			if (csize > len - at)
+				csize = len - at;
+			if (!dir)
+				r = out(j, z + at, csize);
+			at += csize;
+		}
+		else if (method == Z_DEFLATED)
+		{
+			memset(&zs, 0, sizeof(zs));
+			inflateInit2(&zs, -15);
+			zs.next_in = (unsigned char *)z + at;
+			zs.avail_in = len - at;
+			do
+			{
+				zs.next_out = buf;
+				zs.avail_out = sizeof(buf);
+				zr = inflate(&zs, Z_NO_FLUSH);
+				if ((zr != Z_OK) && (zr != Z_STREAM_END))
+				{
+					fprintf(stderr,"Corrupt zip input: %s\n", zs.msg ? zs.msg : "truncated");
+					r = -1;
+				}
+				else if (!dir)
+					r = out(j, buf, sizeof(buf) - zs.avail_out);
+			}
+			while ((r == 0) && (zr != Z_STREAM_END));
+			at = zs.next_in - z;
+			inflateEnd(&zs);
+			if (flags & 8) // data descriptor, with or without its signature
+				at += (at + 4 <= len) && (get32(z + at) == 0x08074B50) ? 16 : 12;
+		}
+		else
+		{
+			fprintf(stderr,"Zip compression method %d not supported\n", method);
+			r = -1;
+		}
+	}
+	return r;
+}
+
+static void *inflater(void *arg)
+{
+	zjob *j = arg;
+	unsigned char in[ZIO_BLOCK], buf[ZIO_BLOCK];
+	ssize_t n;
+	z_stream zs;
+	int r = 0, started = 0, zr;
+#ifdef HAVE_ZSTD
+	ZSTD_DStream *ds = NULL;
+	ZSTD_inBuffer zin;
+	ZSTD_outBuffer zout;
+#endif
+
+	block_sigpipe();
+	memset(&zs, 0, sizeof(zs));
+
+	while ((r == 0) && ((n = read(j->src, in, sizeof(in))) != 0))
+	{
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			r = -1;
+			break;
+		}
+		if (!started)
+		{
+			started = 1;
+			j->kind = kind_of(in, n);
+			if ((j->kind == Z_PLAIN) && !j->regular)
+				j->tar = 0;		// a live stream - passed on as it comes, not held back a block to look for a tar
+			if (j->kind == Z_GZIP)
+				inflateInit2(&zs, 15 + 32);			// gzip or zlib header
+#ifdef HAVE_ZSTD
+			else if (j->kind == Z_ZSTD)
+				ds = ZSTD_createDStream();
+#else
+			else if (j->kind == Z_ZSTD)
+			{
+				fprintf(stderr,"zstd input but built without HAVE_ZSTD\n");
+				r = -1;
+				break;
+			}
+#endif
+		}
+
+		switch (j->kind)
+		{
+		case Z_GZIP:
+			zs.next_in = in;
+			zs.avail_in = n;
+			while ((r == 0) && (zs.avail_in > 0))
+			{
+				zs.next_out = buf;
+				zs.avail_out = sizeof(buf);
+				zr = inflate(&zs, Z_NO_FLUSH);
+				if ((zr != Z_OK) && (zr != Z_STREAM_END) && (zr != Z_BUF_ERROR))
+				{
+					fprintf(stderr,"Corrupt compressed input: %s\n", zs.msg ? zs.msg : "?");
+					r = -1;
+					break;
+				}
+				r = out(j, buf, sizeof(buf) - zs.avail_out);
+				if (zr == Z_STREAM_END)
+					inflateReset(&zs);				// another member may follow
+				else if ((zr == Z_BUF_ERROR) && (zs.avail_out == sizeof(buf)))
+					break;
+			}
+			break;
+#ifdef HAVE_ZSTD
+		case Z_ZSTD:
+			zin.src = in;
+			zin.size = n;
+			zin.pos = 0;
+			while ((r == 0) && (zin.pos < zin.size))
+			{
+				zout.dst = buf;
+				zout.size = sizeof(buf);
+				zout.pos = 0;
+				if (ZSTD_isError(ZSTD_decompressStream(ds, &zout, &zin)))
+				{
+					fprintf(stderr,"Corrupt zstd input\n");
+					r = -1;
+					break;
+				}
+				r = out(j, buf, zout.pos);
+			}
+			break;
+#endif
+		case Z_ZIP:
+			if (j->zip_len + n > j->zip_size)
+			{
+				j->zip_size = (j->zip_len + n) * 2;
+				j->zip = realloc(j->zip, j->zip_size);
+			}
+			memcpy(j->zip + j->zip_len, in, n);
+			j->zip_len += n;
+			break;
+		default:
+			r = out(j, in, n);
+			break;
+		}
+	}
+
+	if ((r == 0) && (j->kind == Z_ZIP))
+		r = unzip(j, j->zip, j->zip_len);
+	free(j->zip);
+
+	if ((r == 0) && (j->tar < 0) && j->hdr_len)
+		r = write_all(j->dst, j->hdr, j->hdr_len);	// less than a block - can't be a tar
+
+	if (j->kind == Z_GZIP)
+		inflateEnd(&zs);
+#ifdef HAVE_ZSTD
+	if (ds)
+		ZSTD_freeDStream(ds);
+#endif
+	close(j->src);
+	close(j->dst);
+	free(j);
+	return NULL;
+}
+
+int zio_open(const char *path)
+{
+	unsigned char probe[512];
+	struct stat st;
+	ssize_t n;
+	off_t at;
+	int fd, p[2], regular;
+	zjob *j;
+	pthread_t tid;
+
+	if (path && strcmp(path, "-"))
+	{
+		if ((fd = open(path, O_RDONLY)) < 0)
+			return -1;
+	}
+	else
+		fd = 0;
+
+	if ((regular = (fstat(fd, &st) == 0) && S_ISREG(st.st_mode)))
+	{ // look without reading so a plain file is left as it is
+		at = lseek(fd, 0, SEEK_CUR);
+		n = pread(fd, probe, sizeof(probe), at < 0 ? 0 : at);
+		if ((n >= 0) && (kind_of(probe, n) == Z_PLAIN) && !is_tar(probe, n))
+			return fd;
+	}
+
+	if (pipe(p) < 0)
+		return -1;
+	big_pipe(p[1]);
+	j = calloc(1, sizeof(zjob));
+	j->src = fd;
+	j->dst = p[1];
+	j->tar = -1;
+	j->regular = regular;
+	j->user_fd = p[0];
+	if (pthread_create(&tid, NULL, inflater, j) != 0)
+	{
+		close(p[0]);
+		close(p[1]);
+		free(j);
+		return -1;
+	}
+	pthread_detach(tid);		// it finishes when the input does, or when the reader closes its end
+	return p[0];
+}
+
+int zio_stdin(const char *path)
+{
+	int fd = zio_open(path);
+
+	if (fd < 0)
+		return 0;
+	if (fd != 0)
+	{
+		dup2(fd, 0);
+		close(fd);
+	}
+	return 1;
+}
+
+// ************************************* writing *************************************
+
+static void put16(unsigned char *b, unsigned int v)
+{
+	b[0] = v;
+	b[1] = v >> 8;
+}
+
+static void put32(unsigned char *b, unsigned long v)
+{
+	put16(b, v & 0xFFFF);
+	put16(b + 2, (v >> 16) & 0xFFFF);
+}
+
+// zip local header for doc.kml - crc and sizes follow the data (flag 8) as they aren't known yet
+// no timestamp (1980-01-01) so the same KML always gives the same KMZ
+static int kmz_header(int fd)
+{
+	unsigned char h[30 + sizeof(KMZ_NAME) - 1];
+
+	memset(h, 0, sizeof(h));
+	put32(h, 0x04034B50);
+	put16(h + 4, 20);
+	put16(h + 6, 8);
+	put16(h + 8, Z_DEFLATED);
+	put16(h + 12, 0x21);
+	put16(h + 26, sizeof(KMZ_NAME) - 1);
+	memcpy(h + 30, KMZ_NAME, sizeof(KMZ_NAME) - 1);
+	return write_all(fd, h, sizeof(h));
+}
+
+static int kmz_trailer(int fd, unsigned long crc, unsigned long csize, unsigned long usize)
+{
+	unsigned char d[16], c[46 + sizeof(KMZ_NAME) - 1], e[22];
+	unsigned long cd_at = 30 + sizeof(KMZ_NAME) - 1 + csize + sizeof(d);
+
+	put32(d, 0x08074B50);		// data descriptor
+	put32(d + 4, crc);
+	put32(d + 8, csize);
+	put32(d + 12, usize);
+
+	memset(c, 0, sizeof(c));	// central directory
+	put32(c, 0x02014B50);
+	put16(c + 4, 20);
+	put16(c + 6, 20);
+	put16(c + 8, 8);
+	put16(c + 10, Z_DEFLATED);
+	put16(c + 14, 0x21);
+	put32(c + 16, crc);
+	put32(c + 20, csize);
+	put32(c + 24, usize);
+	put16(c + 28, sizeof(KMZ_NAME) - 1);
+	memcpy(c + 46, KMZ_NAME, sizeof(KMZ_NAME) - 1);
+
+	memset(e, 0, sizeof(e));	// end of central directory
+	put32(e, 0x06054B50);
+	put16(e + 8, 1);
+	put16(e + 10, 1);
+	put32(e + 12, sizeof(c));
+	put32(e + 16, cd_at);
+
+	if ((write_all(fd, d, sizeof(d)) < 0) || (write_all(fd, c, sizeof(c)) < 0))
+		return -1;
+	return write_all(fd, e, sizeof(e));
+}
+
+static void *deflater(void *arg)
+{
+	zjob *j = arg;
+	unsigned char in[ZIO_BLOCK], buf[ZIO_BLOCK];
+	ssize_t n;
+	z_stream zs;
+	unsigned long crc = crc32(0, NULL, 0), csize = 0, usize = 0;
+	int r = 0, zr, flush;
+#ifdef HAVE_ZSTD
+	ZSTD_CCtx *cs = NULL;
+	ZSTD_inBuffer zin;
+	ZSTD_outBuffer zout;
+	size_t left;
+#endif
+
+	block_sigpipe();
+	memset(&zs, 0, sizeof(zs));
+	if (j->kind == Z_GZIP)
+		deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+	else if (j->kind == Z_KMZ)
+	{
+		deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);	// raw, as zip wants
+		r = kmz_header(j->dst);
+	}
+#ifdef HAVE_ZSTD
+	else
+		cs = ZSTD_createCCtx();
+#endif
+
+	do
+	{
+		while (((n = read(j->src, in, sizeof(in))) < 0) && (errno == EINTR))
+			;
+		if (n < 0)
+			n = 0;
+		if (r)
+			continue;		// keep draining so the writer never blocks, but the file is lost
+
+#ifdef HAVE_ZSTD
+		if (j->kind == Z_ZSTD)
+		{
+			zin.src = in;
+			zin.size = n;
+			zin.pos = 0;
+			do
+			{
+				zout.dst = buf;
+				zout.size = sizeof(buf);
+				zout.pos = 0;
+				left = ZSTD_compressStream2(cs, &zout, &zin, n ? ZSTD_e_continue : ZSTD_e_end);
+				if (ZSTD_isError(left))
+					r = -1;
+				else
+					r = write_all(j->dst, buf, zout.pos);
+			}
+			while ((r == 0) && (n ? (zin.pos < zin.size) : (left != 0)));
+			continue;
+		}
+#endif
+		if (j->kind == Z_KMZ)
+		{
+			crc = crc32(crc, in, n);
+			usize += n;
+		}
+		zs.next_in = in;
+		zs.avail_in = n;
+		flush = n ? Z_NO_FLUSH : Z_FINISH;
+		do
+		{
+			zs.next_out = buf;
+			zs.avail_out = sizeof(buf);
+			zr = deflate(&zs, flush);
+			if (zr == Z_STREAM_ERROR)
+				r = -1;
+			else
+			{
+				csize += sizeof(buf) - zs.avail_out;
+				r = write_all(j->dst, buf, sizeof(buf) - zs.avail_out);
+			}
+		}
+		while ((r == 0) && (zs.avail_out == 0));
+	}
+	while (n > 0);
+
+	if ((r == 0) && (j->kind == Z_KMZ))
+		r = kmz_trailer(j->dst, crc, csize, usize);
+
+	if ((j->kind == Z_GZIP) || (j->kind == Z_KMZ))
+		deflateEnd(&zs);
+#ifdef HAVE_ZSTD
+	if (cs)
+		ZSTD_freeCCtx(cs);
+#endif
+	close(j->src);
+	if (close(j->dst) < 0)
+		r = -1;
+	j->result = r;
+	return NULL;
+}
+
+// close every compressed output still open - at exit, after flushing stdio
+static void zio_finish(void)
+{
+	int i;
+
+	fflush(NULL);
+	for (i = 0; i < ZIO_MAX; i++)
+		if (writers[i].used)
+			zio_close(writers[i].user_fd);
+}
+
+static int create(const char *path, int flags)
+{
+	const char *ext = strrchr(path, '.');
+	int kind = Z_PLAIN, fd, p[2], i;
+	zjob *j = NULL;
+
+	if (ext && (strcmp(ext, ".gz") == 0))
+		kind = Z_GZIP;
+	else if (ext && (strcmp(ext, ".kmz") == 0))
+	{
+		kind = Z_KMZ;
+		flags = O_TRUNC;		// a zip can't be added to like this
+	}
+	else if (ext && (strcmp(ext, ".zst") == 0))
+	{
+#ifdef HAVE_ZSTD
+		kind = Z_ZSTD;
+#else
+		fprintf(stderr,"Can't write %s - built without HAVE_ZSTD\n", path);
+		errno = ENOTSUP;
+		return -1;
+#endif
+	}
+
+	if ((fd = open(path, O_WRONLY | O_CREAT | flags, 0644)) < 0)
+		return -1;
+	if (kind == Z_PLAIN)
+		return fd;
+
+	pthread_mutex_lock(&writers_lock);
+	for (i = 0; i < ZIO_MAX; i++)
+		if (!writers[i].used)
+		{
+			j = &writers[i];
+			memset(j, 0, sizeof(*j));
+			j->used = 1;
+			break;
+		}
+	if (!finish_registered)
+	{
+		atexit(zio_finish);
+		finish_registered = 1;
+	}
+	pthread_mutex_unlock(&writers_lock);
+
+	if ((j == NULL) || (pipe(p) < 0))
+	{
+		if (j)
+			j->used = 0;
+		close(fd);
+		errno = EMFILE;
+		return -1;
+	}
+	big_pipe(p[1]);
+	j->kind = kind;
+	j->src = p[0];
+	j->dst = fd;
+	j->user_fd = p[1];
+	if (pthread_create(&j->tid, NULL, deflater, j) != 0)
+	{
+		close(p[0]);
+		close(p[1]);
+		close(fd);
+		j->used = 0;
+		return -1;
+	}
+	return p[1];
+}
+
+int zio_create(const char *path)
+{
+	return create(path, O_TRUNC);
+}
+
+int zio_append(const char *path)
+{
+	return create(path, O_APPEND);
+}
+
+int zio_close(int fd)
+{
+	int i, r = close(fd);
+
+	for (i = 0; i < ZIO_MAX; i++)
+		if (writers[i].used && (writers[i].user_fd == fd))
+		{
+			pthread_join(writers[i].tid, NULL);
+			if (writers[i].result < 0)
+				r = -1;
+			writers[i].used = 0;
+			break;
+		}
+	return r;
+}
+
+int zio_stdout(const char *path)
+{
+	int fd = zio_create(path), i;
+
+	if (fd < 0)
+		return 0;
+	fflush(stdout);
+	dup2(fd, 1);
+	close(fd);
+	for (i = 0; i < ZIO_MAX; i++)
+		if (writers[i].used && (writers[i].user_fd == fd))
+			writers[i].user_fd = 1;			// closed by zio_finish() at exit
+	return 1;
+}
+
+FILE *zio_fopen(const char *path, const char *mode)
+{
+	int fd;
+	FILE *fp;
+
+	if (mode[0] == 'r')
+		fd = zio_open(path);
+	else if (mode[0] == 'a')
+		fd = zio_append(path);
+	else
+		fd = zio_create(path);
+	if (fd < 0)
+		return NULL;
+	if ((fp = fdopen(fd, mode[0] == 'r' ? "r" : "w")) == NULL)
+		zio_close(fd);
+	return fp;
+}
+
+int zio_fclose(FILE *fp)
+{
+	int fd = fileno(fp), i, r = 0;
+
+	if (fflush(fp))
+		r = -1;
+	for (i = 0; i < ZIO_MAX; i++)
+		if (writers[i].used && (writers[i].user_fd == fd))
+			break;
+	if (i == ZIO_MAX)
+		return fclose(fp) | r;
+
+	// the stream owns the descriptor - let fclose() close it, then wait for the compressor
+	fclose(fp);
+	pthread_join(writers[i].tid, NULL);
+	if (writers[i].result < 0)
+		r = -1;
+	writers[i].used = 0;
+	return r;
+}
@@ -0,0 +1,38 @@
+// zio.h - transparent compressed input and output
+//
+// reading, the format is worked out from the first bytes - gzip, zstd (if built with HAVE_ZSTD), a zip
+// such as a .kmz, a tar archive (plain or compressed - e.g. postdata/telemetry.tgz) or anything else as is.
+// The files in a zip or tar are read one after another. Writing, it is chosen by the name
+//	.gz		gzip
+//	.zst	zstd (HAVE_ZSTD)
+//	.kmz	a zip holding the KML as doc.kml, which is what Google Earth expects
+//	other	as is
+//
+// everything is a plain file descriptor to the caller. A file that needs no work is opened directly (so it
+// can still be memory mapped and seeked); otherwise the caller gets one end of a pipe and a thread at the
+// other end does the inflating or deflating - parsing never waits on zlib, and zlib never waits on parsing
+// until the pipe (1MB) is full.
+//
+// zio_close() must be used on what zio_create() gave (it waits for the compressor to write the last of it).
+// zio_stdin() and zio_stdout() swap standard input / output for a file, so a filter that uses scanf() and
+// printf() gains compression without changing; standard output is finished off at exit().
+//
+// build with -DHAVE_ZSTD and -lzstd for zstd
+
+#ifndef ZIO_H
+#define ZIO_H
+
+#include <stdio.h>
+
+int zio_open(const char *path);				// NULL or "-" for standard input - -1 if it can't be opened
+int zio_create(const char *path);			// truncates - -1 if it can't be created
+int zio_append(const char *path);			// as zio_create, but adds to the end (a .gz gets another member)
+int zio_close(int fd);						// 0, or -1 if the file couldn't be written
+
+int zio_stdin(const char *path);			// 0 if it can't be opened
+int zio_stdout(const char *path);			// 0 if it can't be created
+
+FILE *zio_fopen(const char *path, const char *mode);	// "r", "w" or "a"
+int zio_fclose(FILE *fp);
+
+#endif
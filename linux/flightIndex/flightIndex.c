@@ -0,0 +1,152 @@
+// flightIndex.c - index an archive of flight logs and ask where / when questions of it
+//
+// logs are NMEA ($GPGGA / $GPRMC, e.g. from gpsGen) or UKHAS telemetry ($$CALLSIGN,... e.g. postdata's input).
+// Naming logs adds them to the index - ones already in it are only read again if they have changed, and
+// then only the new part if they have just grown, so it is fine to run this over the whole archive every
+// night. Any of -r, -b, -a or -t runs a query and prints the fixes that match as CSV.
+//
+// options
+//	-d dir					index directory (default flights.idx)
+//	-r lat,lon,km			fixes within km of lat,lon
+//	-b lat,lon,lat,lon		fixes in the box between the two corners
+//	-a min,max				and between min and max metres altitude
+//	-t from,to				and between these times - yyyy-mm-dd[Thh:mm[:ss]] UTC, or seconds since 1970
+//	-c						just count the matches
+//	-C						compact the index (merge its segments and drop stale records)
+//
+// e.g.	flightIndex -d flights.idx archive/*.txt
+//		flightIndex -d flights.idx -r 51.99,-2.55,20 -a 5000,15000 -t 2014-01-01,2015-01-01
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "findex.h"
+
+int count_only = 0;
+
+// yyyy-mm-dd[Thh:mm[:ss]] or seconds
+int parse_time(const char *s, long long *t)
+{
+	struct tm tm;
+	int n;
+
+	memset(&tm, 0, sizeof(tm));
+	n = sscanf(s, "%d-%d-%d%*1[T ]%d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+	if (n >= 3)
+	{
+		tm.tm_year -= 1900;
+		tm.tm_mon -= 1;
+		*t = timegm(&tm);
+		return 1;
+	}
+	return sscanf(s, "%lld", t) == 1;
+}
+
+int got_fix(const findex_rec *r, const char *path, void *user)
+{
+	time_t secs = r->t / 1000;
+	struct tm tm;
+
+	if (!count_only)
+	{
+		gmtime_r(&secs, &tm);
+		printf("%s,%04d-%02d-%02d %02d:%02d:%02d.%03d,%.5f,%.5f,", path, tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+			tm.tm_hour, tm.tm_min, tm.tm_sec, (int)(r->t % 1000), r->lat, r->lon);
+		if (isnan(r->alt))
+			printf("\n");
+		else
+			printf("%.0f\n", r->alt);
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	char *dir = "flights.idx", from[64], to[64];
+	int i, query = 0, compact = 0, bad = 0;
+	long n;
+	findex ix;
+	findex_query q;
+	struct timespec t0, t1;
+
+	findex_query_init(&q);
+
+	for (i = 1; i < argc; i++)
+	{
+		if (argv[i][0] != '-')
+			continue;			// a log - added once the index is open
+		if ((strcmp(argv[i],"-d") == 0) && (i + 1 < argc))
+			dir = argv[++i];
+		else if ((strcmp(argv[i],"-r") == 0) && (i + 1 < argc) &&
+				 (sscanf(argv[++i],"%lf,%lf,%lf", &q.lat, &q.lon, &q.radius) == 3) && (q.radius > 0))
+			query = 1;
+		else if ((strcmp(argv[i],"-b") == 0) && (i + 1 < argc) &&
+				 (sscanf(argv[++i],"%lf,%lf,%lf,%lf", &q.lat_min, &q.lon_min, &q.lat_max, &q.lon_max) == 4))
+		{
+			double d;
+
+			if (q.lat_min > q.lat_max)
+			{
+				d = q.lat_min; q.lat_min = q.lat_max; q.lat_max = d;
+			}
+			if (q.lon_min > q.lon_max)
+			{
+				d = q.lon_min; q.lon_min = q.lon_max; q.lon_max = d;
+			}
+			query = 1;
+		}
+		else if ((strcmp(argv[i],"-a") == 0) && (i + 1 < argc) &&
+				 (sscanf(argv[++i],"%lf,%lf", &q.alt_min, &q.alt_max) == 2))
+			query = 1;
+		else if ((strcmp(argv[i],"-t") == 0) && (i + 1 < argc) &&
+				 (sscanf(argv[++i],"%63[^,],%63s", from, to) == 2) && parse_time(from, &q.t_from) && parse_time(to, &q.t_to))
+			query = 1;
+		else if (strcmp(argv[i],"-c") == 0)
+			count_only = 1;
+		else if (strcmp(argv[i],"-C") == 0)
+			compact = 1;
+		else
+		{
+			fprintf(stderr,"Usage : %s [-d index dir] [-r lat,lon,km] [-b lat,lon,lat,lon] [-a min,max] [-t from,to] [-c] [-C] [log ...]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (findex_open(&ix, dir) < 0)
+		return 1;
+
+	// logs to add
+	for (i = 1; i < argc; i++)
+	{
+		if (argv[i][0] == '-')
+		{
+			if ((strcmp(argv[i],"-c") != 0) && (strcmp(argv[i],"-C") != 0))
+				i++;		// skip the option's value
+			continue;
+		}
+		if ((n = findex_add(&ix, argv[i])) < 0)
+			bad = 1;
+		else if (n > 0)
+			fprintf(stderr,"%s: %ld fixes\n", argv[i], n);
+	}
+	if (findex_commit(&ix) < 0)
+		return 1;
+	if (compact && (findex_compact(&ix) < 0))
+		return 1;
+
+	if (query)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		n = findex_search(&ix, &q, got_fix, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		fflush(stdout);
+		if (count_only)
+			printf("%ld\n", n);
+		fprintf(stderr,"%ld fixes in %.3f ms\n", n, (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+	}
+
+	findex_close(&ix);
+	return bad;
+}
@@ -0,0 +1,758 @@
+// flightStats.c - flight statistics for whole directories of logs in one go
+//
+// every file under the directories named (and any files named) that is an NMEA log ($GPGGA, or $GPRMC if it
+// has no $GPGGA) or UKHAS telemetry ($$CALLSIGN,...) is read, and for each flight in it (each payload's
+// callsign, for telemetry) the following are worked out
+//	burst		the highest altitude, and how long after the first fix it was reached
+//	range		the furthest the payload got from its first fix (the launch site)
+//	ground		the distance covered over the ground, fix to fix
+//	gaps		fixes more than -g seconds apart, and the longest
+//	speed		a histogram of the time spent at each ground speed (10 km/h bands)
+//	rates		ascent and descent rate against altitude (1 km bands) - from each pair of fixes climbing
+//				or falling, by the altitude half way between them
+// gaps aren't counted in the speeds or rates. Time carries on over midnight.
+//
+// the work is map-reduce over a work stealing thread pool (common/pool.c), as logConvert. Each file is memory
+// mapped and cut at line boundaries into pieces of about -s MB, and each piece summarised on its own - so one
+// huge log keeps every core as busy as thousands of small ones. When every piece of a file is done the
+// summaries are merged in order, the join between each pair of pieces being counted as it is merged. The
+// range needs the launch site, which pieces after the first don't know, so those that carry on a flight from
+// an earlier piece are read again (in parallel) for just that once the launch is known. A piece whose first
+// fix of a flight is no later than the earlier pieces' last (a log with lines repeated across the cut) is
+// summarised again from that fix, so it drops what one pass over the whole log would - whatever -s is.
+//
+// a line for each flight, in path order, then the whole archive's totals. -v adds each flight's speed
+// histogram and rate profile.
+//
+// options
+//	-g secs		a gap is fixes more than this apart (default 10, as gpsEmulate)
+//	-j threads	(default one per CPU)
+//	-s MB		piece size (default 8)
+//	-v			the histogram and profile for each flight too
+//
+// e.g.	flightStats archive/ ../postdata/icarus.txt
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "sentence.h"
+#include "pool.h"
+
+#define FMT_NMEA	1
+#define FMT_UKHAS	2
+
+#define MAX_LINE	512
+#define SPEED_BINS	30			// 10 km/h each - the last is anything faster
+#define SPEED_STEP	10.0
+#define ALT_BANDS	50			// 1 km each - the last is anything higher
+#define ALT_STEP	1000.0
+#define EARTH_KM	6371.0
+
+// degrees to radians
+#define RADIANS(x) ((x) / 57.295779513082320877)
+
+typedef struct point
+{
+	double tod;					// time of day (s)
+	double lat, lon, alt;
+} point;
+
+typedef struct stats			// one flight over a piece - or, merged, the whole log
+{
+	char callsign[32];			// "" for NMEA
+	long fixes;
+	point first, last;
+	double elapsed;				// first to last (s)
+	double burst_alt, burst_t;	// t from first
+	double range;				// km from first (the launch, once merged)
+	double ground;				// km
+	long gaps;
+	double longest_gap, longest_gap_t;
+	double speed[SPEED_BINS];	// seconds at each speed
+	double up_dz[ALT_BANDS], up_dt[ALT_BANDS];		// climbing
+	double down_dz[ALT_BANDS], down_dt[ALT_BANDS];	// falling
+} stats;
+
+struct job;
+
+typedef struct piece
+{
+	struct job *j;
+	size_t start, end;			// bytes of the file
+	stats *flights;
+	int nflights;
+	point *launch;				// second read - where flights[i] started, in an earlier piece
+	double *range;				// and how far from there it got in this one (-1 if the launch is here)
+	int redo;					// read again - flights[redo] carrying on from seed, the last fix before the piece
+	point seed;
+} piece;
+
+typedef struct job				// one file
+{
+	char *in;
+	int format;
+	int rmc;					// NMEA with no $GPGGA - take the positions from $GPRMC
+	unsigned char *map;
+	size_t size;
+	int npieces, left;			// pieces not yet done (in this round)
+	piece *pieces;
+	stats *flights;				// merged
+	int nflights;
+	pthread_mutex_t lock;
+} job;
+
+pool *workers;
+size_t piece_size = 8 << 20;
+double gap_secs = 10.0;
+int verbose = 0;
+
+// finished logs, printed in path order at the end
+pthread_mutex_t totals_lock = PTHREAD_MUTEX_INITIALIZER;
+job **done_jobs = NULL;
+long files = 0, skipped = 0;
+unsigned long long bytes_in = 0;
+
+
+// from a to b, a day on at midnight
+double tod_diff(double a, double b)
+{
+	double d = b - a;
+
+	if (d < -43200.0)
+		d += 86400.0;
+	return d;
+}
+
+double distance_km(const point *a, const point *b)
+{
+	double dlat = RADIANS(b->lat - a->lat), dlon = RADIANS(b->lon - a->lon);
+	double h = sin(dlat / 2) * sin(dlat / 2) + cos(RADIANS(a->lat)) * cos(RADIANS(b->lat)) * sin(dlon / 2) * sin(dlon / 2);
+
+	return 2.0 * EARTH_KM * asin(sqrt(h < 1.0 ? h : 1.0));
+}
+
+int band(double alt)
+{
+	int b = (int)(alt / ALT_STEP);
+
+	return b < 0 ? 0 : (b >= ALT_BANDS ? ALT_BANDS - 1 : b);
+}
+
+// from fix a to fix b, dt seconds later - at (from s's first fix) is when it ended
+void segment(stats *s, const point *a, const point *b, double dt, double at)
+{
+	double km = distance_km(a, b), dz = b->alt - a->alt;
+	int i;
+
+	s->ground += km;
+	if (dt > gap_secs)
+	{
+		s->gaps++;
+		if (dt > s->longest_gap)
+		{
+			s->longest_gap = dt;
+			s->longest_gap_t = at - dt;
+		}
+		return;
+	}
+	i = (int)(km / dt * 3600.0 / SPEED_STEP);
+	s->speed[i < SPEED_BINS ? i : SPEED_BINS - 1] += dt;
+	i = band((a->alt + b->alt) / 2);
+	if (dz > 0)
+	{
+		s->up_dz[i] += dz;
+		s->up_dt[i] += dt;
+	}
+	else if (dz < 0)
+	{
+		s->down_dz[i] -= dz;
+		s->down_dt[i] += dt;
+	}
+}
+
+void add_fix(stats *s, const point *p)
+{
+	double dt;
+
+	if (s->fixes++ == 0)
+	{
+		s->first = s->last = *p;
+		s->burst_alt = p->alt;
+		return;
+	}
+	if ((dt = tod_diff(s->last.tod, p->tod)) <= 0)
+	{ // the same epoch again (or out of order) - nothing to learn
+		s->fixes--;
+		return;
+	}
+	s->elapsed += dt;
+	segment(s, &s->last, p, dt, s->elapsed);
+	if (p->alt > s->burst_alt)
+	{
+		s->burst_alt = p->alt;
+		s->burst_t = s->elapsed;
+	}
+	dt = distance_km(&s->first, p);
+	if (dt > s->range)
+		s->range = dt;
+	s->last = *p;
+}
+
+// b follows on from a - a becomes both (b's range is from its own first fix, so isn't taken)
+void merge(stats *a, const stats *b)
+{
+	double dt, offset;
+	int i;
+
+	if (b->fixes == 0)
+		return;
+	if (a->fixes == 0)
+	{
+		*a = *b;
+		return;
+	}
+	dt = tod_diff(a->last.tod, b->first.tod);
+	offset = a->elapsed;
+	if (dt > 0)
+	{ // the join between them
+		offset += dt;
+		segment(a, &a->last, &b->first, dt, offset);
+	}
+	a->ground += b->ground;
+	a->gaps += b->gaps;
+	if (b->longest_gap > a->longest_gap)
+	{
+		a->longest_gap = b->longest_gap;
+		a->longest_gap_t = offset + b->longest_gap_t;
+	}
+	if (b->burst_alt > a->burst_alt)
+	{
+		a->burst_alt = b->burst_alt;
+		a->burst_t = offset + b->burst_t;
+	}
+	for (i = 0; i < SPEED_BINS; i++)
+		a->speed[i] += b->speed[i];
+	for (i = 0; i < ALT_BANDS; i++)
+	{
+		a->up_dz[i] += b->up_dz[i];
+		a->up_dt[i] += b->up_dt[i];
+		a->down_dz[i] += b->down_dz[i];
+		a->down_dt[i] += b->down_dt[i];
+	}
+	a->fixes += b->fixes;
+	a->elapsed = offset + b->elapsed;
+	a->last = b->last;
+}
+
+// the flight with this callsign (added if new)
+stats *flight(stats **list, int *n, const char *callsign)
+{
+	int i;
+
+	for (i = 0; i < *n; i++)
+		if (strcmp((*list)[i].callsign, callsign) == 0)
+			return &(*list)[i];
+	*list = realloc(*list, (*n + 1) * sizeof(stats));
+	memset(&(*list)[*n], 0, sizeof(stats));
+	snprintf((*list)[*n].callsign, sizeof((*list)[*n].callsign), "%s", callsign);
+	return &(*list)[(*n)++];
+}
+
+// each fix in the piece to fn
+void scan(piece *p, void (*fn)(piece *p, const char *callsign, const point *pt))
+{
+	job *j = p->j;
+	const char *s = (const char *)j->map + p->start, *end = (const char *)j->map + p->end, *nl;
+	char line[MAX_LINE];
+	size_t len;
+	sentence_fix fix;
+	point pt;
+	int type;
+
+	for (; s < end; s = nl + 1)
+	{
+		if ((nl = memchr(s, '\n', end - s)) == NULL)
+			nl = end;
+		if ((*s != '$') || ((j->format == FMT_NMEA) && ((end - s < 6) || memcmp(s + 3, j->rmc ? "RMC" : "GGA", 3))))
+			continue;	// not a fix we take - don't parse it
+		len = nl - s < MAX_LINE - 1 ? nl - s : MAX_LINE - 1;
+		memcpy(line, s, len);		// the map isn't NUL terminated
+		line[len] = 0;
+
+		type = parse_sentence(line, &fix);
+		if (!fix.have_pos)
+			continue;
+		if ((type == SENTENCE_GGA) || (type == SENTENCE_UKHAS) || ((type == SENTENCE_RMC) && j->rmc))
+		{
+			pt.tod = fix.tod;
+			pt.lat = fix.lat;
+			pt.lon = fix.lon;
+			pt.alt = fix.have_alt ? fix.alt : 0;
+			fn(p, type == SENTENCE_UKHAS ? fix.callsign : "", &pt);
+		}
+	}
+}
+
+void map_fix(piece *p, const char *callsign, const point *pt)
+{
+	add_fix(flight(&p->flights, &p->nflights, callsign), pt);
+}
+
+void redo_fix(piece *p, const char *callsign, const point *pt)
+{
+	stats *s = &p->flights[p->redo];
+
+	if (strcmp(s->callsign, callsign))
+		return;
+	if ((s->fixes == 0) && (tod_diff(p->seed.tod, pt->tod) <= 0))
+		return;		// not after the earlier pieces' last fix - one pass over the log would drop it too
+	add_fix(s, pt);
+}
+
+void range_fix(piece *p, const char *callsign, const point *pt)
+{
+	double km;
+	int i;
+
+	for (i = 0; (i < p->nflights) && strcmp(p->flights[i].callsign, callsign); i++)
+		;
+	if ((i == p->nflights) || (p->range[i] < 0))
+		return;
+	km = distance_km(&p->launch[i], pt);
+	if (km > p->range[i])
+		p->range[i] = km;
+}
+
+void job_free(job *j)
+{
+	int i;
+
+	munmap(j->map, j->size);
+	j->map = NULL;
+	pthread_mutex_destroy(&j->lock);
+	for (i = 0; i < j->npieces; i++)
+	{
+		free(j->pieces[i].flights);
+		free(j->pieces[i].launch);
+		free(j->pieces[i].range);
+	}
+	free(j->pieces);
+	j->pieces = NULL;
+}
+
+// every piece has been read again for the range - the log is done
+void job_done(job *j)
+{
+	int i, k;
+	stats *f;
+
+	for (i = 1; i < j->npieces; i++)
+		for (k = 0; k < j->pieces[i].nflights; k++)
+		{
+			f = flight(&j->flights, &j->nflights, j->pieces[i].flights[k].callsign);
+			if (j->pieces[i].range[k] > f->range)
+				f->range = j->pieces[i].range[k];
+		}
+
+	pthread_mutex_lock(&totals_lock);
+	done_jobs = realloc(done_jobs, (files + 1) * sizeof(job *));
+	done_jobs[files++] = j;
+	bytes_in += j->size;
+	pthread_mutex_unlock(&totals_lock);
+	job_free(j);
+}
+
+void range_piece_done(job *j)
+{
+	int last;
+
+	pthread_mutex_lock(&j->lock);
+	last = --j->left == 0;
+	pthread_mutex_unlock(&j->lock);
+	if (last)
+		job_done(j);
+}
+
+void range_piece(void *arg)
+{
+	piece *p = arg;
+
+	scan(p, range_fix);
+	range_piece_done(p->j);
+}
+
+// every piece is summarised - merge them in order, then find the range where the launch was in an earlier piece
+void reduce(job *j)
+{
+	piece *p;
+	stats *f;
+	int i, k, n, again;
+
+	for (i = 0; i < j->npieces; i++)
+	{
+		p = &j->pieces[i];
+		p->launch = malloc((p->nflights + 1) * sizeof(point));
+		p->range = malloc((p->nflights + 1) * sizeof(double));
+		for (k = 0; k < p->nflights; k++)
+		{
+			n = j->nflights;
+			f = flight(&j->flights, &j->nflights, p->flights[k].callsign);
+			p->range[k] = -1.0;
+			if (j->nflights == n)
+			{ // an earlier piece has the launch
+				p->launch[k] = f->first;
+				p->range[k] = 0.0;
+				if (f->fixes && p->flights[k].fixes && (tod_diff(f->last.tod, p->flights[k].first.tod) <= 0))
+				{ // the piece starts with fixes the earlier ones already had - summarise it again from their last
+					memset(&p->flights[k], 0, sizeof(stats));
+					snprintf(p->flights[k].callsign, sizeof(p->flights[k].callsign), "%s", f->callsign);
+					p->redo = k;
+					p->seed = f->last;
+					scan(p, redo_fix);
+				}
+			}
+			merge(f, &p->flights[k]);
+		}
+	}
+
+	j->left = 1; // so none can finish before they are all queued
+	for (i = 1; i < j->npieces; i++)
+	{
+		for (k = again = 0; k < j->pieces[i].nflights; k++)
+			again |= j->pieces[i].range[k] >= 0;
+		if (again)
+		{
+			pthread_mutex_lock(&j->lock);
+			j->left++;
+			pthread_mutex_unlock(&j->lock);
+			pool_submit(workers, range_piece, &j->pieces[i]);
+		}
+	}
+	range_piece_done(j);
+}
+
+void map_piece(void *arg)
+{
+	piece *p = arg;
+	job *j = p->j;
+	int last;
+
+	scan(p, map_fix);
+	pthread_mutex_lock(&j->lock);
+	last = --j->left == 0;
+	pthread_mutex_unlock(&j->lock);
+	if (last)
+		reduce(j);
+}
+
+// what sort of log - 0 if not one we know
+int detect(const unsigned char *data, size_t len, int *rmc)
+{
+	size_t i, n = len < 65536 ? len : 65536;
+	int gga = 0, nmea = 0;
+
+	*rmc = 0;
+	for (i = 0; i + 3 < n; i++)
+	{
+		if ((i == 0) || (data[i - 1] == '\n'))
+		{
+			if ((data[i] == '$') && (data[i + 1] == '$'))
+				return FMT_UKHAS;
+			if ((data[i] == '$') && (data[i + 1] == 'G'))
+			{
+				nmea = 1;
+				if ((i + 6 < n) && (memcmp(data + i + 3, "GGA", 3) == 0))
+					gga = 1;
+			}
+		}
+	}
+	if (!nmea)
+		return 0;
+	*rmc = !gga;
+	return FMT_NMEA;
+}
+
+// open, work out the format, and queue the pieces
+void open_file(void *arg)
+{
+	job *j = arg;
+	struct stat st;
+	int fd, c;
+	size_t at, next;
+	const unsigned char *nl;
+	piece *p;
+
+	if (((fd = open(j->in, O_RDONLY)) < 0) || (fstat(fd, &st) < 0) || (st.st_size == 0) ||
+		((j->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED))
+	{
+		if (fd >= 0)
+			close(fd);
+		j->map = NULL;
+		goto skip;
+	}
+	close(fd);
+	j->size = st.st_size;
+
+	if ((j->format = detect(j->map, j->size, &j->rmc)) == 0)
+	{
+		munmap(j->map, j->size);
+		j->map = NULL;
+		goto skip;
+	}
+
+	// cut into pieces at the start of a line
+	for (at = 0; at < j->size; at = next)
+	{
+		next = at + piece_size < j->size ? at + piece_size : j->size;
+		if (next < j->size)
+			next = (nl = memchr(j->map + next, '\n', j->size - next)) ? (size_t)(nl - j->map) + 1 : j->size;
+		j->pieces = realloc(j->pieces, (j->npieces + 1) * sizeof(piece));
+		p = &j->pieces[j->npieces++];
+		memset(p, 0, sizeof(*p));
+		p->j = j;
+		p->start = at;
+		p->end = next;
+	}
+
+	// all the pieces must exist before the first can finish
+	j->left = j->npieces;
+	madvise(j->map, j->size, MADV_SEQUENTIAL);
+	for (c = 0; c < j->npieces; c++)
+	{
+		madvise(j->map + (j->pieces[c].start & ~4095UL), j->pieces[c].end - (j->pieces[c].start & ~4095UL), MADV_WILLNEED);
+		pool_submit(workers, map_piece, &j->pieces[c]);
+	}
+	return;
+
+skip:
+	pthread_mutex_lock(&totals_lock);
+	skipped++;
+	pthread_mutex_unlock(&totals_lock);
+	free(j->in);
+	free(j);
+}
+
+void add_file(const char *path)
+{
+	job *j = calloc(1, sizeof(job));
+
+	j->in = strdup(path);
+	pthread_mutex_init(&j->lock, NULL);
+	pool_submit(workers, open_file, j);
+}
+
+void add_dir(const char *path)
+{
+	DIR *d;
+	struct dirent *e;
+	struct stat st;
+	char full[2048];
+
+	if ((d = opendir(path)) == NULL)
+	{
+		fprintf(stderr,"Can't read %s: %s\n", path, strerror(errno));
+		return;
+	}
+	while ((e = readdir(d)) != NULL)
+	{
+		if (e->d_name[0] == '.')
+			continue;
+		snprintf(full, sizeof(full), "%s/%s", path, e->d_name);
+		if (stat(full, &st) < 0)
+			continue;
+		if (S_ISDIR(st.st_mode))
+			add_dir(full);
+		else if (S_ISREG(st.st_mode))
+			add_file(full);
+	}
+	closedir(d);
+}
+
+// h:mm:ss
+const char *hms(double secs, char *text)
+{
+	long s = (long)(secs + 0.5);
+
+	sprintf(text, "%ld:%02ld:%02ld", s / 3600, (s / 60) % 60, s % 60);
+	return text;
+}
+
+void print_flight(const char *path, const stats *f)
+{
+	char t1[32], t2[32], t3[32];
+
+	printf("%s%s%s: %ld fixes over %s, burst %.0f m at %s, range %.1f km, ground %.1f km, %ld gaps",
+		path, f->callsign[0] ? " " : "", f->callsign, f->fixes, hms(f->elapsed, t1), f->burst_alt, hms(f->burst_t, t2),
+		f->range, f->ground, f->gaps);
+	if (f->gaps)
+		printf(" (longest %.0f s at %s)", f->longest_gap, hms(f->longest_gap_t, t3));
+	printf("\n");
+}
+
+// speed histogram and rate profile
+void print_tables(const stats *f)
+{
+	double total = 0;
+	char range[32];
+	int i;
+
+	for (i = 0; i < SPEED_BINS; i++)
+		total += f->speed[i];
+	printf("\tspeed km/h      time     %%\n");
+	for (i = 0; i < SPEED_BINS; i++)
+		if (f->speed[i] > 0)
+		{
+			if (i < SPEED_BINS - 1)
+				sprintf(range, "%.0f - %.0f", i * SPEED_STEP, (i + 1) * SPEED_STEP);
+			else
+				sprintf(range, "%.0f +", i * SPEED_STEP);
+			printf("\t%-11s %10.0f s %5.1f\n", range, f->speed[i], total > 0 ? 100.0 * f->speed[i] / total : 0.0);
+		}
+	printf("\taltitude km   ascent m/s  descent m/s\n");
+	for (i = 0; i < ALT_BANDS; i++)
+		if ((f->up_dt[i] > 0) || (f->down_dt[i] > 0))
+		{
+			if (i < ALT_BANDS - 1)
+				sprintf(range, "%.0f - %.0f", i * ALT_STEP / 1000, (i + 1) * ALT_STEP / 1000);
+			else
+				sprintf(range, "%.0f +", i * ALT_STEP / 1000);
+			printf("\t%-11s %12.2f %12.2f\n", range,
+				f->up_dt[i] > 0 ? f->up_dz[i] / f->up_dt[i] : 0.0, f->down_dt[i] > 0 ? f->down_dz[i] / f->down_dt[i] : 0.0);
+		}
+}
+
+int by_path(const void *a, const void *b)
+{
+	return strcmp((*(job **)a)->in, (*(job **)b)->in);
+}
+
+int main(int argc, char **argv)
+{
+	int i, k, b, threads = 0, named = 0;
+	long flights = 0, fixes = 0;
+	stats *f;
+	struct stat st;
+	struct timespec t0, t1;
+	double secs;
+	stats all, highest, furthest, longest;
+	char text[32];
+	const char *highest_in = "", *furthest_in = "", *longest_in = "";
+
+	for (i = 1; i < argc; i++)
+	{
+		if (argv[i][0] != '-')
+			named++;
+		else if ((strcmp(argv[i],"-g") == 0) && (i + 1 < argc) && (atof(argv[i + 1]) > 0))
+			gap_secs = atof(argv[++i]);
+		else if ((strcmp(argv[i],"-j") == 0) && (i + 1 < argc))
+			threads = atoi(argv[++i]);
+		else if ((strcmp(argv[i],"-s") == 0) && (i + 1 < argc) && (atoi(argv[i + 1]) > 0))
+			piece_size = (size_t)atoi(argv[++i]) << 20;
+		else if (strcmp(argv[i],"-v") == 0)
+			verbose = 1;
+		else
+			named = -1000;
+	}
+	if (named <= 0)
+	{
+		fprintf(stderr,"Usage : %s [-g gap secs] [-j threads] [-s piece MB] [-v] dir|file ...\n", argv[0]);
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	workers = pool_create(threads);
+	for (i = 1; i < argc; i++)
+	{
+		if (argv[i][0] == '-')
+		{
+			if (strcmp(argv[i],"-v") != 0)
+				i++;		// the rest take a value
+			continue;
+		}
+		if (stat(argv[i], &st) < 0)
+			fprintf(stderr,"Can't read %s: %s\n", argv[i], strerror(errno));
+		else if (S_ISDIR(st.st_mode))
+			add_dir(argv[i]);
+		else
+			add_file(argv[i]);
+	}
+	pool_wait(workers);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	// the archive's totals - each flight's histogram and profile added up, its extremes the largest of any
+	memset(&all, 0, sizeof(all));
+	memset(&highest, 0, sizeof(highest));
+	memset(&furthest, 0, sizeof(furthest));
+	memset(&longest, 0, sizeof(longest));
+	if (files)
+		qsort(done_jobs, files, sizeof(job *), by_path);
+	for (i = 0; i < files; i++)
+	{
+		for (k = 0; k < done_jobs[i]->nflights; k++)
+		{
+			f = &done_jobs[i]->flights[k];
+			print_flight(done_jobs[i]->in, f);
+			if (verbose)
+				print_tables(f);
+			flights++;
+			fixes += f->fixes;
+			all.ground += f->ground;
+			all.gaps += f->gaps;
+			for (b = 0; b < SPEED_BINS; b++)
+				all.speed[b] += f->speed[b];
+			for (b = 0; b < ALT_BANDS; b++)
+			{
+				all.up_dz[b] += f->up_dz[b];
+				all.up_dt[b] += f->up_dt[b];
+				all.down_dz[b] += f->down_dz[b];
+				all.down_dt[b] += f->down_dt[b];
+			}
+			if (f->burst_alt > highest.burst_alt)
+			{
+				highest = *f;
+				highest_in = done_jobs[i]->in;
+			}
+			if (f->range > furthest.range)
+			{
+				furthest = *f;
+				furthest_in = done_jobs[i]->in;
+			}
+			if (f->elapsed > longest.elapsed)
+			{
+				longest = *f;
+				longest_in = done_jobs[i]->in;
+			}
+		}
+	}
+
+	printf("\n%ld flights, %ld fixes, %.1f km over the ground, %ld gaps over %.0f s\n", flights, fixes, all.ground, all.gaps, gap_secs);
+	if (flights)
+	{
+		printf("highest  %.0f m - %s%s%s\n", highest.burst_alt, highest_in, highest.callsign[0] ? " " : "", highest.callsign);
+		printf("furthest %.1f km - %s%s%s\n", furthest.range, furthest_in, furthest.callsign[0] ? " " : "", furthest.callsign);
+		printf("longest  %s - %s%s%s\n", hms(longest.elapsed, text), longest_in, longest.callsign[0] ? " " : "", longest.callsign);
+		print_tables(&all);
+	}
+
+	fprintf(stderr,"%ld files read (%ld skipped), %.1f MB in %.3f s (%.0f MB/s) on %d threads, %llu steals\n",
+		files, skipped, bytes_in / 1e6, secs, secs > 0 ? bytes_in / 1e6 / secs : 0.0, workers->threads, workers->steals);
+	pool_destroy(workers);
+	for (i = 0; i < files; i++)
+	{
+		free(done_jobs[i]->flights);
+		free(done_jobs[i]->in);
+		free(done_jobs[i]);
+	}
+	free(done_jobs);
+	return 0;
+}
@@ -3,7 +3,41 @@
 // it calculates and adds NMEA checksums and paces the output as if it were being sent in real time.
 //
 // emulate is a unix 'filter' i.e. it reads from standard input and write to standard output
-// any arguments are ignored 
+//
+// options
+//	-i file		read the log from file rather than standard input
+//	-s secs		start secs into the flight (seconds after the first $GPGGA in the log) - "burst" is the
+//				highest point so e.g. -s burst-30 starts 30 seconds before burst
+//	-t hhmmss	start at this time of day (the first $GPGGA at or after it)
+//				with -s or -t the launch (bearing and distance, and the KML's first placemark) is still the
+//				log's first fix, as when resuming from a checkpoint
+//	-c file		checkpoint - before each epoch is sent its position in the log and the KML state are
+//				written to file
+//	-r			resume from the checkpoint (e.g. after a crash) - the KML file is carried on, not restarted
+//	-o sink		send the output to sink rather than standard output - can be given several times
+//				- (standard output), pty, tcp:port, udp:host:port or a file name (see sink.h)
+//				add ,drop or ,lag to choose what happens when that reader falls behind (default lag)
+//	-b baud		model a serial link - hold each sentence back until a UART at this baud rate (8N1, 16 byte
+//				FIFO) would have room for it, and report epochs whose sentences don't fit in the epoch
+//	-B			burst - don't wait for each epoch's time, send everything back to back (as fast as the -b
+//				link allows) to find the highest epoch rate the link can carry
+//	-x mode		what to send - nmea (default), ubx (u-blox NAV-PVT frames made from the NMEA) or both
+//				(each epoch's NMEA followed by its NAV-PVT)
+//	-m file		write run-time metrics (epoch lateness, parse/format/write times) to file
+//				in Prometheus text format
+//	-M secs		how often the metrics file is re-written (default 1 second)
+//	-k clock	what the pacing runs to - real (default), a speed factor (e.g. 60 plays an hour in a minute) or
+//				virtual (no waiting at all, the clock just moves on) - see vclock.h
+//	-T start	the date of a log without $GPRMC is taken from the clock - fix it (yyyy-mm-ddThh:mm:ss UTC
+//				or seconds since 1970) so a virtual run gives the same bytes every time
+//	--profile	print where the time went at the end - reading, checksum, parsing, UBX encoding, output and
+//				waiting (see profile.h)
+//	-l port		also serve the KML live on http://127.0.0.1:port/live.kml - Google Earth then only fetches
+//				what is new at each refresh rather than the whole of livekml.kml (see livekml.h)
+//	-R cpu[,prio]	real-time mode for a busy test host - SCHED_FIFO at prio (default 50), memory locked and
+//				prefaulted, pinned to cpu (-1 for any) (see rtmode.h). Each epoch is rendered (parsed, checksummed,
+//				encoded) as soon as it is read and held until its deadline, then sent in one go after spinning
+//				for the last 200us - the worst case lateness is reported at the end
 //
 // use with command line re-direction to output to serial port
 // dos e.g. emulate <gps.log >COM2:
@@ -13,32 +47,75 @@
 // e.g. mode COM2:9600,N,8,1 
 // to set to 9600baud, No parity,8 data bits, 1 stop
 //
+// output is never blocked by a slow reader - each sink has its own ring buffer (see sink.h) so one
+// source can pace several ground station programs under test at once, e.g.
+//	gpsEmulate -i flight.log -o pty -o tcp:2947 -o udp:localhost:10110,drop
+//
+// epochs are paced by the $GPGGA timestamps so logs at any rate (e.g. 25Hz) play back in real time.
+// A gap of more than 10 seconds (or time going backwards) counts as 1 second. UKHAS telemetry
+// ($$CALLSIGN,count,hh:mm:ss,...*CRC16 - e.g. from gpsGen -u) is paced by its time in the same way and
+// passed on with its CRC16 as it is.
+//
+// in ubx mode the $GPGGA, $GPRMC and $GPVTG of an epoch are combined into one NAV-PVT - position, height,
+// speed, heading and time are carried over at the resolution of the NMEA. The frame goes out as soon
+// as the epoch is complete (at its $GPVTG, or when the next epoch starts). Nothing is allocated per epoch.
+//
+// a log in a file (-i or redirected standard input) is memory mapped so lines can be any length and
+// multi-gigabyte archives start straight away. Starting part way through (-s, -t) uses a time index
+// of the log which is built the first time it is needed and kept in <log>.idx
+//
  
 #include <stdio.h>   /* Standard input/output definitions */
 #include <stdlib.h>  /* Standard stuff like exit */
 #include <time.h>
 #include <string.h>  /* String function definitions */
 #include <math.h>
+
+#include "stats.h"
+#include "vclock.h"
+#include "input.h"
+#include "sink.h"
+#include "ubx.h"
+#include "shaper.h"
+#include "sentence.h"
+#include "livekml.h"
+#include "profile.h"
+#include "rtmode.h"
  
 // radians to degrees
 #define DEGREES(x) ((x) * 57.295779513082320877) 
 // degrees to radians
 #define RADIANS(x) ((x) / 57.295779513082320877)
  
-#define BUF_SIZE 256	// size of input buffer
- 
 #define NONE	0
 #define GPGGA	1
 #define GPRMC	2
 #define GPVTG	3
+#define UKHAS	4
+
+#define OUT_NMEA	1	// -x
+#define OUT_UBX		2
 
 int main (int argc, char **argv) ;
  
-char buf[BUF_SIZE];		// input buffer
+char *buf = NULL;		// input line (grown to fit the longest line)
+size_t buf_size = 0;
  
 double BaseSec = 0.0;	// set to time of first valid reading in file
 double BaseLat = 0.0;	// set to Latitude of first valid reading in file
 double BaseLon = 0.0;	// set to Longtitude time of first valid reading in file
+double BaseAlt = 0.0;	// and its altitude (for -s / -t, which start after it)
+
+// run-time metrics (see stats.h)
+stat_counter *lines_stat;		// NMEA lines read
+stat_counter *epochs_stat;		// $GPGGA epochs paced out
+stat_hist *lateness_stat;		// how late each epoch went out compared to its 1 second slot
+stat_hist *parse_stat;			// time to parse a sentence (includes KML update)
+stat_hist *format_stat;			// time to re-calculate the checksum
+stat_hist *write_stat;			// time to write a sentence to the output
+int s_read, s_checksum, s_parse, s_encode, s_output, s_wait;	// --profile stages
+stat_counter *overrun_stat;		// epochs that needed more than their time on the -b link
+stat_hist *link_stat;			// time each epoch's sentences need on the -b link
  
 // **************************************************************************************
 //
@@ -132,15 +209,32 @@ void kml_gen(double lat, double lon, double alt, char * description)
 }
  
  
-// read each line from the input
-int read_input_line(char *pch, int size)
+// read each line from the input into buf
+int read_input_line(void)
 {
+	char *p;
+	size_t len;
+	profile_scope ps;
+
+	profile_begin(&ps, s_read);
 	do
 	{
-		if (fgets(pch, size, stdin) == NULL)
+		if ((p = input_line(&len)) == NULL)
+		{
+			profile_end(&ps);
 			return 0;
+		}
+	}
+	while((len == 0) || (p[0] != '$')); // loop until NMEA valid line read
+
+	if (len + 8 > buf_size)
+	{ // room for the line, checksum, CR LF and '\0'
+		buf_size = len + 256;
+		buf = realloc(buf, buf_size);
 	}
-	while(buf[0] != '$'); // loop until NMEA valid line read
+	memcpy(buf, p, len);
+	strcpy(buf + len, "\n");
+	profile_end(&ps);
  
 	return 1; // line read OK
 }
@@ -151,8 +245,8 @@ void re_crc(char *pch)
 {
 	unsigned char crc;
  
-	if (*pch != '$') 
-		return;		// does not start with '$' - so cant CRC
+	if ((*pch != '$') || (pch[1] == '$'))
+		return;		// does not start with '$' - so cant CRC (or UKHAS telemetry - has its own CRC16)
  
 	pch++;			// skip '$'
 	crc = 0;
@@ -228,7 +322,162 @@ double DegMin_to_Deg(double Deg, double Min, char Dir)
 }
  
 double next_time = 0.0;
+
+int output_mode = OUT_NMEA;
+
+shaper link;			// -b
+int baud = 0;
+int burst = 0;			// -B
+
+int rt_mode = 0;		// -R
+int prerender = 0;		// epochs are rendered into epoch_buf and sent at their deadline (-R without -b)
+char *epoch_buf = NULL;	// the epoch rendered so far
+size_t epoch_len = 0, epoch_size = 0;
+size_t *epoch_piece = NULL;	// where each sentence (or frame) ends in epoch_buf - a UDP sink sends them one by one
+int epoch_pieces = 0, epoch_pieces_size = 0;
+
+// what we know so far about the epoch being read (filled in by parse_NMEA)
+typedef struct nmea_fix
+{
+	int pending;		// some of this epoch has been read but no NAV-PVT sent for it
+	int have_date;		// $GPRMC seen
+	double tod;			// time of day (seconds)
+	int day, month, year;
+	double lat, lon;	// degrees
+	double alt;			// metres above MSL
+	double sep;			// geoid separation (metres)
+	int quality;		// $GPGGA fix quality (0 = no fix)
+	int nsats;
+	double hdop;
+	double speed;		// knots
+	double course;		// degrees true
+	double last_tod;	// previous epoch - for the vertical speed
+	double last_alt;
+} nmea_fix;
+
+nmea_fix fix;
+ubx_pvt pvt;
+unsigned char ubx_frame[UBX_NAV_PVT_LEN];
+
+// save where we are in the log and the KML state so a crashed run can carry on (-r)
+// written to a temporary file and renamed so there is always a complete checkpoint
+void save_checkpoint(char *file, unsigned long long offset)
+{
+	char tmp[1024];
+	FILE *fp;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+	if ((fp = fopen(tmp, "w")) == NULL)
+		return;
+	fprintf(fp,"%llu %d %ld %.3f %.8f %.8f %.3f\n", offset, kml_state, lastpos, BaseSec, BaseLat, BaseLon, next_time);
+	if (fclose(fp) == 0)
+		rename(tmp, file);
+}
+
+// returns the offset to carry on from (-1 if there is no checkpoint)
+long long load_checkpoint(char *file)
+{
+	FILE *fp;
+	unsigned long long offset;
+	int n;
+
+	if ((fp = fopen(file, "r")) == NULL)
+		return -1;
+	n = fscanf(fp,"%llu %d %ld %lf %lf %lf %lf", &offset, &kml_state, &lastpos, &BaseSec, &BaseLat, &BaseLon, &next_time);
+	fclose(fp);
+	return n == 7 ? (long long)offset : -1;
+}
  
+void write_link(char *data, size_t len);
+
+// send the NAV-PVT for the epoch read so far
+void send_ubx(void)
+{
+	double dt, v;
+	time_t now;
+	struct tm *tm;
+	profile_scope ps;
+
+	if (!fix.pending)
+		return;
+	fix.pending = 0;
+	if (!(output_mode & OUT_UBX))
+		return;
+	profile_begin(&ps, s_encode);
+
+	if (!fix.have_date)
+	{ // no $GPRMC - assume today
+		now = vclock_time();
+		tm = gmtime(&now);
+		fix.day = tm->tm_mday;
+		fix.month = tm->tm_mon + 1;
+		fix.year = tm->tm_year + 1900;
+	}
+
+	pvt.year = fix.year;
+	pvt.month = fix.month;
+	pvt.day = fix.day;
+	pvt.hour = (int)(fix.tod / 3600.0);
+	pvt.min = (int)(fix.tod / 60.0) % 60;
+	pvt.sec = fix.tod - pvt.hour * 3600.0 - pvt.min * 60.0;
+	pvt.valid = (fix.have_date ? 0x01 : 0x00) | 0x02 | (fix.have_date ? 0x04 : 0x00);
+	pvt.fixType = fix.quality ? 3 : 0;
+	pvt.fixOK = fix.quality != 0;
+	pvt.numSV = fix.nsats;
+	pvt.lat = fix.lat;
+	pvt.lon = fix.lon;
+	pvt.hMSL = fix.alt;
+	pvt.height = fix.alt + fix.sep;
+	pvt.hAcc = fix.hdop * 2.5;		// NMEA has no accuracies - assume a 2.5m UERE
+	pvt.vAcc = fix.hdop * 4.0;
+	pvt.pDOP = fix.hdop;
+	v = fix.speed * 0.514444444;	// knots to m/s
+	pvt.gSpeed = v;
+	pvt.headMot = fix.course;
+	pvt.velN = v * cos(RADIANS(fix.course));
+	pvt.velE = v * sin(RADIANS(fix.course));
+	dt = fix.tod - fix.last_tod;
+	pvt.velD = ((dt > 0.0) && (dt <= 10.0)) ? -(fix.alt - fix.last_alt) / dt : 0.0;
+	pvt.sAcc = 0.5;
+	pvt.headAcc = 1.0;
+	fix.last_tod = fix.tod;
+	fix.last_alt = fix.alt;
+
+	write_link((char *)ubx_frame, ubx_nav_pvt(ubx_frame, &pvt));
+	profile_end(&ps);
+}
+
+// a sentence with a time - if it is a new epoch finish off the last one
+void new_time(double tod)
+{
+	if (fix.pending && (tod != fix.tod))
+		send_ubx();
+	fix.tod = tod;
+	fix.pending = 1;
+}
+
+// -s / -t - the first valid $GPGGA in the log, which the flight would have started from
+int find_launch(sentence_fix *launch)
+{
+	char line[256], *p;
+	long long offset;
+	size_t len;
+	long i;
+
+	for (i = 0; (offset = index_offset(i)) >= 0; i++)
+	{
+		if (!input_seek(offset) || ((p = input_line(&len)) == NULL))
+			break;
+		len = len < sizeof(line) - 1 ? len : sizeof(line) - 1;
+		memcpy(line, p, len);		// input lines aren't '\0' terminated
+		line[len] = '\0';
+		if ((parse_sentence(line, launch) == SENTENCE_GGA) && launch->have_pos &&
+			(launch->tod != 0.0) && (launch->lat != 0.0) && (launch->lon != 0.0))
+			return 1;		// as parse_NMEA() takes a valid position
+	}
+	return 0;
+}
+
 int parse_NMEA(char *pch)
 {
 	int i;
@@ -241,6 +490,7 @@ int parse_NMEA(char *pch)
 	int NSats;
 	double HDOP;
 	double Alt;
+	double Sep;
 	char Val;
 	char FixQual;
 	double SpeedKn;
@@ -250,15 +500,38 @@ int parse_NMEA(char *pch)
  
 	double Distance;
 	double Bearing;
+	sentence_fix telem;
+
+	if (strncmp(pch,"$$",2) == 0)
+	{ // UKHAS - only its time is used, to pace it
+		if (parse_sentence(pch,&telem) != SENTENCE_UKHAS)
+			return NONE;
+		fix.tod = telem.tod;
+		return UKHAS;
+	}
  
-	i = sscanf(pch,"$GPGGA,%2d%2d%lf,%2lf%lf,%c,%3lf%lf,%c,%c,%d,%lf,%lf,M,",
-		&Hour,&Minute,&Second,&LatDeg,&LatMin,&LatDir,&LonDeg,&LonMin,&LonDir,&FixQual,&NSats,&HDOP,&Alt);
+	i = sscanf(pch,"$GPGGA,%2d%2d%lf,%2lf%lf,%c,%3lf%lf,%c,%c,%d,%lf,%lf,M,%lf,M",
+		&Hour,&Minute,&Second,&LatDeg,&LatMin,&LatDir,&LonDeg,&LonMin,&LonDir,&FixQual,&NSats,&HDOP,&Alt,&Sep);
  
 	if (i > 0)
 	{ // some fileds converted
 		Second = Time_to_Sec(Hour,Minute,Second);		// convert to decimal seconds
 		LatDeg = DegMin_to_Deg(LatDeg,LatMin,LatDir);	// convert to decimal degrees Latitude
 		LonDeg = DegMin_to_Deg(LonDeg,LonMin,LonDir);	// convert to decimal degrees Longtitude
+
+		new_time(Second);
+		if (i >= 13)
+		{
+			fix.lat = LatDeg;
+			fix.lon = LonDeg;
+			fix.quality = FixQual - '0';
+			fix.nsats = NSats;
+			fix.hdop = HDOP;
+			fix.alt = Alt;
+			fix.sep = i >= 14 ? Sep : 0.0;
+		}
+		else
+			fix.quality = 0;
  
 		if ((Second != 0.0) && (LatDeg != 0.0) && (LonDeg != 0.0))
 		{ // valid position
@@ -268,6 +541,7 @@ int parse_NMEA(char *pch)
 				BaseLat = LatDeg;	// first Latitude
 				BaseLon = LonDeg;	// first Longtitude
 				kml_gen(LatDeg,LonDeg,Alt,"Launch!"); // first positions
+				livekml_point(LatDeg,LonDeg,Alt,"Launch!");
 				next_time = Second + 20.0;
 			}
 			else
@@ -275,6 +549,7 @@ int parse_NMEA(char *pch)
 				if (Second >= next_time)
 				{
 					kml_gen(LatDeg,LonDeg,Alt,"HereNoW!"); // subsiquent positions
+					livekml_point(LatDeg,LonDeg,Alt,"HereNoW!");
 					next_time = Second + 20.0;
 				}
 			}
@@ -293,6 +568,20 @@ int parse_NMEA(char *pch)
  
 	if (i > 0)
 	{ // some fields converted
+		new_time(Time_to_Sec(Hour,Minute,Second));
+		if (i >= 12)
+		{
+			fix.speed = SpeedKn;
+			fix.course = Course;
+		}
+		if (i >= 15)
+		{
+			fix.day = Day;
+			fix.month = Month;
+			fix.year = 2000 + Year;
+			fix.have_date = 1;
+		}
+
 		fprintf(stderr," Co=%5.1f %.3s Kh=%.1f",Course,deg_to_compass16(Course),SpeedKn * 1.852);
  
 		return GPRMC;
@@ -302,52 +591,377 @@ int parse_NMEA(char *pch)
  
 	if (i > 0)
 	{ // some fileds converted
+		fix.course = Course;
+		if (i >= 2)
+			fix.speed = SpeedKn;
+		send_ubx(); // last sentence of the epoch
 		return GPVTG;
 	}
  
 	return NONE;
 }
  
-// write the line to the output
+// write to the output(s) - never blocks, but waits for the modelled serial link (-b)
+void write_link(char *data, size_t len)
+{
+	profile_scope ps, wait;
+
+	if (prerender)
+	{ // held until the epoch's deadline (release_epoch)
+		if (epoch_len + len > epoch_size)
+		{
+			epoch_size = (epoch_len + len) * 2;
+			epoch_buf = realloc(epoch_buf, epoch_size);
+		}
+		if (epoch_pieces == epoch_pieces_size)
+		{
+			epoch_pieces_size *= 2;
+			epoch_piece = realloc(epoch_piece, epoch_pieces_size * sizeof(*epoch_piece));
+		}
+		memcpy(epoch_buf + epoch_len, data, len);
+		epoch_len += len;
+		epoch_piece[epoch_pieces++] = epoch_len;
+		return;
+	}
+
+	profile_begin(&ps, s_output);
+	if (baud)
+	{
+		profile_begin(&wait, s_wait);
+		sink_wait(shaper_send(&link,len));
+		profile_end(&wait);
+	}
+	sink_write(data,len);
+	profile_end(&ps);
+}
+
+// -R: send the rendered epoch at its deadline - sleep until just before it, spin the rest of the way and
+// write it all out together
+void release_epoch(unsigned long long deadline)
+{
+	unsigned long long t, spin;
+	size_t from;
+	profile_scope ps;
+	int i;
+
+	if (epoch_pieces == 0)
+		return;
+	if (burst)
+		deadline = vclock_now();
+	else
+	{
+		profile_begin(&ps, s_wait);
+		// RTMODE_SPIN_NS of real time on this clock (none if it is virtual)
+		spin = vclock_mode() == VCLOCK_VIRTUAL ? 0 : RTMODE_SPIN_NS * 1000000000ull / vclock_real_ns(1000000000ull);
+		sink_wait(deadline > spin ? deadline - spin : 0); // keep the readers fed until nearly time
+		if (spin)
+			rtmode_spin_until(deadline, vclock_now);
+		profile_end(&ps);
+	}
+
+	t = vclock_now();
+	stats_record(lateness_stat,t > deadline ? t - deadline : 0);
+	profile_begin(&ps, s_output);
+	for (i = from = 0; i < epoch_pieces; from = epoch_piece[i++])
+		sink_write(epoch_buf + from, epoch_piece[i] - from);
+	profile_end(&ps);
+	epoch_len = 0;
+	epoch_pieces = 0;
+	stats_add(epochs_stat,1);
+	stats_tick();
+}
+
+// write the line to the output(s)
 void write_serial_io(char *pch)
 {
-		fputs(pch,stdout);
-		fflush(stdout);
+		write_link(pch,strlen(pch));
 }
  
 // ******************************************************************************************
 // *************************************** Main *********************************************
  
  
-// lines are played out in pseudo real time - GPGGA messages are held until 1 second has elapsed since the previous
+// lines are played out in pseudo real time - GPGGA messages are held until the time between their timestamps has elapsed since the previous
 // (re)calcualtes NMEA checksum
  
 int main (int argc, char **argv) 
 {
-	time_t now;			// set to current time
-	long gga_count;
-	time_t epoch;		// time the output started
- 
+	unsigned long long deadline;	// when the next epoch is due
+	double last_gga = -1.0;			// time of day of the previous $GPGGA
+	double step = 1.0;
+	unsigned long long t;
+	char *stats_file = NULL;
+	double stats_interval = 1.0;
+	char *input_file = NULL;
+	char *start_at = NULL;		// -s
+	char *start_tod = NULL;		// -t
+	char *checkpoint_file = NULL;
+	int resume = 0;
+	int sinks = 0;
+	int kml_port = 0;			// -l
+	int rt_cpu = -1, rt_priority = 50;	// -R
+	long long offset = -1;
+	profile_scope ps;
+	int i;
+
+	s_read = profile_stage("read");
+	s_checksum = profile_stage("checksum");
+	s_parse = profile_stage("parse");
+	s_encode = profile_stage("encode");
+	s_output = profile_stage("output");
+	s_wait = profile_stage("wait");
+ 
+	for (i = 1; i < argc; i++)
+	{
+		if ((strcmp(argv[i],"-m") == 0) && (i + 1 < argc))
+			stats_file = argv[++i];
+		else if ((strcmp(argv[i],"-M") == 0) && (i + 1 < argc))
+			stats_interval = atof(argv[++i]);
+		else if ((strcmp(argv[i],"-i") == 0) && (i + 1 < argc))
+			input_file = argv[++i];
+		else if ((strcmp(argv[i],"-s") == 0) && (i + 1 < argc))
+			start_at = argv[++i];
+		else if ((strcmp(argv[i],"-t") == 0) && (i + 1 < argc))
+			start_tod = argv[++i];
+		else if ((strcmp(argv[i],"-c") == 0) && (i + 1 < argc))
+			checkpoint_file = argv[++i];
+		else if (strcmp(argv[i],"-r") == 0)
+			resume = 1;
+		else if ((strcmp(argv[i],"-b") == 0) && (i + 1 < argc))
+			baud = atoi(argv[++i]);
+		else if (strcmp(argv[i],"-B") == 0)
+			burst = 1;
+		else if (strcmp(argv[i],"--profile") == 0)
+			profile_init();
+		else if ((strcmp(argv[i],"-l") == 0) && (i + 1 < argc))
+			kml_port = atoi(argv[++i]);
+		else if ((strcmp(argv[i],"-R") == 0) && (i + 1 < argc) && (sscanf(argv[i + 1],"%d,%d",&rt_cpu,&rt_priority) >= 1))
+		{
+			rt_mode = 1;
+			i++;
+		}
+		else if ((strcmp(argv[i],"-k") == 0) && (i + 1 < argc) && vclock_set(argv[i + 1]))
+			i++;
+		else if ((strcmp(argv[i],"-T") == 0) && (i + 1 < argc) && vclock_start(argv[i + 1]))
+			i++;
+		else if ((strcmp(argv[i],"-x") == 0) && (i + 1 < argc))
+		{
+			i++;
+			if (strcmp(argv[i],"nmea") == 0)
+				output_mode = OUT_NMEA;
+			else if (strcmp(argv[i],"ubx") == 0)
+				output_mode = OUT_UBX;
+			else if (strcmp(argv[i],"both") == 0)
+				output_mode = OUT_NMEA | OUT_UBX;
+			else
+			{
+				fprintf(stderr,"-x must be nmea, ubx or both\n");
+				return 1;
+			}
+		}
+		else if ((strcmp(argv[i],"-o") == 0) && (i + 1 < argc))
+		{
+			char *policy = strrchr(argv[++i],',');
+			int lag = 1;
+
+			if (policy && ((strcmp(policy,",drop") == 0) || (strcmp(policy,",lag") == 0)))
+			{
+				lag = strcmp(policy,",lag") == 0;
+				*policy = '\0';
+			}
+			if (!sink_add(argv[i], lag ? SINK_LAG : SINK_DROP))
+				return 1;
+			sinks++;
+		}
+		else
+		{
+			fprintf(stderr,"Usage : %s [-i gps.log] [-s secs|burst-secs] [-t hhmmss] [-c checkpoint file] [-r] [-o sink[,drop|,lag]]... [-x nmea|ubx|both] [-b baud] [-B] [-k real|virtual|factor] [-T start] [-l kml port] [-R cpu[,prio]] [--profile] [-m metrics file] [-M flush secs] <gps.log >COM2:\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (!input_open(input_file))
+		return 1;
+	if (baud)
+		shaper_init(&link,baud,10,16); // 8N1 and a 16550 style FIFO
+	if ((sinks == 0) && !sink_add("-", SINK_LAG))
+		return 1;
+
+	if (resume)
+	{
+		if (checkpoint_file == NULL)
+		{
+			fprintf(stderr,"-r needs the checkpoint file (-c)\n");
+			return 1;
+		}
+		if ((offset = load_checkpoint(checkpoint_file)) < 0)
+			fprintf(stderr,"No checkpoint in %s - starting from the beginning\n", checkpoint_file);
+	}
+	else if (start_at || start_tod)
+	{
+		sentence_fix launch;
+		double secs;
+
+		if (!index_open())
+			return 1;
+		if (start_tod)
+		{
+			int hhmmss = atoi(start_tod);
+			secs = index_flight_time(Time_to_Sec(hhmmss / 10000, (hhmmss / 100) % 100, hhmmss % 100));
+		}
+		else if (strncmp(start_at,"burst",5) == 0)
+			secs = index_burst() + atof(start_at + 5);
+		else
+			secs = atof(start_at);
+		if ((offset = index_find(secs)) < 0)
+		{
+			fprintf(stderr,"The log finishes before %.0f seconds into the flight\n", secs);
+			return 1;
+		}
+		fprintf(stderr,"Starting %.0f seconds into the flight\n", secs);
+		if (find_launch(&launch))
+		{ // the KML is started from it below
+			BaseSec = launch.tod;
+			BaseLat = launch.lat;
+			BaseLon = launch.lon;
+			BaseAlt = launch.alt;
+		}
+	}
+
+	if ((offset >= 0) && !input_seek(offset))
+	{
+		fprintf(stderr,"Input is not a file - can't start part way through it\n");
+		return 1;
+	}
+
+	lines_stat = stats_counter("gpsemulate_lines_total","NMEA lines read",NULL);
+	epochs_stat = stats_counter("gpsemulate_epochs_total","GPGGA epochs paced out",NULL);
+	lateness_stat = stats_hist("gpsemulate_epoch_lateness_seconds","Time an epoch was released after its deadline",NULL);
+	parse_stat = stats_hist("gpsemulate_parse_seconds","Time to parse one sentence",NULL);
+	format_stat = stats_hist("gpsemulate_format_seconds","Time to re-calculate one checksum",NULL);
+	write_stat = stats_hist("gpsemulate_write_seconds","Time to write one sentence",NULL);
+	overrun_stat = stats_counter("gpsemulate_link_overruns_total","Epochs whose sentences need longer than the epoch on the -b link",NULL);
+	link_stat = stats_hist("gpsemulate_link_busy_seconds","Time each epoch's sentences take on the -b link",NULL);
+	if (kml_port && !livekml_start(kml_port, 2))
+	{
+		fprintf(stderr,"Can't serve live KML on port %d\n", kml_port);
+		return 1;
+	}
+	stats_open(stats_file, stats_interval);
+
+	if (rt_mode)
+	{ // last, so the threads started above aren't real-time (or pinned)
+		prerender = !baud; // the -b link model paces each sentence as it is written
+		buf_size = 4096;
+		buf = realloc(buf, buf_size);
+		rtmode_prefault(buf, buf_size);
+		epoch_size = 65536;
+		epoch_buf = malloc(epoch_size);
+		rtmode_prefault(epoch_buf, epoch_size);
+		epoch_pieces_size = 256;
+		epoch_piece = malloc(epoch_pieces_size * sizeof(*epoch_piece));
+		rtmode_prefault(epoch_piece, epoch_pieces_size * sizeof(*epoch_piece));
+		rtmode_init(rt_cpu, rt_priority);
+		input_unlock();
+	}
  
-	now = epoch = time(NULL); // cpature the start time
-	gga_count = 0l;
+	deadline = vclock_now(); // capture the start time
  
-	kml_gen(0.0,0.0,0.0,""); // create KML file etc. (state 0)
+	if (kml_state == 0)
+	{
+		kml_gen(0.0,0.0,0.0,""); // create KML file etc. (state 0)
+		if (BaseSec != 0.0)
+		{ // started part way through (-s / -t) - the launch is the log's first fix, not the first one sent
+			kml_gen(BaseLat,BaseLon,BaseAlt,"Launch!");
+			livekml_point(BaseLat,BaseLon,BaseAlt,"Launch!");
+		}
+	}
  
 	// the main loop
-    while (read_input_line(buf, sizeof(buf)))			// Loop until end of file read - read standard input
+    while (read_input_line())			// Loop until end of file read - read standard input
     {	
+		stats_add(lines_stat,1);
+
+		if (checkpoint_file && (strncmp(buf,"$GPGGA",6) == 0))
+			save_checkpoint(checkpoint_file, input_offset()); // a restart sends this epoch again
+
+		t = stats_now();
+		profile_begin(&ps, s_checksum);
 		re_crc(buf);					// re-calculate CRC and add
- 
-		if (parse_NMEA(buf) == GPGGA)	// parse input (and do output messages)
-		{	// pace $GPGGA messages to one per second
-			gga_count++;
-			while ((now - epoch) < gga_count)
-				now = time(NULL); // wait until elapsed time in seconds catches up with number of gga messages
+		profile_end(&ps);
+		stats_record(format_stat,stats_now() - t);
+ 
+		t = stats_now();
+		profile_begin(&ps, s_parse);	// less the UBX encoding and output inside
+		i = parse_NMEA(buf);			// parse input (and do output messages)
+		profile_end(&ps);
+		stats_record(parse_stat,stats_now() - t);
+
+		if ((i == GPGGA) || (i == UKHAS))
+		{	// pace $GPGGA (and UKHAS) messages by their timestamps
+			step = fix.tod - last_gga;
+			if (step < -43200.0)
+				step += 86400.0; // past midnight
+			if ((last_gga < 0.0) || (step <= 0.0) || (step > 10.0))
+				step = 1.0; // first one, a gap in the log or nonsense
+			if ((last_gga >= 0.0) && baud)
+			{ // did the last epoch fit on the link?
+				stats_record(link_stat,link.bytes * link.char_ns);
+				if (shaper_epoch(&link,step * 1e9))
+				{
+					stats_add(overrun_stat,1);
+					fprintf(stderr,"\nOverrun: %.0f bytes need %.0f ms at %d baud - the epoch is %.0f ms",
+						link.last_use * step * 1e9 / link.char_ns, link.last_use * step * 1000.0, baud, step * 1000.0);
+				}
+			}
+			last_gga = fix.tod;
+			if (prerender)
+				release_epoch(deadline); // the one before this is complete (and its NAV-PVT sent by new_time())
+			deadline += (unsigned long long)(step * 1e9);
+			if (burst)
+				deadline = vclock_now(); // no waiting - only the link (if any) holds us back
+			else if (!prerender) // otherwise sent by release_epoch() when it is complete
+			{
+				profile_begin(&ps, s_wait);
+				sink_wait(deadline); // keep the readers fed (and accept new ones) until elapsed time catches up with the log
+				profile_end(&ps);
+			}
+
+			if (!prerender)
+			{ // how far past its slot did this epoch go out
+				t = vclock_now();
+				stats_record(lateness_stat,t > deadline ? t - deadline : 0);
+				stats_add(epochs_stat,1);
+				stats_tick();
+			}
 		}					
  
-		write_serial_io(buf);				// write to standard output
+		if (output_mode & OUT_NMEA)
+		{
+			t = stats_now();
+			write_serial_io(buf);				// write to standard output
+			stats_record(write_stat,stats_now() - t);
+		}
     }
+	send_ubx(); // the last epoch may not have had a $GPVTG
+	release_epoch(deadline);
+	if (baud)
+	{
+		if (last_gga >= 0.0)
+			shaper_epoch(&link,step * 1e9); // assume the last epoch was as long as the one before
+		shaper_report(&link,stderr);
+	}
+
+	sink_close(2.0); // let slow readers catch up
+	stats_close();
+	input_close();
+	if (profiling || rt_mode)
+		fprintf(stderr,"\n");
+	if (rt_mode)
+		fprintf(stderr,"rtmode: %llu epochs late by p50 %.1fus p99 %.1fus p99.9 %.1fus worst %.1fus\n", lateness_stat->count,
+			stats_quantile(lateness_stat,0.5) / 1e3, stats_quantile(lateness_stat,0.99) / 1e3,
+			stats_quantile(lateness_stat,0.999) / 1e3, lateness_stat->max / 1e3);
+	profile_report(stderr);
  
 	return 0; // normal termination
 }
\ No newline at end of file
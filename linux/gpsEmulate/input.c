@@ -0,0 +1,304 @@
+// input.c - NMEA log reader (memory mapped when it can be, inflated on the fly when compressed) and $GPGGA time index
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "zio.h"
+#include "input.h"
+
+#define INDEX_MAGIC "GEIDX01"
+
+typedef struct idx_entry
+{
+	unsigned long long offset;	// start of the $GPGGA line
+	double time;				// seconds since the first $GPGGA (carries on past midnight)
+	double alt;					// metres (0 if no fix)
+} idx_entry;
+
+static const char *in_path;
+static int in_fd = -1;
+static struct stat in_st;
+static char *map;				// whole file when it is mapped
+static size_t map_len;
+static unsigned long long pos;	// next byte to read
+static unsigned long long line_start;
+
+static FILE *in_fp;				// not a regular file - read it a line at a time
+static char *line_buf;
+static size_t line_size;
+
+static idx_entry *idx;
+static long idx_count;
+static double first_tod;		// time of day of the first $GPGGA
+
+
+int input_open(const char *path)
+{
+	in_path = path;
+	in_fd = zio_open(path);	// a compressed log comes back as a pipe - read by line, no index
+	if ((in_fd < 0) || (fstat(in_fd, &in_st) != 0))
+	{
+		fprintf(stderr,"Can't open %s: %s\n", path, strerror(errno));
+		return 0;
+	}
+
+	if (S_ISREG(in_st.st_mode) && (in_st.st_size > 0))
+	{
+		map_len = in_st.st_size;
+		map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, in_fd, 0);
+		if (map == MAP_FAILED)
+			map = NULL;
+		else
+		{
+			madvise(map, map_len, MADV_SEQUENTIAL); // read ahead hard - we go through it in order
+			pos = lseek(in_fd, 0, SEEK_CUR); // standard input may have been positioned for us
+			if (pos > map_len)
+				pos = map_len;
+			return 1;
+		}
+	}
+
+	in_fp = in_fd ? fdopen(in_fd, "r") : stdin;
+	return in_fp != NULL;
+}
+
+char *input_line(size_t *len)
+{
+	char *p, *nl;
+	ssize_t n;
+
+	if (map)
+	{
+		if (pos >= map_len)
+			return NULL;
+		line_start = pos;
+		p = map + pos;
+		if ((nl = memchr(p, '\n', map_len - pos)) == NULL)
+			nl = map + map_len; // last line has no line ending
+		pos = nl - map + 1;
+		*len = nl - p;
+	}
+	else
+	{
+		line_start = pos;
+		if ((n = getline(&line_buf, &line_size, in_fp)) <= 0)
+			return NULL;
+		pos += n;
+		p = line_buf;
+		*len = n;
+		if (p[*len - 1] == '\n')
+			(*len)--;
+	}
+
+	if (*len && (p[*len - 1] == '\r'))
+		(*len)--;
+	return p;
+}
+
+unsigned long long input_offset(void)
+{
+	return line_start;
+}
+
+int input_seek(unsigned long long offset)
+{
+	if (map)
+	{
+		if (offset > map_len)
+			return 0;
+		pos = offset;
+		return 1;
+	}
+	if (in_fp && (fseeko(in_fp, offset, SEEK_SET) == 0))
+	{
+		pos = offset;
+		return 1;
+	}
+	return 0;
+}
+
+void input_unlock(void)
+{
+	if (map)
+		munlock(map, map_len); // a real-time run (-R) reads it ahead of the deadlines - no need to pin it
+}
+
+void input_close(void)
+{
+	if (map)
+		munmap(map, map_len);
+	map = NULL;
+	if (in_fp && (in_fp != stdin))
+		fclose(in_fp);
+	in_fp = NULL;
+	free(idx);
+	idx = NULL;
+	idx_count = 0;
+}
+
+
+// ************************************* time index *************************************
+
+// the saved index is only used if the log is the same size and age as when it was made
+static int load_index(const char *path)
+{
+	FILE *fp;
+	char magic[8];
+	unsigned long long size, mtime;
+	long count;
+
+	if ((fp = fopen(path, "rb")) == NULL)
+		return 0;
+
+	if ((fread(magic, sizeof(magic), 1, fp) != 1) || (memcmp(magic, INDEX_MAGIC, sizeof(magic)) != 0) ||
+		(fread(&size, sizeof(size), 1, fp) != 1) || (fread(&mtime, sizeof(mtime), 1, fp) != 1) ||
+		(fread(&count, sizeof(count), 1, fp) != 1) || (fread(&first_tod, sizeof(first_tod), 1, fp) != 1) ||
+		(size != (unsigned long long)in_st.st_size) || (mtime != (unsigned long long)in_st.st_mtime) || (count < 0))
+	{
+		fclose(fp);
+		return 0;
+	}
+
+	idx = malloc((count ? count : 1) * sizeof(idx_entry));
+	if (fread(idx, sizeof(idx_entry), count, fp) != (size_t)count)
+	{
+		free(idx);
+		idx = NULL;
+		fclose(fp);
+		return 0;
+	}
+	idx_count = count;
+	fclose(fp);
+	return 1;
+}
+
+static void save_index(const char *path)
+{
+	char tmp[1100];
+	FILE *fp;
+	unsigned long long size = in_st.st_size, mtime = in_st.st_mtime;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	if ((fp = fopen(tmp, "wb")) == NULL)
+		return; // read only directory - build it again next time
+
+	fwrite(INDEX_MAGIC, 8, 1, fp);
+	fwrite(&size, sizeof(size), 1, fp);
+	fwrite(&mtime, sizeof(mtime), 1, fp);
+	fwrite(&idx_count, sizeof(idx_count), 1, fp);
+	fwrite(&first_tod, sizeof(first_tod), 1, fp);
+	fwrite(idx, sizeof(idx_entry), idx_count, fp);
+	if (fclose(fp) == 0)
+		rename(tmp, path);
+	else
+		unlink(tmp);
+}
+
+// one pass over the mapped log picking out the time and altitude of every $GPGGA
+static void build_index(void)
+{
+	char line[128];
+	char *p, *end = map + map_len, *nl;
+	long size = 0;
+	int Hour, Minute;
+	double Second, tod, last = -1.0, days = 0.0, alt;
+	size_t len;
+
+	for (p = map; p < end; p = nl + 1)
+	{
+		if ((nl = memchr(p, '\n', end - p)) == NULL)
+			nl = end;
+		if ((nl - p < 7) || (memcmp(p, "$GPGGA,", 7) != 0))
+			continue;
+
+		len = nl - p < (long)sizeof(line) - 1 ? (size_t)(nl - p) : sizeof(line) - 1;
+		memcpy(line, p, len);
+		line[len] = '\0';
+		alt = 0.0;
+		if (sscanf(line, "$GPGGA,%2d%2d%lf,%*[^,],%*[^,],%*[^,],%*[^,],%*[^,],%*[^,],%*[^,],%lf,", &Hour, &Minute, &Second, &alt) < 3)
+			continue;
+
+		tod = Second + Minute * 60.0 + Hour * 3600.0;
+		if (last < 0.0)
+			first_tod = tod;
+		else if (tod < last - 43200.0)
+			days += 86400.0; // gone past midnight
+		last = tod;
+
+		if (idx_count == size)
+		{
+			size = size ? size * 2 : 4096;
+			idx = realloc(idx, size * sizeof(idx_entry));
+		}
+		idx[idx_count].offset = p - map;
+		idx[idx_count].time = tod + days - first_tod;
+		idx[idx_count].alt = alt;
+		idx_count++;
+	}
+}
+
+int index_open(void)
+{
+	char path[1024];
+
+	if (map == NULL)
+	{
+		fprintf(stderr,"Input is not a plain file (a pipe, or compressed) - it can't be indexed\n");
+		return 0;
+	}
+
+	if (in_path)
+	{
+		snprintf(path, sizeof(path), "%s.idx", in_path);
+		if (load_index(path))
+			return idx_count;
+	}
+
+	build_index();
+	if (in_path)
+		save_index(path);
+	return idx_count;
+}
+
+double index_flight_time(double tod)
+{
+	if (tod < first_tod)
+		tod += 86400.0; // next day
+	return tod - first_tod;
+}
+
+double index_burst(void)
+{
+	long i, top = 0;
+
+	for (i = 1; i < idx_count; i++)
+		if (idx[i].alt > idx[top].alt)
+			top = i;
+	return idx_count ? idx[top].time : 0.0;
+}
+
+long long index_find(double flight_time)
+{
+	long lo = 0, hi = idx_count;
+
+	while (lo < hi)
+	{ // first entry at or after flight_time
+		long mid = (lo + hi) / 2;
+
+		if (idx[mid].time < flight_time)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < idx_count ? (long long)idx[lo].offset : -1;
+}
+
+long long index_offset(long i)
+{
+	return (i >= 0) && (i < idx_count) ? (long long)idx[i].offset : -1;
+}
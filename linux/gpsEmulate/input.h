@@ -0,0 +1,20 @@
+// input.h - NMEA log reader for gpsEmulate
+//
+// a log in a regular file is memory mapped - lines of any length are handed out without copying and
+// the log can be started from any point. Anything else (a pipe) is read a line at a time.
+//
+// the time index lists the file offset, flight time and altitude of every $GPGGA line. It is built
+// by one pass over the log and kept next to it in <log>.idx so later runs start straight away.
+
+int input_open(const char *path);				// NULL for standard input - returns 0 if it can't be read
+char *input_line(size_t *len);					// next line (not '\0' terminated, line ending removed) - NULL at the end
+unsigned long long input_offset(void);			// where the line last returned started
+int input_seek(unsigned long long offset);		// continue from offset - returns 0 if the input is not a file
+void input_unlock(void);						// don't keep the log locked in memory (after mlockall())
+void input_close(void);
+
+int index_open(void);							// load (or build and save) the time index - returns number of $GPGGA lines
+double index_flight_time(double tod);			// time of day (seconds since midnight) to seconds since the first $GPGGA
+double index_burst(void);						// flight time of the highest $GPGGA
+long long index_find(double flight_time);		// offset of the first $GPGGA at or after flight_time (-1 if none)
+long long index_offset(long i);					// offset of the i'th $GPGGA (-1 past the last)
@@ -0,0 +1,277 @@
+// livekml.c - the live track served to Google Earth over HTTP, a little at a time
+//
+// see livekml.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "stats.h"
+#include "livekml.h"
+
+typedef struct point
+{
+	double lat, lon, alt;
+} point;
+
+// a growing piece of text
+typedef struct text
+{
+	char *p;
+	size_t len, size;
+} text;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static point *points;				// every position so far, launch first
+static long npoints, points_size;
+static char launch_description[128];
+static int listen_fd = -1;
+static int port;
+static int refresh;
+
+static stat_counter *requests_stat, *bytes_stat, *update_stat;
+
+
+static void add(text *t, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	for (;;)
+	{
+		va_start(ap, fmt);
+		n = vsnprintf(t->p ? t->p + t->len : NULL, t->p ? t->size - t->len : 0, fmt, ap);
+		va_end(ap);
+		if ((n >= 0) && t->p && (t->len + n < t->size))
+			break;
+		t->size = t->size * 2 + n + 4096;
+		if ((t->p = realloc(t->p, t->size)) == NULL)
+		{
+			fprintf(stderr,"livekml: out of memory\n");
+			exit(1);
+		}
+	}
+	t->len += n;
+}
+
+static void add_header(text *t)
+{
+	add(t, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+	add(t, "<kml xmlns=\"http://www.opengis.net/kml/2.2\">\n");
+}
+
+static void add_launch(text *t)
+{
+	add(t, "<Placemark> <name>Launch</name> <styleUrl>#place</styleUrl>\n");
+	add(t, "<description>%s</description>\n", launch_description);
+	add(t, "<Point> <altitudeMode>absolute</altitudeMode>\n");
+	add(t, "<coordinates>%f,%f,%f</coordinates>\n", points[0].lon, points[0].lat, points[0].alt);
+	add(t, "</Point>\n</Placemark>\n");
+}
+
+// a piece of path through points[from] .. points[to - 1]
+static void add_path(text *t, long from, long to)
+{
+	long i;
+
+	add(t, "<Placemark> <styleUrl>#track</styleUrl>\n");
+	add(t, "<LineString> <extrude>1</extrude> <altitudeMode>absolute</altitudeMode>\n");
+	add(t, "<coordinates>\n");
+	for (i = from; i < to; i++)
+		add(t, "%f,%f,%f\n", points[i].lon, points[i].lat, points[i].alt);
+	add(t, "</coordinates>\n</LineString>\n</Placemark>\n");
+}
+
+// the document to open - links to the track and its updates
+static void live_kml(text *t)
+{
+	add_header(t);
+	add(t, "<Document> <name>gpsEmulate live track</name>\n");
+	add(t, "<NetworkLink> <name>Track</name>\n");
+	add(t, "<Link> <href>http://127.0.0.1:%d/track.kml</href> </Link>\n", port);
+	add(t, "</NetworkLink>\n");
+	add(t, "<NetworkLink> <name>Updates</name>\n");
+	add(t, "<Link> <href>http://127.0.0.1:%d/update.kml?since=0</href>\n", port); // track.kml starts empty
+	add(t, "<refreshMode>onInterval</refreshMode> <refreshInterval>%d</refreshInterval> </Link>\n", refresh);
+	add(t, "</NetworkLink>\n");
+	add(t, "</Document>\n</kml>\n");
+}
+
+// the document the updates are made to (only asked for once) - the styles, an empty path and the
+// current position. The path is all sent by the updates, starting with the first (since=0), so
+// however long after live.kml this is fetched no point is sent twice.
+static void track_kml(text *t)
+{
+	point now = npoints ? points[npoints - 1] : (point){0.0, 0.0, 0.0};
+
+	add_header(t);
+	add(t, "<Document>\n");
+	add(t, "<Style id=\"track\">\n");
+	add(t, "<LineStyle> <color>fff010c0</color> </LineStyle>\n");
+	add(t, "<PolyStyle> <color>3fc00880</color> </PolyStyle>\n");
+	add(t, "</Style>\n");
+	add(t, "<Style id=\"place\">\n");
+	add(t, "<IconStyle> <scale>1</scale> <Icon> <href>http://weather.uwyo.edu/icons/purple.gif</href> </Icon> </IconStyle>\n");
+	add(t, "</Style>\n");
+
+	add(t, "<Folder id=\"path\"> <name>Flight Path</name> </Folder>\n"); // updates add to this
+
+	add(t, "<Placemark> <name>Position Now</name> <styleUrl>#place</styleUrl>\n");
+	add(t, "<Point id=\"now\"> <altitudeMode>absolute</altitudeMode>\n"); // and change this
+	add(t, "<coordinates>%f,%f,%f</coordinates>\n", now.lon, now.lat, now.alt);
+	add(t, "</Point>\n</Placemark>\n");
+	add(t, "</Document>\n</kml>\n");
+}
+
+// what has been added since the client had since positions
+static void update_kml(text *t, long since)
+{
+	point now;
+
+	if ((since < 0) || (since > npoints))
+		since = 0; // we have restarted - send it all again
+	add_header(t);
+	add(t, "<NetworkLinkControl>\n");
+	add(t, "<cookie>since=%ld</cookie>\n", npoints);
+	if (since < npoints)
+	{
+		now = points[npoints - 1];
+		add(t, "<Update> <targetHref>http://127.0.0.1:%d/track.kml</targetHref>\n", port);
+		add(t, "<Create> <Folder targetId=\"path\">\n");
+		if (since == 0)
+			add_launch(t);
+		add_path(t, since ? since - 1 : 0, npoints); // from the last one it has, so the path joins up
+		add(t, "</Folder> </Create>\n");
+		add(t, "<Change> <Point targetId=\"now\"> <coordinates>%f,%f,%f</coordinates> </Point> </Change>\n",
+			now.lon, now.lat, now.alt);
+		add(t, "</Update>\n");
+	}
+	add(t, "</NetworkLinkControl>\n</kml>\n");
+}
+
+// read a request and answer it
+static void answer(int fd)
+{
+	char req[4096], method[16], path[256], head[256];
+	const char *status = "200 OK", *since;
+	text t = {NULL, 0, 0};
+	size_t have = 0;
+	ssize_t n;
+	int len;
+
+	while ((have < sizeof(req) - 1) && ((n = recv(fd, req + have, sizeof(req) - 1 - have, 0)) > 0))
+	{
+		have += n;
+		req[have] = '\0';
+		if (strstr(req, "\r\n\r\n"))
+			break;
+	}
+	req[have] = '\0';
+	if (sscanf(req, "%15s %255s", method, path) != 2)
+		return;
+
+	pthread_mutex_lock(&lock);
+	if (strncmp(path, "/live.kml", 9) == 0)
+		live_kml(&t);
+	else if (strncmp(path, "/track.kml", 10) == 0)
+		track_kml(&t);
+	else if (strncmp(path, "/update.kml", 11) == 0)
+	{ // the last since= - Google Earth adds the cookie after the one in the link
+		for (since = strstr(path, "since="); since && strstr(since + 1, "since="); since = strstr(since + 1, "since="))
+			;
+		update_kml(&t, since ? atol(since + 6) : 0);
+		stats_set(update_stat, t.len);
+	}
+	else
+	{
+		status = "404 Not Found";
+		add(&t, "try /live.kml\n");
+	}
+	pthread_mutex_unlock(&lock);
+
+	len = snprintf(head, sizeof(head), "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+		status, status[0] == '2' ? "application/vnd.google-earth.kml+xml" : "text/plain", t.len);
+	if ((send(fd, head, len, MSG_NOSIGNAL) == len) && (strcmp(method, "HEAD") != 0))
+		send(fd, t.p, t.len, MSG_NOSIGNAL);
+	stats_add(requests_stat, 1);
+	stats_add(bytes_stat, len + t.len);
+	free(t.p);
+}
+
+static void *server(void *arg)
+{
+	struct timeval tv = {2, 0};
+	int fd;
+
+	while (1)
+	{
+		if ((fd = accept(listen_fd, NULL, NULL)) < 0)
+			continue;
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)); // a client that says nothing doesn't hold up the rest
+		answer(fd);
+		close(fd);
+	}
+	return NULL;
+}
+
+int livekml_start(int p, int r)
+{
+	struct sockaddr_in addr;
+	pthread_t th;
+	int on = 1;
+
+	port = p;
+	refresh = r;
+	if ((listen_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+		return 0;
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // Google Earth on this machine only
+	addr.sin_port = htons(port);
+	// before the server thread - it counts the first request
+	requests_stat = stats_counter("gpsemulate_kml_requests_total","Live KML requests answered",NULL);
+	bytes_stat = stats_counter("gpsemulate_kml_bytes_total","Live KML bytes sent",NULL);
+	update_stat = stats_gauge("gpsemulate_kml_update_bytes","Size of the last live KML update",NULL);
+	if ((bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) || (listen(listen_fd, 16) != 0)
+		|| (pthread_create(&th, NULL, server, NULL) != 0))
+	{
+		close(listen_fd);
+		listen_fd = -1;
+		return 0;
+	}
+	pthread_detach(th);
+	fprintf(stderr,"Live KML on http://127.0.0.1:%d/live.kml\n", port);
+	return 1;
+}
+
+void livekml_point(double lat, double lon, double alt, const char *description)
+{
+	point *p;
+
+	if (listen_fd < 0)
+		return;
+	pthread_mutex_lock(&lock);
+	if (npoints == points_size)
+	{
+		if ((p = realloc(points, (points_size ? points_size * 2 : 1024) * sizeof(*p))) == NULL)
+		{
+			pthread_mutex_unlock(&lock);
+			return;
+		}
+		points = p;
+		points_size = points_size ? points_size * 2 : 1024;
+	}
+	if (npoints == 0)
+		snprintf(launch_description, sizeof(launch_description), "%s", description);
+	points[npoints].lat = lat;
+	points[npoints].lon = lon;
+	points[npoints++].alt = alt;
+	pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,23 @@
+// livekml.h - the live track served to Google Earth over HTTP, a little at a time
+//
+// livekml.kml on disk has to be read again from the top on every refresh, so the longer the flight the
+// more each refresh costs. Served from localhost:port instead, Google Earth loads the track once and
+// then only asks for what has been added since it last asked
+//	/live.kml		open this (File > Open, or Add > Network Link) - two network links, to these
+//	/track.kml		loaded once - the styles, an empty path folder and the current position
+//	/update.kml		refreshed every few seconds - a <NetworkLinkControl><Update> that <Create>s a piece of
+//					path joining on the new positions and <Change>s the current position to the latest.
+//					The first (since=0) creates the launch placemark and the whole path so far.
+//					Its <cookie> holds how many positions the client has, and Google Earth sends it back
+//					on the next refresh, so each answer is the same size however long the flight has been.
+//
+// the server runs in its own thread; connections are answered one at a time and closed.
+//
+// metrics
+//	gpsemulate_kml_requests_total		requests answered
+//	gpsemulate_kml_bytes_total			bytes sent
+//	gpsemulate_kml_update_bytes			size of the last /update.kml answer
+
+int livekml_start(int port, int refresh);	// serve on localhost:port, Google Earth refreshing every refresh seconds
+void livekml_point(double lat, double lon, double alt, const char *description);	// the next position (the
+																				// first is the launch site)
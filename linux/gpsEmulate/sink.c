@@ -0,0 +1,516 @@
+// sink.c - fan the paced NMEA out to several readers, each with its own non-blocking ring buffer
+//
+// what we open ourselves is made O_NONBLOCK. Standard output isn't - its file description is shared
+// with the shell (and with stderr when both are the terminal), so O_NONBLOCK would make diagnostics
+// fail with EAGAIN and leave the terminal non-blocking after we exit. It is written only when poll()
+// says it has room, PIPE_BUF at a time, so the write doesn't block either.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <termios.h>
+#include <netdb.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "stats.h"
+#include "vclock.h"
+#include "zio.h"
+#include "sink.h"
+
+#define MAX_SINKS 64		// including TCP clients
+
+#define SK_FD		0		// stdout, file, pty or TCP client - written through the ring
+#define SK_LISTEN	1		// TCP port clients connect to
+#define SK_UDP		2		// connected UDP socket - a datagram per line, never queued
+
+// metrics are per -o sink (all of a TCP port's clients share them)
+typedef struct sink_stats
+{
+	stat_counter *bytes;		// bytes written
+	stat_counter *dropped;		// lines thrown away
+	stat_counter *queued;		// bytes waiting in the ring (the fullest client's for TCP)
+	stat_counter *clients;		// TCP clients connected
+	stat_counter *kicked;		// TCP clients disconnected for falling too far behind
+} sink_stats;
+
+typedef struct sink
+{
+	int kind;
+	int fd;
+	int policy;
+	char *name;
+	char *ring;				// circular buffer of bytes waiting to be written
+	size_t size;			// power of 2
+	size_t head;			// first byte waiting
+	size_t len;				// bytes waiting
+	sink_stats *stats;
+	int slave_fd;			// pty - our own open of the other end so it never reads as hung up
+	int shared;				// standard output - left blocking, see fd_writev()
+} sink;
+
+static sink *sinks[MAX_SINKS];
+static int nsinks;
+
+
+static sink_stats *new_stats(const char *spec)
+{
+	sink_stats *st = calloc(1, sizeof(*st));
+	char labels[STAT_LABELS];
+
+	snprintf(labels, sizeof(labels), "sink=\"%.50s\"", spec);
+	st->bytes = stats_counter("gpsemulate_sink_bytes_total","Bytes written to a sink",labels);
+	st->dropped = stats_counter("gpsemulate_sink_dropped_lines_total","Lines thrown away because a sink's ring was full",labels);
+	st->queued = stats_gauge("gpsemulate_sink_queued_bytes","Bytes waiting in a sink's ring buffer",labels);
+	if (strncmp(spec, "tcp:", 4) == 0)
+	{
+		st->clients = stats_gauge("gpsemulate_sink_clients","TCP clients connected",labels);
+		st->kicked = stats_counter("gpsemulate_sink_kicked_total","TCP clients disconnected for falling too far behind",labels);
+	}
+	return st;
+}
+
+static sink *new_sink(int kind, int fd, int policy, const char *name, sink_stats *st)
+{
+	sink *s;
+
+	if (nsinks == MAX_SINKS)
+	{
+		fprintf(stderr,"Too many sinks - %s not added\n", name);
+		return NULL;
+	}
+	s = calloc(1, sizeof(*s));
+	s->kind = kind;
+	s->fd = fd;
+	s->policy = policy;
+	s->name = strdup(name);
+	s->stats = st;
+	s->slave_fd = -1;
+	if (kind == SK_FD)
+	{
+		s->size = SINK_RING;
+		s->ring = malloc(s->size);
+		if ((s->shared = fd == 1) == 0)
+			fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	}
+	sinks[nsinks++] = s;
+	return s;
+}
+
+static void remove_sink(int i)
+{
+	sink *s = sinks[i];
+
+	if (s->stats->clients && (s->kind == SK_FD))
+		stats_add(s->stats->clients, -1);
+	zio_close(s->fd);
+	if (s->slave_fd >= 0)
+		close(s->slave_fd);
+	free(s->ring);
+	free(s->name);
+	free(s);
+	sinks[i] = sinks[--nsinks];
+}
+
+static int open_tcp(const char *port)
+{
+	struct sockaddr_in addr;
+	int fd, on = 1;
+
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+		return -1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // test rigs only - not on the network
+	addr.sin_port = htons(atoi(port));
+	if ((bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) || (listen(fd, 16) != 0))
+	{
+		close(fd);
+		return -1;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	return fd;
+}
+
+static int open_udp(const char *host_port)
+{
+	struct addrinfo hints, *res;
+	char host[256], *port;
+	int fd;
+
+	snprintf(host, sizeof(host), "%s", host_port);
+	if ((port = strrchr(host, ':')) == NULL)
+		return -1;
+	*port++ = '\0';
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	if (getaddrinfo(host, port, &hints, &res) != 0)
+		return -1;
+	if ((fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) >= 0)
+	{
+		if (connect(fd, res->ai_addr, res->ai_addrlen) != 0)
+		{
+			close(fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+
+static int open_pty(int *slave)
+{
+	struct termios tio;
+	int fd;
+
+	if ((fd = posix_openpt(O_RDWR | O_NOCTTY)) < 0)
+		return -1;
+	if ((grantpt(fd) != 0) || (unlockpt(fd) != 0) || ((*slave = open(ptsname(fd), O_RDWR | O_NOCTTY)) < 0))
+	{
+		close(fd);
+		return -1;
+	}
+	tcgetattr(*slave, &tio);
+	cfmakeraw(&tio); // no echo or line editing - NMEA straight through
+	tcsetattr(*slave, TCSANOW, &tio);
+	fprintf(stderr,"NMEA on %s\n", ptsname(fd));
+	return fd;
+}
+
+int sink_add(const char *spec, int policy)
+{
+	int fd, kind = SK_FD, slave = -1, file = 0;
+	sink *s;
+
+	signal(SIGPIPE, SIG_IGN); // a reader going away is an error return, not the end of us
+
+	if (strcmp(spec, "-") == 0)
+		fd = 1;
+	else if (strcmp(spec, "pty") == 0)
+		fd = open_pty(&slave);
+	else if (strncmp(spec, "tcp:", 4) == 0)
+	{
+		fd = open_tcp(spec + 4);
+		kind = SK_LISTEN;
+	}
+	else if (strncmp(spec, "udp:", 4) == 0)
+	{
+		fd = open_udp(spec + 4);
+		kind = SK_UDP;
+	}
+	else
+	{
+		fd = zio_append(spec);		// .gz / .zst compressed as it goes
+		file = 1;
+	}
+
+	if (fd < 0)
+	{
+		fprintf(stderr,"Can't open %s: %s\n", spec, strerror(errno));
+		return 0;
+	}
+
+	if ((s = new_sink(kind, fd, policy, spec, new_stats(spec))) == NULL)
+	{
+		zio_close(fd);
+		return 0;
+	}
+	s->slave_fd = slave;
+	if (file) // a compressed file is a pipe to its compressor - wait for it rather than drop lines
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+	return 1;
+}
+
+
+// ************************************* ring buffers *************************************
+
+// make room for len more bytes by doubling the ring (lag policy) - returns 0 if it would be too big
+static int ring_grow(sink *s, size_t len)
+{
+	size_t size = s->size, first;
+	char *ring;
+
+	while (s->len + len > size)
+		size *= 2;
+	if (size > SINK_MAX_LAG)
+		return 0;
+
+	ring = malloc(size);
+	first = s->size - s->head < s->len ? s->size - s->head : s->len;
+	memcpy(ring, s->ring + s->head, first);
+	memcpy(ring + first, s->ring, s->len - first);
+	free(s->ring);
+	s->ring = ring;
+	s->size = size;
+	s->head = 0;
+	return 1;
+}
+
+static int ring_put(sink *s, const char *data, size_t len)
+{
+	size_t tail, first;
+
+	if ((s->len + len > s->size) && ((s->policy != SINK_LAG) || !ring_grow(s, len)))
+		return 0;
+
+	tail = (s->head + s->len) & (s->size - 1);
+	first = s->size - tail < len ? s->size - tail : len;
+	memcpy(s->ring + tail, data, first);
+	memcpy(s->ring, data + first, len - first);
+	s->len += len;
+	return 1;
+}
+
+// writev() that doesn't block - standard output (still blocking) only when poll() says there is room,
+// and no more than PIPE_BUF, which a pipe or terminal with room always takes whole
+static ssize_t fd_writev(sink *s, struct iovec *iov, int cnt)
+{
+	struct pollfd pfd;
+
+	if (s->shared)
+	{
+		pfd.fd = s->fd;
+		pfd.events = POLLOUT;
+		if (poll(&pfd, 1, 0) <= 0)
+		{
+			errno = EAGAIN; // full (or interrupted) - it goes in the ring
+			return -1;
+		}
+		if (iov[0].iov_len >= PIPE_BUF)
+		{
+			iov[0].iov_len = PIPE_BUF;
+			cnt = 1;
+		}
+		else if ((cnt > 1) && (iov[0].iov_len + iov[1].iov_len > PIPE_BUF))
+			iov[1].iov_len = PIPE_BUF - iov[0].iov_len;
+	}
+	return writev(s->fd, iov, cnt);
+}
+
+// write as much of the ring as the reader will take - returns -1 if the reader has gone
+static int ring_flush(sink *s)
+{
+	struct iovec iov[2];
+	ssize_t n;
+	int cnt;
+
+	while (s->len)
+	{
+		iov[0].iov_base = s->ring + s->head;
+		iov[0].iov_len = s->size - s->head < s->len ? s->size - s->head : s->len;
+		iov[1].iov_base = s->ring;
+		iov[1].iov_len = s->len - iov[0].iov_len;
+		cnt = iov[1].iov_len ? 2 : 1;
+
+		if ((n = fd_writev(s, iov, cnt)) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return ((errno == EAGAIN) || (errno == EWOULDBLOCK)) ? 0 : -1;
+		}
+		stats_add(s->stats->bytes, n);
+		s->head = (s->head + n) & (s->size - 1);
+		s->len -= n;
+	}
+	s->head = 0; // empty - start at the beginning so most lines go in one piece
+	return 0;
+}
+
+static void sink_failed(int i, const char *why)
+{
+	if (sinks[i]->stats->clients == NULL)
+		fprintf(stderr,"%s: %s - no longer written to\n", sinks[i]->name, why);
+	remove_sink(i);
+}
+
+void sink_write(const char *data, size_t len)
+{
+	struct iovec iov;
+	sink *s;
+	ssize_t n;
+	int i;
+
+	for (i = 0; i < nsinks; i++)
+	{
+		s = sinks[i];
+		if (s->kind == SK_LISTEN)
+			continue;
+
+		if (s->kind == SK_UDP)
+		{
+			if (send(s->fd, data, len, MSG_DONTWAIT) == (ssize_t)len)
+				stats_add(s->stats->bytes, len);
+			else
+				stats_add(s->stats->dropped, 1); // nobody listening or socket buffer full
+			continue;
+		}
+
+		if (s->len && (ring_flush(s) < 0))
+		{
+			sink_failed(i--, strerror(errno));
+			continue;
+		}
+
+		n = 0;
+		if (s->len == 0)
+		{ // nothing waiting - try to write it straight out without copying
+			iov.iov_base = (void *)data;
+			iov.iov_len = len;
+			if ((n = fd_writev(s, &iov, 1)) < 0)
+			{
+				if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+				{
+					sink_failed(i--, strerror(errno));
+					continue;
+				}
+				n = 0;
+			}
+			stats_add(s->stats->bytes, n);
+		}
+
+		if (((size_t)n < len) && !ring_put(s, data + n, len - n))
+		{
+			if ((s->policy == SINK_LAG) && s->stats->kicked)
+			{ // this client is too far behind to be any use
+				stats_add(s->stats->kicked, 1);
+				remove_sink(i--);
+				continue;
+			}
+			stats_add(s->stats->dropped, 1);
+		}
+	}
+}
+
+
+// ************************************* waiting *************************************
+
+static void accept_clients(sink *listener)
+{
+	int fd;
+
+	while ((fd = accept(listener->fd, NULL, NULL)) >= 0)
+	{
+		if (new_sink(SK_FD, fd, listener->policy, listener->name, listener->stats) == NULL)
+			close(fd);
+		else
+			stats_add(listener->stats->clients, 1);
+	}
+}
+
+// one round of waiting on the sinks for up to real_ns - returns what ppoll() did
+static int poll_sinks(unsigned long long real_ns)
+{
+	struct pollfd pfd[MAX_SINKS];
+	sink *polled[MAX_SINKS];
+	struct timespec ts;
+	char discard[512];
+	int i, n, m, r;
+
+	n = 0;
+	for (i = 0; i < nsinks; i++)
+	{
+		pfd[n].fd = sinks[i]->fd;
+		pfd[n].events = 0;
+		if (sinks[i]->kind == SK_LISTEN)
+			pfd[n].events = POLLIN;
+		else if (sinks[i]->kind == SK_FD)
+		{
+			if (sinks[i]->len)
+				pfd[n].events |= POLLOUT;
+			if (sinks[i]->stats->clients)
+				pfd[n].events |= POLLIN; // TCP client - notice it going away
+		}
+		if (pfd[n].events)
+			polled[n++] = sinks[i];
+	}
+
+	ts.tv_sec = real_ns / 1000000000ull;
+	ts.tv_nsec = real_ns % 1000000000ull;
+	if ((r = ppoll(pfd, n, &ts, NULL)) <= 0)
+		return r;
+
+	for (i = 0; i < n; i++)
+	{
+		if (pfd[i].revents == 0)
+			continue;
+		if (polled[i]->kind == SK_LISTEN)
+		{
+			accept_clients(polled[i]);
+			continue;
+		}
+		if (pfd[i].revents & POLLIN)
+		{ // clients don't talk to us - anything they send is ignored
+			if (read(pfd[i].fd, discard, sizeof(discard)) == 0)
+				pfd[i].revents |= POLLHUP;
+		}
+		if ((pfd[i].revents & POLLOUT) && (ring_flush(polled[i]) < 0))
+			pfd[i].revents |= POLLERR;
+		if (pfd[i].revents & (POLLHUP | POLLERR))
+		{
+			for (m = 0; (m < nsinks) && (sinks[m] != polled[i]); m++)
+				;
+			sink_failed(m, "reader has gone");
+		}
+	}
+	return r;
+}
+
+void sink_wait(unsigned long long deadline_ns)
+{
+	unsigned long long now;
+	int i;
+
+	do
+	{
+		now = vclock_now();
+		if (poll_sinks(now < deadline_ns ? vclock_real_ns(deadline_ns - now) : 0) == 0)
+			vclock_sleep_until(deadline_ns); // timed out - a virtual clock jumps straight there
+	}
+	while (vclock_now() < deadline_ns);
+
+	// fill in the ring depths (the deepest of a TCP port's clients)
+	for (i = 0; i < nsinks; i++)
+		if (sinks[i]->kind == SK_LISTEN)
+			stats_set(sinks[i]->stats->queued, 0);
+	for (i = 0; i < nsinks; i++)
+		if ((sinks[i]->kind == SK_FD) && ((sinks[i]->stats->clients == NULL) || (sinks[i]->len > (size_t)sinks[i]->stats->queued->value)))
+			stats_set(sinks[i]->stats->queued, sinks[i]->len);
+}
+
+void sink_close(double linger)
+{
+	unsigned long long deadline = stats_now() + (unsigned long long)(linger * 1e9);
+	int i, waiting;
+
+	do
+	{
+		for (i = waiting = 0; i < nsinks; i++)
+			if (sinks[i]->len)
+				waiting = 1;
+		if (waiting)
+			poll_sinks(10000000ull); // 10ms at a time, in real time whatever the vclock
+	}
+	while (waiting && (stats_now() < deadline));
+
+	for (i = 0; i < nsinks; i++)
+		if (sinks[i]->len)
+			fprintf(stderr,"%s: %lu bytes not written\n", sinks[i]->name, (unsigned long)sinks[i]->len);
+
+	while (nsinks)
+	{
+		if (sinks[0]->fd == 1)
+			sinks[0]->fd = dup(1); // leave standard output open
+		remove_sink(0);
+	}
+}
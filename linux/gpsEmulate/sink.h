@@ -0,0 +1,26 @@
+// sink.h - where gpsEmulate's paced output goes
+//
+// the same stream can go to several places at once
+//	-				standard output (the serial port when re-directed)
+//	pty				a new pseudo terminal (its name is printed) for programs that want a serial port
+//	tcp:port		any number of clients connecting to localhost:port (like gpsd's raw NMEA port)
+//	udp:host:port	datagrams, one line each
+//	anything else	a file (appended to)
+//
+// every sink (and every TCP client) has its own ring buffer and is written non-blocking, so a slow
+// reader only falls behind itself - it never holds up the pacing or the other sinks. When a ring is
+// full the sink's policy decides what happens
+//	drop			the new line is thrown away (the reader sees gaps but stays current)
+//	lag				the ring grows (to SINK_MAX_LAG) so the reader sees everything, late - past that
+//					a TCP client is disconnected, anything else drops
+
+#define SINK_DROP	0
+#define SINK_LAG	1
+
+#define SINK_RING	65536		// starting ring size (bytes)
+#define SINK_MAX_LAG 1048576	// largest a lagging ring can grow
+
+int sink_add(const char *spec, int policy);					// returns 0 if it can't be opened
+void sink_write(const char *data, size_t len);				// queue one line for every sink
+void sink_wait(unsigned long long deadline_ns);				// write out and accept clients until deadline (vclock ns)
+void sink_close(double linger);								// give readers up to linger seconds to catch up, then close
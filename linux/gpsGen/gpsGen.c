@@ -24,6 +24,45 @@
 //	Course and direction are calculated between the "from" and "to" co-ordinates and apply 
 //  to all samples between the points.
 //
+// the segment times are summed into a flight profile (see flight.h) once the KML has been read, and each
+// second's fix looked up in that - so the output can start part way through the flight (-s) without
+// generating what comes before.
+//
+// options
+//	-b baud		model a serial link - send each epoch at its 1 second time with each sentence held back
+//				until a UART at this baud rate (8N1, 16 byte FIFO) would have room for it, and report
+//				epochs whose sentences don't fit in the second
+//	-B			burst - send the epochs back to back (as fast as the -b link allows) to find the highest
+//				epoch rate the link can carry
+//	-k clock	what -b runs to - real (default), a speed factor, or virtual (no waiting) - see vclock.h
+//	-T start	time of the first fix (yyyy-mm-ddThh:mm:ss UTC or seconds since 1970) rather than now -
+//				the output is then the same every run
+//	-i file		read the KML from a file rather than standard input - .kmz, .gz (and .zst) are
+//				read as they are
+//	-o file		write the log to a file rather than standard output - compressed if it ends .gz
+//				(or .zst), see zio.h
+//	-u callsign	write UKHAS telemetry (as postdata uploads) rather than NMEA - one sentence a second
+//				(a callsign of at most 32 characters)
+//					$$CALLSIGN,count,hh:mm:ss,lat,lon,alt,speed,course,sats*CRC16
+//	-f fields	the fields after the callsign, comma separated, from count, time, lat, lon, alt, speed
+//				(km/h), course and sats (default all of them in that order) - and stamp, when the sentence
+//				was written (CLOCK_MONOTONIC microseconds) for pipeBench to time it through the pipeline
+//	-r rate		epochs (NMEA) or sentences (UKHAS) per second - each still 1 second of flight time, so
+//				-r 100 flies 100 times faster. 0 (the default) is as fast as the output will take them
+//	-n times	fly the flight this many times, time and sentence count carrying on - e.g.
+//				gpsGen -q -u LOADTEST -n 100 -i spiral.kml -o load.txt.gz for a million sentences
+//	-s secs		start this many seconds after launch (the first fix is still at -T or now)
+//	-e secs		stop this many seconds after launch
+//	-w epochs	epochs gathered for each write when not paced (default 64) - see epochio.h
+//	-U			write with io_uring (where the kernel has it) rather than writev
+//	-q			no progress messages for each coordinate
+//	--profile	print where the time went at the end - reading the KML, interpolation, formatting, checksum,
+//				output and waiting (see profile.h)
+//
+// without -b the output is written as fast as standard output will take it, each epoch (or -w of them)
+// with one system call - so a reader never sees part of an epoch. How many calls that took, and the
+// throughput, are printed at the end (unless -q).
+//
  
  
 #include <stdio.h>
@@ -31,27 +70,59 @@
 #include <math.h>
 #include <string.h>
 #include <time.h>
+#include "shaper.h"
+#include "vclock.h"
+#include "zio.h"
+#include "crc16.h"
+#include "flight.h"
+#include "epochio.h"
+#include "profile.h"
  
-// radians to degrees
-#define DEGREES(x) ((x) * 57.295779513082320877) 
-// degrees to radians
-#define RADIANS(x) ((x) / 57.295779513082320877)
- 
-#define LOG_BASE 1.4142135623730950488
-#define LOG_POWER 5300.0
- 
-time_t Now;					// the time of starting this program 
+time_t Now;					// the time of starting this program (or -T)
  
 char buf[128];
+
+shaper link;				// -b
+int baud = 0;
+int burst = 0;				// -B
+long epochs = 0;
+unsigned long long next_epoch;	// when the next epoch is due to start (-b or -r)
+double rate = 0;			// -r
+unsigned long long epoch_ns = 1000000000ull;
+
+#define F_COUNT		0		// UKHAS fields (-f)
+#define F_TIME		1
+#define F_LAT		2
+#define F_LON		3
+#define F_ALT		4
+#define F_SPEED		5
+#define F_COURSE	6
+#define F_SATS		7
+#define F_STAMP		8
+#define MAX_FIELDS	32
+#define MAX_CALLSIGN	32
+
+const char *field_names[] = {"count", "time", "lat", "lon", "alt", "speed", "course", "sats", "stamp", NULL};
+char *Callsign = NULL;		// -u
+int fields[MAX_FIELDS] = {F_COUNT, F_TIME, F_LAT, F_LON, F_ALT, F_SPEED, F_COURSE, F_SATS};
+int nfields = 8;
+unsigned long sentence_count = 0;
+int quiet = 0;				// -q
+epochio eo;					// the output, an epoch at a time (unless -b)
+int batch = 64;				// -w
+int uring = 0;				// -U
+int s_read, s_interpolate, s_format, s_checksum, s_output, s_wait;	// --profile stages
  
 // calculate a CRC for the line of input
 void do_crc(char *pch)
 {
 	unsigned char crc;
+	profile_scope ps;
  
 	if (*pch != '$') 
 		return;		// does not start with '$' - so can't CRC
  
+	profile_begin(&ps, s_checksum);
 	pch++;			// skip '$'
 	crc = 0;
  
@@ -65,9 +136,100 @@ void do_crc(char *pch)
 	// add or re-write checksum
  
 	sprintf(pch,"*%02X\r\n",(unsigned int)crc);
+	profile_end(&ps);
 }
  
  
+// write a sentence - held back by the modelled serial link (-b), otherwise gathered into the epoch
+void write_nmea(char *pch)
+{
+	profile_scope ps;
+
+	profile_begin(&ps, s_output);
+	if (baud)
+	{
+		shaper_sleep_until(shaper_send(&link, strlen(pch)));
+		fputs(pch,stdout);
+		fflush(stdout);
+	}
+	else
+		epochio_add(&eo, pch, strlen(pch));
+	profile_end(&ps);
+}
+
+// the same for a sentence that never changes - not copied
+void write_const(char *pch)
+{
+	profile_scope ps;
+
+	if (baud)
+		write_nmea(pch);
+	else
+	{
+		profile_begin(&ps, s_output);
+		epochio_ref(&eo, pch, strlen(pch));
+		profile_end(&ps);
+	}
+}
+
+// the epoch's sentences are all written (or gathered)
+void end_epoch(void)
+{
+	profile_scope ps;
+
+	if (!baud)
+	{
+		profile_begin(&ps, s_output);
+		epochio_end(&eo);
+		profile_end(&ps);
+	}
+}
+
+// a new epoch is starting - check the last one fitted on the link and wait for this one's time
+void start_epoch(void)
+{
+	profile_scope ps;
+
+	if ((baud == 0) && (rate == 0))
+		return;
+
+	if (epochs++ == 0)
+		next_epoch = shaper_now();
+	else if (baud && shaper_epoch(&link, epoch_ns))
+		fprintf(stderr,"Overrun: %.0f bytes need %.0f ms at %d baud\n", link.last_use * epoch_ns / link.char_ns, link.last_use * epoch_ns / 1e6, baud);
+
+	if (!burst)
+	{
+		profile_begin(&ps, s_output);
+		fflush(stdout);
+		epochio_flush(&eo);
+		profile_end(&ps);
+		profile_begin(&ps, s_wait);
+		shaper_sleep_until(next_epoch);
+		profile_end(&ps);
+		next_epoch += epoch_ns;
+	}
+}
+
+// the -f list - 0 if a field isn't known
+int parse_fields(const char *list)
+{
+	char copy[256], *f;
+	int i;
+
+	snprintf(copy, sizeof(copy), "%s", list);
+	nfields = 0;
+	for (f = strtok(copy, ","); f; f = strtok(NULL, ","))
+	{
+		for (i = 0; field_names[i] && strcmp(field_names[i], f); i++)
+			;
+		if ((field_names[i] == NULL) || (nfields == MAX_FIELDS))
+			return 0;
+		fields[nfields++] = i;
+	}
+	return nfields > 0;
+}
+
 // Speed in Kph 
 // Course over ground relative to North
 //
@@ -89,6 +251,7 @@ void Output_NEMA(time_t Time, double Lat, double Lon, double Alt, double Course,
 	double LonMin;				// longtitude - minute part
 	char LonDir;				// longtitude - direction E/W
 	struct tm *ptm;
+	static char gsa[80], gsv1[80], gsv2[80];	// the same every time
  
 	ptm = gmtime(&Time);
  
@@ -110,11 +273,13 @@ void Output_NEMA(time_t Time, double Lat, double Lon, double Alt, double Course,
 	LonDeg = (int)(Lon);
 	LonMin = (Lon - (double)LonDeg) * 60.0;
  
+	start_epoch();
+
 	// $GPGGA - 1st in epoc - 5 satellites in view, FixQual = 1, 45m Geoidal separation HDOP = 2.4
 	sprintf(buf,"$GPGGA,%02d%02d%02d.000,%02d%07.4f,%c,%03d%07.4f,%c,1,05,02.4,%.1f,M,45.0,M,,*",
 		ptm->tm_hour,ptm->tm_min,ptm->tm_sec,LatDeg,LatMin,LatDir,LonDeg,LonMin,LonDir,Alt);
 	do_crc(buf); // add CRC to buf
-	fputs(buf,stdout);
+	write_nmea(buf);
  
  
 	switch((int)Time % 3)
@@ -124,23 +289,32 @@ void Output_NEMA(time_t Time, double Lat, double Lon, double Alt, double Course,
  
 	case 1:
 		// 3D fix - 5 satellites (3,7,18,19 & 22) in view. PDOP = 3.3,HDOP = 2.4, VDOP = 2.3
-		sprintf(buf,"$GPGSA,A,3,03,07,18,19,22,,,,,,,,3.3,2.4,2.3*");
-		do_crc(buf); // add CRC to buf
-		fputs(buf,stdout);
+		if (gsa[0] == '\0')
+		{
+			sprintf(gsa,"$GPGSA,A,3,03,07,18,19,22,,,,,,,,3.3,2.4,2.3*");
+			do_crc(gsa); // add CRC to gsa
+		}
+		write_const(gsa);
 		break;
  
 	case 2:
 		// two lines og GPGSV messages - 1st line of 2, 8 satellites being tracked in total
 		// 03,07 in view 11,12 being tracked
-		sprintf(buf,"$GPGSV,2,1,08,03,89,276,30,07,63,181,22,11,,,,12,,,*");
-		do_crc(buf); // add CRC to buf
-		fputs(buf,stdout);
+		if (gsv1[0] == '\0')
+		{
+			sprintf(gsv1,"$GPGSV,2,1,08,03,89,276,30,07,63,181,22,11,,,,12,,,*");
+			do_crc(gsv1); // add CRC to gsv1
+		}
+		write_const(gsv1);
  
 		// GPGSV 2nd line of 2, 8 satellites being tracked in total
 		// 18,19,22 in view 27 being tracked
-		sprintf(buf,"$GPGSV,2.2,08,18,73,111,35,19,33,057,27,22,57,173,37,27,,,*");
-		do_crc(buf); // add CRC to buf
-		fputs(buf,stdout);
+		if (gsv2[0] == '\0')
+		{
+			sprintf(gsv2,"$GPGSV,2.2,08,18,73,111,35,19,33,057,27,22,57,173,37,27,,,*");
+			do_crc(gsv2); // add CRC to gsv2
+		}
+		write_const(gsv2);
 		break;
 	}
  
@@ -148,81 +322,105 @@ void Output_NEMA(time_t Time, double Lat, double Lon, double Alt, double Course,
 	sprintf(buf,"$GPRMC,%02d%02d%02d.000,A,%02d%07.4f,%c,%03d%07.4f,%c,%.2f,%.2f,%02d%02d%02d,,,A*",
 		ptm->tm_hour,ptm->tm_min,ptm->tm_sec,LatDeg,LatMin,LatDir,LonDeg,LonMin,LonDir,Speed * 1.943844,Course,ptm->tm_mday,ptm->tm_mon + 1,ptm->tm_year % 100);
 	do_crc(buf); // add CRC to buf
-	fputs(buf,stdout);
+	write_nmea(buf);
  
 	// $GPVTG message last in epoc
 	sprintf(buf,"$GPVTG,%.2f,T,,,%.2f,N,%.2f,K,A*",Course,Speed * 1.943844,Speed * 3.6);
 	do_crc(buf); // add CRC to buf
-	fputs(buf,stdout);
+	write_nmea(buf);
+
+	end_epoch();
 }
  
  
-// do a KML segment between two coordinates
- 
-void do_segment(double FromLat, double FromLon, double FromAlt, double ToLat, double ToLon, double ToAlt)
+// Output_UKHAS - Output the position as a UKHAS telemetry sentence
+// Latitude & Longtitude in degrees, Altitude in meters Speed in meters/sec
+
+void Output_UKHAS(time_t Time, double Lat, double Lon, double Alt, double Course, double Speed)
 {
-	double Rate;			// ascent(+ve) / decent(-ve) rate meters per second (for segment)
-	int Duration;			// calculated segment duration in seconds
-	double Elapsed;			// floating point duration
-	double Lat,Lon,Alt;		// clacualted for each step
-	double	Course,Speed;	// calculated for entire segment
-	double Distance;		// distance between coordinates
-	double DeltaLat,DeltaLon,DeltaAlt;	// Latitude, Longtitude and Altitude differences
-	double AdjLon;			// Adjusted Longtitude difference
-	int i;					// counter
- 
-	DeltaAlt = (ToAlt - FromAlt);
-	DeltaLat = (ToLat - FromLat);
-	DeltaLon = (ToLon - FromLon);
- 
-	if (DeltaAlt >= 0)
-	{ // ascending
-		Rate = 5.0;
-	}
-	else 
-	{ // descending - calculate the geometric mean of the expected velocities at To and From altitude
-		Rate = -5.0 * sqrt(pow(LOG_BASE,(FromAlt / LOG_POWER)) * pow(LOG_BASE,(ToAlt / LOG_POWER))); 
+	char line[64 + MAX_FIELDS * 24];
+	const int room = sizeof(line) - 8;	// what the fields may use - the rest is for *CRC16
+	struct timespec ts;
+	struct tm *ptm;
+	profile_scope ps;
+	int n, i;
+
+	ptm = gmtime(&Time);
+
+	start_epoch();
+
+	n = snprintf(line,room,"$$%s",Callsign);
+	for (i = 0; i < nfields; i++)
+	{
+		switch (fields[i])
+		{
+		case F_COUNT:
+			n += snprintf(line + n,room - n,",%lu",sentence_count);
+			break;
+		case F_TIME:
+			n += snprintf(line + n,room - n,",%02d:%02d:%02d",ptm->tm_hour,ptm->tm_min,ptm->tm_sec);
+			break;
+		case F_LAT:
+			n += snprintf(line + n,room - n,",%.5f",Lat);
+			break;
+		case F_LON:
+			n += snprintf(line + n,room - n,",%.5f",Lon);
+			break;
+		case F_ALT:
+			n += snprintf(line + n,room - n,",%05.0f",Alt);
+			break;
+		case F_SPEED:
+			n += snprintf(line + n,room - n,",%.0f",Speed * 3.6);
+			break;
+		case F_COURSE:
+			n += snprintf(line + n,room - n,",%.0f",Course);
+			break;
+		case F_SATS:
+			n += snprintf(line + n,room - n,",5"); // as the NMEA - 5 satellites
+			break;
+		case F_STAMP:
+			clock_gettime(CLOCK_MONOTONIC,&ts);
+			n += snprintf(line + n,room - n,",%llu",(unsigned long long)ts.tv_sec * 1000000ull + ts.tv_nsec / 1000);
+			break;
+		}
+		if (n >= room)
+			n = room - 1;	// truncated - a field too wide for the line
 	}
- 
-	// calcualte time (secs) between co-ordinates
-	Elapsed = DeltaAlt / Rate; // always positive
-	Duration = (int)Elapsed;
-	Duration = 1;
-	fprintf(stderr,"Duration %d",Duration);
-	if ((Elapsed - (float)Duration) >= 0.5)
-		Duration++; // round duration of segment to nearest integer
- 
-	// Calculate Course (degrees relative to north) for entire segment
-	Course = atan2(DeltaLat,DeltaLon);	// result is +PI radians (cw) to -PI radians (ccw) from x (Longtitude) axis
- 
-	Course = DEGREES(Course);			// convert radians to degrees
-	if (Course <= 90.0)
-		Course = 90.0 - Course;
+	profile_begin(&ps, s_checksum);
+	snprintf(line + n,sizeof(line) - n,"*%04X\n",crc16(line + 2));
+	profile_end(&ps);
+	sentence_count++;
+	write_nmea(line);
+	end_epoch();
+}
+
+void Output(time_t Time, double Lat, double Lon, double Alt, double Course, double Speed)
+{
+	profile_scope ps;
+
+	profile_begin(&ps, s_format); // less the checksum, output and waiting inside
+	if (Callsign)
+		Output_UKHAS(Time,Lat,Lon,Alt,Course,Speed);
 	else
-		Course = 450.0 - Course;		// convert to 0 - 360 clockwise from north
- 
-	// Calculate Speed (m/sec) for entire segment
-	AdjLon = cos(RADIANS((FromLat + ToLat) / 2.0)) * DeltaLon;
-	Distance = (sqrt((DeltaLat * DeltaLat) + (AdjLon * AdjLon)) * 111194.9266); // result in meters
- 
-	Speed =  Distance / (double)Duration; // meters per second
- 
-	// calculate 1 second "step" sizes
-	DeltaAlt /= (double)Duration;
-	DeltaLat /= (double)Duration;
-	DeltaLon /= (double)Duration;
+		Output_NEMA(Time,Lat,Lon,Alt,Course,Speed);
+	profile_end(&ps);
+}
+
+// fly from start to end seconds after launch - a fix every second, from the flight profile (flight.h)
  
-	// now output the NMEA for each step between From and To (but excluding To - which is picked up on next segment)
-	Lat = FromLat;
-	Lon = FromLon;
-	Alt = FromAlt;
-	for (i = 0; i < Duration; i++)
+void fly(const flight *f, double start, double end)
+{
+	flight_fix fix;
+	profile_scope ps;
+	double t;
+
+	for (t = start; t < end; t++)
 	{
-		Output_NEMA(Now,Lat,Lon,Alt,Course,Speed);
+		profile_begin(&ps, s_interpolate);
+		flight_at(f, t, &fix);
+		profile_end(&ps);
+		Output(Now,fix.lat,fix.lon,fix.alt,fix.course,fix.speed);
 		Now++;				// 1 second steps
-		Lat += DeltaLat;
-		Lon += DeltaLon;
-		Alt += DeltaAlt;	
 	}
 }
  
@@ -261,9 +459,89 @@ void look_for(char *string)
  
 int main(int argc, char **argv)
 {
-	int i;
+	int i, repeat = 1, n;
 	float FromLon,FromLat,FromAlt, ToLon,ToLat,ToAlt;
+	flight Flight;
+	flight_fix fix;
+	double start = 0.0, end = -1.0;	// -s, -e
+	profile_scope ps;
+
+	s_read = profile_stage("read");
+	s_interpolate = profile_stage("interpolate");
+	s_format = profile_stage("format");
+	s_checksum = profile_stage("checksum");
+	s_output = profile_stage("output");
+	s_wait = profile_stage("wait");
+
+	for (i = 1; i < argc; i++)
+	{
+		if ((strcmp(argv[i],"-b") == 0) && (i + 1 < argc))
+			baud = atoi(argv[++i]);
+		else if (strcmp(argv[i],"-B") == 0)
+			burst = 1;
+		else if ((strcmp(argv[i],"-k") == 0) && (i + 1 < argc) && vclock_set(argv[i + 1]))
+			i++;
+		else if ((strcmp(argv[i],"-T") == 0) && (i + 1 < argc) && vclock_start(argv[i + 1]))
+			i++;
+		else if ((strcmp(argv[i],"-i") == 0) && (i + 1 < argc))
+		{
+			if (!zio_stdin(argv[++i]))
+			{
+				fprintf(stderr,"Can't open %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if ((strcmp(argv[i],"-o") == 0) && (i + 1 < argc))
+		{
+			if (!zio_stdout(argv[++i]))
+			{
+				fprintf(stderr,"Can't create %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if ((strcmp(argv[i],"-u") == 0) && (i + 1 < argc))
+		{
+			if (strlen(Callsign = argv[++i]) > MAX_CALLSIGN)
+			{
+				fprintf(stderr,"Callsign %s is too long (at most %d characters)\n", Callsign, MAX_CALLSIGN);
+				return 1;
+			}
+		}
+		else if ((strcmp(argv[i],"-f") == 0) && (i + 1 < argc) && parse_fields(argv[i + 1]))
+			i++;
+		else if ((strcmp(argv[i],"-r") == 0) && (i + 1 < argc) && (atof(argv[i + 1]) >= 0))
+			rate = atof(argv[++i]);
+		else if ((strcmp(argv[i],"-n") == 0) && (i + 1 < argc) && (atoi(argv[i + 1]) > 0))
+			repeat = atoi(argv[++i]);
+		else if ((strcmp(argv[i],"-s") == 0) && (i + 1 < argc) && (atof(argv[i + 1]) >= 0))
+			start = atof(argv[++i]);
+		else if ((strcmp(argv[i],"-e") == 0) && (i + 1 < argc) && (atof(argv[i + 1]) >= 0))
+			end = atof(argv[++i]);
+		else if ((strcmp(argv[i],"-w") == 0) && (i + 1 < argc) && (atoi(argv[i + 1]) > 0))
+			batch = atoi(argv[++i]);
+		else if (strcmp(argv[i],"-U") == 0)
+			uring = 1;
+		else if (strcmp(argv[i],"-q") == 0)
+			quiet = 1;
+		else if (strcmp(argv[i],"--profile") == 0)
+			profile_init();
+		else
+		{
+			fprintf(stderr,"Usage : %s [-b baud] [-B] [-k real|virtual|factor] [-T start] [-i flight.kml] [-o gps.log] [-u callsign [-f fields]] [-r rate] [-n times] [-s secs] [-e secs] [-w epochs] [-U] [-q] [--profile] <flight.kml >gps.log\n", argv[0]);
+			return 1;
+		}
+	}
+	if (rate > 0)
+		epoch_ns = (unsigned long long)(1e9 / rate);
+	if (baud)
+		shaper_init(&link, baud, 10, 16); // 8N1 and a 16550 style FIFO
+	else if (!epochio_init(&eo, 1, rate > 0 ? 1 : batch, uring)) // paced - each epoch goes at its time
+	{
+		fprintf(stderr,"Out of memory\n");
+		return 1;
+	}
  
+	profile_begin(&ps, s_read);
 	look_for("<LineString>"); // look for 1st <LineString> token
  
 	look_for("<coordinates>"); // look for subsiquent <coordinates> token
@@ -278,7 +556,10 @@ int main(int argc, char **argv)
 		return 1; // abnormal termination
 	}
  
-	Now = time(NULL); // use the current time as a reference
+	Now = vclock_time(); // use the current time (or -T) as a reference
+	flight_init(&Flight);
+	Flight.short_segments = 1; // as do_segment() timed them
+	flight_add(&Flight,FromLat,FromLon,FromAlt);
 	// get subsiquent LineString co-ordinates
 	
 	int j =0;
@@ -286,27 +567,62 @@ int main(int argc, char **argv)
 	while(1==1)
 	{
 		
-		fprintf(stderr,"processing %d\n",j);
+		if (!quiet)
+			fprintf(stderr,"processing %d\n",j);
 
 		i = scanf("%f , %f , %f",&ToLon,&ToLat,&ToAlt);
  
 		if (i != 3) {
 			break; // not co-ordinate
 		}
-		
-		do_segment(FromLat,FromLon,FromAlt,ToLat,ToLon,ToAlt);
+
+		if (!flight_add(&Flight,ToLat,ToLon,ToAlt))
+		{
+			fprintf(stderr,"Out of memory\n");
+			return 1;
+		}
  
 		FromLon = ToLon;
 		FromLat = ToLat;
 		FromAlt = ToAlt;
 		j++;
 	}
- fprintf(stderr,"hello5\n");
-	Output_NEMA(Now,ToLat,ToLon,ToAlt,0.0,0.0); // Final Position (assume stationary)
+	profile_end(&ps);
+	if (!quiet)
+		fprintf(stderr,"hello5\n");
+
+	if ((end < 0) || (end > flight_duration(&Flight)))
+		end = flight_duration(&Flight);
+	for (n = 0; n < repeat; n++)
+		fly(&Flight, start, end); // again from the launch site (-n) - Now and the sentence count carry on
+
+	flight_at(&Flight, end, &fix);
+	Output(Now,fix.lat,fix.lon,fix.alt,fix.course,fix.speed); // Final Position (stationary once landed)
+	flight_free(&Flight);
  
 	look_for("</coordinates>"); // look for closing </coordinates> token
  
 	look_for("</LineString>"); // look for closing </LineString> token
+
+	if (baud)
+	{
+		shaper_epoch(&link, epoch_ns);
+		shaper_report(&link, stderr);
+	}
+	else
+	{
+		profile_begin(&ps, s_output);
+		i = epochio_close(&eo);
+		profile_end(&ps);
+		if (i)
+		{
+			fprintf(stderr,"Can't write the output\n");
+			return 1;
+		}
+		if (!quiet)
+			epochio_report(&eo, stderr);
+	}
+	profile_report(stderr);
  
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,536 @@
+// habStub.c - a local stand-in for the habitat CouchDB server, for testing postdata
+//
+// accepts
+//	PUT /habitat/_design/payload_telemetry/_update/add_listener/<doc_id>
+//		{"data": {"_raw": "<base64 sentence>"},"receivers": {"<callsign>": {...}}}
+// checks the doc ID is the SHA256 of the base64 data (as habitat does), creates the document or
+// adds the receiver to an existing one and answers "OK" like habitat's update handler.
+//
+//	POST /habitat/_bulk_docs
+//		{"docs": [{"_id": "<doc_id>", "type": "payload_telemetry", "data": {"_raw": "..."}, "receivers": {...}}, ...]}
+// creates each document as CouchDB does - the answer has a result per document, {"ok":true,"id":..,"rev":..}
+// or, if it is already there, {"id":..,"error":"conflict",..} (the uploader then adds itself as a listener).
+//
+// the answer can be delayed and errors (500) or conflicts (409) injected to see how the uploader copes.
+// Once a second the request rate and service time are printed to stderr, with totals when stopped
+// (Ctrl-C). Received sentences can be logged to check nothing was lost or duplicated.
+//
+// options
+//	-p port		port to listen on (localhost only, default 5984 - CouchDB's)
+//	-l ms		delay every answer by ms milliseconds
+//	-j ms		plus a random extra delay of up to ms milliseconds
+//	-d us		plus us microseconds for each document in a bulk request (what writing them costs CouchDB)
+//	-e pct		answer pct% of requests with 500 Internal Server Error
+//	-c pct		answer pct% of requests with 409 Conflict (in a bulk request, pct% of the documents)
+//	-o file		log each new document - doc ID, time received (monotonic ns) and the sentence
+//	-q			don't print the once a second rates
+//
+// e.g.	habStub -l 50 -e 5 &
+//		postdata -u http://localhost:5984/habitat -i telemetry.txt
+
+#define _GNU_SOURCE	// strcasestr
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "sha256.h"
+#include "base64.h"
+
+#define MAX_REQUEST 1048576		// biggest request body accepted
+#define MAX_ANSWER 262144		// biggest answer (a bulk answer is ~130 bytes a document, a document ~300 bytes)
+
+int port = 5984;
+int latency_ms = 0;
+int jitter_ms = 0;
+int doc_us = 0;
+int error_pct = 0;
+int conflict_pct = 0;
+int quiet = 0;
+FILE *log_fp = NULL;
+
+// documents seen - a hash set of SHA256 doc IDs
+pthread_mutex_t docs_lock = PTHREAD_MUTEX_INITIALIZER;
+unsigned char *docs = NULL;		// doc_capacity * 32 bytes, all zero = empty
+size_t doc_capacity = 0;
+size_t doc_count = 0;
+
+// counters (updated with atomic adds - one thread per connection)
+unsigned long long requests, created, listeners_added, errors_injected, conflicts_injected, bad_requests, bulk_received;
+unsigned long long service_ns, service_max_ns;
+
+
+unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// starting slot for a doc ID (its bits are already random)
+size_t doc_slot(const unsigned char *id)
+{
+	size_t h;
+
+	memcpy(&h, id, sizeof(h));
+	return h & (doc_capacity - 1);
+}
+
+// add a doc ID to the set - returns 1 if it is new
+int add_doc(const unsigned char *id)
+{
+	static const unsigned char zero[32];
+	unsigned char *old, *slot;
+	size_t i, j, oldcap;
+	int added = 0;
+
+	pthread_mutex_lock(&docs_lock);
+
+	if ((doc_count + 1) * 4 > doc_capacity * 3)
+	{ // grow (and start) the table
+		old = docs;
+		oldcap = doc_capacity;
+		doc_capacity = doc_capacity ? doc_capacity * 2 : 4096;
+		docs = calloc(doc_capacity, 32);
+		for (i = 0; i < oldcap; i++)
+		{
+			if (memcmp(old + i * 32, zero, 32) == 0)
+				continue;
+			for (j = doc_slot(old + i * 32); memcmp(docs + j * 32, zero, 32); j = (j + 1) & (doc_capacity - 1))
+				;
+			memcpy(docs + j * 32, old + i * 32, 32);
+		}
+		free(old);
+	}
+
+	for (i = doc_slot(id); ; i = (i + 1) & (doc_capacity - 1))
+	{
+		slot = docs + i * 32;
+		if (memcmp(slot, id, 32) == 0)
+			break; // already have it
+		if (memcmp(slot, zero, 32) == 0)
+		{
+			memcpy(slot, id, 32);
+			doc_count++;
+			added = 1;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&docs_lock);
+	return added;
+}
+
+int hex_to_hash(const char *hex, unsigned char *hash)
+{
+	int i;
+	unsigned int b;
+
+	for (i = 0; i < 32; i++)
+	{
+		if (sscanf(hex + i * 2, "%2x", &b) != 1)
+			return 0;
+		hash[i] = b;
+	}
+	return hex[64] == '\0';
+}
+
+// find "key": "string value" in a JSON body - copies the value (no escapes expected in base64 or callsigns)
+int json_string(const char *json, const char *key, char *value, size_t size)
+{
+	char pattern[64];
+	const char *p, *e;
+
+	snprintf(pattern, sizeof(pattern), "\"%s\"", key);
+	if ((p = strstr(json, pattern)) == NULL)
+		return 0;
+	p += strlen(pattern);
+	while ((*p == ' ') || (*p == ':'))
+		p++;
+	if (*p++ != '"')
+		return 0;
+	if (((e = strchr(p, '"')) == NULL) || ((size_t)(e - p) >= size))
+		return 0;
+	memcpy(value, p, e - p);
+	value[e - p] = '\0';
+	return 1;
+}
+
+// check a payload_telemetry document - returns 0 (id filled in) or the HTTP status and error for the answer
+int check_doc(const char *doc_id, const char *body, char *raw, size_t raw_size, unsigned char *id, const char **error)
+{
+	unsigned char hash[32];
+	SHA256_CTX ctx;
+
+	if (!hex_to_hash(doc_id, id) || !json_string(body, "_raw", raw, raw_size) || (strstr(body, "\"receivers\"") == NULL))
+	{
+		*error = "\"error\":\"bad_request\",\"reason\":\"not a payload_telemetry document\"";
+		__atomic_fetch_add(&bad_requests, 1, __ATOMIC_RELAXED);
+		return 400;
+	}
+
+	// doc ID has to be the SHA256 of the base64 data
+	sha256_init(&ctx);
+	sha256_update(&ctx, (unsigned char *)raw, strlen(raw));
+	sha256_final(&ctx, hash);
+	if (memcmp(hash, id, 32) != 0)
+	{
+		*error = "\"error\":\"forbidden\",\"reason\":\"doc id is not the sha256 of _raw\"";
+		__atomic_fetch_add(&bad_requests, 1, __ATOMIC_RELAXED);
+		return 403;
+	}
+	return 0;
+}
+
+// a document has been created - count and log it
+void new_doc(const char *doc_id, const char *raw)
+{
+	unsigned char *sentence;
+	size_t len;
+
+	__atomic_fetch_add(&created, 1, __ATOMIC_RELAXED);
+	if (log_fp && ((sentence = base64_decode((unsigned char *)raw, strlen(raw), &len)) != NULL))
+	{
+		while ((len > 0) && ((sentence[len - 1] == '\n') || (sentence[len - 1] == '\r')))
+			len--;
+		flockfile(log_fp);
+		fprintf(log_fp, "%s %llu %.*s\n", doc_id, now_ns(), (int)len, sentence);
+		funlockfile(log_fp);
+		free(sentence);
+	}
+}
+
+// handle PUT .../add_listener/<doc_id> - returns the HTTP status, fills in the answer body
+int add_listener(const char *doc_id, const char *body, char *answer, size_t size)
+{
+	char raw[4096];
+	unsigned char id[32];
+	const char *error;
+	int status;
+
+	if ((status = check_doc(doc_id, body, raw, sizeof(raw), id, &error)) != 0)
+	{
+		snprintf(answer, size, "{%s}", error);
+		return status;
+	}
+
+	if (add_doc(id))
+		new_doc(doc_id, raw);
+	else
+		__atomic_fetch_add(&listeners_added, 1, __ATOMIC_RELAXED);
+
+	snprintf(answer, size, "OK");
+	return 201;
+}
+
+// handle POST .../_bulk_docs - one result per document, in the order they came
+int bulk_docs(char *body, char *answer, size_t size)
+{
+	char doc_id[80], raw[4096];
+	unsigned char id[32];
+	const char *error;
+	char *p, *next, save;
+	size_t len = 0;
+	int n = 0;
+
+	if (strstr(body, "\"docs\"") == NULL)
+	{
+		snprintf(answer, size, "{\"error\":\"bad_request\",\"reason\":\"POST body must include `docs` parameter.\"}");
+		__atomic_fetch_add(&bad_requests, 1, __ATOMIC_RELAXED);
+		return 400;
+	}
+
+	len += snprintf(answer + len, size - len, "[");
+	for (p = strstr(body, "\"_id\""); p != NULL; p = next)
+	{
+		// the document runs to the next _id
+		if ((next = strstr(p + 5, "\"_id\"")) != NULL)
+		{
+			save = *next;
+			*next = '\0';
+		}
+
+		if (len + 200 > size)
+			break; // no room to answer - the rest are left out, as if never sent
+		if (!json_string(p, "_id", doc_id, sizeof(doc_id)))
+			snprintf(doc_id, sizeof(doc_id), "?");
+		if (check_doc(doc_id, p, raw, sizeof(raw), id, &error) != 0)
+			len += snprintf(answer + len, size - len, "%s{\"id\":\"%s\",%s}", n ? "," : "", doc_id, error);
+		else if ((conflict_pct > 0) && (rand() % 100 < conflict_pct))
+		{
+			len += snprintf(answer + len, size - len, "%s{\"id\":\"%s\",\"error\":\"conflict\",\"reason\":\"Document update conflict.\"}", n ? "," : "", doc_id);
+			__atomic_fetch_add(&conflicts_injected, 1, __ATOMIC_RELAXED);
+		}
+		else if (add_doc(id))
+		{
+			new_doc(doc_id, raw);
+			len += snprintf(answer + len, size - len, "%s{\"ok\":true,\"id\":\"%s\",\"rev\":\"1-%.32s\"}", n ? "," : "", doc_id, doc_id);
+		}
+		else // there already - CouchDB won't create it again without its revision
+			len += snprintf(answer + len, size - len, "%s{\"id\":\"%s\",\"error\":\"conflict\",\"reason\":\"Document update conflict.\"}", n ? "," : "", doc_id);
+		n++;
+
+		if (next)
+			*next = save;
+	}
+	snprintf(answer + len, size - len, "]");
+	__atomic_fetch_add(&bulk_received, n, __ATOMIC_RELAXED);
+	if (doc_us)
+		usleep(n * doc_us);
+	return 201;
+}
+
+const char *status_text(int status)
+{
+	switch (status)
+	{
+	case 200: return "OK";
+	case 201: return "Created";
+	case 400: return "Bad Request";
+	case 403: return "Forbidden";
+	case 404: return "Not Found";
+	case 409: return "Conflict";
+	default: return "Internal Server Error";
+	}
+}
+
+// read until the end of the request headers (or the connection closes) - returns bytes in buf
+ssize_t read_headers(int fd, char *buf, size_t size, size_t have, char **body)
+{
+	ssize_t n;
+
+	buf[have] = '\0';
+	while ((*body = strstr(buf, "\r\n\r\n")) == NULL)
+	{
+		if (have >= size - 1)
+			return -1;
+		if ((n = read(fd, buf + have, size - 1 - have)) <= 0)
+			return -1;
+		have += n;
+		buf[have] = '\0';
+	}
+	*body += 4;
+	return have;
+}
+
+// one thread per connection - HTTP/1.1 with keep-alive
+void *connection(void *arg)
+{
+	int fd = (int)(long)arg;
+	char *buf, *answer, method[16], path[512], header[256];
+	char *body, *p;
+	size_t have = 0, content_length, head_len;
+	ssize_t n;
+	int status, keep_alive;
+	unsigned long long start, took, max;
+
+	buf = malloc(MAX_REQUEST + 8192);
+	answer = malloc(MAX_ANSWER);
+
+	while ((n = read_headers(fd, buf, MAX_REQUEST + 8192, have, &body)) > 0)
+	{
+		have = n;
+		start = now_ns();
+		head_len = body - buf;
+
+		if (sscanf(buf, "%15s %511s", method, path) != 2)
+			break;
+		content_length = 0;
+		if ((p = strcasestr(buf, "\r\nContent-Length:")) != NULL)
+			content_length = strtoul(p + 17, NULL, 10);
+		keep_alive = (strcasestr(buf, "\r\nConnection: close") == NULL);
+		if ((content_length > MAX_REQUEST) || (head_len + content_length > MAX_REQUEST + 8192 - 1))
+			break;
+		if (strcasestr(buf, "\r\nExpect: 100-continue") && (have < head_len + content_length))
+			write(fd, "HTTP/1.1 100 Continue\r\n\r\n", 25);
+
+		// rest of the body
+		while (have < head_len + content_length)
+		{
+			if ((n = read(fd, buf + have, head_len + content_length - have)) <= 0)
+				goto done;
+			have += n;
+		}
+		body[content_length] = '\0';
+
+		__atomic_fetch_add(&requests, 1, __ATOMIC_RELAXED);
+
+		// injected problems first - the request is not acted on
+		if ((error_pct > 0) && (rand() % 100 < error_pct))
+		{
+			status = 500;
+			snprintf(answer, MAX_ANSWER, "{\"error\":\"injected\",\"reason\":\"habStub -e\"}");
+			__atomic_fetch_add(&errors_injected, 1, __ATOMIC_RELAXED);
+		}
+		else if ((conflict_pct > 0) && (strstr(path, "/_bulk_docs") == NULL) && (rand() % 100 < conflict_pct))
+		{
+			status = 409;
+			snprintf(answer, MAX_ANSWER, "{\"error\":\"conflict\",\"reason\":\"Document update conflict.\"}");
+			__atomic_fetch_add(&conflicts_injected, 1, __ATOMIC_RELAXED);
+		}
+		else if ((strcmp(method, "PUT") == 0) && ((p = strstr(path, "/_update/add_listener/")) != NULL))
+			status = add_listener(p + 22, body, answer, MAX_ANSWER);
+		else if ((strcmp(method, "POST") == 0) && (strstr(path, "/_bulk_docs") != NULL))
+			status = bulk_docs(body, answer, MAX_ANSWER);
+		else
+		{
+			status = 404;
+			snprintf(answer, MAX_ANSWER, "{\"error\":\"not_found\",\"reason\":\"missing\"}");
+		}
+
+		if (latency_ms || jitter_ms)
+			usleep((latency_ms + (jitter_ms ? rand() % jitter_ms : 0)) * 1000);
+
+		n = snprintf(header, sizeof(header), "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n%s\r\n",
+			status, status_text(status), ((answer[0] == '{') || (answer[0] == '[')) ? "application/json" : "text/plain", strlen(answer),
+			keep_alive ? "" : "Connection: close\r\n");
+		if ((write(fd, header, n) != n) || (write(fd, answer, strlen(answer)) < 0))
+			break;
+
+		took = now_ns() - start;
+		__atomic_fetch_add(&service_ns, took, __ATOMIC_RELAXED);
+		max = __atomic_load_n(&service_max_ns, __ATOMIC_RELAXED);
+		while ((took > max) && !__atomic_compare_exchange_n(&service_max_ns, &max, took, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			;
+
+		if (!keep_alive)
+			break;
+
+		// anything after this request is the start of the next one (pipelining)
+		have -= head_len + content_length;
+		memmove(buf, body + content_length, have);
+	}
+
+done:
+	close(fd);
+	free(buf);
+	free(answer);
+	return NULL;
+}
+
+void report(const char *label, double secs, unsigned long long reqs)
+{
+	fprintf(stderr,"%s%llu requests (%.1f/s), %llu bulk docs, %llu new docs, %llu listeners added, %llu errors and %llu conflicts injected, %llu bad, mean service %.2f ms, max %.2f ms\n",
+		label, requests, secs > 0 ? reqs / secs : 0.0, bulk_received, created, listeners_added, errors_injected, conflicts_injected,
+		bad_requests, requests ? service_ns / 1e6 / requests : 0.0, service_max_ns / 1e6);
+}
+
+volatile sig_atomic_t stop = 0;
+
+void on_signal(int sig)
+{
+	stop = 1;
+}
+
+// prints the request rate once a second
+void *reporter(void *arg)
+{
+	unsigned long long last = 0, now;
+
+	while (!stop)
+	{
+		sleep(1);
+		now = __atomic_load_n(&requests, __ATOMIC_RELAXED);
+		if (!quiet && (now != last))
+			report("", 1.0, now - last);
+		last = now;
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_in addr;
+	struct sigaction sa;
+	pthread_t th;
+	unsigned long long start;
+	size_t len;
+	int lfd, fd, i, on = 1;
+
+	for (i = 1; i < argc; i++)
+	{
+		if ((strcmp(argv[i],"-p") == 0) && (i + 1 < argc))
+			port = atoi(argv[++i]);
+		else if ((strcmp(argv[i],"-l") == 0) && (i + 1 < argc))
+			latency_ms = atoi(argv[++i]);
+		else if ((strcmp(argv[i],"-j") == 0) && (i + 1 < argc))
+			jitter_ms = atoi(argv[++i]);
+		else if ((strcmp(argv[i],"-d") == 0) && (i + 1 < argc))
+			doc_us = atoi(argv[++i]);
+		else if ((strcmp(argv[i],"-e") == 0) && (i + 1 < argc))
+			error_pct = atoi(argv[++i]);
+		else if ((strcmp(argv[i],"-c") == 0) && (i + 1 < argc))
+			conflict_pct = atoi(argv[++i]);
+		else if ((strcmp(argv[i],"-o") == 0) && (i + 1 < argc))
+		{
+			if ((log_fp = fopen(argv[++i], "a")) == NULL)
+			{
+				fprintf(stderr,"Can't open %s\n", argv[i]);
+				return 1;
+			}
+			setvbuf(log_fp, NULL, _IOLBF, 0);
+		}
+		else if (strcmp(argv[i],"-q") == 0)
+			quiet = 1;
+		else
+		{
+			fprintf(stderr,"Usage : %s [-p port] [-l latency ms] [-j jitter ms] [-d us per bulk doc] [-e error %%] [-c conflict %%] [-o log file] [-q]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	free(base64_decode((unsigned char *)"AAAA", 4, &len)); // builds the decoding table before there are threads
+
+	if ((lfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+	{
+		perror("socket");
+		return 1;
+	}
+	setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if ((bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) || (listen(lfd, 128) < 0))
+	{
+		perror("bind");
+		return 1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_signal; // no SA_RESTART - accept() returns when stopped
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	fprintf(stderr,"habitat stand-in on http://localhost:%d/habitat\n", port);
+	start = now_ns();
+	pthread_create(&th, NULL, reporter, NULL);
+	pthread_detach(th);
+
+	while (!stop)
+	{
+		if ((fd = accept(lfd, NULL, NULL)) < 0)
+			continue;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+		if (pthread_create(&th, NULL, connection, (void *)(long)fd) != 0)
+			close(fd);
+		else
+			pthread_detach(th);
+	}
+
+	report("total ", (now_ns() - start) / 1e9, requests);
+	if (log_fp)
+		fflush(log_fp);
+	return 0;
+}
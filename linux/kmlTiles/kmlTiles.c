@@ -0,0 +1,498 @@
+// kmlTiles.c - turn a long track into a quadtree of level of detail KML tiles
+//
+// Google Earth slows to a crawl on a single <LineString> of tens of thousands of points (livekml.kml from
+// gpsEmulate, spiral.kml, a week of telemetry). This splits the track's bounding box into a quadtree. Each
+// tile holds the parts of the track inside it, thinned (Douglas-Peucker) to about a pixel at the size the
+// tile is drawn, and <NetworkLink>s to its four children gated by <Region>/<Lod> - so Earth only fetches the
+// tiles in view, and only as deep as the zoom needs. A tile with few enough points is a leaf and keeps
+// every one of them.
+//
+// each tile hands the points it holds (as runs of indexes into the track) down to its children, so every
+// level is one pass over the track. Tiles are built by a pool of threads.
+//
+// input is KML (every <coordinates> in it taken as one track), or NMEA / UKHAS telemetry ($GPGGA, $$CALLSIGN)
+// output is dir/doc.kml (open this one) and dir/tiles/<level>/<x>_<y>.kml
+//
+// options
+//	-i file		track to tile (default standard input)
+//	-o dir		where to write the tiles (default tiles.kml.d)
+//	-n name		name shown in Earth
+//	-l points	most points in a leaf tile (default 4096)
+//	-j threads	(default one per CPU)
+//
+// e.g.	kmlTiles -i ../spiral/spiral.kml -o spiral.d
+//		kmlTiles -i ../postdata/icarus.txt -o icarus.d -n "Icarus IV"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "sentence.h"
+
+#define MAX_LEVEL		24
+#define TILE_PIXELS		512			// a tile is drawn at up to about this size before its children take over
+
+typedef struct range
+{
+	long a, b;						// first and last point
+} range;
+
+typedef struct tile
+{
+	int level, x, y;
+	double west, south, east, north;
+	range *runs;					// parts of the track in the tile (with a point either side so the line reaches the edge)
+	long nruns;
+	struct tile *next;
+} tile;
+
+// the track
+double *lon, *lat, *alt;
+long points = 0, points_size = 0;
+double west, south, east, north;
+
+char *out_dir = "tiles.kml.d";
+char *name = "Flight Path";
+long leaf_points = 4096;
+
+// work queue
+pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+tile *queue = NULL;
+int active = 0;
+long tiles = 0, written = 0;
+int deepest = 0;
+
+
+void add_point(double x, double y, double z)
+{
+	if (points == points_size)
+	{
+		points_size = points_size ? points_size * 2 : 65536;
+		lon = realloc(lon, points_size * sizeof(double));
+		lat = realloc(lat, points_size * sizeof(double));
+		alt = realloc(alt, points_size * sizeof(double));
+	}
+	lon[points] = x;
+	lat[points] = y;
+	alt[points++] = z;
+}
+
+// lon,lat[,alt] tuples from every <coordinates> element
+void read_kml(char *text)
+{
+	char *p = text, *end, *q;
+	double x, y, z;
+
+	while ((p = strstr(p, "<coordinates>")) != NULL)
+	{
+		p += 13;
+		if ((end = strstr(p, "</coordinates>")) == NULL)
+			break;
+		*end = 0;
+		while (p < end)
+		{
+			x = strtod(p, &q);
+			if (q == p)
+				break;
+			if (*q++ != ',')
+				break;
+			y = strtod(q, &p);
+			z = 0;
+			if (*p == ',')
+				z = strtod(p + 1, &p);
+			add_point(x, y, z);
+			while ((p < end) && ((*p == ' ') || (*p == '\t') || (*p == '\r') || (*p == '\n')))
+				p++;
+		}
+		p = end + 1;
+	}
+}
+
+// $GPGGA or $$CALLSIGN lines ($GPRMC only if there is no $GPGGA)
+void read_log(char *text)
+{
+	char *line = text, *nl;
+	sentence_fix fix;
+	int type, gga = 0;
+
+	for (; *line; line = nl + 1)
+	{
+		if ((nl = strchr(line, '\n')) == NULL)
+			nl = line + strlen(line) - 1;
+		if ((type = parse_sentence(line, &fix)) == SENTENCE_GGA)
+			gga = 1;
+		if (fix.have_pos && ((type != SENTENCE_RMC) || !gga))
+			add_point(fix.lon, fix.lat, fix.have_alt ? fix.alt : 0);
+	}
+}
+
+char *read_all(const char *path)
+{
+	FILE *fp = path ? fopen(path, "rb") : stdin;
+	char *text = NULL;
+	size_t len = 0, size = 0, n;
+
+	if (fp == NULL)
+	{
+		fprintf(stderr,"Can't open %s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+	do
+	{
+		if (size - len < 65536)
+			text = realloc(text, size = size ? size * 2 : 1048576);
+		n = fread(text + len, 1, size - len - 1, fp);
+		len += n;
+	} while (n > 0);
+	text[len] = 0;
+	if (path)
+		fclose(fp);
+	return text;
+}
+
+// Douglas-Peucker over points a..b - keep[i - a] set for the points that survive
+// lon is scaled by cos(lat) so eps (degrees of latitude) means the same distance both ways
+void simplify(long a, long b, double eps, double kx, unsigned char *keep)
+{
+	long *stack, sp = 0, i, s, e, best;
+	double dx, dy, len, d, dmax;
+
+	memset(keep, 0, b - a + 1);
+	keep[0] = keep[b - a] = 1;
+	if (b - a < 2)
+		return;
+
+	stack = malloc((b - a + 1) * 2 * sizeof(long));
+	stack[sp++] = a;
+	stack[sp++] = b;
+	while (sp > 0)
+	{
+		e = stack[--sp];
+		s = stack[--sp];
+		dx = (lon[e] - lon[s]) * kx;
+		dy = lat[e] - lat[s];
+		len = sqrt(dx * dx + dy * dy);
+		dmax = 0;
+		best = -1;
+		for (i = s + 1; i < e; i++)
+		{
+			if (len > 0)
+				d = fabs(dy * (lon[i] - lon[s]) * kx - dx * (lat[i] - lat[s])) / len;
+			else
+				d = hypot((lon[i] - lon[s]) * kx, lat[i] - lat[s]);
+			if (d > dmax)
+			{
+				dmax = d;
+				best = i;
+			}
+		}
+		if ((best >= 0) && (dmax > eps))
+		{
+			keep[best - a] = 1;
+			if (best - s > 1)
+			{
+				stack[sp++] = s;
+				stack[sp++] = best;
+			}
+			if (e - best > 1)
+			{
+				stack[sp++] = best;
+				stack[sp++] = e;
+			}
+		}
+	}
+	free(stack);
+}
+
+void region(FILE *fp, tile *t, int min_lod, int max_lod)
+{
+	fprintf(fp,"<Region>\n<LatLonAltBox> <north>%.7f</north> <south>%.7f</south> <east>%.7f</east> <west>%.7f</west> </LatLonAltBox>\n",
+		t->north, t->south, t->east, t->west);
+	fprintf(fp,"<Lod> <minLodPixels>%d</minLodPixels> <maxLodPixels>%d</maxLodPixels> </Lod>\n</Region>\n", min_lod, max_lod);
+}
+
+int inside(tile *t, long i)
+{
+	return (lon[i] >= t->west) && (lon[i] <= t->east) && (lat[i] >= t->south) && (lat[i] <= t->north);
+}
+
+// the runs of the parent's points that fall in child t
+void child_runs(tile *parent, tile *t)
+{
+	long r, i, start, size = 0;
+	range run;
+
+	for (r = 0; r < parent->nruns; r++)
+	{
+		start = -1;
+		for (i = parent->runs[r].a; i <= parent->runs[r].b + 1; i++)
+		{
+			if ((i <= parent->runs[r].b) && inside(t, i))
+			{
+				if (start < 0)
+					start = i;
+				continue;
+			}
+			if (start < 0)
+				continue;
+			run.a = start > 0 ? start - 1 : 0;				// a point either side so the line runs on to the edge
+			run.b = i < points ? i : points - 1;
+			start = -1;
+			if ((t->nruns > 0) && (run.a <= t->runs[t->nruns - 1].b))
+			{ // joins up with the last one
+				t->runs[t->nruns - 1].b = run.b;
+				continue;
+			}
+			if (t->nruns == size)
+				t->runs = realloc(t->runs, (size = size ? size * 2 : 16) * sizeof(range));
+			t->runs[t->nruns++] = run;
+		}
+	}
+}
+
+char *tile_path(char *path, size_t size, int level, int x, int y)
+{
+	if (level == 0)
+		snprintf(path, size, "%s/doc.kml", out_dir);
+	else
+		snprintf(path, size, "%s/tiles/%d/%d_%d.kml", out_dir, level, x, y);
+	return path;
+}
+
+// write tile t - returns its children
+tile *make_tile(tile *t)
+{
+	char path[1024];
+	FILE *fp;
+	tile *children = NULL, *c;
+	long r, i, count = 0, kept = 0;
+	unsigned char *keep = NULL;
+	size_t keep_size = 0;
+	double eps, kx;
+	int leaf, q;
+
+	for (r = 0; r < t->nruns; r++)
+		count += t->runs[r].b - t->runs[r].a + 1;
+	leaf = (count <= leaf_points) || (t->level >= MAX_LEVEL);
+
+	kx = cos((t->north + t->south) / 2 * M_PI / 180.0);
+	eps = fmax(t->north - t->south, (t->east - t->west) * kx) / TILE_PIXELS;
+
+	if (t->level > 0)
+	{
+		snprintf(path, sizeof(path), "%s/tiles/%d", out_dir, t->level);
+		mkdir(path, 0777);
+	}
+	if ((fp = fopen(tile_path(path, sizeof(path), t->level, t->x, t->y), "w")) == NULL)
+	{
+		fprintf(stderr,"Can't create %s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+	setvbuf(fp, NULL, _IOFBF, 65536);
+
+	fprintf(fp,"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+	fprintf(fp,"<kml xmlns=\"http://www.opengis.net/kml/2.2\">\n");
+	fprintf(fp,"<Document>\n<name>%s</name>\n", t->level ? "tile" : name);
+	fprintf(fp,"<Style id=\"track\">\n");
+	fprintf(fp,"<LineStyle> <color>fff010c0</color> <width>2</width> </LineStyle>\n");
+	fprintf(fp,"</Style>\n");
+
+	// the track at this level - hidden once the tile is big enough for the children to show
+	fprintf(fp,"<Placemark> <name>%s</name> <styleUrl>#track</styleUrl>\n", name);
+	region(fp, t, 0, leaf ? -1 : TILE_PIXELS);
+	fprintf(fp,"<MultiGeometry>\n");
+	for (r = 0; r < t->nruns; r++)
+	{
+		if (!leaf)
+		{
+			if ((size_t)(t->runs[r].b - t->runs[r].a + 1) > keep_size)
+				keep = realloc(keep, keep_size = t->runs[r].b - t->runs[r].a + 1);
+			simplify(t->runs[r].a, t->runs[r].b, eps, kx, keep);
+		}
+		fprintf(fp,"<LineString> <altitudeMode>absolute</altitudeMode>\n<coordinates>\n");
+		for (i = t->runs[r].a; i <= t->runs[r].b; i++)
+			if (leaf || keep[i - t->runs[r].a])
+			{
+				fprintf(fp,"%.6f,%.6f,%.0f\n", lon[i], lat[i], alt[i]);
+				kept++;
+			}
+		fprintf(fp,"</coordinates>\n</LineString>\n");
+	}
+	fprintf(fp,"</MultiGeometry>\n</Placemark>\n");
+	free(keep);
+
+	if (!leaf)
+		for (q = 0; q < 4; q++)
+		{
+			c = calloc(1, sizeof(tile));
+			c->level = t->level + 1;
+			c->x = t->x * 2 + (q & 1);
+			c->y = t->y * 2 + (q >> 1);
+			c->west = (q & 1) ? (t->west + t->east) / 2 : t->west;
+			c->east = (q & 1) ? t->east : (t->west + t->east) / 2;
+			c->south = (q & 2) ? (t->south + t->north) / 2 : t->south;
+			c->north = (q & 2) ? t->north : (t->south + t->north) / 2;
+			child_runs(t, c);
+			if (c->nruns == 0)
+			{
+				free(c);
+				continue;
+			}
+
+			// a child is half the size, so it reaches TILE_PIXELS / 2 just as this one is hidden
+			fprintf(fp,"<NetworkLink>\n");
+			region(fp, c, TILE_PIXELS / 2, -1);
+			if (t->level == 0)
+				fprintf(fp,"<Link> <href>tiles/%d/%d_%d.kml</href> <viewRefreshMode>onRegion</viewRefreshMode> </Link>\n", c->level, c->x, c->y);
+			else
+				fprintf(fp,"<Link> <href>../%d/%d_%d.kml</href> <viewRefreshMode>onRegion</viewRefreshMode> </Link>\n", c->level, c->x, c->y);
+			fprintf(fp,"</NetworkLink>\n");
+
+			c->next = children;
+			children = c;
+		}
+
+	fprintf(fp,"</Document>\n</kml>\n");
+	if (fclose(fp))
+	{
+		fprintf(stderr,"Can't write %s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+
+	pthread_mutex_lock(&lock);
+	tiles++;
+	written += kept;
+	if (t->level > deepest)
+		deepest = t->level;
+	pthread_mutex_unlock(&lock);
+	return children;
+}
+
+void *worker(void *arg)
+{
+	tile *t, *children, *c;
+
+	for (;;)
+	{
+		pthread_mutex_lock(&lock);
+		while ((queue == NULL) && (active > 0))
+			pthread_cond_wait(&cond, &lock);
+		if (queue == NULL)
+		{ // nothing queued and nothing running to queue more
+			pthread_cond_broadcast(&cond);
+			pthread_mutex_unlock(&lock);
+			return NULL;
+		}
+		t = queue;
+		queue = t->next;
+		active++;
+		pthread_mutex_unlock(&lock);
+
+		children = make_tile(t);
+		free(t->runs);
+		free(t);
+
+		pthread_mutex_lock(&lock);
+		while ((c = children) != NULL)
+		{
+			children = c->next;
+			c->next = queue;
+			queue = c;
+		}
+		active--;
+		pthread_cond_broadcast(&cond);
+		pthread_mutex_unlock(&lock);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	char *in_file = NULL, *text, path[1024];
+	int i, threads = sysconf(_SC_NPROCESSORS_ONLN);
+	pthread_t *pool;
+	tile *root;
+	long j;
+	struct timespec t0, t1;
+
+	for (i = 1; i < argc; i++)
+	{
+		if ((strcmp(argv[i],"-i") == 0) && (i + 1 < argc))
+			in_file = argv[++i];
+		else if ((strcmp(argv[i],"-o") == 0) && (i + 1 < argc))
+			out_dir = argv[++i];
+		else if ((strcmp(argv[i],"-n") == 0) && (i + 1 < argc))
+			name = argv[++i];
+		else if ((strcmp(argv[i],"-l") == 0) && (i + 1 < argc))
+			leaf_points = atol(argv[++i]);
+		else if ((strcmp(argv[i],"-j") == 0) && (i + 1 < argc))
+			threads = atoi(argv[++i]);
+		else
+		{
+			fprintf(stderr,"Usage : %s [-i track] [-o dir] [-n name] [-l points per leaf] [-j threads]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (threads < 1)
+		threads = 1;
+	if (leaf_points < 16)
+		leaf_points = 16;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	text = read_all(in_file);
+	if (strstr(text, "<kml"))
+		read_kml(text);
+	else
+		read_log(text);
+	free(text);
+	if (points == 0)
+	{
+		fprintf(stderr,"No track in %s\n", in_file ? in_file : "standard input");
+		return 1;
+	}
+
+	west = east = lon[0];
+	south = north = lat[0];
+	for (j = 1; j < points; j++)
+	{
+		west = fmin(west, lon[j]);
+		east = fmax(east, lon[j]);
+		south = fmin(south, lat[j]);
+		north = fmax(north, lat[j]);
+	}
+
+	if ((mkdir(out_dir, 0777) < 0) && (errno != EEXIST))
+	{
+		fprintf(stderr,"Can't create %s: %s\n", out_dir, strerror(errno));
+		return 1;
+	}
+	snprintf(path, sizeof(path), "%s/tiles", out_dir);
+	mkdir(path, 0777);
+
+	root = calloc(1, sizeof(tile));
+	root->west = west;
+	root->east = east;
+	root->south = south;
+	root->north = north;
+	root->runs = malloc(sizeof(range));
+	root->runs[0].a = 0;
+	root->runs[0].b = points - 1;
+	root->nruns = 1;
+	queue = root;
+
+	pool = malloc(threads * sizeof(pthread_t));
+	for (i = 0; i < threads; i++)
+		pthread_create(&pool[i], NULL, worker, NULL);
+	for (i = 0; i < threads; i++)
+		pthread_join(pool[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	fprintf(stderr,"%ld points -> %ld tiles, %d levels, %ld points written, %.3f s on %d threads\n",
+		points, tiles, deepest + 1, written, (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9, threads);
+	return 0;
+}
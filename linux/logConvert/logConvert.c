@@ -0,0 +1,577 @@
+// logConvert.c - convert whole directories of flight logs in one go
+//
+// every file under the directories named (and any files named) is looked at, its format worked out from the
+// first few KB - NMEA ($GPGGA / $GPRMC), UKHAS telemetry ($$CALLSIGN,...) or UBX (NAV-PVT / NAV-POSLLH) -
+// and its fixes written out as CSV, KML or columns (one file of little endian doubles per field, as ubxParse -c).
+// Files that are none of these are skipped. The output tree mirrors the input, e.g. archive/2014/icarus.txt
+// becomes out/2014/icarus.txt.csv
+//
+// the work is spread over a work stealing thread pool (common/pool.c). Each file is memory mapped and cut into
+// pieces of about -s MB - at line boundaries for text, anywhere for UBX (a piece takes the frames that start in
+// it) - so one huge log keeps every core busy as well as thousands of small ones do. The kernel is asked to read
+// each piece in ahead (MADV_WILLNEED) when the piece is queued, so the disk works while the CPUs parse.
+// Pieces are converted into memory and written out in order as soon as all the pieces before them are done.
+//
+// options
+//	-o dir		where to write (default converted)
+//	-f format	csv (default), kml or col
+//	-j threads	(default one per CPU)
+//	-s MB		piece size (default 8)
+//
+// e.g.	logConvert -o kml -f kml archive/ ../postdata/icarus.txt
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "sentence.h"
+#include "ubxread.h"
+#include "pool.h"
+
+#define FMT_NMEA	1
+#define FMT_UKHAS	2
+#define FMT_UBX		3
+
+#define OUT_CSV		0
+#define OUT_KML		1
+#define OUT_COL		2
+
+#define COLUMNS		4			// tod, lat, lon, alt
+#define MAX_LINE	512
+
+typedef struct outbuf
+{
+	char *data;
+	size_t len, size;
+} outbuf;
+
+struct job;
+
+typedef struct piece
+{
+	struct job *j;
+	size_t start, end;			// bytes of the file this piece converts
+	outbuf out[COLUMNS];		// just out[0] unless columns
+	long fixes;
+	int done;
+	// UBX
+	unsigned long last_itow;
+	int any;
+	size_t seed_end;			// seed_frame() looks at frames before this
+} piece;
+
+typedef struct job				// one file
+{
+	char *in, *out;
+	int format;
+	int rmc;					// NMEA with no $GPGGA - take the positions from $GPRMC
+	unsigned char *map;
+	size_t size;
+	int npieces, written;
+	piece *pieces;
+	FILE *fp[COLUMNS];
+	pthread_mutex_t lock;
+} job;
+
+static const char *col_names[COLUMNS] = {"tod", "lat", "lon", "alt"};
+static const char *exts[] = {"csv", "kml", NULL};
+
+pool *workers;
+char *out_dir = "converted";
+int out_format = OUT_CSV;
+size_t piece_size = 8 << 20;
+
+// totals
+pthread_mutex_t totals_lock = PTHREAD_MUTEX_INITIALIZER;
+long files = 0, skipped = 0, failed = 0;
+unsigned long long bytes_in = 0, fixes_out = 0;
+
+
+void put(outbuf *b, const void *data, size_t len)
+{
+	if (b->len + len > b->size)
+	{
+		b->size = b->size ? b->size * 2 : 65536;
+		while (b->len + len > b->size)
+			b->size *= 2;
+		b->data = realloc(b->data, b->size);
+	}
+	memcpy(b->data + b->len, data, len);
+	b->len += len;
+}
+
+// one fix into the piece's output
+void put_fix(piece *p, const char *date, double tod, double lat, double lon, double alt)
+{
+	char text[128];
+	int n, h, m;
+	double v[COLUMNS];
+
+	switch (out_format)
+	{
+	case OUT_CSV:
+		h = (int)(tod / 3600);
+		m = (int)(tod / 60) % 60;
+		n = sprintf(text, "%s,%02d:%02d:%06.3f,%.7f,%.7f,%.1f\n", date, h, m, tod - h * 3600 - m * 60, lat, lon, alt);
+		put(&p->out[0], text, n);
+		break;
+	case OUT_KML:
+		n = sprintf(text, "%f,%f,%f\n", lon, lat, alt);
+		put(&p->out[0], text, n);
+		break;
+	case OUT_COL:
+		v[0] = tod;
+		v[1] = lat;
+		v[2] = lon;
+		v[3] = alt;
+		for (n = 0; n < COLUMNS; n++)
+			put(&p->out[n], &v[n], sizeof(double));
+		break;
+	}
+	p->fixes++;
+}
+
+void convert_text(piece *p)
+{
+	job *j = p->j;
+	const char *s = (const char *)j->map + p->start, *end = (const char *)j->map + p->end, *nl;
+	char line[MAX_LINE], date[16] = "";
+	size_t len;
+	sentence_fix fix;
+	int type;
+
+	for (; s < end; s = nl + 1)
+	{
+		if ((nl = memchr(s, '\n', end - s)) == NULL)
+			nl = end;
+		len = nl - s < MAX_LINE - 1 ? nl - s : MAX_LINE - 1;
+		memcpy(line, s, len);		// the map isn't NUL terminated
+		line[len] = 0;
+
+		type = parse_sentence(line, &fix);
+		if (fix.have_date)
+			sprintf(date, "%04d-%02d-%02d", fix.year, fix.month, fix.day);
+		if (!fix.have_pos)
+			continue;
+		if ((type == SENTENCE_GGA) || (type == SENTENCE_UKHAS) || ((type == SENTENCE_RMC) && j->rmc))
+			put_fix(p, date, fix.tod, fix.lat, fix.lon, fix.have_alt ? fix.alt : 0);
+	}
+}
+
+void got_frame(const ubx_msg *m, void *user)
+{
+	piece *p = user;
+	unsigned long iTOW;
+	ubx_pvt pvt;
+	ubx_posllh pos;
+	char date[16];
+
+	if (m->offset >= p->end - p->start)
+		return;		// starts in the next piece - that one has it
+
+	if (ubx_get_nav_pvt(m, &iTOW, &pvt))
+	{
+		if (pvt.fixType < 2)
+			return;
+		if (p->any && (iTOW == p->last_itow))
+			return;
+		sprintf(date, "%04d-%02d-%02d", pvt.year, pvt.month, pvt.day);
+		put_fix(p, date, pvt.hour * 3600 + pvt.min * 60 + pvt.sec, pvt.lat, pvt.lon, pvt.hMSL);
+	}
+	else if (ubx_get_nav_posllh(m, &pos))
+	{
+		iTOW = pos.iTOW;
+		if (p->any && (iTOW == p->last_itow))
+			return;		// the NAV-PVT for the same epoch has been had
+		put_fix(p, "", ((pos.iTOW / 1000) + 86400 - GPS_LEAP_SECONDS) % 86400 + (pos.iTOW % 1000) / 1000.0,
+			pos.lat, pos.lon, pos.hMSL);
+	}
+	else
+		return;
+	p->last_itow = iTOW;
+	p->any = 1;
+}
+
+// the epoch of the last fix before the piece - so a NAV-POSLLH just after the cut isn't taken for a new one
+void seed_frame(const ubx_msg *m, void *user)
+{
+	piece *p = user;
+	unsigned long iTOW;
+	ubx_pvt pvt;
+	ubx_posllh pos;
+
+	if (m->offset >= p->seed_end)
+		return;
+	if (ubx_get_nav_pvt(m, &iTOW, &pvt) && (pvt.fixType >= 2))
+		p->last_itow = iTOW;
+	else if (ubx_get_nav_posllh(m, &pos))
+		p->last_itow = pos.iTOW;
+	else
+		return;
+	p->any = 1;
+}
+
+void convert_ubx(piece *p)
+{
+	job *j = p->j;
+	ubx_reader r;
+	size_t len = p->end - p->start + 8 + UBX_MAX_PAYLOAD;	// room for a frame that starts at the very end
+	size_t back = 2 * (8 + UBX_MAX_PAYLOAD);
+
+	if (p->start + len > j->size)
+		len = j->size - p->start;
+
+	if (p->start > 0)
+	{ // look back over the end of the piece before
+		if (back > p->start)
+			back = p->start;
+		p->seed_end = back;
+		ubx_reader_init(&r, seed_frame, p);
+		ubx_reader_feed(&r, j->map + p->start - back, back + (len < 8 + UBX_MAX_PAYLOAD ? len : 8 + UBX_MAX_PAYLOAD));
+		ubx_reader_end(&r);
+	}
+
+	ubx_reader_init(&r, got_frame, p);
+	ubx_reader_feed(&r, j->map + p->start, len);
+	ubx_reader_end(&r);
+}
+
+void job_header(job *j)
+{
+	if (out_format == OUT_CSV)
+		fprintf(j->fp[0],"date,time,lat,lon,alt\n");
+	else if (out_format == OUT_KML)
+	{
+		fprintf(j->fp[0],"<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+		fprintf(j->fp[0],"<kml xmlns=\"http://www.opengis.net/kml/2.2\">\n");
+		fprintf(j->fp[0],"<Document>\n<name>%s</name>\n", j->in);
+		fprintf(j->fp[0],"<Style id=\"track\">\n");
+		fprintf(j->fp[0],"<LineStyle> <color>fff010c0</color> </LineStyle>\n");
+		fprintf(j->fp[0],"<PolyStyle> <color>3fc00880</color> </PolyStyle>\n");
+		fprintf(j->fp[0],"</Style>\n");
+		fprintf(j->fp[0],"<Placemark> <name>Flight Path</name> <styleUrl>#track</styleUrl>\n");
+		fprintf(j->fp[0],"<LineString> <extrude>1</extrude> <altitudeMode>absolute</altitudeMode>\n");
+		fprintf(j->fp[0],"<coordinates>\n");
+	}
+}
+
+void job_footer(job *j)
+{
+	if (out_format == OUT_KML)
+		fprintf(j->fp[0],"</coordinates>\n</LineString>\n</Placemark>\n</Document>\n</kml>\n");
+}
+
+void job_free(job *j)
+{
+	munmap(j->map, j->size);
+	pthread_mutex_destroy(&j->lock);
+	free(j->pieces);
+	free(j->in);
+	free(j->out);
+	free(j);
+}
+
+// piece p is done - write it and any done pieces after it, in order
+void piece_done(piece *p)
+{
+	job *j = p->j;
+	piece *w;
+	long fixes = 0;
+	int c, last = 0, bad = 0;
+
+	pthread_mutex_lock(&j->lock);
+	p->done = 1;
+	while ((j->written < j->npieces) && j->pieces[j->written].done)
+	{
+		w = &j->pieces[j->written++];
+		for (c = 0; c < COLUMNS; c++)
+		{
+			if (j->fp[c] && w->out[c].len)
+				fwrite(w->out[c].data, 1, w->out[c].len, j->fp[c]);
+			free(w->out[c].data);
+			w->out[c].data = NULL;
+		}
+		fixes += w->fixes;
+	}
+	last = j->written == j->npieces;
+	pthread_mutex_unlock(&j->lock);
+
+	if (last)
+	{ // nobody else touches the job now
+		job_footer(j);
+		for (c = 0; c < COLUMNS; c++)
+			if (j->fp[c] && fclose(j->fp[c]))
+				bad = 1;
+		if (bad)
+			fprintf(stderr,"Can't write %s: %s\n", j->out, strerror(errno));
+	}
+
+	pthread_mutex_lock(&totals_lock);
+	fixes_out += fixes;
+	if (last)
+	{
+		files++;
+		bytes_in += j->size;
+		failed += bad;
+	}
+	pthread_mutex_unlock(&totals_lock);
+
+	if (last)
+		job_free(j);
+}
+
+void convert_piece(void *arg)
+{
+	piece *p = arg;
+
+	if (p->j->format == FMT_UBX)
+		convert_ubx(p);
+	else
+		convert_text(p);
+	piece_done(p);
+}
+
+// what sort of log - 0 if not one we know
+int detect(const unsigned char *data, size_t len, int *rmc)
+{
+	size_t i, n = len < 65536 ? len : 65536;
+	int gga = 0, nmea = 0;
+
+	*rmc = 0;
+	for (i = 0; i + 3 < n; i++)
+	{
+		if ((data[i] == UBX_SYNC1) && (data[i + 1] == UBX_SYNC2) && (data[i + 2] == UBX_CLASS_NAV))
+			return FMT_UBX;
+		if ((i == 0) || (data[i - 1] == '\n'))
+		{
+			if ((data[i] == '$') && (data[i + 1] == '$'))
+				return FMT_UKHAS;
+			if ((data[i] == '$') && (data[i + 1] == 'G'))
+			{
+				nmea = 1;
+				if ((i + 6 < n) && (memcmp(data + i + 3, "GGA", 3) == 0))
+					gga = 1;
+			}
+		}
+	}
+	if (!nmea)
+		return 0;
+	*rmc = !gga;
+	return FMT_NMEA;
+}
+
+// mkdir -p for the directory part of path
+void make_dirs(const char *path)
+{
+	char dir[2048], *s;
+
+	snprintf(dir, sizeof(dir), "%s", path);
+	for (s = dir + 1; (s = strchr(s, '/')) != NULL; s++)
+	{
+		*s = 0;
+		mkdir(dir, 0777);
+		*s = '/';
+	}
+}
+
+// open, work out the format, and queue the pieces
+void open_file(void *arg)
+{
+	job *j = arg;
+	struct stat st;
+	char path[2100];
+	int fd, c;
+	size_t at, next;
+	const unsigned char *nl;
+	piece *p;
+
+	if (((fd = open(j->in, O_RDONLY)) < 0) || (fstat(fd, &st) < 0) || (st.st_size == 0) ||
+		((j->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED))
+	{
+		if (fd >= 0)
+			close(fd);
+		j->map = NULL;
+		goto skip;
+	}
+	close(fd);
+	j->size = st.st_size;
+
+	if ((j->format = detect(j->map, j->size, &j->rmc)) == 0)
+	{
+		munmap(j->map, j->size);
+		j->map = NULL;
+		goto skip;
+	}
+
+	make_dirs(j->out);
+	for (c = 0; c < COLUMNS; c++)
+	{
+		if (out_format == OUT_COL)
+			snprintf(path, sizeof(path), "%s.%s.f64", j->out, col_names[c]);
+		else if (c == 0)
+			snprintf(path, sizeof(path), "%s.%s", j->out, exts[out_format]);
+		else
+			break;
+		if ((j->fp[c] = fopen(path, "wb")) == NULL)
+		{
+			fprintf(stderr,"Can't create %s: %s\n", path, strerror(errno));
+			while (--c >= 0)
+				fclose(j->fp[c]);
+			munmap(j->map, j->size);
+			j->map = NULL;
+			pthread_mutex_lock(&totals_lock);
+			failed++;
+			pthread_mutex_unlock(&totals_lock);
+			goto skip;
+		}
+	}
+	job_header(j);
+
+	// cut into pieces - text at the start of a line
+	for (at = 0; at < j->size; at = next)
+	{
+		next = at + piece_size < j->size ? at + piece_size : j->size;
+		if ((j->format != FMT_UBX) && (next < j->size))
+			next = (nl = memchr(j->map + next, '\n', j->size - next)) ? (size_t)(nl - j->map) + 1 : j->size;
+		j->pieces = realloc(j->pieces, (j->npieces + 1) * sizeof(piece));
+		p = &j->pieces[j->npieces++];
+		memset(p, 0, sizeof(*p));
+		p->j = j;
+		p->start = at;
+		p->end = next;
+	}
+
+	// all the pieces must exist before the first can finish
+	madvise(j->map, j->size, MADV_SEQUENTIAL);
+	for (c = 0; c < j->npieces; c++)
+	{
+		madvise(j->map + (j->pieces[c].start & ~4095UL), j->pieces[c].end - (j->pieces[c].start & ~4095UL), MADV_WILLNEED);
+		pool_submit(workers, convert_piece, &j->pieces[c]);
+	}
+	return;
+
+skip:
+	pthread_mutex_lock(&totals_lock);
+	skipped++;
+	pthread_mutex_unlock(&totals_lock);
+	free(j->in);
+	free(j->out);
+	free(j);
+}
+
+// queue a file - rel is its path below the directory named on the command line
+void add_file(const char *path, const char *rel)
+{
+	job *j = calloc(1, sizeof(job));
+	char out[4200];
+
+	snprintf(out, sizeof(out), "%s/%s", out_dir, rel);
+	j->in = strdup(path);
+	j->out = strdup(out);
+	pthread_mutex_init(&j->lock, NULL);
+	pool_submit(workers, open_file, j);
+}
+
+void add_dir(const char *path, const char *rel)
+{
+	DIR *d;
+	struct dirent *e;
+	struct stat st;
+	char full[2048], sub[2048];
+
+	if ((d = opendir(path)) == NULL)
+	{
+		fprintf(stderr,"Can't read %s: %s\n", path, strerror(errno));
+		return;
+	}
+	while ((e = readdir(d)) != NULL)
+	{
+		if (e->d_name[0] == '.')
+			continue;
+		snprintf(full, sizeof(full), "%s/%s", path, e->d_name);
+		snprintf(sub, sizeof(sub), "%s%s%s", rel, *rel ? "/" : "", e->d_name);
+		if (stat(full, &st) < 0)
+			continue;
+		if (S_ISDIR(st.st_mode))
+			add_dir(full, sub);
+		else if (S_ISREG(st.st_mode))
+			add_file(full, sub);
+	}
+	closedir(d);
+}
+
+int main(int argc, char **argv)
+{
+	int i, threads = 0, named = 0;
+	struct stat st;
+	struct timespec t0, t1;
+	const char *base;
+	double secs;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (argv[i][0] != '-')
+			named++;
+		else if ((strcmp(argv[i],"-o") == 0) && (i + 1 < argc))
+			out_dir = argv[++i];
+		else if ((strcmp(argv[i],"-f") == 0) && (i + 1 < argc))
+		{
+			i++;
+			if (strcmp(argv[i],"csv") == 0)
+				out_format = OUT_CSV;
+			else if (strcmp(argv[i],"kml") == 0)
+				out_format = OUT_KML;
+			else if (strcmp(argv[i],"col") == 0)
+				out_format = OUT_COL;
+			else
+				named = -1000;
+		}
+		else if ((strcmp(argv[i],"-j") == 0) && (i + 1 < argc))
+			threads = atoi(argv[++i]);
+		else if ((strcmp(argv[i],"-s") == 0) && (i + 1 < argc) && (atoi(argv[i + 1]) > 0))
+			piece_size = (size_t)atoi(argv[++i]) << 20;
+		else
+			named = -1000;
+	}
+	if (named <= 0)
+	{
+		fprintf(stderr,"Usage : %s [-o out dir] [-f csv|kml|col] [-j threads] [-s piece MB] dir|file ...\n", argv[0]);
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	workers = pool_create(threads);
+	for (i = 1; i < argc; i++)
+	{
+		if (argv[i][0] == '-')
+		{
+			i++;		// every option takes a value
+			continue;
+		}
+		if (stat(argv[i], &st) < 0)
+			fprintf(stderr,"Can't read %s: %s\n", argv[i], strerror(errno));
+		else if (S_ISDIR(st.st_mode))
+			add_dir(argv[i], "");
+		else
+		{
+			base = strrchr(argv[i], '/');
+			add_file(argv[i], base ? base + 1 : argv[i]);
+		}
+	}
+	pool_wait(workers);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	fprintf(stderr,"%ld files converted (%ld skipped, %ld failed), %llu fixes, %.1f MB in %.3f s (%.0f MB/s) on %d threads, %llu steals\n",
+		files, skipped, failed, fixes_out, bytes_in / 1e6, secs, secs > 0 ? bytes_in / 1e6 / secs : 0.0,
+		workers->threads, workers->steals);
+	pool_destroy(workers);
+	return failed ? 2 : 0;
+}
@@ -0,0 +1,554 @@
+// pipeBench.c - end to end latency benchmark of the whole chain, KML to habitat
+//
+// the stages are started as separate processes joined by pipes, with pipeBench in the pipes so it sees
+// every sentence leave each stage, and habStub standing in for habitat:
+//
+//	gpsGen -u BENCH -r rate --> [A] --> gpsEmulate -k rate --> [B] --> postdata -i - --> habStub -o log
+//
+// gpsGen puts the time it wrote each sentence in it (the stamp field, CLOCK_MONOTONIC) and habStub logs
+// when it got it, so every sentence gives
+//	generate	A - stamp			gpsGen's own buffering
+//	emulate		B - A				gpsEmulate's parsing, pacing and sinks
+//	upload		habStub - B			postdata's spool (fsync), dedup and the HTTP round trip
+//	end to end	habStub - stamp
+// and the 50th, 90th and 99th percentiles and the maximum of each are printed.
+//
+// each rate (sentences a second - each still a second of flight time, so gpsEmulate is sped up to match)
+// is run for a while with a fresh set of processes. It is sustainable if all but a few of the sentences
+// it should have made were made and got to habitat, and the end to end 99th percentile is within the
+// limit. The highest sustainable rate is printed at the end.
+//
+// options
+//	-k file		the flight (default ../spiral/spiral.kml)
+//	-r list		rates to try, comma separated (default 10,50,100,200,500,1000)
+//	-d secs		how long to generate at each rate (default 10)
+//	-l ms		end to end 99th percentile limit (default 1000)
+//	-w secs		how long to wait for the pipeline to drain when generating stops (default 30)
+//	-p port		port for habStub (default 5985 - not CouchDB's, so a real one isn't disturbed)
+//	-t dir		where the tools are built - dir/gpsGen/gpsGen.exe etc. (default ..)
+//	-K			keep each run's directory (spool, habStub log, stage stderr) rather than removing it
+//
+// the same arguments run the same flight from the same start time every time - "make bench" runs
+// the defaults.
+
+#define _GNU_SOURCE		// mkdtemp, nftw
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <ftw.h>
+#include <limits.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define CALLSIGN	"BENCH"
+#define FIELDS		"count,time,lat,lon,alt,stamp"
+#define START		"2019-10-26T10:00:00"
+#define RELAY_BUF	65536
+
+#define ST_GEN		0		// stages
+#define ST_EMU		1
+#define ST_UP		2
+#define ST_E2E		3
+#define STAGES		4
+
+const char *stage_names[STAGES] = {"generate", "emulate", "upload", "end to end"};
+
+char *kml = "../spiral/spiral.kml";
+char *rates = "10,50,100,200,500,1000";
+double run_secs = 10.0;
+double limit_ms = 1000.0;
+double drain_secs = 30.0;
+int port = 5985;
+char tools[PATH_MAX];
+int keep = 0;
+
+// when each sentence (by its count) was seen - ns, 0 if not seen
+typedef struct sample
+{
+	unsigned long long stamp, at_a, at_b, at_hab;
+} sample;
+
+sample *samples = NULL;
+long nsamples = 0;
+
+// one of the pipes pipeBench sits in
+typedef struct relay
+{
+	int in, out;			// from the stage before, to the stage after (-1 once closed)
+	int stage;				// ST_GEN for A, ST_EMU for B
+	char buf[RELAY_BUF];	// part line read
+	size_t len;
+	char *pending;			// read but not yet taken by the stage after
+	size_t pending_len, pending_size;
+	long lines;
+} relay;
+
+
+unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+sample *sample_for(long count)
+{
+	long n;
+
+	if ((count < 0) || (count > 100000000))
+		return NULL;
+	if (count >= nsamples)
+	{
+		n = nsamples ? nsamples : 4096;
+		while (n <= count)
+			n *= 2;
+		samples = realloc(samples, n * sizeof(sample));
+		memset(samples + nsamples, 0, (n - nsamples) * sizeof(sample));
+		nsamples = n;
+	}
+	return samples + count;
+}
+
+// $$BENCH,count,...,stamp*CRC - the sentence count and the stamp (last field, us) in ns
+int parse_bench(const char *line, long *count, unsigned long long *stamp)
+{
+	const char *p, *star;
+
+	if ((strncmp(line, "$$" CALLSIGN ",", sizeof(CALLSIGN) + 2) != 0) || ((star = strchr(line, '*')) == NULL))
+		return 0;
+	*count = atol(line + sizeof(CALLSIGN) + 2);
+	for (p = star; (p > line) && (p[-1] != ','); p--)
+		;
+	*stamp = strtoull(p, NULL, 10) * 1000ull;
+	return 1;
+}
+
+// start a stage - standard input and output from in and out, standard error to dir/name.err
+pid_t spawn(char **argv, const char *dir, int in, int out)
+{
+	char path[PATH_MAX];
+	pid_t pid;
+	int fd;
+
+	if ((pid = fork()) != 0)
+		return pid;
+
+	snprintf(path, sizeof(path), "%s/%s.err", dir, strrchr(argv[0], '/') + 1);
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0)
+		dup2(fd, 2);
+	dup2(in, 0);
+	dup2(out, 1);
+	for (fd = 3; fd < 1024; fd++)
+		close(fd);
+	if (chdir(dir) != 0) // gpsEmulate's KML, postdata's spool etc. go in the run's directory
+		_exit(127);
+	execv(argv[0], argv);
+	fprintf(stderr, "Can't run %s: %s\n", argv[0], strerror(errno));
+	_exit(127);
+}
+
+void tool(char *path, size_t size, const char *name)
+{
+	snprintf(path, size, "%s/%s/%s.exe", tools, name, name);
+}
+
+// wait for habStub to be listening
+int wait_listening(void)
+{
+	struct sockaddr_in addr;
+	int fd, i, ok = 0;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	for (i = 0; (i < 200) && !ok; i++)
+	{
+		if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+			return 0;
+		ok = connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0;
+		close(fd);
+		if (!ok)
+			usleep(10000);
+	}
+	return ok;
+}
+
+// ************************************* relays *************************************
+
+void relay_line(relay *r, char *line, size_t len, unsigned long long t)
+{
+	unsigned long long stamp;
+	long count;
+	sample *s;
+
+	line[len - 1] = '\0';
+	if (parse_bench(line, &count, &stamp) && ((s = sample_for(count)) != NULL))
+	{
+		s->stamp = stamp;
+		if (r->stage == ST_GEN)
+			s->at_a = t;
+		else
+			s->at_b = t;
+	}
+	line[len - 1] = '\n';
+	r->lines++;
+
+	if (r->pending_len + len > r->pending_size)
+	{
+		r->pending_size = (r->pending_len + len) * 2;
+		r->pending = realloc(r->pending, r->pending_size);
+	}
+	memcpy(r->pending + r->pending_len, line, len);
+	r->pending_len += len;
+}
+
+// read what the stage before has written - 0 at its end
+int relay_read(relay *r)
+{
+	unsigned long long t;
+	char *nl, *p;
+	ssize_t n;
+
+	if ((n = read(r->in, r->buf + r->len, sizeof(r->buf) - r->len)) <= 0)
+		return (n < 0) && ((errno == EAGAIN) || (errno == EINTR));
+
+	t = now_ns();
+	r->len += n;
+	for (p = r->buf; (nl = memchr(p, '\n', r->buf + r->len - p)) != NULL; p = nl + 1)
+		relay_line(r, p, nl + 1 - p, t);
+	r->len -= p - r->buf;
+	memmove(r->buf, p, r->len);
+	if (r->len == sizeof(r->buf))
+		r->len = 0; // no line is that long - throw it away
+	return 1;
+}
+
+void relay_write(relay *r)
+{
+	ssize_t n;
+
+	if ((n = write(r->out, r->pending, r->pending_len)) > 0)
+	{
+		memmove(r->pending, r->pending + n, r->pending_len - n);
+		r->pending_len -= n;
+	}
+	else if ((n < 0) && (errno != EAGAIN) && (errno != EINTR))
+		r->pending_len = 0; // the stage after has gone
+}
+
+// ************************************* results *************************************
+
+int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+double percentile(double *v, long n, double pct)
+{
+	long i = (long)(pct / 100.0 * n);
+
+	return n ? v[i < n ? i : n - 1] : 0.0;
+}
+
+// when habStub got each sentence - from its log "docid ns sentence"
+long read_hab_log(const char *path, unsigned long long *first, unsigned long long *last)
+{
+	char line[1024], *sentence;
+	unsigned long long t, stamp;
+	long count, got = 0;
+	sample *s;
+	FILE *fp;
+
+	*first = *last = 0;
+	if ((fp = fopen(path, "r")) == NULL)
+		return 0;
+	while (fgets(line, sizeof(line), fp))
+	{
+		if ((sentence = strchr(line, ' ')) == NULL)
+			continue;
+		t = strtoull(sentence + 1, &sentence, 10);
+		if (!parse_bench(sentence + 1, &count, &stamp) || ((s = sample_for(count)) == NULL) || s->at_hab)
+			continue;
+		s->at_hab = t;
+		if (!*first || (t < *first))
+			*first = t;
+		if (t > *last)
+			*last = t;
+		got++;
+	}
+	fclose(fp);
+	return got;
+}
+
+// print the run at one rate - returns 1 if it was sustainable
+int report(double rate, long made, long got, unsigned long long first, unsigned long long last)
+{
+	double *v[STAGES];
+	long n[STAGES], i, want = (long)(rate * run_secs);
+	int st, ok;
+	sample *s;
+
+	for (st = 0; st < STAGES; st++)
+	{
+		v[st] = malloc((nsamples + 1) * sizeof(double));
+		n[st] = 0;
+	}
+	for (i = 0; i < nsamples; i++)
+	{
+		s = samples + i;
+		if (s->stamp && s->at_a)
+			v[ST_GEN][n[ST_GEN]++] = ((double)s->at_a - s->stamp) / 1e6;
+		if (s->at_a && s->at_b)
+			v[ST_EMU][n[ST_EMU]++] = ((double)s->at_b - s->at_a) / 1e6;
+		if (s->at_b && s->at_hab)
+			v[ST_UP][n[ST_UP]++] = ((double)s->at_hab - s->at_b) / 1e6;
+		if (s->stamp && s->at_hab)
+			v[ST_E2E][n[ST_E2E]++] = ((double)s->at_hab - s->stamp) / 1e6;
+	}
+	for (st = 0; st < STAGES; st++)
+		qsort(v[st], n[st], sizeof(double), cmp_double);
+
+	// a few short at either end of the run is timing, not falling behind
+	ok = (made >= want * 0.95) && (got >= made - 2) && (n[ST_E2E] > 0) && (percentile(v[ST_E2E], n[ST_E2E], 99) <= limit_ms);
+
+	printf("rate %.0f/s: %ld made (%ld wanted), %ld uploaded", rate, made, want, got);
+	if (last > first)
+		printf(" at %.1f/s", (got - 1) / ((last - first) / 1e9));
+	printf(" - %s\n", ok ? "sustainable" : "NOT sustainable");
+	printf("  %-12s %10s %10s %10s %10s\n", "stage ms", "p50", "p90", "p99", "max");
+	for (st = 0; st < STAGES; st++)
+	{
+		printf("  %-12s %10.2f %10.2f %10.2f %10.2f\n", stage_names[st], percentile(v[st], n[st], 50),
+			percentile(v[st], n[st], 90), percentile(v[st], n[st], 99), n[st] ? v[st][n[st] - 1] : 0.0);
+		free(v[st]);
+	}
+	fflush(stdout);
+	return ok;
+}
+
+int remove_one(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+	return remove(path);
+}
+
+// ************************************* one rate *************************************
+
+int run(double rate)
+{
+	char dir[] = "/tmp/pipeBench.XXXXXX", log[PATH_MAX], url[64], port_s[16], rate_s[32], kml_path[PATH_MAX];
+	char gen[PATH_MAX + 64], emu[PATH_MAX + 64], up[PATH_MAX + 64], hab[PATH_MAX + 64];
+	int a[2], a_out[2], b[2], b_out[2], devnull, n, i;
+	pid_t gen_pid, emu_pid, up_pid, hab_pid, pid;
+	unsigned long long start, stop_at, give_up, first, last;
+	relay ra, rb, *r[2] = {&ra, &rb};
+	struct pollfd pfd[4];
+	long got;
+	int status, ok, up_done = 0, stopped = 0;
+
+	if ((mkdtemp(dir) == NULL) || (realpath(kml, kml_path) == NULL))
+	{
+		fprintf(stderr, "Can't set up the run: %s\n", strerror(errno));
+		return -1;
+	}
+	memset(samples, 0, nsamples * sizeof(sample));
+	tool(gen, sizeof(gen), "gpsGen");
+	tool(emu, sizeof(emu), "gpsEmulate");
+	tool(up, sizeof(up), "postdata");
+	tool(hab, sizeof(hab), "habStub");
+	snprintf(log, sizeof(log), "%s/habStub.log", dir);
+	snprintf(port_s, sizeof(port_s), "%d", port);
+	snprintf(url, sizeof(url), "http://localhost:%d/habitat", port);
+	snprintf(rate_s, sizeof(rate_s), "%g", rate);
+	devnull = open("/dev/null", O_RDWR);
+
+	char *hab_argv[] = {hab, "-p", port_s, "-q", "-o", log, NULL};
+	char *gen_argv[] = {gen, "-q", "-u", CALLSIGN, "-f", FIELDS, "-r", rate_s, "-n", "1000000", "-T", START, "-i", kml_path, NULL};
+	char *emu_argv[] = {emu, "-k", rate_s, "-T", START, NULL};
+	char *up_argv[] = {up, "-i", "-", "-u", url, "-q", NULL};
+
+	hab_pid = spawn(hab_argv, dir, devnull, devnull);
+	if (!wait_listening())
+	{
+		fprintf(stderr, "habStub didn't start listening on port %d (see %s/habStub.exe.err)\n", port, dir);
+		kill(hab_pid, SIGKILL);
+		waitpid(hab_pid, NULL, 0);
+		return -1;
+	}
+
+	if ((pipe(a) < 0) || (pipe(a_out) < 0) || (pipe(b) < 0) || (pipe(b_out) < 0))
+		return -1;
+	gen_pid = spawn(gen_argv, dir, devnull, a[1]);
+	emu_pid = spawn(emu_argv, dir, a_out[0], b[1]);
+	up_pid = spawn(up_argv, dir, b_out[0], devnull);
+	close(a[1]);
+	close(a_out[0]);
+	close(b[1]);
+	close(b_out[0]);
+	close(devnull);
+
+	memset(&ra, 0, sizeof(ra));
+	memset(&rb, 0, sizeof(rb));
+	ra.in = a[0];
+	ra.out = a_out[1];
+	ra.stage = ST_GEN;
+	rb.in = b[0];
+	rb.out = b_out[1];
+	rb.stage = ST_EMU;
+	for (i = 0; i < 2; i++)
+	{
+		fcntl(r[i]->in, F_SETFL, O_NONBLOCK);
+		fcntl(r[i]->out, F_SETFL, O_NONBLOCK);
+	}
+
+	start = now_ns();
+	stop_at = start + (unsigned long long)(run_secs * 1e9);
+	give_up = stop_at + (unsigned long long)(drain_secs * 1e9);
+
+	// relay until postdata has uploaded everything and gone, or we run out of patience
+	while (!up_done && (now_ns() < give_up))
+	{
+		if (!stopped && (now_ns() >= stop_at))
+		{ // enough - the end of gpsGen's output closes each pipe after it in turn
+			kill(gen_pid, SIGTERM);
+			stopped = 1;
+		}
+
+		n = 0;
+		for (i = 0; i < 2; i++)
+		{
+			if (r[i]->in >= 0)
+			{
+				pfd[n].fd = r[i]->in;
+				pfd[n++].events = POLLIN;
+			}
+			if ((r[i]->out >= 0) && r[i]->pending_len)
+			{
+				pfd[n].fd = r[i]->out;
+				pfd[n++].events = POLLOUT;
+			}
+		}
+		poll(pfd, n, 10);
+
+		for (i = 0; i < 2; i++)
+		{
+			if ((r[i]->in >= 0) && !relay_read(r[i]))
+			{
+				close(r[i]->in);
+				r[i]->in = -1;
+			}
+			if ((r[i]->out >= 0) && r[i]->pending_len)
+				relay_write(r[i]);
+			if ((r[i]->in < 0) && (r[i]->out >= 0) && !r[i]->pending_len)
+			{ // all passed on - the stage after sees its end of input
+				close(r[i]->out);
+				r[i]->out = -1;
+			}
+		}
+
+		if (waitpid(up_pid, &status, WNOHANG) == up_pid)
+			up_done = 1;
+	}
+
+	// whatever is left hasn't made it in time
+	for (i = 0; i < 2; i++)
+	{
+		if (r[i]->in >= 0)
+			close(r[i]->in);
+		if (r[i]->out >= 0)
+			close(r[i]->out);
+		free(r[i]->pending);
+	}
+	kill(gen_pid, SIGKILL);
+	kill(emu_pid, SIGKILL);
+	if (!up_done)
+	{
+		fprintf(stderr, "rate %.0f/s: the pipeline didn't drain in %.0f seconds\n", rate, drain_secs);
+		kill(up_pid, SIGKILL);
+	}
+	kill(hab_pid, SIGINT); // its log is line buffered - nothing is lost if it has to be killed
+	for (i = 0; (i < 200) && (waitpid(hab_pid, &status, WNOHANG) == 0); i++)
+		usleep(10000);
+	kill(hab_pid, SIGKILL);
+	while (((pid = wait(&status)) > 0) || (errno == EINTR))
+		;
+
+	got = read_hab_log(log, &first, &last);
+	ok = report(rate, ra.lines, got, first, last);
+
+	if (keep)
+		printf("  run kept in %s\n", dir);
+	else
+		nftw(dir, remove_one, 16, FTW_DEPTH | FTW_PHYS);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	char *list, *rate, path[PATH_MAX];
+	double best = 0.0;
+	int i, ok;
+
+	strcpy(tools, "..");
+	for (i = 1; i < argc; i++)
+	{
+		if ((strcmp(argv[i],"-k") == 0) && (i + 1 < argc))
+			kml = argv[++i];
+		else if ((strcmp(argv[i],"-r") == 0) && (i + 1 < argc))
+			rates = argv[++i];
+		else if ((strcmp(argv[i],"-d") == 0) && (i + 1 < argc))
+			run_secs = atof(argv[++i]);
+		else if ((strcmp(argv[i],"-l") == 0) && (i + 1 < argc))
+			limit_ms = atof(argv[++i]);
+		else if ((strcmp(argv[i],"-w") == 0) && (i + 1 < argc))
+			drain_secs = atof(argv[++i]);
+		else if ((strcmp(argv[i],"-p") == 0) && (i + 1 < argc))
+			port = atoi(argv[++i]);
+		else if ((strcmp(argv[i],"-t") == 0) && (i + 1 < argc))
+			snprintf(tools, sizeof(tools), "%s", argv[++i]);
+		else if (strcmp(argv[i],"-K") == 0)
+			keep = 1;
+		else
+		{
+			fprintf(stderr,"Usage : %s [-k flight.kml] [-r rate,rate...] [-d secs] [-l p99 ms] [-w drain secs] [-p port] [-t tools dir] [-K]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (realpath(tools, path) == NULL)
+	{
+		fprintf(stderr, "Can't find the tools in %s\n", tools);
+		return 1;
+	}
+	strcpy(tools, path);
+	signal(SIGPIPE, SIG_IGN);
+
+	list = strdup(rates);
+	for (rate = strtok(list, ","); rate; rate = strtok(NULL, ","))
+	{
+		if (atof(rate) <= 0)
+			continue;
+		if ((ok = run(atof(rate))) < 0)
+			return 1;
+		if (ok && (atof(rate) > best))
+			best = atof(rate);
+	}
+	free(list);
+
+	if (best > 0)
+		printf("highest sustainable rate %.0f sentences/s (end to end p99 within %.0f ms)\n", best, limit_ms);
+	else
+		printf("no rate tried was sustainable (end to end p99 within %.0f ms)\n", limit_ms);
+	return 0;
+}
@@ -23,8 +23,6 @@ void base64_encode(const unsigned char *data,
 
 	int i, j;
 	
-	printf ("data=%s\n",data);
-	
     *output_length = 4 * ((input_length + 2) / 3);
 
     // unsigned char *encoded_data = malloc(*output_length);
@@ -47,7 +45,6 @@ void base64_encode(const unsigned char *data,
     for (i = 0; i < mod_table[input_length % 3]; i++)
         encoded_data[*output_length - 1 - i] = '=';
 
-	printf ("encoded data=%s\n",encoded_data);
     // return encoded_data;
 }
 
@@ -0,0 +1,259 @@
+// dedup.c - uploaded document ID cache
+//
+// the doc ID is a SHA-256 digest so its bits are already uniformly spread, they are used
+// directly as the hash - bytes 0-7 pick the table slot, bytes 8-15 the Bloom filter block.
+//
+// table	linear probing, power of 2 size, grown at 3/4 full - 16 bytes a slot so
+//			between 21 and 43 bytes per entry (about 21 - 43 MB per million documents)
+// bloom	(optional) 16 bits per slot, all 7 probes for a key fall in one 64 byte block
+//			so a miss costs one cache line rather than a probe sequence through the table
+// snapshot	"PDDEDUP1", entry count (8 bytes), then the keys. Written to a temporary, fsync'ed and
+//			renamed at exit and whenever the set has grown by 10% since the last one
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "dedup.h"
+#include "stats.h"
+
+#define BLOOM_PROBES 7
+#define BLOCK_BITS 512		// one cache line
+
+static unsigned char *table;			// capacity * DEDUP_KEY bytes, all zero = empty slot
+static size_t capacity, count;
+static uint64_t *bloom;					// NULL if not wanted
+static size_t bloom_blocks;
+static int want_bloom;
+static char *dedup_path;
+static size_t saved_count;				// entries in the last snapshot
+
+static stat_counter *lookup_stat, *hit_stat, *bloom_stat, *entries_stat, *memory_stat;
+
+
+static uint64_t word(const unsigned char *key, int at)
+{
+	uint64_t w;
+
+	memcpy(&w, key + at, sizeof(w));
+	return w;
+}
+
+// the block and the probe bits for a key (probes come from a multiplicative hash of bytes 0-7
+// so they are not the same bits that picked the table slot)
+static uint64_t *bloom_block(const unsigned char *key, uint64_t *h)
+{
+	*h = word(key, 0) * 0x9E3779B97F4A7C15ull;
+	return bloom + (word(key, 8) % bloom_blocks) * (BLOCK_BITS / 64);
+}
+
+static void bloom_add(const unsigned char *key)
+{
+	uint64_t *block, h;
+	int i;
+
+	block = bloom_block(key, &h);
+	for (i = 0; i < BLOOM_PROBES; i++, h >>= 9)
+		block[(h & (BLOCK_BITS - 1)) >> 6] |= 1ull << (h & 63);
+}
+
+static int bloom_maybe(const unsigned char *key)
+{
+	uint64_t *block, h;
+	int i;
+
+	block = bloom_block(key, &h);
+	for (i = 0; i < BLOOM_PROBES; i++, h >>= 9)
+		if (!(block[(h & (BLOCK_BITS - 1)) >> 6] & (1ull << (h & 63))))
+			return 0;
+	return 1;
+}
+
+static int empty_slot(const unsigned char *slot)
+{
+	static const unsigned char zero[DEDUP_KEY];
+
+	return memcmp(slot, zero, DEDUP_KEY) == 0;
+}
+
+// slot holding the key, or the empty slot where it would go
+static unsigned char *find(const unsigned char *key)
+{
+	size_t i;
+	unsigned char *slot;
+
+	for (i = word(key, 0) & (capacity - 1); ; i = (i + 1) & (capacity - 1))
+	{
+		slot = table + i * DEDUP_KEY;
+		if (empty_slot(slot) || (memcmp(slot, key, DEDUP_KEY) == 0))
+			return slot;
+	}
+}
+
+static size_t memory_used(void)
+{
+	return capacity * DEDUP_KEY + (bloom ? bloom_blocks * BLOCK_BITS / 8 : 0);
+}
+
+// (re)build the table (and the Bloom filter) at a new size
+static void resize(size_t newcap)
+{
+	unsigned char *old = table;
+	size_t oldcap = capacity, i;
+
+	if ((table = calloc(newcap, DEDUP_KEY)) == NULL)
+	{
+		fprintf(stderr,"dedup: out of memory\n");
+		exit(1);
+	}
+	capacity = newcap;
+
+	if (want_bloom)
+	{
+		free(bloom);
+		bloom_blocks = capacity * 16 / BLOCK_BITS + 1;
+		if ((bloom = calloc(bloom_blocks, BLOCK_BITS / 8)) == NULL)
+		{
+			fprintf(stderr,"dedup: out of memory\n");
+			exit(1);
+		}
+	}
+
+	for (i = 0; i < oldcap; i++)
+	{
+		if (!empty_slot(old + i * DEDUP_KEY))
+		{
+			memcpy(find(old + i * DEDUP_KEY), old + i * DEDUP_KEY, DEDUP_KEY);
+			if (bloom)
+				bloom_add(old + i * DEDUP_KEY);
+		}
+	}
+	free(old);
+
+	stats_set(memory_stat, memory_used());
+}
+
+static void snapshot(void)
+{
+	char tmp[1024];
+	FILE *fp;
+	uint64_t n = count;
+	size_t i;
+	int synced;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", dedup_path);
+	if ((fp = fopen(tmp, "wb")) == NULL)
+		return; // cant write it now - maybe next time
+
+	fwrite("PDDEDUP1", 8, 1, fp);
+	fwrite(&n, sizeof(n), 1, fp);
+	for (i = 0; i < capacity; i++)
+		if (!empty_slot(table + i * DEDUP_KEY))
+			fwrite(table + i * DEDUP_KEY, DEDUP_KEY, 1, fp);
+
+	// on disk before it replaces the last one - a power cut mustn't leave an empty set (and everything re-sent)
+	synced = (fflush(fp) == 0) && (fsync(fileno(fp)) == 0);
+	if ((fclose(fp) == 0) && synced)
+		rename(tmp, dedup_path);
+	saved_count = count;
+}
+
+// add a key to the table - returns 0 if it was already there
+static int add_key(const unsigned char *key)
+{
+	unsigned char *slot;
+
+	if (empty_slot(key))
+		return 0; // 1 in 2^128 - and that is the empty marker
+
+	slot = find(key);
+	if (!empty_slot(slot))
+		return 0; // already known
+
+	memcpy(slot, key, DEDUP_KEY);
+	count++;
+	if (bloom)
+		bloom_add(key);
+
+	if (count > capacity / 4 * 3)
+		resize(capacity * 2);
+	stats_set(entries_stat, count);
+	return 1;
+}
+
+void dedup_open(const char *path, int bloom_wanted)
+{
+	FILE *fp;
+	char magic[8];
+	uint64_t n = 0;
+	unsigned char key[DEDUP_KEY];
+	size_t cap;
+
+	lookup_stat = stats_counter("postdata_dedup_lookups_total","Doc ID cache lookups",NULL);
+	hit_stat = stats_counter("postdata_dedup_hits_total","Doc ID cache hits (upload skipped)",NULL);
+	bloom_stat = stats_counter("postdata_dedup_bloom_rejects_total","Lookups answered by the Bloom filter alone",NULL);
+	entries_stat = stats_gauge("postdata_dedup_entries","Doc IDs in the cache",NULL);
+	memory_stat = stats_gauge("postdata_dedup_bytes","Memory used by the doc ID cache",NULL);
+
+	dedup_path = strdup(path);
+	want_bloom = bloom_wanted;
+
+	if ((fp = fopen(path, "rb")) != NULL)
+	{
+		if ((fread(magic, 8, 1, fp) != 1) || (memcmp(magic, "PDDEDUP1", 8) != 0) || (fread(&n, sizeof(n), 1, fp) != 1))
+		{
+			fprintf(stderr,"dedup: %s is not a doc ID snapshot - ignored\n", path);
+			n = 0;
+		}
+	}
+
+	for (cap = 1024; cap / 4 * 3 <= n; cap *= 2)
+		; // big enough to load without growing
+	resize(cap);
+
+	while (n-- && (fread(key, DEDUP_KEY, 1, fp) == 1))
+		add_key(key);
+	if (fp)
+		fclose(fp);
+
+	saved_count = count;
+}
+
+int dedup_contains(const unsigned char *hash)
+{
+	stats_add(lookup_stat, 1);
+
+	if (bloom && !bloom_maybe(hash))
+	{
+		stats_add(bloom_stat, 1);
+		return 0;
+	}
+	if (empty_slot(find(hash)))
+		return 0;
+
+	stats_add(hit_stat, 1);
+	return 1;
+}
+
+void dedup_insert(const unsigned char *hash)
+{
+	if (add_key(hash) && (count - saved_count >= 100) && (count - saved_count >= saved_count / 10))
+		snapshot();
+}
+
+void dedup_close(void)
+{
+	long long lookups = lookup_stat->value;
+	long long hits = hit_stat->value;
+
+	if (count != saved_count)
+		snapshot();
+
+	fprintf(stderr,"dedup: %zu doc IDs, %lld lookups, %lld hits (%.1f%%)", count, lookups, hits,
+		lookups ? 100.0 * hits / lookups : 0.0);
+	if (bloom)
+		fprintf(stderr,", %lld answered by the Bloom filter", bloom_stat->value);
+	fprintf(stderr,", %zu bytes (%.1f MB per million doc IDs)\n", memory_used(),
+		count ? (double)memory_used() / count : 0.0);
+}
@@ -0,0 +1,11 @@
+// dedup.h - set of document IDs (SHA-256 of the base64 sentence) already uploaded to habitat
+//
+// kept in memory as an open addressed hash table of the first 128 bits of each digest,
+// optionally fronted by a blocked Bloom filter, and snapshotted to disk so it survives restarts.
+
+#define DEDUP_KEY 16		// bytes of the digest kept
+
+void dedup_open(const char *path, int bloom);			// load the snapshot (if any)
+int dedup_contains(const unsigned char *hash);			// 1 if this digest has been uploaded (counted as a lookup)
+void dedup_insert(const unsigned char *hash);			// remember an uploaded digest
+void dedup_close(void);									// write the snapshot and report hit rates
@@ -0,0 +1,260 @@
+// fairq.c - deficit round robin over per payload queues, with optional per payload rate limits
+//
+// see fairq.h for the usage
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stats.h"
+#include "fairq.h"
+
+#define MAX_PAYLOADS 256
+#define MAX_RATES 64
+
+typedef struct payload
+{
+	char callsign[32];
+	spool_entry **q;				// ring of sentences waiting, oldest first
+	int first, count, size;
+	int sent;						// the first sent are being uploaded
+	int deficit;					// bytes it may still send this turn
+	int topped;						// has had its quantum this turn
+	double rate;					// sentences a second (0 - no limit)
+	double tokens;
+	unsigned long long refilled;	// when tokens were last topped up
+	unsigned long uploads;
+	unsigned long long max_lag;
+	stat_counter *pending_stat, *uploads_stat, *oldest_stat;
+	stat_hist *lag_stat;
+} payload;
+
+typedef struct rate_spec
+{
+	char callsign[32];				// "" for the default
+	double rate;
+} rate_spec;
+
+static payload *payloads[MAX_PAYLOADS];
+static int npayloads;
+static int cur;						// whose turn it is
+static int quantum = 256;
+static rate_spec rates[MAX_RATES];
+static int nrates;
+
+
+void fairq_init(int q)
+{
+	if (q > 0)
+		quantum = q;
+}
+
+int fairq_rate(const char *spec)
+{
+	const char *eq = strchr(spec, '=');
+	char *end;
+	double r;
+
+	if (nrates == MAX_RATES)
+		return 0;
+	r = strtod(eq ? eq + 1 : spec, &end);
+	if (*end || (r <= 0) || (eq && ((eq == spec) || (eq - spec >= (int)sizeof(rates[0].callsign)))))
+		return 0;
+	snprintf(rates[nrates].callsign, sizeof(rates[0].callsign), "%.*s", eq ? (int)(eq - spec) : 0, spec);
+	rates[nrates++].rate = r;
+	return 1;
+}
+
+// the payload a sentence belongs to - the callsign after $$ (a line may have a time etc. in front)
+static void callsign_of(const char *sentence, char *callsign, size_t size)
+{
+	const char *p = strstr(sentence, "$$");
+	size_t n;
+
+	if (p == NULL)
+	{
+		snprintf(callsign, size, "-");
+		return;
+	}
+	p += 2;
+	n = strcspn(p, ",*");
+	if (n >= size)
+		n = size - 1;
+	memcpy(callsign, p, n);
+	callsign[n] = '\0';
+}
+
+static payload *find_payload(const char *callsign)
+{
+	char labels[STAT_LABELS];
+	payload *p;
+	int i;
+
+	for (i = 0; i < npayloads; i++)
+		if (strcmp(payloads[i]->callsign, callsign) == 0)
+			return payloads[i];
+
+	if ((npayloads == MAX_PAYLOADS) || ((p = calloc(1, sizeof(*p))) == NULL))
+		return payloads[npayloads - 1]; // silly numbers of payloads share the last queue
+	snprintf(p->callsign, sizeof(p->callsign), "%s", callsign);
+	for (i = 0; i < nrates; i++)
+		if ((rates[i].callsign[0] == '\0') || (strcmp(rates[i].callsign, callsign) == 0))
+			p->rate = rates[i].rate; // the callsign's own, if it has one, comes later than a default
+	p->tokens = p->rate; // a second's burst to start with
+
+	snprintf(labels, sizeof(labels), "payload=\"%.40s\"", callsign);
+	p->pending_stat = stats_gauge("postdata_payload_pending","Sentences waiting to be uploaded, by payload",labels);
+	p->uploads_stat = stats_counter("postdata_payload_uploads_total","Sentences uploaded, by payload",labels);
+	p->oldest_stat = stats_gauge_ns("postdata_payload_oldest_seconds","Age of the oldest sentence waiting, by payload",labels);
+	p->lag_stat = stats_hist("postdata_payload_lag_seconds","Time from a sentence being read to habitat accepting it, by payload",labels);
+
+	payloads[npayloads++] = p;
+	return p;
+}
+
+void fairq_add(spool_entry *e)
+{
+	char callsign[32];
+	spool_entry **q;
+	payload *p;
+	int i;
+
+	callsign_of(e->sentence, callsign, sizeof(callsign));
+	p = find_payload(callsign);
+
+	if (p->count == p->size)
+	{ // grow the ring, unwrapping it
+		if ((q = malloc((p->size ? p->size * 2 : 64) * sizeof(*q))) == NULL)
+		{
+			fprintf(stderr,"fairq: out of memory\n");
+			exit(1);
+		}
+		for (i = 0; i < p->count; i++)
+			q[i] = p->q[(p->first + i) % p->size];
+		free(p->q);
+		p->q = q;
+		p->first = 0;
+		p->size = p->size ? p->size * 2 : 64;
+	}
+	p->q[(p->first + p->count++) % p->size] = e;
+	stats_set(p->pending_stat, p->count);
+}
+
+static void refill(payload *p, unsigned long long now)
+{
+	double burst = p->rate > 1 ? p->rate : 1; // at most a second's worth banked (one sentence below 1/s)
+
+	if (p->rate <= 0)
+		return;
+	p->tokens += (now - p->refilled) / 1e9 * p->rate;
+	if (p->tokens > burst)
+		p->tokens = burst;
+	p->refilled = now;
+}
+
+spool_entry *fairq_next(unsigned long long now, unsigned long long *due)
+{
+	unsigned long long when;
+	spool_entry *e;
+	payload *p;
+	int visits, len;
+
+	*due = 0;
+	for (visits = 0; visits < 2 * npayloads; visits++)
+	{
+		p = payloads[cur];
+		if (p->count > p->sent)
+		{
+			if (!p->topped)
+			{
+				p->deficit += quantum;
+				p->topped = 1;
+			}
+			refill(p, now);
+			e = p->q[(p->first + p->sent) % p->size];
+			len = strlen(e->sentence);
+			if ((p->rate > 0) && (p->tokens < 1.0))
+			{ // not due yet - no credit is banked while it waits
+				when = now + (unsigned long long)((1.0 - p->tokens) / p->rate * 1e9);
+				if ((*due == 0) || (when < *due))
+					*due = when;
+				p->deficit = 0;
+			}
+			else if ((len <= p->deficit) || (p->deficit >= quantum))
+			{ // (a sentence longer than the quantum goes on a full turn's credit)
+				p->deficit -= len;
+				if (p->rate > 0)
+					p->tokens -= 1.0;
+				p->sent++;
+				return e; // and its turn carries on while it has credit
+			}
+		}
+		else
+			p->deficit = 0; // nothing waiting (or all of it on its way) - no credit banked either
+		p->topped = 0;
+		cur = (cur + 1) % npayloads;
+	}
+	return NULL;
+}
+
+void fairq_done(spool_entry *e, int ok)
+{
+	unsigned long long lag;
+	char callsign[32];
+	payload *p;
+	int i, j;
+
+	callsign_of(e->sentence, callsign, sizeof(callsign));
+	p = find_payload(callsign);
+	if (p->sent > 0)
+		p->sent--;
+	if (!ok)
+	{ // give back what it was charged - it will be tried again
+		p->deficit += strlen(e->sentence);
+		if (p->rate > 0)
+			p->tokens += 1.0;
+		return;
+	}
+
+	// it is one of the first few (a batch may finish in any order)
+	for (i = 0; (i < p->count) && (p->q[(p->first + i) % p->size] != e); i++)
+		;
+	if (i < p->count)
+	{
+		for (j = i; j > 0; j--)
+			p->q[(p->first + j) % p->size] = p->q[(p->first + j - 1) % p->size];
+		p->first = (p->first + 1) % p->size;
+		p->count--;
+	}
+	lag = stats_now() - e->queued;
+	stats_record(p->lag_stat, lag);
+	if (lag > p->max_lag)
+		p->max_lag = lag;
+	stats_add(p->uploads_stat, 1);
+	stats_set(p->pending_stat, p->count);
+	p->uploads++;
+}
+
+void fairq_tick(unsigned long long now)
+{
+	payload *p;
+	int i;
+
+	for (i = 0; i < npayloads; i++)
+	{
+		p = payloads[i];
+		stats_set(p->oldest_stat, p->count ? now - p->q[p->first]->queued : 0); // ns, like lag_stat
+	}
+}
+
+void fairq_report(FILE *fp)
+{
+	payload *p;
+	int i;
+
+	for (i = 0; i < npayloads; i++)
+	{
+		p = payloads[i];
+		fprintf(fp,"%s: %lu uploaded, lag p50 %.3f p99 %.3f max %.3f s, %d left\n", p->callsign, p->uploads,
+			stats_quantile(p->lag_stat, 0.5) / 1e9, stats_quantile(p->lag_stat, 0.99) / 1e9, p->max_lag / 1e9, p->count);
+	}
+}
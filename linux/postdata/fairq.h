@@ -0,0 +1,29 @@
+// fairq.h - fair upload order across payloads
+//
+// each spooled sentence is put in a queue for its payload (the callsign after $$) and the queues are
+// served by deficit round robin - every turn a payload may send up to a quantum of bytes, so a payload
+// sending twice as often doesn't get twice the uploads while others wait, and sentences of different
+// lengths are counted fairly. Within a payload sentences go oldest first.
+//
+// a payload may also be limited to a rate (sentences a second, token bucket with a second's burst);
+// fairq_next() passes over it until it is due and says when the next one will be.
+//
+// per payload metrics (labelled payload="CALLSIGN")
+//	postdata_payload_pending			sentences waiting
+//	postdata_payload_uploads_total		sentences uploaded
+//	postdata_payload_lag_seconds		time from a sentence being read to habitat accepting it
+//	postdata_payload_oldest_seconds		age of the oldest sentence waiting - stays low for every payload
+//										that isn't falling behind
+
+#include <stdio.h>
+#include "spool.h"
+
+void fairq_init(int quantum);				// bytes per payload per turn
+int fairq_rate(const char *spec);			// "CALLSIGN=rate" or "rate" for every payload - 0 if not understood
+void fairq_add(spool_entry *e);				// a sentence to upload
+spool_entry *fairq_next(unsigned long long now, unsigned long long *due);	// next to upload (NULL if none can go
+																			// now - *due is when one can, 0 if none waiting)
+void fairq_done(spool_entry *e, int ok);	// uploaded (e is finished with), or failed (it stays at the front)
+											// - several may be taken with fairq_next() before they are done
+void fairq_tick(unsigned long long now);	// update the oldest ages (call at every wake up)
+void fairq_report(FILE *fp);				// per payload totals
@@ -0,0 +1,88 @@
+#!/bin/sh
+# killtest.sh - kill postdata part way through uploading, again and again, and check that habitat
+# (the habStub stand-in) ends up with every sentence, each created once
+#
+# telemReplay -u writes unique sentences into a file that postdata -f follows. postdata is killed with
+# SIGKILL several times mid-upload and started again on the same spool and doc ID snapshot. When the
+# replay has finished a last postdata (not following) uploads whatever is left and exits.
+# habStub's log of new documents must then hold every sentence written, and no doc ID twice.
+#
+# a sentence uploaded just before a kill, whose "done" record hadn't reached the spool, is sent again
+# on restart - habitat adds the receiver to the document it already has, so that is harmless. These
+# re-sends are counted (habStub's "listeners added") but are not a failure.
+#
+# build postdata, habStub and telemReplay first, then from this directory
+#	./killtest.sh [sentences] [kills] [port]
+# exits 0 if nothing was lost or duplicated
+
+N=${1:-2000}			# sentences to replay
+KILLS=${2:-8}			# times postdata is killed
+PORT=${3:-5990}			# for habStub
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+POSTDATA=$HERE/postdata.exe
+HABSTUB=$HERE/../habStub/habStub.exe
+REPLAY=$HERE/../telemReplay/telemReplay.exe
+URL=http://localhost:$PORT/habitat
+
+for exe in "$POSTDATA" "$HABSTUB" "$REPLAY"
+do
+	if [ ! -x "$exe" ]
+	then
+		echo "killtest: $exe not built" >&2
+		exit 1
+	fi
+done
+
+DIR=$(mktemp -d)
+trap 'kill $HAB $REP $PD 2>/dev/null; rm -rf "$DIR"' EXIT
+cd "$DIR"
+
+# a 20ms answer so kills land while uploads are in flight
+"$HABSTUB" -p $PORT -l 20 -q -o habstub.log 2>habstub.err &
+HAB=$!
+sleep 0.5
+
+: > load.txt
+"$REPLAY" -i "$HERE/telemetry.txt" -o load.txt -r 200 -n $N -u 2>/dev/null &
+REP=$!
+
+i=0
+while [ $i -lt $KILLS ]
+do
+	"$POSTDATA" -f -q -i load.txt -u $URL -s postdata.spool -d postdata.dedup -c KILLTEST 2>>postdata.err &
+	PD=$!
+	sleep 0.$(( (i * 37) % 7 + 3 ))	# 0.3 - 0.9 seconds, different each time
+	kill -9 $PD
+	wait $PD 2>/dev/null
+	i=$((i + 1))
+	echo "killtest: killed postdata $i times, $(wc -l < habstub.log) documents so far"
+done
+
+wait $REP
+REP=
+"$POSTDATA" -q -i load.txt -u $URL -s postdata.spool -d postdata.dedup -c KILLTEST 2>>postdata.err
+PD=
+
+kill -INT $HAB
+wait $HAB
+HAB=
+
+sort -u load.txt > sent
+cut -d' ' -f3- habstub.log | sort > received
+cut -d' ' -f1 habstub.log | sort | uniq -d > duplicated
+lost=$(comm -23 sent received | wc -l)
+extra=$(comm -13 sent received | wc -l)
+dups=$(wc -l < duplicated)
+
+echo "killtest: $(wc -l < sent) sentences written, $(wc -l < habstub.log) documents created"
+echo "killtest: $lost lost, $dups doc IDs created twice, $extra not written by the replay"
+tail -1 habstub.err
+
+if [ "$lost" -ne 0 ] || [ "$dups" -ne 0 ] || [ "$extra" -ne 0 ]
+then
+	echo "killtest: FAILED"
+	exit 1
+fi
+echo "killtest: passed"
+exit 0
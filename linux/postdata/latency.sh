@@ -0,0 +1,64 @@
+#!/bin/sh
+# latency.sh - how long a sentence appended to the log takes to reach habitat, against the habStub stand-in
+#
+# telemReplay -u appends unique sentences at a steady rate to a file that postdata -f follows and
+# uploads to habStub. Once every sentence has been accepted the percentiles of postdata_latency_seconds
+# (from a line being read - in follow mode, woken by inotify as it is appended - to habitat accepting
+# it) are printed from the metrics file, with the upload round trip for comparison.
+#
+# build postdata, habStub and telemReplay first, then from this directory
+#	./latency.sh [sentences] [rate] [habStub ms] [port]
+# e.g.	./latency.sh 1000 20 0		# 1000 sentences at 20 a second to an instant habitat
+
+N=${1:-1000}			# sentences to replay
+RATE=${2:-20}			# a second
+DELAY=${3:-0}			# habStub answer delay (ms)
+PORT=${4:-5989}			# for habStub
+
+HERE=$(cd "$(dirname "$0")" && pwd)
+POSTDATA=$HERE/postdata.exe
+HABSTUB=$HERE/../habStub/habStub.exe
+REPLAY=$HERE/../telemReplay/telemReplay.exe
+URL=http://localhost:$PORT/habitat
+
+for exe in "$POSTDATA" "$HABSTUB" "$REPLAY"
+do
+	if [ ! -x "$exe" ]
+	then
+		echo "latency: $exe not built" >&2
+		exit 1
+	fi
+done
+
+DIR=$(mktemp -d)
+trap 'kill $HAB $PD 2>/dev/null; rm -rf "$DIR"' EXIT
+cd "$DIR"
+
+"$HABSTUB" -p $PORT -l $DELAY -q 2>habstub.err &
+HAB=$!
+sleep 0.5
+
+: > load.txt
+"$POSTDATA" -f -q -i load.txt -u $URL -m postdata.prom -M 0.2 2>postdata.err &
+PD=$!
+sleep 0.5
+
+"$REPLAY" -i "$HERE/telemetry.txt" -o load.txt -r $RATE -n $N -u 2>/dev/null
+
+# until the metrics show them all uploaded (10 seconds at most)
+i=0
+while [ $i -lt 50 ] && ! grep -q "^postdata_uploads_total{result=\"ok\"} $N\$" postdata.prom 2>/dev/null
+do
+	sleep 0.2
+	i=$((i + 1))
+done
+
+ok=$(grep "^postdata_uploads_total{result=\"ok\"}" postdata.prom | cut -d' ' -f2)
+echo "latency: $N sentences at $RATE a second, habStub answering after ${DELAY}ms - $ok uploaded"
+for metric in postdata_latency_seconds postdata_upload_seconds
+do
+	grep "^$metric{quantile=" postdata.prom | awk -v m=$metric '
+		{ split($1, q, "\""); v[q[2]] = $2 * 1000 }
+		END { printf "%-26s p50 %.3f ms  p99 %.3f ms  max %.3f ms\n", m, v["0.5"], v["0.99"], v["1"] }'
+done
+[ "$ok" = "$N" ]
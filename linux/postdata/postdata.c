@@ -19,35 +19,356 @@
 
 #include "base64.h"
 #include "sha256.h"
+#include "stats.h"
+#include "spool.h"
+#include "dedup.h"
+#include "tail.h"
+#include "fairq.h"
+#include "profile.h"
 
 void hash_to_hex(unsigned char *hash, unsigned char *line);
-void UploadTelemetryPacket(unsigned char * buffer);
+void make_document(unsigned char *buffer, unsigned char *base64_data, size_t *base64_length, unsigned char *hash);
+int UploadTelemetryPacket(unsigned char * buffer);
+void BulkUpload(spool_entry **batch, int n, int *ok);
+char *json_string(const char *text);
 
+#define SPOOL_BATCH 64		// most sentences read from the input per group commit
+#define MAX_BACKOFF 60		// longest wait (seconds) between retries when habitat can't be reached
+#define MAX_INPUTS 32		// most -i files
+#define BULK_MAX 1000		// most sentences in one bulk request
+#define BULK_STEP 8			// bulk batch growth after each quick round trip
+#define MAX_RECEIVER 32		// longest -c callsign
 
-int main (void){
-	
-	unsigned char buffer[500];
+// run-time metrics (see stats.h)
+stat_counter *upload_ok_stat;		// uploads accepted by habitat
+stat_counter *upload_fail_stat;		// uploads that failed (network or server)
+stat_counter *retry_stat;			// uploads that will have to be tried again
+stat_hist *upload_stat;				// upload round trip time
+stat_hist *encode_stat;				// base64 + SHA256 + JSON build time
+stat_hist *latency_stat;			// time from a sentence being read to habitat accepting it
+stat_counter *batch_stat;			// sentences per bulk request
+stat_counter *conflict_stat;		// bulk documents habitat already had (sent again to add the listener)
+
+time_t retry_at = 0;				// when to next try habitat after a failure
+int backoff = 1;					// seconds to wait after the next failure
+char *habitat_url = "http://habitat.habhub.org/habitat";	// CouchDB database to upload to
+int quiet = 0;						// don't print every sentence and document
+char *receiver = "M0RJX-LGW";		// listener callsign the uploads are made as (escaped for JSON)
+unsigned long long upload_due = 0;	// when a rate limited payload may next upload (0 - not waiting)
+int bulk_max = 0;					// most sentences per bulk request (0 - one PUT per sentence)
+int bulk_batch = BULK_STEP;			// sentences in the next bulk request
+int bulk_target_ms = 500;			// round trip the bulk batch size is adjusted to
+int s_read, s_dedup, s_spool, s_format, s_encode, s_hash, s_upload, s_wait;	// --profile stages
+
+
+// upload everything in the spool, taking the payloads in turn (see fairq.h), until it is empty, an
+// upload fails or only rate limited payloads are left
+// (everything queued is committed to disk first so nothing is uploaded that could be lost)
+void drain_spool(void)
+{
+	static spool_entry *batch[BULK_MAX];
+	static int ok[BULK_MAX];
+	unsigned long long t;
+	int i, n, failed, uncommitted = 0;
+	profile_scope ps;
+
+	profile_begin(&ps, s_spool);
+	spool_commit();
+	profile_end(&ps);
+
+	if (time(NULL) < retry_at)
+		return; // habitat was unreachable - wait a bit
+
+	for (;;)
+	{
+		for (n = 0; (n < (bulk_max ? bulk_batch : 1)) && ((batch[n] = fairq_next(stats_now(), &upload_due)) != NULL); n++)
+			;
+		if (n == 0)
+			break;
+
+		t = stats_now();
+		profile_begin(&ps, s_format); // less the encoding, hashing and upload inside
+		if (bulk_max)
+			BulkUpload(batch, n, ok);
+		else
+			ok[0] = UploadTelemetryPacket((unsigned char *)batch[0]->sentence);
+		profile_end(&ps);
+		t = stats_now() - t;
+
+		for (i = failed = 0; i < n; i++)
+		{
+			if (ok[i])
+			{
+				stats_record(latency_stat, stats_now() - batch[i]->queued);
+				fairq_done(batch[i], 1);
+				spool_done(batch[i]);
+				uncommitted++;
+			}
+			else
+			{ // link down (or habitat unhappy) - keep it and try again later
+				fairq_done(batch[i], 0);
+				failed++;
+			}
+		}
+
+		if (bulk_max)
+		{ // additive increase while the round trip is quick, halve it when it isn't (or the request failed)
+			if (failed || (t > bulk_target_ms * 1000000ull))
+				bulk_batch = bulk_batch > 1 ? bulk_batch / 2 : 1;
+			else if (n == bulk_batch)
+				bulk_batch = bulk_batch + BULK_STEP < bulk_max ? bulk_batch + BULK_STEP : bulk_max;
+			stats_set(batch_stat, bulk_batch);
+		}
+
+		if (failed)
+		{
+			stats_add(retry_stat, failed);
+			retry_at = time(NULL) + backoff;
+			fprintf(stderr,"%d sentences spooled - retry in %d seconds\n", spool_pending(), backoff);
+			if ((backoff *= 2) > MAX_BACKOFF)
+				backoff = MAX_BACKOFF;
+			break;
+		}
+		backoff = 1;
+
+		if (uncommitted >= SPOOL_BATCH)
+		{ // keep the done records moving during a long drain
+			profile_begin(&ps, s_spool);
+			spool_commit();
+			profile_end(&ps);
+			uncommitted = 0;
+		}
+
+		fairq_tick(stats_now());
+		stats_tick();
+	}
+
+	profile_begin(&ps, s_spool);
+	spool_commit();
+	profile_end(&ps);
+}
+
+
+// queue a sentence from the input - unless it has already been uploaded
+void queue_line(char *line)
+{
+	unsigned char base64_data[1000];
+	size_t base64_length;
+	unsigned char hash[32];
+	profile_scope ps;
+	int seen;
+
+	if (line[0] == '\0')
+		return;
+
+	if (!quiet)
+		printf("%s\n", line); 
+
+	make_document((unsigned char *)line, base64_data, &base64_length, hash);
+	profile_begin(&ps, s_dedup);
+	seen = dedup_contains(hash);
+	profile_end(&ps);
+	if (seen)
+	{
+		if (!quiet)
+			printf("Already uploaded\n");
+		return;
+	}
+	profile_begin(&ps, s_spool);
+	fairq_add(spool_append(line));
+	profile_end(&ps);
+}
+
+
+// options
+//	-i file		telemetry to upload, - for standard input (default telemetry.txt) - may be gzip/zstd
+//				compressed or a tar of logs, e.g. telemetry.tgz, unless following. May be given more than
+//				once (e.g. a decoder log per radio), the lines being uploaded as they arrive from any of them
+//	-f			follow the file - keep uploading lines as they are added to it (like tail -f)
+//	-m file		write run-time metrics (upload round trip, results, spool depth) to file in Prometheus text format
+//	-M secs		how often the metrics file is re-written (default 1 second)
+//	-s file		spool (write ahead log) of sentences waiting to be uploaded (default postdata.spool)
+//	-d file		snapshot of the doc IDs already uploaded (default postdata.dedup)
+//	-b			front the doc ID cache with a Bloom filter
+//	-u url		habitat database to upload to (default http://habitat.habhub.org/habitat) - e.g.
+//				http://localhost:5984/habitat for the habStub test server
+//	-q			quiet - only print errors (for load tests)
+//	-c callsign	receiver (listener) callsign to upload as (default M0RJX-LGW, at most 32 characters)
+//	-r [CALL=]n	limit a payload to n sentences a second (without CALL=, every payload) - may be repeated
+//	-Q bytes	deficit round robin quantum - bytes each payload may upload per turn (default 256)
+//	-B n		bulk mode - upload up to n sentences (at most 1000) per request with CouchDB's _bulk_docs
+//	-L ms		bulk round trip to aim for (default 500) - the batch grows while requests take less, and
+//				halves when one takes longer
+//	--profile	print where the time went at the end - reading (and waiting for) input, dedup, spool,
+//				building documents, base64, SHA256, upload round trips and waiting to retry (see profile.h)
+//
+// every sentence is written to the spool (and fsync'ed) before it is uploaded and is only
+// removed once habitat has accepted it. If habitat can't be reached sentences build up in the spool
+// and are sent, oldest first, once it can. Anything left in the spool when postdata stops is
+// uploaded next time it starts.
+//
+// the doc ID of every sentence is checked against those already uploaded (by this or an earlier run)
+// before it is queued, so re-running over an old log only costs the hashing.
+//
+// sentences are sorted by payload (the callsign after $$) and the payloads take turns to upload, so
+// one chatty payload or a backlog from one input can't hold up the rest. Per payload queue depth and
+// lag are in the metrics and summarised on exit.
+//
+// in bulk mode (for backfilling old logs, or a receiver that has been offline) each batch is one POST of
+// complete payload_telemetry documents. habitat answers for each document separately; those it already
+// has (another receiver got there first) are sent again the usual way so this receiver is added to them,
+// and any that failed stay in the spool for the next try. Batch size and round trip are in the metrics.
+//
+// when following, the file is watched with inotify so a line is queued (and uploaded) as soon as the
+// decoder writes it. The file may be rotated or truncated while postdata is running. Standard input
+// is read until it is closed.
+
+int main (int argc, char **argv){
 	
-	char const* const fileName = "telemetry.txt";
-    FILE* file = fopen(fileName, "r"); 
-
-    while (fgets(buffer, sizeof(buffer), file)) {
-        
-		printf("%s", buffer); 
-		buffer[strlen(buffer)-1]='\0';
-		UploadTelemetryPacket(buffer);
-		Sleep(10);
-    }
+	char *input_files[MAX_INPUTS];
+	int ninputs = 0;
+	int follow = 0;
+	char *stats_file = NULL;
+	double stats_interval = 1.0;
+	char *spool_file = "postdata.spool";
+	char *dedup_file = "postdata.dedup";
+	int bloom = 0;
+	int quantum = 0;
+	int i, n, timeout;
+	unsigned long long now;
+	spool_entry *e;
+	profile_scope ps;
+
+	s_read = profile_stage("read");
+	s_dedup = profile_stage("dedup");
+	s_spool = profile_stage("spool");
+	s_format = profile_stage("format");
+	s_encode = profile_stage("encode");
+	s_hash = profile_stage("hash");
+	s_upload = profile_stage("upload");
+	s_wait = profile_stage("wait");
 	
-    /* may check feof here to make a difference between eof and io failure -- network
-       timeout for instance */
+	for (i = 1; i < argc; i++)
+	{
+		if ((strcmp(argv[i],"-i") == 0) && (i + 1 < argc) && (ninputs < MAX_INPUTS))
+			input_files[ninputs++] = argv[++i];
+		else if (strcmp(argv[i],"-f") == 0)
+			follow = 1;
+		else if ((strcmp(argv[i],"-m") == 0) && (i + 1 < argc))
+			stats_file = argv[++i];
+		else if ((strcmp(argv[i],"-M") == 0) && (i + 1 < argc))
+			stats_interval = atof(argv[++i]);
+		else if ((strcmp(argv[i],"-s") == 0) && (i + 1 < argc))
+			spool_file = argv[++i];
+		else if ((strcmp(argv[i],"-d") == 0) && (i + 1 < argc))
+			dedup_file = argv[++i];
+		else if (strcmp(argv[i],"-b") == 0)
+			bloom = 1;
+		else if ((strcmp(argv[i],"-u") == 0) && (i + 1 < argc))
+			habitat_url = argv[++i];
+		else if (strcmp(argv[i],"-q") == 0)
+			quiet = 1;
+		else if ((strcmp(argv[i],"-c") == 0) && (i + 1 < argc))
+		{
+			if (strlen(argv[++i]) > MAX_RECEIVER)
+			{
+				fprintf(stderr,"Receiver callsign %s is too long (at most %d characters)\n", argv[i], MAX_RECEIVER);
+				return 1;
+			}
+			receiver = json_string(argv[i]);
+		}
+		else if ((strcmp(argv[i],"-r") == 0) && (i + 1 < argc) && fairq_rate(argv[i + 1]))
+			i++;
+		else if ((strcmp(argv[i],"-Q") == 0) && (i + 1 < argc))
+			quantum = atoi(argv[++i]);
+		else if ((strcmp(argv[i],"-B") == 0) && (i + 1 < argc))
+		{
+			if ((bulk_max = atoi(argv[++i])) > BULK_MAX)
+				bulk_max = BULK_MAX;
+		}
+		else if ((strcmp(argv[i],"-L") == 0) && (i + 1 < argc))
+			bulk_target_ms = atoi(argv[++i]);
+		else if (strcmp(argv[i],"--profile") == 0)
+			profile_init();
+		else
+		{
+			fprintf(stderr,"Usage : %s [-i telemetry file]... [-f] [-m metrics file] [-M flush secs] [-s spool file] [-d dedup file] [-b] [-u habitat url] [-q] [-c receiver] [-r [CALL=]rate]... [-Q quantum] [-B bulk max] [-L bulk ms] [--profile]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (ninputs == 0)
+		input_files[ninputs++] = "telemetry.txt";
+	fairq_init(quantum);
+	if (bulk_batch > bulk_max)
+		bulk_batch = bulk_max;
+
+	upload_ok_stat = stats_counter("postdata_uploads_total","Telemetry uploads by result","result=\"ok\"");
+	upload_fail_stat = stats_counter("postdata_uploads_total","Telemetry uploads by result","result=\"failed\"");
+	retry_stat = stats_counter("postdata_retries_total","Uploads that failed and will be retried",NULL);
+	upload_stat = stats_hist("postdata_upload_seconds","Upload round trip time",NULL);
+	encode_stat = stats_hist("postdata_encode_seconds","Time to encode, hash and build the JSON document",NULL);
+	batch_stat = stats_gauge("postdata_bulk_batch","Sentences in the next bulk request",NULL);
+	conflict_stat = stats_counter("postdata_bulk_conflicts_total","Bulk documents habitat already had",NULL);
+	latency_stat = stats_hist("postdata_latency_seconds","Time from a sentence being read (appended when following) to habitat accepting it",NULL);
+	stats_open(stats_file, stats_interval);
+
+	/* In windows, this will init the winsock stuff */ 
+	curl_global_init(CURL_GLOBAL_ALL);
+
+	dedup_open(dedup_file, bloom);
+
+	if ((n = spool_open(spool_file)) > 0)
+	{
+		fprintf(stderr,"%d sentences left in %s from last time\n", n, spool_file);
+		for (e = spool_peek(); e != NULL; e = spool_next(e))
+			fairq_add(e);
+		drain_spool();
+	}
+
+	for (i = 0; i < ninputs; i++)
+		if (!tail_add(input_files[i], follow))
+			return 1;
 
-    fclose(file);
+	while (tail_active() || spool_pending())
+	{
+		// queue what has arrived (up to a batch - one fsync covers them all) then upload it
+		now = stats_now();
+		if (spool_pending() && (time(NULL) < retry_at))
+			timeout = (retry_at - time(NULL)) * 1000; // habitat unreachable - sleep until the next try
+		else if (upload_due > now)
+			timeout = (upload_due - now) / 1000000 + 1; // only rate limited payloads waiting
+		else
+			timeout = -1; // until there is something to do
+		if (stats_file && ((timeout < 0) || (timeout > stats_interval * 1000)))
+			timeout = (int)(stats_interval * 1000); // keep the metrics current (even while habitat is away)
+
+		if (!tail_active())
+		{ // nothing more to read - wait for habitat to come back
+			profile_begin(&ps, s_wait);
+			if (timeout > 0)
+				usleep(timeout * 1000);
+			profile_end(&ps);
+		}
+		else
+		{
+			profile_begin(&ps, s_read); // less the queueing inside
+			tail_poll(timeout, bulk_max ? bulk_max : SPOOL_BATCH, queue_line);
+			profile_end(&ps);
+		}
+
+		drain_spool();
+		fairq_tick(stats_now()); // the oldest ages keep growing while nothing can be uploaded
+		stats_tick();
+	}
+
+	fairq_report(stderr);
+	profile_report(stderr);
+	spool_close();
+	dedup_close();
+	stats_close();
+	curl_global_cleanup();
 		
 	return 0;
-	
-	
-	return 0;
 }
 
 void hash_to_hex(unsigned char *hash, unsigned char *line)
@@ -63,30 +384,79 @@ void hash_to_hex(unsigned char *hash, unsigned char *line)
 	// LogMessage(line);
 }
 
-void UploadTelemetryPacket(unsigned char * buffer)
+// a copy of text that can go between quotes in JSON - " and \ escaped
+char *json_string(const char *text)
+{
+	char *json = malloc(2 * strlen(text) + 1), *p = json;
+
+	while (*text)
+	{
+		if ((*text == '"') || (*text == '\\'))
+			*p++ = '\\';
+		*p++ = *text++;
+	}
+	*p = '\0';
+
+	return json;
+}
+
+// habitat document for a sentence - the sentence (with a linefeed) in base64 and the SHA256 of that
+// (the doc ID). base64_data must hold 4/3 of the sentence length + 4
+void make_document(unsigned char *buffer, unsigned char *base64_data, size_t *base64_length, unsigned char *hash)
+{
+	SHA256_CTX ctx;
+	unsigned char Sentence[512];
+	profile_scope ps;
+
+	// Grab current telemetry string and append a linefeed
+	snprintf((char *)Sentence, sizeof(Sentence), "%s\n", buffer);
+	
+	// Convert sentence to base64
+	profile_begin(&ps, s_encode);
+	base64_encode(Sentence, strlen((char *)Sentence), base64_length, base64_data);
+	base64_data[*base64_length] = '\0';	
+	profile_end(&ps);
+	
+	// Take SHA256 hash of the base64 version.  This (in hex) will be the document ID
+	profile_begin(&ps, s_hash);
+	sha256_init(&ctx);
+	sha256_update(&ctx, base64_data, *base64_length);
+	sha256_final(&ctx, hash);
+	profile_end(&ps);
+}
+
+// throw away habitat's reply (quiet mode)
+size_t discard_response(char *data, size_t size, size_t nmemb, void *user)
 {
-	CURL *curl;
+	return size * nmemb;
+}
+
+// upload one sentence - returns 1 if habitat accepted it (or already has it)
+// the curl handle is kept between calls so the connection to habitat is re-used
+int UploadTelemetryPacket(unsigned char * buffer)
+{
+	static CURL *curl = NULL;
 	CURLcode res;
 	char errbuf [CURL_ERROR_SIZE];
- 
-	/* In windows, this will init the winsock stuff */ 
-	curl_global_init(CURL_GLOBAL_ALL);
+	long http_code = 0;
+	int ok = 0;
  
 	/* get a curl handle */ 
-	curl = curl_easy_init();
+	if (curl == NULL)
+		curl = curl_easy_init();
 	if (curl)
 	{
-		char url[200];
+		char url[1024];
 		unsigned char base64_data[1000];
 		size_t base64_length;
-		SHA256_CTX ctx;
 		unsigned char hash[32];
 		unsigned char doc_id[100];
 		char json[1000], now[32];
-		unsigned char Sentence[512];
 		struct curl_slist *headers = NULL;
 		time_t rawtime;
 		struct tm *tm;
+		unsigned long long t;
+		profile_scope ps;
 
 		// Get formatted timestamp
 		time(&rawtime);
@@ -95,6 +465,8 @@ void UploadTelemetryPacket(unsigned char * buffer)
 		
 		// So that the response to the curl PUT doesn't mess up my finely crafted display!
 		// curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, habitat_write_data);
+		if (quiet)
+			curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, discard_response);
 		
 		// Set the timeout
 		curl_easy_setopt(curl, CURLOPT_TIMEOUT, 5);
@@ -105,30 +477,36 @@ void UploadTelemetryPacket(unsigned char * buffer)
 		// Add string errors
 		curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
 
-		// Grab current telemetry string and append a linefeed
-		sprintf(Sentence, "%s\n", buffer);
-		
-		// Convert sentence to base64
-		base64_encode(Sentence, strlen(Sentence), &base64_length, base64_data);
-		base64_data[base64_length] = '\0';	
-		
-		// Take SHA256 hash of the base64 version and express as hex.  This will be the document ID
-		sha256_init(&ctx);
-		sha256_update(&ctx, base64_data, base64_length);
-		sha256_final(&ctx, hash);
+		t = stats_now();
+
+		make_document(buffer, base64_data, &base64_length, hash);
+
+		if (dedup_contains(hash))
+		{ // an identical sentence queued earlier has gone up since this one was queued
+			if (!quiet)
+				printf("Already uploaded\n");
+			return 1;
+		}
 		
 		hash_to_hex(hash, doc_id);
 				
 		// Create json with the base64 data in hex, the tracker callsign and the current timestamp
-		sprintf(json,
+		if (snprintf(json, sizeof(json),
 				"{\"data\": {\"_raw\": \"%s\"},\"receivers\": {\"%s\": {\"time_created\": \"%s\",\"time_uploaded\": \"%s\"}}}",
 				base64_data,
-				"M0RJX-LGW",
+				receiver,
 				now,
-				now);
+				now) >= (int)sizeof(json))
+		{
+			fprintf(stderr,"Document for %s too long\n", doc_id);
+			stats_add(upload_fail_stat, 1);
+			return 0;
+		}
 		
+		stats_record(encode_stat, stats_now() - t);
+
 		// Set the URL that is about to receive our PUT
-		sprintf(url, "http://habitat.habhub.org/habitat/_design/payload_telemetry/_update/add_listener/%s", doc_id);
+		snprintf(url, sizeof(url), "%s/_design/payload_telemetry/_update/add_listener/%s", habitat_url, doc_id);
 		
 		// Set the headers
 		headers = NULL;
@@ -136,28 +514,48 @@ void UploadTelemetryPacket(unsigned char * buffer)
 		headers = curl_slist_append(headers, "Content-Type: application/json");
 		headers = curl_slist_append(headers, "charsets: utf-8");
 
-		// PUT to http://habitat.habhub.org/habitat/_design/payload_telemetry/_update/add_listener/<doc_id> with content-type application/json
+		// PUT to <habitat_url>/_design/payload_telemetry/_update/add_listener/<doc_id> with content-type application/json
 		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers); 
 		curl_easy_setopt(curl, CURLOPT_URL, url);  
 		curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PUT");
 		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, json);
 		
-		printf("%s\n",json);
-		printf("%s\n",url);
-		printf("%s\n",doc_id);
+		if (!quiet)
+		{
+			printf("%s\n",json);
+			printf("%s\n",url);
+			printf("%s\n",doc_id);
+		}
 		// exit (-1);
 		
 		// Perform the request, res will get the return code
+		t = stats_now();
+		profile_begin(&ps, s_upload);
 		res = curl_easy_perform(curl);
+		profile_end(&ps);
+		stats_record(upload_stat, stats_now() - t);
 	
-		// Check for errors
 		if (res == CURLE_OK)
+			curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+
+		// Check for errors
+		if ((res == CURLE_OK) && (http_code >= 200) && (http_code < 300))
 		{
-			printf("OK\n");
+			if (!quiet)
+				printf("OK\n");
+			stats_add(upload_ok_stat, 1);
+			dedup_insert(hash);
+			ok = 1;
+		}
+		else if (res == CURLE_OK)
+		{ // got there but it was not accepted
+			fprintf(stderr,"Failed\nhabitat: HTTP %ld\n", http_code);
+			stats_add(upload_fail_stat, 1);
 		}
 		else
 		{
 			fprintf(stderr,"Failed\n");
+			stats_add(upload_fail_stat, 1);
 			size_t len = strlen(errbuf);
 			fprintf(stderr, "\nlibcurl: (%d) ", res);
 			if(len)
@@ -166,12 +564,186 @@ void UploadTelemetryPacket(unsigned char * buffer)
 				fprintf(stderr, "%s\n", curl_easy_strerror(res));
 		}
 		
-		// always cleanup
+		// always cleanup (but keep the handle and its connection)
 		curl_slist_free_all(headers);
-		curl_easy_cleanup(curl);
+		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
 		// free(base64_data);
 	}
-  
-	curl_global_cleanup();
+
+	return ok;
 }
 
+// habitat's answer to a bulk request
+typedef struct response
+{
+	char *data;
+	size_t len, size;
+} response;
+
+size_t collect_response(char *data, size_t size, size_t nmemb, void *user)
+{
+	response *r = (response *)user;
+	size_t n = size * nmemb;
+	char *p;
+
+	if (r->len + n + 1 > r->size)
+	{
+		if ((p = realloc(r->data, r->len + n + 4096)) == NULL)
+			return 0;
+		r->data = p;
+		r->size = r->len + n + 4096;
+	}
+	memcpy(r->data + r->len, data, n);
+	r->len += n;
+	r->data[r->len] = '\0';
+	return n;
+}
+
+// upload a batch of sentences in one POST to <habitat_url>/_bulk_docs - ok[i] is set to 1 for each one habitat
+// now has with this receiver on it. The answer is a list with a result per document; a conflict means
+// habitat already had it (from another receiver) so it is sent again with add_listener.
+void BulkUpload(spool_entry **batch, int n, int *ok)
+{
+	static CURL *curl = NULL;
+	static char (*doc_ids)[65] = NULL;
+	static unsigned char (*hashes)[32] = NULL;
+	static char *json = NULL;
+	static size_t size;
+	static response r;
+	CURLcode res;
+	char errbuf[CURL_ERROR_SIZE];
+	unsigned char base64_data[1000];
+	size_t base64_length, len, doc_len;
+	char url[1024], now[32], id[80];
+	struct curl_slist *headers = NULL;
+	long http_code = 0;
+	time_t rawtime;
+	const char *p, *end;
+	int i, docs, conflicts = 0;
+	unsigned long long t;
+	profile_scope ps;
+
+	for (i = 0; i < n; i++)
+		ok[i] = 0;
+
+	if (curl == NULL)
+	{
+		curl = curl_easy_init();
+		doc_ids = malloc(BULK_MAX * sizeof(*doc_ids));
+		hashes = malloc(BULK_MAX * sizeof(*hashes));
+		size = BULK_MAX * (1000 + strlen(receiver)) + 64; // a document is the base64 (< 700 bytes), the receiver and ~250
+		json = malloc(size);
+	}
+	if ((curl == NULL) || (doc_ids == NULL) || (hashes == NULL) || (json == NULL))
+		return;
+
+	time(&rawtime);
+	strftime(now, sizeof(now), "%Y-%m-%dT%H:%M:%SZ", gmtime(&rawtime));
+
+	// build the request
+	t = stats_now();
+	len = sprintf(json, "{\"docs\": [");
+	for (i = docs = 0; i < n; i++)
+	{
+		make_document((unsigned char *)batch[i]->sentence, base64_data, &base64_length, hashes[i]);
+		hash_to_hex(hashes[i], (unsigned char *)doc_ids[i]);
+		if (dedup_contains(hashes[i]))
+		{ // an identical sentence queued earlier has gone up since this one was queued
+			ok[i] = 1;
+			continue;
+		}
+		doc_len = snprintf(json + len, size - len - 2,
+				"%s{\"_id\": \"%s\",\"type\": \"payload_telemetry\",\"data\": {\"_raw\": \"%s\"},\"receivers\": {\"%s\": {\"time_created\": \"%s\",\"time_uploaded\": \"%s\"}}}",
+				docs ? "," : "", doc_ids[i], base64_data, receiver, now, now);
+		if (len + doc_len >= size - 2)
+		{ // no room (keeping 2 bytes for the end) - the rest go in a later batch
+			fprintf(stderr,"Bulk request full after %d documents\n", docs);
+			break;
+		}
+		len += doc_len;
+		docs++;
+	}
+	snprintf(json + len, size - len, "]}");
+	stats_record(encode_stat, stats_now() - t);
+
+	if (docs == 0)
+		return;
+
+	r.len = 0;
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, collect_response);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &r);
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
+	curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
+
+	snprintf(url, sizeof(url), "%s/_bulk_docs", habitat_url);
+	headers = curl_slist_append(headers, "Accept: application/json");
+	headers = curl_slist_append(headers, "Content-Type: application/json");
+	headers = curl_slist_append(headers, "charsets: utf-8");
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+	curl_easy_setopt(curl, CURLOPT_URL, url);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, json);
+
+	if (!quiet)
+		printf("%s - %d documents\n", url, docs);
+
+	t = stats_now();
+	profile_begin(&ps, s_upload);
+	res = curl_easy_perform(curl);
+	profile_end(&ps);
+	stats_record(upload_stat, stats_now() - t);
+
+	if (res == CURLE_OK)
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+
+	curl_slist_free_all(headers);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
+
+	if ((res != CURLE_OK) || (http_code < 200) || (http_code >= 300) || (r.data == NULL))
+	{ // nothing in it counts
+		if (res == CURLE_OK)
+			fprintf(stderr,"Failed\nhabitat: HTTP %ld\n", http_code);
+		else
+			fprintf(stderr,"Failed\nlibcurl: (%d) %s\n", res, errbuf[0] ? errbuf : curl_easy_strerror(res));
+		stats_add(upload_fail_stat, docs);
+		return;
+	}
+
+	// a result per document - {"ok":true,"id":"..","rev":".."} or {"id":"..","error":"..","reason":".."}
+	for (p = strstr(r.data, "\"id\""); p != NULL; p = strstr(end, "\"id\""))
+	{
+		if ((end = strchr(p, '}')) == NULL)
+			break;
+		if (sscanf(p, "\"id\" : \"%64[0-9a-f]\"", id) != 1)
+			continue;
+		for (i = 0; (i < n) && (ok[i] || (strcmp(doc_ids[i], id) != 0)); i++)
+			;
+		if (i == n)
+			continue;
+
+		if ((p = strstr(p, "\"error\"")) == NULL || (p > end))
+			ok[i] = 1; // created
+		else if ((p = strstr(p, "conflict")) != NULL && (p < end))
+		{ // habitat already has it - add this receiver to it
+			conflicts++;
+			ok[i] = UploadTelemetryPacket((unsigned char *)batch[i]->sentence);
+			continue; // counted by that
+		}
+		else
+		{
+			stats_add(upload_fail_stat, 1);
+			continue;
+		}
+
+		stats_add(upload_ok_stat, 1);
+		dedup_insert(hashes[i]);
+	}
+	stats_add(conflict_stat, conflicts);
+
+	if (!quiet)
+	{
+		for (i = docs = 0; i < n; i++)
+			docs += ok[i];
+		printf("%d of %d OK (%d already there)\n", docs, n, conflicts);
+	}
+}
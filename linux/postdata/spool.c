@@ -0,0 +1,385 @@
+// spool.c - append only write ahead log of telemetry sentences waiting to be uploaded
+//
+// the log is plain text, one record per line, each ending with a CRC32 of the rest of the line
+//	A <seq> <sentence> <crc>	sentence received
+//	D <seq> <crc>				sentence uploaded
+//
+// appends are collected in memory and written with a single write() + fsync() by spool_commit()
+// (group commit) so a burst of sentences costs one disk flush not one each.
+// A torn or corrupt record (power cut part way through a write) ends the replay and the log is
+// cut back to the last good record.
+// On open the log is compacted - rewritten holding only the sentences still to upload - and again
+// by spool_commit() once it holds SPOOL_COMPACT done records and they outnumber the sentences still to
+// upload, so a postdata that follows a file for weeks doesn't grow its log forever. (Either on its own
+// would rewrite too often - every commit with a short queue, or the whole of a long backlog every
+// SPOOL_COMPACT uploads.)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <libgen.h>
+#include "spool.h"
+#include "stats.h"
+
+#define SPOOL_COMPACT 1024		// done records in the log before it is worth rewriting
+
+typedef struct spool_node
+{
+	spool_entry e;				// first - a spool_entry * is its node
+	struct spool_node *prev, *next;
+} spool_node;
+
+static int fd = -1;						// the log
+static char *spool_path;
+static spool_node *head, *tail;			// sentences still to upload, oldest first
+static int npending;
+static unsigned long next_seq = 1;
+static int ndone;						// done records in the log since it was last compacted
+
+static char *wbuf;						// records appended since the last commit
+static size_t wlen, wsize;
+
+static stat_counter *pending_stat;		// queue depth
+static stat_counter *commits_stat;
+static stat_counter *compactions_stat;
+static stat_hist *commit_stat;			// write + fsync time
+
+
+// CRC32 (IEEE 802.3 polynomial, as used by zip and ethernet)
+static unsigned int crc32_of(const char *p, size_t len)
+{
+	static unsigned int table[256];
+	unsigned int crc, c;
+	int i, j;
+
+	if (table[1] == 0)
+	{ // first call - build the table
+		for (i = 0; i < 256; i++)
+		{
+			c = i;
+			for (j = 0; j < 8; j++)
+				c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			table[i] = c;
+		}
+	}
+
+	crc = 0xFFFFFFFF;
+	while (len--)
+		crc = table[(crc ^ (unsigned char)*p++) & 0xFF] ^ (crc >> 8);
+	return crc ^ 0xFFFFFFFF;
+}
+
+// add a record (without CRC or line ending) to the write buffer
+static void add_record(const char *rec, size_t len)
+{
+	if (wlen + len + 11 > wsize)
+	{
+		wsize = (wlen + len + 11) * 2;
+		if ((wbuf = realloc(wbuf, wsize)) == NULL)
+		{
+			fprintf(stderr,"spool: out of memory\n");
+			exit(1);
+		}
+	}
+	memcpy(wbuf + wlen, rec, len);
+	wlen += len;
+	wlen += sprintf(wbuf + wlen, " %08X\n", crc32_of(rec, len));
+}
+
+static spool_entry *queue(unsigned long seq, const char *sentence)
+{
+	spool_node *n;
+
+	if (((n = malloc(sizeof(*n))) == NULL) || ((n->e.sentence = strdup(sentence)) == NULL))
+	{
+		fprintf(stderr,"spool: out of memory\n");
+		exit(1);
+	}
+	n->e.seq = seq;
+	n->e.queued = stats_now();
+	n->next = NULL;
+	n->prev = tail;
+
+	if (tail)
+		tail->next = n;
+	else
+		head = n;
+	tail = n;
+	npending++;
+	return &n->e;
+}
+
+static void unlink_node(spool_node *n)
+{
+	if (n->prev)
+		n->prev->next = n->next;
+	else
+		head = n->next;
+	if (n->next)
+		n->next->prev = n->prev;
+	else
+		tail = n->prev;
+	free(n->e.sentence);
+	free(n);
+	npending--;
+}
+
+// replaying - nearly always the head
+static int unqueue(unsigned long seq)
+{
+	spool_node *n;
+
+	for (n = head; n != NULL; n = n->next)
+	{
+		if (n->e.seq == seq)
+		{
+			unlink_node(n);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// make a rename or create in the spool's directory durable
+static void sync_dir(const char *path)
+{
+	char *copy;
+	int dfd;
+
+	copy = strdup(path);
+	if ((dfd = open(dirname(copy), O_RDONLY)) >= 0)
+	{
+		fsync(dfd);
+		close(dfd);
+	}
+	free(copy);
+}
+
+// read the log, rebuilding the queue - returns 1 if it needs compacting
+static int replay(FILE *fp)
+{
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	unsigned long seq;
+	unsigned int crc;
+	int n, dirty = 0;
+
+	while ((len = getline(&line, &size, fp)) > 0)
+	{
+		if ((len < 13) || (line[len - 1] != '\n') || (line[len - 10] != ' ') ||
+			(sscanf(line + len - 9, "%8X", &crc) != 1) || (crc != crc32_of(line, len - 10)))
+		{
+			fprintf(stderr,"spool: discarding torn record and anything after it\n");
+			dirty = 1;
+			break;
+		}
+		line[len - 10] = '\0';
+
+		if ((sscanf(line, "A %lu %n", &seq, &n) == 1) && (n > 0))
+			queue(seq, line + n);
+		else if (sscanf(line, "D %lu", &seq) == 1)
+		{
+			unqueue(seq);
+			dirty = 1;
+		}
+		else
+		{
+			fprintf(stderr,"spool: unknown record '%s'\n", line);
+			dirty = 1;
+			break;
+		}
+		if (seq >= next_seq)
+			next_seq = seq + 1;
+	}
+
+	free(line);
+	return dirty;
+}
+
+// rewrite the log holding only the sentences still to upload - returns 0 if it could not
+// (if the log is open, appends carry on to the new one)
+static int compact(void)
+{
+	char tmp[1024], rec[64];
+	spool_node *n;
+	int tfd;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", spool_path);
+	if ((tfd = open(tmp, O_WRONLY | O_APPEND | O_CREAT | O_TRUNC, 0644)) < 0)
+		return 0; // carry on with the long log
+
+	wlen = 0;
+	for (n = head; n != NULL; n = n->next)
+	{
+		size_t len = strlen(n->e.sentence);
+		char *r = malloc(len + 32);
+
+		sprintf(r, "A %lu %s", n->e.seq, n->e.sentence);
+		add_record(r, strlen(r));
+		free(r);
+	}
+	if (head == NULL)
+	{ // keep the sequence going
+		sprintf(rec, "D %lu", next_seq - 1);
+		add_record(rec, strlen(rec));
+	}
+
+	if ((write(tfd, wbuf, wlen) == (ssize_t)wlen) && (fsync(tfd) == 0) && (rename(tmp, spool_path) == 0))
+	{
+		sync_dir(spool_path);
+		if (fd >= 0)
+		{ // the old log has gone - carry on appending to this one
+			close(fd);
+			fd = tfd;
+		}
+		else
+			close(tfd);
+		wlen = 0;
+		ndone = 0;
+		stats_add(compactions_stat, 1);
+		return 1;
+	}
+
+	close(tfd);
+	unlink(tmp);
+	wlen = 0;
+	return 0;
+}
+
+int spool_open(const char *path)
+{
+	FILE *fp;
+
+	pending_stat = stats_gauge("postdata_spool_pending","Sentences waiting to be uploaded",NULL);
+	commits_stat = stats_counter("postdata_spool_commits_total","Group commits (fsyncs) of the spool",NULL);
+	compactions_stat = stats_counter("postdata_spool_compactions_total","Times the spool has been rewritten without the uploaded sentences",NULL);
+	commit_stat = stats_hist("postdata_spool_commit_seconds","Time to write and fsync one group of spool records",NULL);
+
+	spool_path = strdup(path);
+
+	if ((fp = fopen(path, "r")) != NULL)
+	{
+		if (replay(fp))
+		{ // must not append after a torn record - it would hide everything written from now on
+			if (!compact())
+			{
+				fprintf(stderr,"spool: can't rewrite %s: %s\n", path, strerror(errno));
+				exit(1);
+			}
+		}
+		else if (npending == 0)
+			compact(); // just tidy up
+		fclose(fp);
+	}
+
+	if ((fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644)) < 0)
+	{
+		fprintf(stderr,"spool: can't open %s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+	sync_dir(path);
+
+	stats_set(pending_stat, npending);
+	return npending;
+}
+
+spool_entry *spool_append(const char *sentence)
+{
+	spool_entry *e;
+	size_t len = strlen(sentence);
+	char *r;
+	unsigned long seq = next_seq++;
+
+	if ((r = malloc(len + 32)) == NULL)
+	{
+		fprintf(stderr,"spool: out of memory\n");
+		exit(1);
+	}
+	sprintf(r, "A %lu %s", seq, sentence);
+	add_record(r, strlen(r));
+	free(r);
+
+	e = queue(seq, sentence);
+	stats_set(pending_stat, npending);
+	return e;
+}
+
+void spool_commit(void)
+{
+	unsigned long long t;
+	size_t done;
+	ssize_t n;
+
+	if (wlen == 0)
+		return; // nothing new
+
+	t = stats_now();
+	for (done = 0; done < wlen; done += n)
+	{
+		if ((n = write(fd, wbuf + done, wlen - done)) < 0)
+		{
+			if (errno == EINTR)
+			{
+				n = 0;
+				continue;
+			}
+			fprintf(stderr,"spool: write failed: %s\n", strerror(errno));
+			exit(1); // can't promise anything is safe any more
+		}
+	}
+	if (fsync(fd) != 0)
+	{
+		fprintf(stderr,"spool: fsync failed: %s\n", strerror(errno));
+		exit(1);
+	}
+	wlen = 0;
+
+	stats_record(commit_stat, stats_now() - t);
+	stats_add(commits_stat, 1);
+
+	if ((ndone >= SPOOL_COMPACT) && (ndone > npending))
+		compact(); // mostly uploaded sentences - if it can't, carry on with the long log and try next time
+}
+
+spool_entry *spool_peek(void)
+{
+	return head ? &head->e : NULL;
+}
+
+spool_entry *spool_next(spool_entry *e)
+{
+	spool_node *n = ((spool_node *)e)->next;
+
+	return n ? &n->e : NULL;
+}
+
+void spool_done(spool_entry *e)
+{
+	char rec[64];
+
+	sprintf(rec, "D %lu", e->seq);
+	add_record(rec, strlen(rec));
+	ndone++;
+	unlink_node((spool_node *)e);
+	stats_set(pending_stat, npending);
+}
+
+int spool_pending(void)
+{
+	return npending;
+}
+
+void spool_close(void)
+{
+	spool_commit();
+	if (npending == 0)
+	{ // everything went - start the next run with an empty log
+		compact();
+	}
+	close(fd);
+	fd = -1;
+}
@@ -0,0 +1,29 @@
+// spool.h - crash safe store-and-forward queue of telemetry sentences
+//
+// every received sentence is appended to the spool file (a write ahead log) and made durable
+// before it is uploaded. Once habitat has accepted it a "done" record is appended.
+// On start up the log is replayed so anything not marked done is uploaded again.
+// Sentences needn't be uploaded in the order they were queued (see fairq.h).
+
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <stddef.h>
+
+typedef struct spool_entry
+{
+	unsigned long seq;				// sequence number in the log
+	char *sentence;					// telemetry sentence (no line ending)
+	unsigned long long queued;		// stats_now() when it was queued
+} spool_entry;
+
+int spool_open(const char *path);				// replay the log - returns the number of sentences still to upload
+spool_entry *spool_append(const char *sentence);	// queue a sentence (durable at the next spool_commit)
+void spool_commit(void);						// group commit - write and fsync everything appended since the last one
+spool_entry *spool_peek(void);					// oldest sentence still to upload (NULL if none)
+spool_entry *spool_next(spool_entry *e);		// the one queued after it (NULL if none)
+void spool_done(spool_entry *e);				// a sentence has been uploaded - e is freed
+int spool_pending(void);						// number of sentences still to upload
+void spool_close(void);
+
+#endif
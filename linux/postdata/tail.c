@@ -0,0 +1,260 @@
+// tail.c - line reader for plain files, followed (growing) files and standard input
+//
+// a followed file is read to its end then we sleep in poll() on an inotify watch of its
+// directory. Any change in the directory wakes us up, then for each followed file
+//	- new data is read and complete lines handed on (a part line waits for the rest)
+//	- if the file now has a different inode (renamed away and re-created by log rotation) the
+//	  old one is read to the end then the new one is opened and read from the start
+//	- if it is shorter than where we had read up to (truncated) it is read again from the start
+//
+// standard input (or any pipe) is read non-blocking and waited for with the same poll()
+//
+// a file (or standard input) that isn't followed may be compressed - telemetry.txt.gz, or a tar of
+// logs such as telemetry.tgz - it is inflated as it is read (see zio.h)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#include "zio.h"
+#include "tail.h"
+
+#define TAIL_BUF 65536		// longest line (anything longer is split)
+#define MAX_TAILS 64
+
+typedef struct tail
+{
+	char *path;				// NULL for standard input
+	int fd;					// -1 while a followed file does not exist
+	int follow;				// keep reading after end of file
+	int ended;				// reached the end and not following
+	dev_t dev;				// identity of the file we have open
+	ino_t ino;
+	off_t offset;			// bytes read from it
+	char buf[TAIL_BUF];
+	size_t start, len;		// data read but not yet handed on
+} tail;
+
+static tail *tails[MAX_TAILS];
+static int ntails;
+static int inotify_fd = -1;
+
+
+// open (or re-open) a followed file - quietly leave it closed if it is not there yet
+static void open_file(tail *t)
+{
+	struct stat st;
+
+	if ((t->fd = open(t->path, O_RDONLY)) < 0)
+		return;
+
+	fstat(t->fd, &st);
+	t->dev = st.st_dev;
+	t->ino = st.st_ino;
+	t->offset = 0;
+	t->start = t->len = 0;
+}
+
+int tail_add(const char *path, int follow)
+{
+	tail *t;
+
+	if ((ntails == MAX_TAILS) || ((t = calloc(1, sizeof(*t))) == NULL))
+		return 0;
+
+	if (strcmp(path, "-") == 0)
+	{ // standard input - never blocks, poll() says when there is more
+		t->fd = zio_open(NULL);
+		fcntl(t->fd, F_SETFL, fcntl(t->fd, F_GETFL) | O_NONBLOCK);
+	}
+	else
+	{
+		t->path = strdup(path);
+		t->follow = follow;
+		if (follow)
+			open_file(t);
+		else
+			t->fd = zio_open(path);
+		if ((t->fd < 0) && !follow)
+		{
+			fprintf(stderr,"Can't open %s: %s\n", path, strerror(errno));
+			free(t->path);
+			free(t);
+			return 0;
+		}
+	}
+
+#ifdef __linux__
+	if (t->follow)
+	{
+		char *dir = strdup(path);
+
+		if (inotify_fd < 0)
+			inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (inotify_add_watch(inotify_fd, dirname(dir), IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE) < 0)
+			fprintf(stderr,"Can't watch %s: %s\n", path, strerror(errno));
+		free(dir);
+	}
+#endif
+
+	tails[ntails++] = t;
+	return 1;
+}
+
+int tail_active(void)
+{
+	int i, n = 0;
+
+	for (i = 0; i < ntails; i++)
+		if (!tails[i]->ended)
+			n++;
+	return n;
+}
+
+// at the end of a followed file - see if it has been rotated or truncated
+// returns 1 if there may be more to read now
+static int check_file(tail *t)
+{
+	struct stat st;
+
+	if (stat(t->path, &st) != 0)
+		return 0; // moved away and not re-created yet - keep what we have open
+
+	if ((t->fd < 0) || (st.st_dev != t->dev) || (st.st_ino != t->ino))
+	{ // new file - we have read all of the old one
+		if (t->fd >= 0)
+			close(t->fd);
+		open_file(t);
+		return t->fd >= 0;
+	}
+
+	if (st.st_size < t->offset)
+	{ // truncated - start again (a part line from before is thrown away)
+		fprintf(stderr,"%s truncated\n", t->path);
+		lseek(t->fd, 0, SEEK_SET);
+		t->offset = 0;
+		t->start = t->len = 0;
+		return 1;
+	}
+	return 0;
+}
+
+// hand on complete lines from one input, reading more as needed
+static int read_tail(tail *t, int max_lines, tail_line_fn line)
+{
+	char *p, *nl;
+	ssize_t n;
+	int delivered = 0;
+
+	while ((delivered < max_lines) && !t->ended)
+	{
+		p = t->buf + t->start;
+		if ((nl = memchr(p, '\n', t->len)) != NULL)
+		{
+			*nl = '\0';
+			if ((nl > p) && (nl[-1] == '\r'))
+				nl[-1] = '\0';
+			t->len -= nl + 1 - p;
+			t->start += nl + 1 - p;
+			line(p);
+			delivered++;
+			continue;
+		}
+
+		// no complete line buffered - shuffle the part line down and read some more
+		memmove(t->buf, p, t->len);
+		t->start = 0;
+		if (t->len == TAIL_BUF - 1)
+		{ // silly long line - pass on what we have
+			t->buf[t->len] = '\0';
+			t->len = 0;
+			line(t->buf);
+			delivered++;
+			continue;
+		}
+
+		n = (t->fd >= 0) ? read(t->fd, t->buf + t->len, TAIL_BUF - 1 - t->len) : 0;
+		if (n > 0)
+		{
+			t->len += n;
+			t->offset += n;
+		}
+		else if ((n < 0) && ((errno == EAGAIN) || (errno == EINTR)))
+			break; // pipe with nothing more yet
+		else if (t->follow)
+		{
+			if (!check_file(t))
+				break; // wait for it to grow
+		}
+		else
+		{ // end of input - last line may have no line ending
+			if (t->len)
+			{
+				t->buf[t->len] = '\0';
+				t->len = 0;
+				line(t->buf);
+				delivered++;
+			}
+			if (t->fd > 0)
+				close(t->fd);
+			t->ended = 1;
+		}
+	}
+	return delivered;
+}
+
+static int read_all(int max_lines, tail_line_fn line)
+{
+	int i, delivered = 0;
+
+	for (i = 0; (i < ntails) && (delivered < max_lines); i++)
+		delivered += read_tail(tails[i], max_lines - delivered, line);
+	return delivered;
+}
+
+int tail_poll(int timeout_ms, int max_lines, tail_line_fn line)
+{
+	struct pollfd pfd[MAX_TAILS + 1];
+	char events[4096];
+	int i, n, delivered;
+
+	if (((delivered = read_all(max_lines, line)) > 0) || !tail_active())
+		return delivered; // (all ended - there is nothing left to wait for)
+
+	// nothing ready - sleep until a followed file changes or a pipe has data
+	n = 0;
+	if (inotify_fd >= 0)
+	{
+		pfd[n].fd = inotify_fd;
+		pfd[n++].events = POLLIN;
+	}
+	for (i = 0; i < ntails; i++)
+	{
+		if (!tails[i]->ended && (tails[i]->path == NULL))
+		{
+			pfd[n].fd = tails[i]->fd;
+			pfd[n++].events = POLLIN;
+		}
+	}
+#ifndef __linux__
+	if ((inotify_fd < 0) && (n < ntails) && ((timeout_ms < 0) || (timeout_ms > 250)))
+		timeout_ms = 250; // no inotify - check followed files 4 times a second
+#endif
+
+	if (poll(pfd, n, timeout_ms) > 0)
+	{
+		if (inotify_fd >= 0)
+			while (read(inotify_fd, events, sizeof(events)) > 0)
+				; // just a wake up - which file changed does not matter
+	}
+
+	return read_all(max_lines, line);
+}
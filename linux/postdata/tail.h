@@ -0,0 +1,11 @@
+// tail.h - read telemetry lines from files (optionally following them as they grow) or stdin
+//
+// followed files are watched with inotify (the directory is watched so the file can be created,
+// rotated or truncated under us). Each complete line is handed to a callback as soon as it is
+// written - there is no polling.
+
+typedef void (*tail_line_fn)(char *line);
+
+int tail_add(const char *path, int follow);						// "-" for standard input - returns 0 if it can't be read
+int tail_poll(int timeout_ms, int max_lines, tail_line_fn line);	// deliver up to max_lines, waiting up to timeout_ms (-1 forever) if none are ready
+int tail_active(void);											// number of inputs that may still produce lines
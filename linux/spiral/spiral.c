@@ -1,17 +1,26 @@
+// writes a test spiral track to spiral.kml, or the file named - spiral.kmz for Google Earth, or
+// spiral.kml.gz (see zio.h)
+
 #include <stdio.h>
 #include <float.h>
 #include <math.h>
+#include "zio.h"
 
 #define NEWLINE "\n"
 
 
-int main () {
+int main (int argc, char **argv) {
 
 		FILE *fp;
         double a,t,x,y;
         long i;
 
-		fp=fopen("spiral.kml", "w");
+		const char *name = argc > 1 ? argv[1] : "spiral.kml";
+
+		if ((fp=zio_fopen(name, "w")) == NULL) {
+			fprintf(stderr, "Can't create %s\n", name);
+			return 1;
+		}
 		fprintf(fp, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>" NEWLINE);
 		fprintf(fp, "<kml xmlns=\"http://www.opengis.net/kml/2.2\">" NEWLINE);
 		fprintf(fp, "  <Document>" NEWLINE);
@@ -67,5 +76,9 @@ int main () {
 		fprintf(fp, "  </Document>" NEWLINE);
 		fprintf(fp, "</kml>" NEWLINE);
 
+		if (zio_fclose(fp)) {
+			fprintf(stderr, "Can't write %s\n", name);
+			return 1;
+		}
         return 0;
 }
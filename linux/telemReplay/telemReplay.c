@@ -0,0 +1,158 @@
+// telemReplay.c - load generator: replays UKHAS telemetry ($$CALLSIGN,count,...*CRC16) at a chosen rate
+//
+// reads a telemetry log (e.g. postdata/telemetry.txt) and writes its lines out again, paced to a
+// fixed rate, looping over the log as often as needed. Writing to a file appends one whole line per
+// write() so "postdata -f" following the file sees each line as it arrives.
+//
+// habitat (and postdata's doc ID cache) would treat a replayed line as the same document as last
+// time, so -u gives each line a new sentence count (and re-calculates the CRC) to make it unique.
+//
+// options
+//	-i file		telemetry to replay (default standard input)
+//	-o file		append to file (default standard output)
+//	-r rate		lines per second (default 10, 0 = as fast as possible)
+//	-n count	lines to send (default - the log once)
+//	-u			make each line a new document
+//
+// e.g. load test postdata against the local stand-in
+//	habStub -l 20 &
+//	postdata -u http://localhost:5984/habitat -i load.txt -f -m postdata.prom &
+//	telemReplay -i telemetry.txt -o load.txt -r 50 -n 10000 -u
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <errno.h>
+#include "crc16.h"
+
+char **lines = NULL;		// the log
+int nlines = 0;
+
+
+unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// line with its sentence count replaced by count - "$$CALL,count,rest*CRC\n"
+int renumber(const char *line, unsigned long count, char *out, size_t size)
+{
+	const char *rest, *star;
+	int n;
+
+	if ((strncmp(line, "$$", 2) != 0) || ((rest = strchr(line, ',')) == NULL) || ((rest = strchr(rest + 1, ',')) == NULL))
+		return snprintf(out, size, "%s\n", line); // not telemetry - leave it alone
+
+	if ((star = strchr(rest, '*')) == NULL)
+		star = rest + strlen(rest);
+
+	n = snprintf(out, size, "%.*s,%lu%.*s", (int)(strchr(line, ',') - line), line, count, (int)(star - rest), rest);
+	n += snprintf(out + n, size - n, "*%04X\n", crc16(out + 2));
+	return n;
+}
+
+int main(int argc, char **argv)
+{
+	char *in_file = NULL, *out_file = NULL;
+	double rate = 10.0;
+	long count = -1;
+	int unique = 0;
+	FILE *in;
+	char *line = NULL, out[1024];
+	size_t size = 0;
+	ssize_t len;
+	int fd, i, n;
+	long sent;
+	unsigned long long start, due, late, max_late = 0, now;
+	struct timespec ts;
+
+	for (i = 1; i < argc; i++)
+	{
+		if ((strcmp(argv[i],"-i") == 0) && (i + 1 < argc))
+			in_file = argv[++i];
+		else if ((strcmp(argv[i],"-o") == 0) && (i + 1 < argc))
+			out_file = argv[++i];
+		else if ((strcmp(argv[i],"-r") == 0) && (i + 1 < argc))
+			rate = atof(argv[++i]);
+		else if ((strcmp(argv[i],"-n") == 0) && (i + 1 < argc))
+			count = atol(argv[++i]);
+		else if (strcmp(argv[i],"-u") == 0)
+			unique = 1;
+		else
+		{
+			fprintf(stderr,"Usage : %s [-i telemetry file] [-o output file] [-r lines/sec] [-n count] [-u]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if ((in = in_file ? fopen(in_file, "r") : stdin) == NULL)
+	{
+		fprintf(stderr,"Can't open %s\n", in_file);
+		return 1;
+	}
+	while ((len = getline(&line, &size, in)) > 0)
+	{
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] == '\0')
+			continue;
+		lines = realloc(lines, (nlines + 1) * sizeof(char *));
+		lines[nlines++] = strdup(line);
+	}
+	if (nlines == 0)
+	{
+		fprintf(stderr,"Nothing to replay\n");
+		return 1;
+	}
+	if (count < 0)
+		count = nlines;
+
+	if (out_file)
+	{
+		if ((fd = open(out_file, O_WRONLY | O_APPEND | O_CREAT, 0644)) < 0)
+		{
+			fprintf(stderr,"Can't open %s: %s\n", out_file, strerror(errno));
+			return 1;
+		}
+	}
+	else
+		fd = 1;
+
+	start = now_ns();
+	for (sent = 0; sent < count; sent++)
+	{
+		if (rate > 0)
+		{ // sleep until this line is due (absolute times so lateness does not build up)
+			due = start + (unsigned long long)(sent * 1e9 / rate);
+			ts.tv_sec = due / 1000000000ull;
+			ts.tv_nsec = due % 1000000000ull;
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+				;
+			now = now_ns();
+			late = now > due ? now - due : 0;
+			if (late > max_late)
+				max_late = late;
+		}
+
+		if (unique)
+			n = renumber(lines[sent % nlines], sent + 1, out, sizeof(out));
+		else
+			n = snprintf(out, sizeof(out), "%s\n", lines[sent % nlines]);
+
+		if (write(fd, out, n) != n)
+		{
+			fprintf(stderr,"Write failed: %s\n", strerror(errno));
+			return 1;
+		}
+	}
+
+	now = now_ns();
+	fprintf(stderr,"%ld lines in %.3f s (%.1f/s), latest line %.3f ms behind schedule\n",
+		sent, (now - start) / 1e9, sent / ((now - start) / 1e9), max_late / 1e6);
+	return 0;
+}
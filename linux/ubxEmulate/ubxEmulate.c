@@ -2,10 +2,22 @@
 // it expects to be given an input file containing the ubx protocol and it will
 // send out the ubx message every time it is polled by the COM port to do so
 //
+// the serial port runs at 9600 baud unless another rate is given after the file name
+// e.g. ubxEmulate ubx.bin 115200
+//
+// -R (or -Rcpu) at the end runs in real-time mode for a busy test host - REALTIME_PRIORITY_CLASS (HIGH
+// without the privilege) and a time critical thread, pinned to cpu if given, the buffers locked in memory
+// and a 1ms timer. Each frame is read from the file before it is polled for, and the 100ms reply delay is
+// timed on the performance counter - Sleep() for most of it, spinning for the last 2ms. The worst lateness
+// so far is printed whenever it gets worse.
+// e.g. ubxEmulate ubx.bin 115200 -R2
+//
  
 #include <stdio.h>   /* Standard input/output definitions */
 #include <stdlib.h>  /* Standard stuff like exit */
+#include <string.h>
 #include<windows.h>
+#include <mmsystem.h> /* timeBeginPeriod - link with -lwinmm */
 
 DWORD readFromSerialPort(HANDLE hSerial, unsigned char * buffer, int maxBuffer);
 DWORD writeToSerialPort(HANDLE hSerial, unsigned char * buffer, int length);
@@ -14,11 +26,31 @@ unsigned char buffer_out[1000];
 unsigned char buffer_in[1000];
 int Status;
 
+int rt_mode = 0;			// -R
+LARGE_INTEGER rt_freq;		// performance counter ticks a second
+double worst_late = 0.0;	// seconds
+
+void rtInit(int cpu);
+void rtSend(HANDLE hComm, FILE *fp);
+
 
 int main (int argc, char **argv) 
 {
 	
 	HANDLE hComm;
+	DWORD baud = CBR_9600;
+	int rt_cpu = -1;
+
+	if ((argc >= 3) && (strncmp(argv[argc - 1],"-R",2) == 0))
+	{
+		rt_mode = 1;
+		if (argv[argc - 1][2])
+			rt_cpu = atoi(argv[argc - 1] + 2);
+		argc--;
+	}
+
+	if (argc == 3)
+		baud = atol(argv[2]); // the DCB takes any rate the port supports, not just the CBR_ values
 
 	hComm = CreateFile("COM3",       //port name
                       GENERIC_READ | GENERIC_WRITE, //Read/Write
@@ -41,8 +73,7 @@ int main (int argc, char **argv)
 
 	GetCommState(hComm, &dcbSerialParams);
 
-	dcbSerialParams.BaudRate = CBR_9600;  // Setting BaudRate = 9600
-    //dcbSerialParams.BaudRate = CBR_57600;  // Setting BaudRate = 9600
+	dcbSerialParams.BaudRate = baud;  // Setting BaudRate (default 9600)
 	dcbSerialParams.ByteSize = 8;         // Setting ByteSize = 8
 	dcbSerialParams.StopBits = ONESTOPBIT;// Setting StopBits = 1
 	dcbSerialParams.Parity   = NOPARITY;  // Setting Parity = None
@@ -70,8 +101,8 @@ int main (int argc, char **argv)
 	FILE * fp;
 	
 	
-	if (argc != 2) {
-		fprintf(stderr,"\nUsage : %s <ubx binary file> < COM0 > COM0 \n", argv[0]);
+	if ((argc != 2) && (argc != 3)) {
+		fprintf(stderr,"\nUsage : %s <ubx binary file> [baud] [-R[cpu]] < COM0 > COM0 \n", argv[0]);
 		exit(-1);
 	}
 	
@@ -81,6 +112,12 @@ int main (int argc, char **argv)
 		exit(-1);
 	}
 	
+	if (rt_mode)
+	{
+		rtInit(rt_cpu);
+		fread(buffer_out,sizeof(unsigned char),100,fp); // the first frame, ready for the first poll
+	}
+
 	// the main loop
 	unsigned char c = 0x00;
 	DWORD dwEventMask; 
@@ -91,7 +128,11 @@ int main (int argc, char **argv)
 		int i=0;
 		
 		//Status = WaitCommEvent(hComm, &dwEventMask, NULL);  	
-		if (strstr(buffer_in, "#")){
+		if (strstr(buffer_in, "#") && rt_mode){
+				rtSend(hComm,fp);
+				readFromSerialPort (hComm,buffer_in,sizeof(buffer_in));
+				printf ("%s",buffer_in);
+		}	else if (strstr(buffer_in, "#")){
 				Sleep(100);
 				
 				// for (i=0; i<100;i++) {
@@ -119,6 +160,51 @@ int main (int argc, char **argv)
 	return 1; // normal termination
 }
 
+// -R: as little as possible between the poll and the reply
+void rtInit(int cpu)
+{
+	SetPriorityClass(GetCurrentProcess(), REALTIME_PRIORITY_CLASS); // quietly HIGH_PRIORITY_CLASS if not allowed
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+	if ((cpu >= 0) && !SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu))
+		fprintf(stderr,"Can't run on CPU %d\n", cpu);
+
+	// room in the working set to lock the buffers (and keep the rest of us in)
+	SetProcessWorkingSetSize(GetCurrentProcess(), 16 * 1024 * 1024, 64 * 1024 * 1024);
+	if (!VirtualLock(buffer_out, sizeof(buffer_out)) || !VirtualLock(buffer_in, sizeof(buffer_in)))
+		fprintf(stderr,"Can't lock the buffers in memory\n");
+
+	timeBeginPeriod(1); // Sleep(1) sleeps for 1ms, not a 15.6ms tick
+	QueryPerformanceFrequency(&rt_freq);
+}
+
+// reply to a poll with the frame read ahead, 100ms after the poll, then read the next one
+void rtSend(HANDLE hComm, FILE *fp)
+{
+	LARGE_INTEGER now;
+	LONGLONG due;
+	double late;
+
+	QueryPerformanceCounter(&now);
+	due = now.QuadPart + rt_freq.QuadPart / 10;
+	while (due - now.QuadPart > rt_freq.QuadPart / 500)
+	{ // Sleep() until the last 2ms
+		Sleep(1);
+		QueryPerformanceCounter(&now);
+	}
+	while (now.QuadPart < due)
+		QueryPerformanceCounter(&now); // spin the rest
+
+	writeToSerialPort (hComm,buffer_out,100);
+
+	late = (double)(now.QuadPart - due) / rt_freq.QuadPart;
+	if (late > worst_late)
+	{
+		worst_late = late;
+		fprintf(stderr,"\nWorst lateness so far %.0fus\n", late * 1e6);
+	}
+	fread(buffer_out,sizeof(unsigned char),100,fp); // ready for the next poll
+}
+
 DWORD readFromSerialPort(HANDLE hSerial, unsigned char * buffer, int maxBuffer)
 {
     DWORD dwBytesRead = 0;
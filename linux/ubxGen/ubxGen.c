@@ -24,280 +24,114 @@
 //	Course and direction are calculated between the "from" and "to" co-ordinates and apply 
 //  to all samples between the points.
 //
+// the segment times are summed into a flight profile (see flight.h) once the KML has been read, and each
+// second's fix looked up in that - so the output can start part way through the flight (-s) without
+// generating what comes before.
+//
+// options
+//	-T start	time of the first fix (yyyy-mm-ddThh:mm:ss UTC or seconds since 1970) rather than now -
+//				the output is then the same every run
+//	-i file		read the KML from a file rather than standard input - .kmz, .gz (and .zst) are read as they are
+//	-o file		add the UBX to this file rather than ubx.bin - compressed if it ends .gz (or .zst), see zio.h
+//	-s secs		start this many seconds after launch (the first fix is still at -T or now)
+//	-e secs		stop this many seconds after launch
+//	-w epochs	epochs gathered for each write (default 64) - see epochio.h
+//	-U			write with io_uring (where the kernel has it) rather than writev
+//	--profile	print where the time went at the end - reading the KML, interpolation, encoding (with the
+//				checksum) and output (see profile.h)
+//
+// how many system calls the output took, and its throughput, are printed at the end
+//
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
 #include <time.h>
- 
-// radians to degrees
-#define DEGREES(x) ((x) * 57.295779513082320877) 
-// degrees to radians
+#include "vclock.h"
+#include "zio.h"
+#include "flight.h"
+#include "epochio.h"
+#include "profile.h"
+#include "ubx.h"
+
 #define RADIANS(x) ((x) / 57.295779513082320877)
  
-#define LOG_BASE 1.4142135623730950488
-#define LOG_POWER 5300.0
- 
-time_t Now;					// the time of starting this program 
+time_t Now;					// the time of starting this program (or -T)
+const char *OutName = "ubx.bin";
+FILE *Out;					// opened once - not per epoch - so a compressed file is one stream
+epochio eo;					// written to Out's descriptor, -w epochs at a time
+int batch = 64;				// -w
+int uring = 0;				// -U
+int s_read, s_interpolate, s_encode, s_output;	// --profile stages
  
 char buf[200];
  
-static void set_checksum (unsigned char * buffer, int size) ;
-
 void Output_UBX(time_t Time, double Lat, double Lon, double Alt, double Course, double Speed)
 {
-
-	unsigned char buffer[100];
-
+	unsigned char frame[UBX_NAV_PVT_LEN];
+	profile_scope ps;
 	struct tm *ptm;
-	
-	typedef struct  t_ubx_nav_pvt {
-		unsigned short int header;
-		unsigned char class;
-		unsigned char id;
-		unsigned short int length;
-		unsigned long iTOW;
-		unsigned short int year;
-		unsigned char month;
-		unsigned char day;
-		unsigned char hour;
-		unsigned char min;
-		unsigned char sec;
-		unsigned char valid;
-		unsigned long tAcc;
-		long nano;
-		unsigned char fixType;
-		unsigned char flags;
-		unsigned char flags2;
-		unsigned char numSV;
-		long lon;
-		long lat;
-		long height;
-		long hMSL;
-		unsigned long hAcc;
-		unsigned long vAcc;
-		long velN;
-		long velE;
-		long velD;
-		long gSpeed;
-		long headMot;
-		unsigned long sAcc;
-		unsigned long headAcc;
-		unsigned short int pDOP;
-		unsigned char reserved1 [6];
-		long headVeh;
-		unsigned char reserved2 [4];
-		unsigned char ck_a;
-		unsigned char ck_b;
-	} t_ubx_nav_pov;
-	
-	t_ubx_nav_pov ubx_nav_pvt;
+	ubx_pvt pvt;
+	int len;
 
-	unsigned char c = (unsigned  char) 0xFA;
-	
 	ptm = gmtime(&Time);
-	
-	unsigned int position = 0;
-	int i = 0;
-	
-	ubx_nav_pvt.header = (unsigned short int) 0x62 << 8 | 0xB5;
-	ubx_nav_pvt.class = 0x01;
-	ubx_nav_pvt.id = 0x07;
-	ubx_nav_pvt.length = (unsigned short int) 0x00 << 8 | 0x5C;
-	ubx_nav_pvt.iTOW = 0x00;
-	ubx_nav_pvt.year = (unsigned short int) (1900+ptm->tm_year);
-	ubx_nav_pvt.month = (unsigned char) (1+ptm->tm_mon);
-	ubx_nav_pvt.day = (unsigned char) (ptm->tm_mday);
-	ubx_nav_pvt.hour = (unsigned char) (ptm->tm_hour);
-	ubx_nav_pvt.min = (unsigned char) (ptm->tm_min);
-	ubx_nav_pvt.sec = (unsigned char) (ptm->tm_sec);
-	ubx_nav_pvt.valid = 0b01000111;
-	ubx_nav_pvt.tAcc = 0xFF;
-	ubx_nav_pvt.nano = 0xFF;
-	ubx_nav_pvt.fixType = 0x03;
-	ubx_nav_pvt.flags = 0x03;
-	ubx_nav_pvt.flags2 = 0x0A;
-	ubx_nav_pvt.numSV = 0x0B;
-	ubx_nav_pvt.lon = (long)round(Lat*10000000);
-	ubx_nav_pvt.lat = (long)round(Lon*10000000);
-	ubx_nav_pvt.height = (long)round(Alt*1000); //Stored in mm not m
-	ubx_nav_pvt.hMSL = (long)round(Alt*1000);
-	ubx_nav_pvt.hAcc = 0x00;
-	ubx_nav_pvt.vAcc = 0x00;
-	ubx_nav_pvt.velN = 0x00;
-	ubx_nav_pvt.velE = 0x00;
-	ubx_nav_pvt.velD = 0x00;
-	ubx_nav_pvt.gSpeed = (long)round(Speed*1000);
-	ubx_nav_pvt.headMot = (long)round(Course*100000);
-	ubx_nav_pvt.sAcc = 0xFD;
-	ubx_nav_pvt.headAcc = 0xFE;
-	ubx_nav_pvt.pDOP = 0xFF;
-	
-	for (i=0;i<6;i++) {
-		memcpy(ubx_nav_pvt.reserved1+i,&c,1);
-	}
-	
-	ubx_nav_pvt.headVeh = (long)round(Course*100000);
-	
-	for (i=0;i<4;i++) {
-		memcpy(ubx_nav_pvt.reserved2+i,&c,1);
-	}
-	
+
+	memset(&pvt, 0, sizeof(pvt));
+	pvt.year = 1900 + ptm->tm_year;
+	pvt.month = 1 + ptm->tm_mon;
+	pvt.day = ptm->tm_mday;
+	pvt.hour = ptm->tm_hour;
+	pvt.min = ptm->tm_min;
+	pvt.sec = ptm->tm_sec;
+	pvt.valid = 0x07;			// date and time, fully resolved
+	pvt.fixType = 3;
+	pvt.fixOK = 1;
+	pvt.numSV = 11;
+	pvt.lat = Lat;
+	pvt.lon = Lon;
+	pvt.height = Alt;
+	pvt.hMSL = Alt;
+	pvt.gSpeed = Speed;
+	pvt.headMot = Course;
+	pvt.velN = Speed * cos(RADIANS(Course));
+	pvt.velE = Speed * sin(RADIANS(Course));
+	pvt.sAcc = 0.25;
+	pvt.headAcc = 2.5;
+	pvt.pDOP = 2.55;
+
 	fprintf(stderr,"%f, %f, %f, %f, %f, %ld\n",Lat,Lon,Alt,Speed,Course, (long)round(Course*100000));
 
-	memcpy(buffer + position ,&ubx_nav_pvt.header, sizeof(ubx_nav_pvt.header)); position+=sizeof(ubx_nav_pvt.header);
-	memcpy(buffer + position ,&ubx_nav_pvt.class, sizeof(ubx_nav_pvt.class)); position+=sizeof(ubx_nav_pvt.class);
-	memcpy(buffer + position ,&ubx_nav_pvt.id, sizeof(ubx_nav_pvt.id)); position+=sizeof(ubx_nav_pvt.id);
-	memcpy(buffer + position ,&ubx_nav_pvt.length, sizeof(ubx_nav_pvt.length)); position+=sizeof(ubx_nav_pvt.length);
-    memcpy(buffer + position ,&ubx_nav_pvt.iTOW, sizeof(ubx_nav_pvt.iTOW)); position+=sizeof(ubx_nav_pvt.iTOW);
-	memcpy(buffer + position ,&ubx_nav_pvt.year, sizeof(ubx_nav_pvt.year)); position+=sizeof(ubx_nav_pvt.year);
-	memcpy(buffer + position ,&ubx_nav_pvt.month, sizeof(ubx_nav_pvt.month)); position+=sizeof(ubx_nav_pvt.month);
-	memcpy(buffer + position ,&ubx_nav_pvt.day, sizeof(ubx_nav_pvt.day)); position+=sizeof(ubx_nav_pvt.day);
-	memcpy(buffer + position ,&ubx_nav_pvt.hour, sizeof(ubx_nav_pvt.hour)); position+=sizeof(ubx_nav_pvt.hour);
-	memcpy(buffer + position ,&ubx_nav_pvt.min, sizeof(ubx_nav_pvt.min)); position+=sizeof(ubx_nav_pvt.min);
-	memcpy(buffer + position ,&ubx_nav_pvt.sec, sizeof(ubx_nav_pvt.sec)); position+=sizeof(ubx_nav_pvt.sec);
-	memcpy(buffer + position ,&ubx_nav_pvt.valid, sizeof(ubx_nav_pvt.valid)); position+=sizeof(ubx_nav_pvt.valid);
-	memcpy(buffer + position ,&ubx_nav_pvt.tAcc, sizeof(ubx_nav_pvt.tAcc)); position+=sizeof(ubx_nav_pvt.tAcc);
-	memcpy(buffer + position ,&ubx_nav_pvt.nano, sizeof(ubx_nav_pvt.nano)); position+=sizeof(ubx_nav_pvt.nano);
-	memcpy(buffer + position ,&ubx_nav_pvt.fixType, sizeof(ubx_nav_pvt.fixType)); position+=sizeof(ubx_nav_pvt.fixType);
-	memcpy(buffer + position ,&ubx_nav_pvt.flags, sizeof(ubx_nav_pvt.flags)); position+=sizeof(ubx_nav_pvt.flags);
-	memcpy(buffer + position ,&ubx_nav_pvt.flags2, sizeof(ubx_nav_pvt.flags2)); position+=sizeof(ubx_nav_pvt.flags2);
-	memcpy(buffer + position ,&ubx_nav_pvt.numSV, sizeof(ubx_nav_pvt.numSV)); position+=sizeof(ubx_nav_pvt.numSV);
-	memcpy(buffer + position ,&ubx_nav_pvt.lon, sizeof(ubx_nav_pvt.lon)); position+=sizeof(ubx_nav_pvt.lon);
-	memcpy(buffer + position ,&ubx_nav_pvt.lat, sizeof(ubx_nav_pvt.lat)); position+=sizeof(ubx_nav_pvt.lat);
-	memcpy(buffer + position ,&ubx_nav_pvt.height, sizeof(ubx_nav_pvt.height)); position+=sizeof(ubx_nav_pvt.height);
-	memcpy(buffer + position ,&ubx_nav_pvt.hMSL, sizeof(ubx_nav_pvt.hMSL)); position+=sizeof(ubx_nav_pvt.hMSL);
-	memcpy(buffer + position ,&ubx_nav_pvt.hAcc, sizeof(ubx_nav_pvt.hAcc)); position+=sizeof(ubx_nav_pvt.hAcc);
-	memcpy(buffer + position ,&ubx_nav_pvt.vAcc, sizeof(ubx_nav_pvt.vAcc)); position+=sizeof(ubx_nav_pvt.vAcc);
-	memcpy(buffer + position ,&ubx_nav_pvt.velN, sizeof(ubx_nav_pvt.velN)); position+=sizeof(ubx_nav_pvt.velN);
-	memcpy(buffer + position ,&ubx_nav_pvt.velE, sizeof(ubx_nav_pvt.velE)); position+=sizeof(ubx_nav_pvt.velE);
-	memcpy(buffer + position ,&ubx_nav_pvt.velD, sizeof(ubx_nav_pvt.velD)); position+=sizeof(ubx_nav_pvt.velD);
-	memcpy(buffer + position ,&ubx_nav_pvt.gSpeed, sizeof(ubx_nav_pvt.gSpeed)); position+=sizeof(ubx_nav_pvt.gSpeed);
-	memcpy(buffer + position ,&ubx_nav_pvt.headMot, sizeof(ubx_nav_pvt.headMot)); position+=sizeof(ubx_nav_pvt.headMot);
-	memcpy(buffer + position ,&ubx_nav_pvt.sAcc, sizeof(ubx_nav_pvt.sAcc)); position+=sizeof(ubx_nav_pvt.sAcc);
-	memcpy(buffer + position ,&ubx_nav_pvt.headAcc, sizeof(ubx_nav_pvt.headAcc)); position+=sizeof(ubx_nav_pvt.headAcc);
-	memcpy(buffer + position ,&ubx_nav_pvt.pDOP, sizeof(ubx_nav_pvt.pDOP)); position+=sizeof(ubx_nav_pvt.pDOP);
-	memcpy(buffer + position ,&ubx_nav_pvt.reserved1, sizeof(ubx_nav_pvt.reserved1)); position+=sizeof(ubx_nav_pvt.reserved1);
-	memcpy(buffer + position ,&ubx_nav_pvt.headVeh, sizeof(ubx_nav_pvt.headVeh)); position+=sizeof(ubx_nav_pvt.headVeh);
-	memcpy(buffer + position ,&ubx_nav_pvt.reserved2, sizeof(ubx_nav_pvt.reserved2)); position+=sizeof(ubx_nav_pvt.reserved2);
+	len = ubx_nav_pvt(frame, &pvt);
 
-/*
-	fprintf(stderr,"\n");
-	
-	for (i=0;i<100;i++) {
-		fprintf(stderr,"%02x ",buffer[i]);
-		if (i%10==9) {fprintf(stderr,"\n");}
-	} 
-	*/
-	set_checksum (buffer,100);
-	
-	FILE * fp;
-	
-	if ( !(fp = fopen("ubx.bin","ab"))) {
+	profile_begin(&ps, s_output);
+	if (!Out && (!(Out = zio_fopen(OutName,"a")) || !epochio_init(&eo, fileno(Out), batch, uring))) {
 		fprintf(stderr,"\nErorr\n");
 		exit(-1);
 	}
 	
-	for (i=0;i<100;i++) {
-		fputc (buffer[i], fp);
-	}		
-	
-	fclose(fp);
-}
- 
- 
- static void set_checksum (unsigned char * buffer, int size) {
-	
-	/* This will put the calculated checksum on the end of your message
-	 * Make sure you have left two bytes at the end of your message
-	 * for the checksum !
-	 */
-	
-	unsigned char CK_A = 0;
-	unsigned char CK_B = 0;
-	
-	int i;
-	
-	for( i=2; i<size-2; i++)
-	{
-		CK_A = CK_A + buffer[i];
-		CK_B = CK_B + CK_A;
-	}
-	
-	buffer[i++] = CK_A;
-	buffer[i++] = CK_B;
-	
+	epochio_add(&eo, frame, len);
+	epochio_end(&eo);
+	profile_end(&ps);
 }
  
-// do a KML segment between two coordinates
+// fly from start to end seconds after launch - a fix every second, from the flight profile (flight.h)
  
-void do_segment(double FromLat, double FromLon, double FromAlt, double ToLat, double ToLon, double ToAlt)
+void fly(const flight *f, double start, double end)
 {
-	double Rate;			// ascent(+ve) / decent(-ve) rate meters per second (for segment)
-	int Duration;			// calculated segment duration in seconds
-	double Elapsed;			// floating point duration
-	double Lat,Lon,Alt;		// clacualted for each step
-	double	Course,Speed;	// calculated for entire segment
-	double Distance;		// distance between coordinates
-	double DeltaLat,DeltaLon,DeltaAlt;	// Latitude, Longtitude and Altitude differences
-	double AdjLon;			// Adjusted Longtitude difference
-	int i;					// counter
- 
-	DeltaAlt = (ToAlt - FromAlt);
-	DeltaLat = (ToLat - FromLat);
-	DeltaLon = (ToLon - FromLon);
- 
-	if (DeltaAlt >= 0)
-	{ // ascending
-		Rate = 5.0;
-	}
-	else 
-	{ // descending - calculate the geometric mean of the expected velocities at To and From altitude
-		Rate = -5.0 * sqrt(pow(LOG_BASE,(FromAlt / LOG_POWER)) * pow(LOG_BASE,(ToAlt / LOG_POWER))); 
-	}
- 
-	// calcualte time (secs) between co-ordinates
-	Elapsed = DeltaAlt / Rate; // always positive
-	Duration = (int)Elapsed;
+	flight_fix fix;
+	profile_scope ps;
+	double t;
 
-	/* RJH FIX tfor tight points to 1 second if les */
-	if (Duration==0) {Duration = 1;}
-	
-	if ((Elapsed - (float)Duration) >= 0.5)
-		Duration++; // round duration of segment to nearest integer
- 
-	// Calculate Course (degrees relative to north) for entire segment
-	Course = atan2(DeltaLat,DeltaLon);	// result is +PI radians (cw) to -PI radians (ccw) from x (Longtitude) axis
- 
-	Course = DEGREES(Course);			// convert radians to degrees
-	if (Course <= 90.0)
-		Course = 90.0 - Course;
-	else
-		Course = 450.0 - Course;		// convert to 0 - 360 clockwise from north
- 
-	// Calculate Speed (m/sec) for entire segment
-	AdjLon = cos(RADIANS((FromLat + ToLat) / 2.0)) * DeltaLon;
-	Distance = (sqrt((DeltaLat * DeltaLat) + (AdjLon * AdjLon)) * 111194.9266); // result in meters
- 
-	Speed =  Distance / (double)Duration; // meters per second
- 
-	// calculate 1 second "step" sizes
-	DeltaAlt /= (double)Duration;
-	DeltaLat /= (double)Duration;
-	DeltaLon /= (double)Duration;
- 
-	// now output the NMEA for each step between From and To (but excluding To - which is picked up on next segment)
-	Lat = FromLat;
-	Lon = FromLon;
-	Alt = FromAlt;
-	for (i = 0; i < Duration; i++)
+	for (t = start; t < end; t++)
 	{
-		Output_UBX(Now,Lat,Lon,Alt,Course,Speed);
+		profile_begin(&ps, s_interpolate);
+		flight_at(f, t, &fix);
+		profile_end(&ps);
+		profile_begin(&ps, s_encode); // less the output inside
+		Output_UBX(Now,fix.lat,fix.lon,fix.alt,fix.course,fix.speed);
+		profile_end(&ps);
 		Now++;				// 1 second steps
-		Lat += DeltaLat;
-		Lon += DeltaLon;
-		Alt += DeltaAlt;	
 	}
 }
  
@@ -337,7 +171,48 @@ int main(int argc, char **argv)
 {
 	int i;
 	float FromLon,FromLat,FromAlt, ToLon,ToLat,ToAlt;
+	flight Flight;
+	flight_fix fix;
+	double start = 0.0, end = -1.0;	// -s, -e
+	profile_scope ps;
+
+	s_read = profile_stage("read");
+	s_interpolate = profile_stage("interpolate");
+	s_encode = profile_stage("encode");
+	s_output = profile_stage("output");
+
+	for (i = 1; i < argc; i++)
+	{
+		if ((strcmp(argv[i],"-T") == 0) && (i + 1 < argc) && vclock_start(argv[i + 1]))
+			i++;
+		else if ((strcmp(argv[i],"-i") == 0) && (i + 1 < argc))
+		{
+			if (!zio_stdin(argv[++i]))
+			{
+				fprintf(stderr,"Can't open %s\n", argv[i]);
+				return 1;
+			}
+		}
+		else if ((strcmp(argv[i],"-o") == 0) && (i + 1 < argc))
+			OutName = argv[++i];
+		else if ((strcmp(argv[i],"-s") == 0) && (i + 1 < argc) && (atof(argv[i + 1]) >= 0))
+			start = atof(argv[++i]);
+		else if ((strcmp(argv[i],"-e") == 0) && (i + 1 < argc) && (atof(argv[i + 1]) >= 0))
+			end = atof(argv[++i]);
+		else if ((strcmp(argv[i],"-w") == 0) && (i + 1 < argc) && (atoi(argv[i + 1]) > 0))
+			batch = atoi(argv[++i]);
+		else if (strcmp(argv[i],"-U") == 0)
+			uring = 1;
+		else if (strcmp(argv[i],"--profile") == 0)
+			profile_init();
+		else
+		{
+			fprintf(stderr,"Usage : %s [-T start] [-i flight.kml] [-o ubx.bin] [-s secs] [-e secs] [-w epochs] [-U] [--profile] <flight.kml\n", argv[0]);
+			return 1;
+		}
+	}
  
+	profile_begin(&ps, s_read);
 	look_for("<LineString>"); // look for 1st <LineString> token
  
 	look_for("<coordinates>"); // look for subsiquent <coordinates> token
@@ -352,7 +227,9 @@ int main(int argc, char **argv)
 		return 1; // abnormal termination
 	}
  
-	Now = time(NULL); // use the current time as a reference
+	Now = vclock_time(); // use the current time (or -T) as a reference
+	flight_init(&Flight);
+	flight_add(&Flight,FromLat,FromLon,FromAlt);
 	// get subsiquent LineString co-ordinates
 	
 	int j =0;
@@ -370,21 +247,43 @@ int main(int argc, char **argv)
 			break; // not co-ordinate
 		}
 		
-		do_segment(FromLat,FromLon,FromAlt,ToLat,ToLon,ToAlt);
+		if (!flight_add(&Flight,ToLat,ToLon,ToAlt))
+		{
+			fprintf(stderr,"Out of memory\n");
+			return 1;
+		}
  
 		FromLon = ToLon;
 		FromLat = ToLat;
 		FromAlt = ToAlt;
 		j++;
 	}
+	profile_end(&ps);
+
+	if ((end < 0) || (end > flight_duration(&Flight)))
+		end = flight_duration(&Flight);
+	fly(&Flight, start, end);
 
-	Output_UBX(Now,ToLat,ToLon,ToAlt,0.0,0.0); // Final Position (assume stationary)
+	flight_at(&Flight, end, &fix);
+	Output_UBX(Now,fix.lat,fix.lon,fix.alt,fix.course,fix.speed); // Final Position (stationary once landed)
+	flight_free(&Flight);
  
 	look_for("</coordinates>"); // look for closing </coordinates> token
  
 	look_for("</LineString>"); // look for closing </LineString> token
 
 	fprintf(stderr,"\n");
+
+	profile_begin(&ps, s_output);
+	i = Out && (epochio_close(&eo) | zio_fclose(Out));
+	profile_end(&ps);
+	if (i) {
+		fprintf(stderr,"Can't write %s\n", OutName);
+		return 1;
+	}
+	if (Out)
+		epochio_report(&eo, stderr);
+	profile_report(stderr);
  
 	return 0;
 }
\ No newline at end of file
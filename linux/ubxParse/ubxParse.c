@@ -0,0 +1,206 @@
+// ubxParse.c - read UBX back (e.g. ubx.bin from ubxGen, or gpsEmulate -x ubx) and check / export it
+//
+// every frame's checksum is checked. NAV-PVT is written out as CSV (one line per solution) and/or as
+// columns - one file of little endian binary values per field, ready for numpy.fromfile() or similar.
+// A summary of what was found (frames of each type, bad frames, bytes that were not UBX) is printed
+// at the end, and the exit status is 2 if any frame was bad so scripts can use it as a check.
+//
+// a capture in a file is memory mapped and read in one go. Anything else (a pipe) is read in 1MB pieces.
+//
+// options
+//	-i file		capture to read (default standard input)
+//	-c prefix	write NAV-PVT columns to prefix.<field>.<type> e.g. flight.lat.f64
+//	-q			no CSV (just the summary, and columns if asked for)
+//	-m bytes	longest payload to believe (default 8192) - longer lengths are taken as corruption
+//
+// e.g.	ubxParse -i ubx.bin > pvt.csv
+//		gpsEmulate -i flight.log -x ubx | ubxParse -q
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "ubxread.h"
+
+#define READ_SIZE 1048576
+
+unsigned long long counts[256][256];	// frames of each class and id
+int csv = 1;
+
+// NAV-PVT columns
+typedef struct column
+{
+	const char *name;
+	int type;				// 0 f64, 1 u32, 2 u8
+	FILE *fp;
+} column;
+
+column columns[] =
+{
+	{"itow", 1}, {"lat", 0}, {"lon", 0}, {"height", 0}, {"hmsl", 0},
+	{"velN", 0}, {"velE", 0}, {"velD", 0}, {"gspeed", 0}, {"heading", 0},
+	{"hacc", 0}, {"vacc", 0}, {"numsv", 2}, {"fixtype", 2},
+};
+#define NCOLUMNS (sizeof(columns) / sizeof(columns[0]))
+int use_columns = 0;
+
+
+void open_columns(const char *prefix)
+{
+	static const char *types[] = {"f64", "u32", "u8"};
+	char path[1024];
+	size_t i;
+
+	for (i = 0; i < NCOLUMNS; i++)
+	{
+		snprintf(path, sizeof(path), "%s.%s.%s", prefix, columns[i].name, types[columns[i].type]);
+		if ((columns[i].fp = fopen(path, "wb")) == NULL)
+		{
+			fprintf(stderr,"Can't create %s: %s\n", path, strerror(errno));
+			exit(1);
+		}
+		setvbuf(columns[i].fp, NULL, _IOFBF, 65536);
+	}
+	use_columns = 1;
+}
+
+void put_column(int i, double v)
+{
+	unsigned int u32;
+	unsigned char u8;
+
+	switch (columns[i].type)
+	{
+	case 0:
+		fwrite(&v, sizeof(v), 1, columns[i].fp);
+		break;
+	case 1:
+		u32 = (unsigned int)v;
+		fwrite(&u32, sizeof(u32), 1, columns[i].fp);
+		break;
+	case 2:
+		u8 = (unsigned char)v;
+		fwrite(&u8, sizeof(u8), 1, columns[i].fp);
+		break;
+	}
+}
+
+// called for every good frame
+void got_frame(const ubx_msg *m, void *user)
+{
+	unsigned long iTOW;
+	ubx_pvt p;
+
+	counts[m->cls][m->id]++;
+
+	if (!ubx_get_nav_pvt(m, &iTOW, &p))
+		return;
+
+	if (csv)
+		printf("%lu,%04d-%02d-%02d,%02d:%02d:%06.3f,%.7f,%.7f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.5f,%d,%d\n",
+			iTOW, p.year, p.month, p.day, p.hour, p.min, p.sec, p.lat, p.lon, p.height, p.hMSL,
+			p.velN, p.velE, p.velD, p.gSpeed, p.headMot, p.numSV, p.fixType);
+
+	if (use_columns)
+	{
+		double v[NCOLUMNS] = {iTOW, p.lat, p.lon, p.height, p.hMSL, p.velN, p.velE, p.velD, p.gSpeed, p.headMot, p.hAcc, p.vAcc, p.numSV, p.fixType};
+		size_t i;
+
+		for (i = 0; i < NCOLUMNS; i++)
+			put_column(i, v[i]);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	char *in_file = NULL, *prefix = NULL;
+	int fd, i, j, max_payload = UBX_MAX_PAYLOAD;
+	struct stat st;
+	unsigned char *data;
+	ssize_t n;
+	ubx_reader r;
+	struct timespec t0, t1;
+	double secs;
+	const char *name;
+
+	for (i = 1; i < argc; i++)
+	{
+		if ((strcmp(argv[i],"-i") == 0) && (i + 1 < argc))
+			in_file = argv[++i];
+		else if ((strcmp(argv[i],"-c") == 0) && (i + 1 < argc))
+			prefix = argv[++i];
+		else if (strcmp(argv[i],"-q") == 0)
+			csv = 0;
+		else if ((strcmp(argv[i],"-m") == 0) && (i + 1 < argc))
+			max_payload = atoi(argv[++i]);
+		else
+		{
+			fprintf(stderr,"Usage : %s [-i ubx file] [-c column prefix] [-q] [-m max payload] >pvt.csv\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if ((fd = in_file ? open(in_file, O_RDONLY) : 0) < 0)
+	{
+		fprintf(stderr,"Can't open %s: %s\n", in_file, strerror(errno));
+		return 1;
+	}
+	if (prefix)
+		open_columns(prefix);
+	if (csv)
+		printf("itow,date,time,lat,lon,height,hmsl,veln,vele,veld,gspeed,heading,numsv,fixtype\n");
+
+	ubx_reader_init(&r, got_frame, NULL);
+	if (max_payload > 0)
+		r.max_payload = max_payload;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	fstat(fd, &st);
+	if (S_ISREG(st.st_mode) && (st.st_size > 0) &&
+		((data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED))
+	{ // the whole capture in one go
+		madvise(data, st.st_size, MADV_SEQUENTIAL);
+		ubx_reader_feed(&r, data, st.st_size);
+		munmap(data, st.st_size);
+	}
+	else
+	{
+		data = malloc(READ_SIZE);
+		while ((n = read(fd, data, READ_SIZE)) != 0)
+		{
+			if (n < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				fprintf(stderr,"Read failed: %s\n", strerror(errno));
+				break;
+			}
+			ubx_reader_feed(&r, data, n);
+		}
+		free(data);
+	}
+	ubx_reader_end(&r);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+	fflush(stdout);
+	for (i = 0; i < 256; i++)
+		for (j = 0; j < 256; j++)
+			if (counts[i][j])
+			{
+				name = ubx_name(i, j);
+				fprintf(stderr,"%-12s %02X-%02X %llu\n", name ? name : "?", i, j, counts[i][j]);
+			}
+	fprintf(stderr,"%llu frames, %llu bad, %llu bytes skipped - %.1f MB in %.3f s (%.0f MB/s)\n",
+		r.frames, r.bad, r.skipped, r.offset / 1e6, secs, secs > 0 ? r.offset / 1e6 / secs : 0.0);
+
+	if (use_columns)
+		for (i = 0; i < (int)NCOLUMNS; i++)
+			fclose(columns[i].fp);
+	return r.bad ? 2 : 0;
+}